@@ -0,0 +1,261 @@
+/*
+ * access_benchmark.c
+ *
+ *  Created on: 18 Oct 2026
+ *      Author: Mr_Halfword
+ *
+ * Measures the rate at which a mapped cmem buffer can be read by the debugger access path, by reading the buffer
+ * through /proc/self/mem. The Kernel services reads of /proc/<pid>/mem, as used by gdb, using the access function
+ * of the cmem mapping.
+ *
+ * When the fast_access module parameter is writable, i.e. when run as root, the benchmark is run with the parameter
+ * both enabled and disabled to compare the multi-page kernel mappings against generic_access_phys().
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <fcntl.h>
+
+#include "cmem_drv.h"
+#include "benchmarks.h"
+#include "benchmark_utils.h"
+
+
+/* The module parameter which selects the access path */
+#define FAST_ACCESS_PARAMETER_PATH "/sys/module/cmem_dev/parameters/fast_access"
+
+
+/* The options for the benchmark */
+static bool arg_dma_capability_a64 = true;
+static size_t arg_buffer_size = 64 * 1024 * 1024;
+static size_t arg_read_size = 1024 * 1024;
+static uint32_t arg_num_iterations = 4;
+
+
+static void display_usage (const char *const program_name)
+{
+    printf ("Usage: %s [-a] [-s <buffer_size>] [-r <read_size>] [-i <iterations>]\n", program_name);
+    printf ("  -a  Allocate the buffer with A32 physical addresses, rather than A64\n");
+    printf ("  -s  Size of the buffer in bytes\n");
+    printf ("  -r  Number of bytes read by each read of /proc/self/mem, which is similar to the gdb block size\n");
+    printf ("  -i  Number of times the entire buffer is read for each access path\n");
+}
+
+
+static size_t parse_size_arg (const char *const program_name, const char *const arg)
+{
+    char *end;
+    const unsigned long long value = strtoull (arg, &end, 0);
+
+    if ((*end != '\0') || (value == 0) || (value > SIZE_MAX))
+    {
+        fprintf (stderr, "Invalid numeric argument %s\n", arg);
+        display_usage (program_name);
+        exit (EXIT_FAILURE);
+    }
+
+    return (size_t) value;
+}
+
+
+static void parse_command_line_arguments (int argc, char *argv[])
+{
+    const char *const optstring = "as:r:i:h";
+    int option;
+
+    optind = 1;
+    while ((option = getopt (argc, argv, optstring)) != -1)
+    {
+        switch (option)
+        {
+        case 'a':
+            arg_dma_capability_a64 = false;
+            break;
+
+        case 's':
+            arg_buffer_size = parse_size_arg (argv[0], optarg);
+            break;
+
+        case 'r':
+            arg_read_size = parse_size_arg (argv[0], optarg);
+            break;
+
+        case 'i':
+            arg_num_iterations = (uint32_t) parse_size_arg (argv[0], optarg);
+            break;
+
+        case 'h':
+        default:
+            display_usage (argv[0]);
+            exit (EXIT_FAILURE);
+        }
+    }
+}
+
+
+/**
+ * @brief Read the current value of the fast_access module parameter
+ * @param[out] fast_access The current value
+ * @return Returns true if the parameter was read
+ */
+static bool read_fast_access (bool *const fast_access)
+{
+    FILE *const parameter_file = fopen (FAST_ACCESS_PARAMETER_PATH, "r");
+    char value;
+    bool success = false;
+
+    if (parameter_file != NULL)
+    {
+        if (fscanf (parameter_file, " %c", &value) == 1)
+        {
+            *fast_access = (value == 'Y') || (value == 'y') || (value == '1');
+            success = true;
+        }
+        fclose (parameter_file);
+    }
+
+    return success;
+}
+
+
+/**
+ * @brief Attempt to change the fast_access module parameter
+ * @param[in] fast_access The value to set
+ * @return Returns true if the parameter was changed
+ */
+static bool write_fast_access (const bool fast_access)
+{
+    FILE *const parameter_file = fopen (FAST_ACCESS_PARAMETER_PATH, "w");
+    bool success = false;
+
+    if (parameter_file != NULL)
+    {
+        success = fputs (fast_access ? "Y" : "N", parameter_file) >= 0;
+        success = (fclose (parameter_file) == 0) && success;
+    }
+
+    return success;
+}
+
+
+/**
+ * @brief Read the entire buffer through /proc/self/mem a number of times, reporting the rate
+ * @param[in] mem_fd File descriptor for /proc/self/mem
+ * @param[in] buffer The mapped cmem buffer, which contains the expected pattern
+ * @param[out] read_data Where to store the data read, which is the size of the buffer
+ * @param[in] description Describes the access path for the report
+ * @return Returns true if the data read matched the buffer contents
+ */
+static bool time_buffer_reads (const int mem_fd, const cmem_host_buf_desc_t *const buffer, uint8_t *const read_data,
+                               const char *const description)
+{
+    uint64_t total_bytes = 0;
+    int64_t start_time_ns;
+    int64_t end_time_ns;
+    bool success = true;
+
+    start_time_ns = get_monotonic_time_ns ();
+    for (uint32_t iteration = 0; success && (iteration < arg_num_iterations); iteration++)
+    {
+        size_t offset = 0;
+
+        while (success && (offset < buffer->length))
+        {
+            const size_t remaining = buffer->length - offset;
+            const size_t read_size = (remaining < arg_read_size) ? remaining : arg_read_size;
+            const ssize_t num_read = pread (mem_fd, &read_data[offset], read_size,
+                    (off_t) (uintptr_t) &buffer->userAddr[offset]);
+
+            if (num_read <= 0)
+            {
+                perror ("pread of /proc/self/mem failed");
+                success = false;
+            }
+            else
+            {
+                offset += (size_t) num_read;
+                total_bytes += (uint64_t) num_read;
+            }
+        }
+    }
+    end_time_ns = get_monotonic_time_ns ();
+
+    if (success)
+    {
+        const double duration_secs = (double) (end_time_ns - start_time_ns) / 1E9;
+
+        success = memcmp (read_data, buffer->userAddr, buffer->length) == 0;
+        printf ("%-32s : %lu bytes in %.3f secs = %.2f MB/sec%s\n", description, total_bytes, duration_secs,
+                ((double) total_bytes / duration_secs) / 1E6, success ? "" : " (data read didn't match buffer)");
+    }
+
+    return success;
+}
+
+
+int access_benchmark_main (int argc, char *argv[])
+{
+    cmem_drv_context_t *context;
+    cmem_host_buf_desc_t buffer;
+    uint8_t *read_data;
+    int mem_fd;
+    bool initial_fast_access;
+    bool success;
+    int32_t rc;
+
+    parse_command_line_arguments (argc, argv);
+
+    rc = cmem_drv_open (&context);
+    if (rc != 0)
+    {
+        return EXIT_FAILURE;
+    }
+
+    rc = cmem_drv_alloc (context, arg_dma_capability_a64, 1, arg_buffer_size, &buffer);
+    if (rc != 0)
+    {
+        fprintf (stderr, "Failed to allocate buffer of %zu bytes\n", arg_buffer_size);
+        return EXIT_FAILURE;
+    }
+
+    read_data = malloc (buffer.length);
+    mem_fd = open ("/proc/self/mem", O_RDONLY);
+    if ((read_data == NULL) || (mem_fd == -1))
+    {
+        perror ("Benchmark initialisation failed");
+        return EXIT_FAILURE;
+    }
+
+    /* Fill the buffer with a pattern which differs in each word, to check the data read */
+    for (size_t word_index = 0; word_index < (buffer.length / sizeof (uint32_t)); word_index++)
+    {
+        ((uint32_t *) buffer.userAddr)[word_index] = (uint32_t) word_index * 0x9E3779B1u;
+    }
+    printf ("Reading buffer of %zu bytes at physical 0x%lx using %zu byte reads\n",
+            buffer.length, buffer.physAddr, arg_read_size);
+
+    if (read_fast_access (&initial_fast_access) && write_fast_access (!initial_fast_access))
+    {
+        /* Able to change the access path, so compare both */
+        success = write_fast_access (true) &&
+                time_buffer_reads (mem_fd, &buffer, read_data, "Multi-page kernel mappings");
+        success = write_fast_access (false) &&
+                time_buffer_reads (mem_fd, &buffer, read_data, "generic_access_phys") && success;
+        write_fast_access (initial_fast_access);
+    }
+    else
+    {
+        printf ("Unable to change %s, so only measuring the current access path\n", FAST_ACCESS_PARAMETER_PATH);
+        success = time_buffer_reads (mem_fd, &buffer, read_data, "Current access path");
+    }
+
+    close (mem_fd);
+    free (read_data);
+    cmem_drv_free (context, 1, &buffer);
+    cmem_drv_close (context);
+
+    return success ? EXIT_SUCCESS : EXIT_FAILURE;
+}
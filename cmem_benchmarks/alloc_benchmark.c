@@ -0,0 +1,330 @@
+/*
+ * alloc_benchmark.c
+ *
+ *  Created on: 18 Oct 2026
+ *      Author: Mr_Halfword
+ *
+ * Compares the latency of the region allocator against the granule bitmap allocator, for small buffers.
+ * A set of live buffers of random sizes is allocated, and then random buffers are repeatedly freed and replaced by
+ * new buffers of random sizes so that the pool becomes fragmented.
+ *
+ * The allocation and free ioctls are called directly, without mapping the buffers, so that the latencies are of the
+ * allocators rather than of mmap() and munmap(). The granule bitmap allocator is only measured when the cmem module
+ * was loaded with the granule_pools parameter selecting at least one pool.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/ioctl.h>
+
+#include "cmem_drv.h"
+#include "benchmarks.h"
+#include "benchmark_utils.h"
+
+
+/* The options for the benchmark */
+static bool arg_dma_capability_a64 = true;
+static uint32_t arg_num_live_buffers = 256;
+static uint32_t arg_num_iterations = 100000;
+static size_t arg_min_buffer_size = 4096;
+static size_t arg_max_buffer_size = 64 * 1024;
+static uint64_t arg_seed = 1;
+
+
+/* Defines one allocator to be measured */
+typedef struct
+{
+    /* Describes the allocator for the report */
+    const char *name;
+    /* The allocation ioctl for devices which can address 64-bits */
+    unsigned long a64_command;
+    /* The allocation ioctl for devices which can only address 32-bits */
+    unsigned long a32_command;
+} allocator_definition_t;
+
+static const allocator_definition_t allocators[] =
+{
+    {
+        .name = "regions",
+        .a64_command = CMEM_IOCTL_ALLOC_A64_HOST_BUFFERS,
+        .a32_command = CMEM_IOCTL_ALLOC_A32_HOST_BUFFERS
+    },
+    {
+        .name = "granules",
+        .a64_command = CMEM_IOCTL_ALLOC_A64_GRANULE_BUFFERS,
+        .a32_command = CMEM_IOCTL_ALLOC_A32_GRANULE_BUFFERS
+    }
+};
+
+#define NUM_ALLOCATORS (sizeof (allocators) / sizeof (allocators[0]))
+
+
+static void display_usage (const char *const program_name)
+{
+    printf ("Usage: %s [-a] [-n <live_buffers>] [-i <iterations>] [-m <min_size>] [-M <max_size>] [-s <seed>]\n",
+            program_name);
+    printf ("  -a  Allocate buffers with A32 physical addresses, rather than A64\n");
+    printf ("  -n  Number of live buffers, which are randomly replaced\n");
+    printf ("  -i  Number of buffers which are freed and replaced\n");
+    printf ("  -m  Minimum buffer size in bytes\n");
+    printf ("  -M  Maximum buffer size in bytes\n");
+    printf ("  -s  Seed for the random buffer sizes, so the same sequence is used for each allocator\n");
+}
+
+
+static uint64_t parse_uint_arg (const char *const program_name, const char *const arg)
+{
+    char *end;
+    const unsigned long long value = strtoull (arg, &end, 0);
+
+    if ((*end != '\0') || (value == 0))
+    {
+        fprintf (stderr, "Invalid numeric argument %s\n", arg);
+        display_usage (program_name);
+        exit (EXIT_FAILURE);
+    }
+
+    return value;
+}
+
+
+static void parse_command_line_arguments (int argc, char *argv[])
+{
+    const char *const optstring = "an:i:m:M:s:h";
+    int option;
+
+    optind = 1;
+    while ((option = getopt (argc, argv, optstring)) != -1)
+    {
+        switch (option)
+        {
+        case 'a':
+            arg_dma_capability_a64 = false;
+            break;
+
+        case 'n':
+            arg_num_live_buffers = (uint32_t) parse_uint_arg (argv[0], optarg);
+            break;
+
+        case 'i':
+            arg_num_iterations = (uint32_t) parse_uint_arg (argv[0], optarg);
+            break;
+
+        case 'm':
+            arg_min_buffer_size = (size_t) parse_uint_arg (argv[0], optarg);
+            break;
+
+        case 'M':
+            arg_max_buffer_size = (size_t) parse_uint_arg (argv[0], optarg);
+            break;
+
+        case 's':
+            arg_seed = parse_uint_arg (argv[0], optarg);
+            break;
+
+        case 'h':
+        default:
+            display_usage (argv[0]);
+            exit (EXIT_FAILURE);
+        }
+    }
+
+    if (arg_min_buffer_size > arg_max_buffer_size)
+    {
+        fprintf (stderr, "Minimum buffer size exceeds the maximum\n");
+        exit (EXIT_FAILURE);
+    }
+}
+
+
+/**
+ * @brief Generate the next pseudo-random number, using the xorshift64* generator
+ * @param[in/out] state The state of the generator
+ * @return The next pseudo-random number
+ */
+static uint64_t next_random (uint64_t *const state)
+{
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 0x2545F4914F6CDD1DULL;
+}
+
+
+/**
+ * @brief Allocate one buffer of a random size, recording the latency of the allocation ioctl
+ * @param[in] cmem_fd File descriptor for the cmem device
+ * @param[in] command The allocation ioctl
+ * @param[in/out] random_state The state used to generate the size of the buffer
+ * @param[out] buffer The allocated buffer
+ * @param[in/out] histogram Updated with the latency of the allocation
+ * @return Returns true if the allocation was successful
+ */
+static bool allocate_buffer (const int cmem_fd, const unsigned long command, uint64_t *const random_state,
+                             cmem_host_buf_entry_t *const buffer, latency_histogram_t *const histogram)
+{
+    const size_t size = arg_min_buffer_size +
+            (size_t) (next_random (random_state) % ((arg_max_buffer_size - arg_min_buffer_size) + 1));
+    cmem_ioctl_t cmem_ioctl;
+    int64_t start_time_ns;
+    int rc;
+
+    cmem_ioctl.host_buf_info.num_buffers = 1;
+    cmem_ioctl.host_buf_info.buf_info[0].dma_address = 0;
+    cmem_ioctl.host_buf_info.buf_info[0].length = size;
+    start_time_ns = get_monotonic_time_ns ();
+    rc = ioctl (cmem_fd, command, &cmem_ioctl);
+    latency_histogram_add (histogram, (uint64_t) (get_monotonic_time_ns () - start_time_ns));
+    *buffer = cmem_ioctl.host_buf_info.buf_info[0];
+
+    return rc == 0;
+}
+
+
+/**
+ * @brief Free one buffer, recording the latency of the free ioctl
+ * @param[in] cmem_fd File descriptor for the cmem device
+ * @param[in] buffer The buffer to free
+ * @param[in/out] histogram Updated with the latency of the free
+ * @return Returns true if the free was successful
+ */
+static bool free_buffer (const int cmem_fd, const cmem_host_buf_entry_t *const buffer,
+                         latency_histogram_t *const histogram)
+{
+    cmem_ioctl_t cmem_ioctl;
+    int64_t start_time_ns;
+    int rc;
+
+    cmem_ioctl.host_buf_info.num_buffers = 1;
+    cmem_ioctl.host_buf_info.buf_info[0] = *buffer;
+    start_time_ns = get_monotonic_time_ns ();
+    rc = ioctl (cmem_fd, CMEM_IOCTL_FREE_HOST_BUFFERS, &cmem_ioctl);
+    latency_histogram_add (histogram, (uint64_t) (get_monotonic_time_ns () - start_time_ns));
+
+    return rc == 0;
+}
+
+
+/**
+ * @brief Measure the latencies of one allocator
+ * @param[in] cmem_fd File descriptor for the cmem device
+ * @param[in] allocator The allocator to measure
+ * @param[out] buffers Space for the live buffers
+ * @return Returns true if the allocator was measured, or false if it couldn't allocate the live buffers or an
+ *         operation failed
+ */
+static bool measure_allocator (const int cmem_fd, const allocator_definition_t *const allocator,
+                               cmem_host_buf_entry_t buffers[const arg_num_live_buffers])
+{
+    const unsigned long command = arg_dma_capability_a64 ? allocator->a64_command : allocator->a32_command;
+    latency_histogram_t *const alloc_histogram = calloc (1, sizeof (*alloc_histogram));
+    latency_histogram_t *const free_histogram = calloc (1, sizeof (*free_histogram));
+    uint64_t random_state = arg_seed;
+    uint32_t num_allocated = 0;
+    bool success = true;
+
+    if ((alloc_histogram == NULL) || (free_histogram == NULL))
+    {
+        fprintf (stderr, "Failed to allocate histograms\n");
+        exit (EXIT_FAILURE);
+    }
+
+    /* Allocate the initial live buffers, which aren't included in the reported latencies */
+    while (success && (num_allocated < arg_num_live_buffers))
+    {
+        success = allocate_buffer (cmem_fd, command, &random_state, &buffers[num_allocated], alloc_histogram);
+        if (success)
+        {
+            num_allocated++;
+        }
+        else
+        {
+            printf ("%-10s : Unable to allocate %u live buffers (%s)\n",
+                    allocator->name, arg_num_live_buffers, strerror (errno));
+        }
+    }
+    memset (alloc_histogram, 0, sizeof (*alloc_histogram));
+
+    /* Randomly replace the live buffers */
+    for (uint32_t iteration = 0; success && (iteration < arg_num_iterations); iteration++)
+    {
+        const uint32_t buffer_index = (uint32_t) (next_random (&random_state) % arg_num_live_buffers);
+
+        success = free_buffer (cmem_fd, &buffers[buffer_index], free_histogram);
+        if (success)
+        {
+            success = allocate_buffer (cmem_fd, command, &random_state, &buffers[buffer_index], alloc_histogram);
+            if (!success)
+            {
+                printf ("%-10s : Allocation failed after %u iterations (%s)\n", allocator->name, iteration, strerror (errno));
+
+                /* Replace the freed buffer with the last live buffer, so only allocated buffers are freed below */
+                num_allocated--;
+                buffers[buffer_index] = buffers[num_allocated];
+            }
+        }
+        else
+        {
+            printf ("%-10s : Free failed after %u iterations (%s)\n", allocator->name, iteration, strerror (errno));
+        }
+    }
+
+    if (success)
+    {
+        char description[32];
+
+        snprintf (description, sizeof (description), "%s alloc", allocator->name);
+        latency_histogram_display (description, alloc_histogram);
+        snprintf (description, sizeof (description), "%s free", allocator->name);
+        latency_histogram_display (description, free_histogram);
+    }
+
+    /* Free the live buffers, which may include buffers left allocated by a failure */
+    for (uint32_t buffer_index = 0; buffer_index < num_allocated; buffer_index++)
+    {
+        free_buffer (cmem_fd, &buffers[buffer_index], free_histogram);
+    }
+
+    free (alloc_histogram);
+    free (free_histogram);
+
+    return success;
+}
+
+
+int alloc_benchmark_main (int argc, char *argv[])
+{
+    cmem_host_buf_entry_t *buffers;
+    int cmem_fd;
+    uint32_t num_measured = 0;
+
+    parse_command_line_arguments (argc, argv);
+
+    buffers = calloc (arg_num_live_buffers, sizeof (buffers[0]));
+    cmem_fd = open (CMEM_DRIVER_SIGNATURE, O_RDWR);
+    if ((buffers == NULL) || (cmem_fd == -1))
+    {
+        perror ("Benchmark initialisation failed");
+        return EXIT_FAILURE;
+    }
+
+    printf ("Replacing %u of %u live buffers of %zu to %zu bytes\n",
+            arg_num_iterations, arg_num_live_buffers, arg_min_buffer_size, arg_max_buffer_size);
+    for (uint32_t allocator_index = 0; allocator_index < NUM_ALLOCATORS; allocator_index++)
+    {
+        if (measure_allocator (cmem_fd, &allocators[allocator_index], buffers))
+        {
+            num_measured++;
+        }
+    }
+
+    close (cmem_fd);
+    free (buffers);
+
+    return (num_measured > 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
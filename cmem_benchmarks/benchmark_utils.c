@@ -0,0 +1,202 @@
+/*
+ * benchmark_utils.c
+ *
+ *  Created on: 18 Oct 2026
+ *      Author: Mr_Halfword
+ *
+ * Utility functions shared by the benchmarks
+ */
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <sched.h>
+
+#include "benchmark_utils.h"
+
+
+/**
+ * @brief Get the current value of the monotonic clock, for timing benchmarks
+ * @return The monotonic time in nanoseconds
+ */
+int64_t get_monotonic_time_ns (void)
+{
+    struct timespec now;
+
+    clock_gettime (CLOCK_MONOTONIC, &now);
+    return (now.tv_sec * 1000000000LL) + now.tv_nsec;
+}
+
+
+/**
+ * @brief Parse a comma separated list of CPU numbers from the command line
+ * @param[in] cpu_list The comma separated list to parse
+ * @param[in] max_cpus The maximum number of CPUs which may be specified
+ * @param[out] cpus The parsed CPU numbers
+ * @param[out] num_cpus The number of CPUs parsed
+ * @return Returns true if the list was valid, or false if not
+ */
+bool parse_cpu_list (const char *const cpu_list, const uint32_t max_cpus, int cpus[const max_cpus], uint32_t *const num_cpus)
+{
+    const char *field = cpu_list;
+    char *end;
+
+    *num_cpus = 0;
+    while (*field != '\0')
+    {
+        const long cpu = strtol (field, &end, 10);
+
+        if ((end == field) || (cpu < 0) || (cpu >= CPU_SETSIZE) || (*num_cpus == max_cpus) ||
+            ((*end != ',') && (*end != '\0')))
+        {
+            return false;
+        }
+        cpus[*num_cpus] = (int) cpu;
+        (*num_cpus)++;
+        field = (*end == ',') ? end + 1 : end;
+    }
+
+    return true;
+}
+
+
+/**
+ * @brief Set the CPU affinity of a thread which is about to be created
+ * @param[in/out] attr The attributes for the thread to be created
+ * @param[in] cpu The CPU to run the thread on, or negative to leave the affinity unchanged
+ */
+void set_thread_attr_cpu (pthread_attr_t *const attr, const int cpu)
+{
+    cpu_set_t cpu_set;
+    int rc;
+
+    if (cpu >= 0)
+    {
+        CPU_ZERO (&cpu_set);
+        CPU_SET (cpu, &cpu_set);
+        rc = pthread_attr_setaffinity_np (attr, sizeof (cpu_set), &cpu_set);
+        if (rc != 0)
+        {
+            fprintf (stderr, "pthread_attr_setaffinity_np for CPU %d failed : %s\n", cpu, strerror (rc));
+            exit (EXIT_FAILURE);
+        }
+    }
+}
+
+
+/**
+ * @brief Get the histogram bucket for a latency
+ * @details Values less than LATENCY_HISTOGRAM_SUB_BUCKETS have a bucket each. Larger values are divided into
+ *          LATENCY_HISTOGRAM_SUB_BUCKETS buckets for each power of two.
+ * @param[in] latency_ns The latency
+ * @return The bucket index
+ */
+static uint32_t latency_histogram_bucket (const uint64_t latency_ns)
+{
+    uint32_t msb;
+
+    if (latency_ns < LATENCY_HISTOGRAM_SUB_BUCKETS)
+    {
+        return (uint32_t) latency_ns;
+    }
+
+    msb = 63 - (uint32_t) __builtin_clzll (latency_ns);
+    return ((msb - LATENCY_HISTOGRAM_SUB_BUCKET_BITS + 1) * LATENCY_HISTOGRAM_SUB_BUCKETS) +
+            (uint32_t) ((latency_ns >> (msb - LATENCY_HISTOGRAM_SUB_BUCKET_BITS)) & (LATENCY_HISTOGRAM_SUB_BUCKETS - 1));
+}
+
+
+/**
+ * @brief Get the lowest latency which is recorded in a histogram bucket
+ * @param[in] bucket The bucket index
+ * @return The lowest latency in the bucket
+ */
+static uint64_t latency_histogram_bucket_start (const uint32_t bucket)
+{
+    const uint32_t range = bucket / LATENCY_HISTOGRAM_SUB_BUCKETS;
+    const uint64_t sub_bucket = bucket % LATENCY_HISTOGRAM_SUB_BUCKETS;
+
+    if (range == 0)
+    {
+        return sub_bucket;
+    }
+
+    return (LATENCY_HISTOGRAM_SUB_BUCKETS + sub_bucket) << (range - 1);
+}
+
+
+/**
+ * @brief Record one latency in a histogram
+ * @param[in/out] histogram The histogram to update
+ * @param[in] latency_ns The latency to record
+ */
+void latency_histogram_add (latency_histogram_t *const histogram, const uint64_t latency_ns)
+{
+    histogram->buckets[latency_histogram_bucket (latency_ns)]++;
+    histogram->count++;
+    if (latency_ns > histogram->max_ns)
+    {
+        histogram->max_ns = latency_ns;
+    }
+}
+
+
+/**
+ * @brief Add the latencies recorded in one histogram to a total
+ * @param[in/out] total The total histogram to update
+ * @param[in] histogram The histogram to add
+ */
+void latency_histogram_merge (latency_histogram_t *const total, const latency_histogram_t *const histogram)
+{
+    for (uint32_t bucket = 0; bucket < LATENCY_HISTOGRAM_NUM_BUCKETS; bucket++)
+    {
+        total->buckets[bucket] += histogram->buckets[bucket];
+    }
+    total->count += histogram->count;
+    if (histogram->max_ns > total->max_ns)
+    {
+        total->max_ns = histogram->max_ns;
+    }
+}
+
+
+/**
+ * @brief Get a percentile from a histogram
+ * @param[in] histogram The histogram to get the percentile from
+ * @param[in] percentile The percentile in the range 0 to 100
+ * @return The start of the bucket containing the percentile, or zero if the histogram is empty
+ */
+uint64_t latency_histogram_percentile (const latency_histogram_t *const histogram, const double percentile)
+{
+    const uint64_t target = (uint64_t) ((percentile / 100.0) * (double) histogram->count);
+    uint64_t cumulative = 0;
+
+    for (uint32_t bucket = 0; bucket < LATENCY_HISTOGRAM_NUM_BUCKETS; bucket++)
+    {
+        cumulative += histogram->buckets[bucket];
+        if ((cumulative > target) && (cumulative > 0))
+        {
+            return latency_histogram_bucket_start (bucket);
+        }
+    }
+
+    return histogram->max_ns;
+}
+
+
+/**
+ * @brief Display the count and percentiles of a latency histogram on one line
+ * @param[in] description Describes the latencies in the histogram
+ * @param[in] histogram The histogram to display
+ */
+void latency_histogram_display (const char *const description, const latency_histogram_t *const histogram)
+{
+    printf ("%-12s count %10lu  p50 %9lu ns  p90 %9lu ns  p99 %9lu ns  p99.9 %9lu ns  max %9lu ns\n",
+            description, histogram->count,
+            latency_histogram_percentile (histogram, 50.0), latency_histogram_percentile (histogram, 90.0),
+            latency_histogram_percentile (histogram, 99.0), latency_histogram_percentile (histogram, 99.9),
+            histogram->max_ns);
+}
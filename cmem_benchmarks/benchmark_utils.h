@@ -0,0 +1,44 @@
+/*
+ * benchmark_utils.h
+ *
+ *  Created on: 18 Oct 2026
+ *      Author: Mr_Halfword
+ *
+ * Utility functions shared by the benchmarks
+ */
+
+#ifndef BENCHMARK_UTILS_H_
+#define BENCHMARK_UTILS_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+/* Number of sub-buckets in each power of two range of a latency_histogram_t, which determines the resolution */
+#define LATENCY_HISTOGRAM_SUB_BUCKET_BITS 4
+#define LATENCY_HISTOGRAM_SUB_BUCKETS (1 << LATENCY_HISTOGRAM_SUB_BUCKET_BITS)
+
+/* Number of buckets, to cover the full range of 64-bit values */
+#define LATENCY_HISTOGRAM_NUM_BUCKETS ((64 - LATENCY_HISTOGRAM_SUB_BUCKET_BITS + 1) * LATENCY_HISTOGRAM_SUB_BUCKETS)
+
+/* Histogram of latencies in nanoseconds, using log-linear buckets with a relative error of at most
+ * 1 / LATENCY_HISTOGRAM_SUB_BUCKETS. Contains no pointers, so may be placed in memory shared between processes. */
+typedef struct
+{
+    /* The number of latencies recorded */
+    uint64_t count;
+    /* The largest latency recorded */
+    uint64_t max_ns;
+    /* The number of latencies recorded in each bucket */
+    uint64_t buckets[LATENCY_HISTOGRAM_NUM_BUCKETS];
+} latency_histogram_t;
+
+int64_t get_monotonic_time_ns (void);
+bool parse_cpu_list (const char *const cpu_list, const uint32_t max_cpus, int cpus[const max_cpus], uint32_t *const num_cpus);
+void set_thread_attr_cpu (pthread_attr_t *const attr, const int cpu);
+void latency_histogram_add (latency_histogram_t *const histogram, const uint64_t latency_ns);
+void latency_histogram_merge (latency_histogram_t *const total, const latency_histogram_t *const histogram);
+uint64_t latency_histogram_percentile (const latency_histogram_t *const histogram, const double percentile);
+void latency_histogram_display (const char *const description, const latency_histogram_t *const histogram);
+
+#endif /* BENCHMARK_UTILS_H_ */
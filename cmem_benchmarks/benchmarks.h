@@ -0,0 +1,24 @@
+/*
+ * benchmarks.h
+ *
+ *  Created on: 18 Oct 2026
+ *      Author: Mr_Halfword
+ *
+ * Defines the benchmarks which may be selected from the command line of cmem_benchmarks
+ */
+
+#ifndef BENCHMARKS_H_
+#define BENCHMARKS_H_
+
+int ring_benchmark_main (int argc, char *argv[]);
+int access_benchmark_main (int argc, char *argv[]);
+int stress_benchmark_main (int argc, char *argv[]);
+int alloc_benchmark_main (int argc, char *argv[]);
+int copy_benchmark_main (int argc, char *argv[]);
+int cache_benchmark_main (int argc, char *argv[]);
+int recycle_benchmark_main (int argc, char *argv[]);
+int pipeline_benchmark_main (int argc, char *argv[]);
+int replay_benchmark_main (int argc, char *argv[]);
+int colour_benchmark_main (int argc, char *argv[]);
+
+#endif /* BENCHMARKS_H_ */
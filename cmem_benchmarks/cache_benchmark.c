@@ -0,0 +1,300 @@
+/*
+ * cache_benchmark.c
+ *
+ *  Created on: 18 Oct 2026
+ *      Author: Mr_Halfword
+ *
+ * Compares the CPU cost of two ways of sharing buffers with a device which doesn't snoop the CPU caches:
+ * a. An uncached mapping, obtained by opening the cmem device with O_SYNC.
+ * b. A write-back mapping, with the cache maintenance ioctls used on the ranges which the device accesses.
+ *
+ * For each, the CPU produces data for the device by writing the buffer, and consumes data from the device by reading
+ * the buffer. With the write-back mapping the ranges are cleaned after being written and flushed before being read.
+ * No device is used, so the benchmark only measures the CPU side of the transfers.
+ *
+ * The uncached buffer is allocated through its own file descriptor, and never mapped write-back, since mapping the
+ * same physical memory with different cache types is not allowed.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+
+#include "cmem_drv.h"
+#include "benchmarks.h"
+#include "benchmark_utils.h"
+
+
+/* The options for the benchmark */
+static bool arg_dma_capability_a64 = true;
+static size_t arg_buffer_size = 16 * 1024 * 1024;
+static size_t arg_range_size = 64 * 1024;
+static uint32_t arg_num_iterations = 16;
+
+
+/* The accumulated time for one type of transfer */
+typedef struct
+{
+    /* Describes the transfer for the report */
+    const char *description;
+    /* The total time taken by the CPU accesses and any cache maintenance */
+    int64_t total_time_ns;
+    /* The part of total_time_ns in the cache maintenance ioctls */
+    int64_t maintenance_time_ns;
+} transfer_time_t;
+
+
+static void display_usage (const char *const program_name)
+{
+    printf ("Usage: %s [-a] [-s <buffer_size>] [-r <range_size>] [-i <iterations>]\n", program_name);
+    printf ("  -a  Allocate the buffers with A32 physical addresses, rather than A64\n");
+    printf ("  -s  Size of each buffer in bytes\n");
+    printf ("  -r  Size of each range passed to the cache maintenance ioctls\n");
+    printf ("  -i  Number of times each buffer is written and read\n");
+}
+
+
+static size_t parse_size_arg (const char *const program_name, const char *const arg)
+{
+    char *end;
+    const unsigned long long value = strtoull (arg, &end, 0);
+
+    if ((*end != '\0') || (value == 0) || (value > SIZE_MAX))
+    {
+        fprintf (stderr, "Invalid numeric argument %s\n", arg);
+        display_usage (program_name);
+        exit (EXIT_FAILURE);
+    }
+
+    return (size_t) value;
+}
+
+
+static void parse_command_line_arguments (int argc, char *argv[])
+{
+    const char *const optstring = "as:r:i:h";
+    int option;
+
+    optind = 1;
+    while ((option = getopt (argc, argv, optstring)) != -1)
+    {
+        switch (option)
+        {
+        case 'a':
+            arg_dma_capability_a64 = false;
+            break;
+
+        case 's':
+            arg_buffer_size = parse_size_arg (argv[0], optarg);
+            break;
+
+        case 'r':
+            arg_range_size = parse_size_arg (argv[0], optarg);
+            break;
+
+        case 'i':
+            arg_num_iterations = (uint32_t) parse_size_arg (argv[0], optarg);
+            break;
+
+        case 'h':
+        default:
+            display_usage (argv[0]);
+            exit (EXIT_FAILURE);
+        }
+    }
+}
+
+
+/**
+ * @brief Write a pattern to a buffer, as the CPU producing data for a device
+ */
+static void produce_data (uint64_t *const words, const size_t num_words, const uint64_t seed)
+{
+    for (size_t word_index = 0; word_index < num_words; word_index++)
+    {
+        words[word_index] = seed + word_index;
+    }
+}
+
+
+/**
+ * @brief Sum the words in a buffer, as the CPU consuming data from a device
+ */
+static uint64_t consume_data (const uint64_t *const words, const size_t num_words)
+{
+    uint64_t sum = 0;
+
+    for (size_t word_index = 0; word_index < num_words; word_index++)
+    {
+        sum += words[word_index];
+    }
+
+    return sum;
+}
+
+
+/**
+ * @brief Perform cache maintenance on all ranges of a buffer, accumulating the time taken
+ * @return Returns true if the maintenance was successful
+ */
+static bool perform_maintenance (cmem_drv_context_t *const context, const bool flush, const uint32_t num_ranges, const cmem_cache_range_t ranges[const num_ranges],
+                                 transfer_time_t *const transfer)
+{
+    const int64_t start_time_ns = get_monotonic_time_ns ();
+    const bool success = cmem_drv_cache_maintenance (context, flush, num_ranges, ranges) == 0;
+
+    transfer->maintenance_time_ns += get_monotonic_time_ns () - start_time_ns;
+    if (!success)
+    {
+        perror ("Cache maintenance failed");
+    }
+
+    return success;
+}
+
+
+/**
+ * @brief Display the rate for one type of transfer
+ */
+static void display_transfer_time (const transfer_time_t *const transfer, const size_t buffer_size)
+{
+    const double total_bytes = (double) buffer_size * arg_num_iterations;
+
+    printf ("%-34s : %9.2f MB/sec", transfer->description, (total_bytes / ((double) transfer->total_time_ns / 1E9)) / 1E6);
+    if (transfer->maintenance_time_ns > 0)
+    {
+        printf (" (%.1f%% of time in cache maintenance)",
+                (100.0 * (double) transfer->maintenance_time_ns) / (double) transfer->total_time_ns);
+    }
+    printf ("\n");
+}
+
+
+int cache_benchmark_main (int argc, char *argv[])
+{
+    transfer_time_t uncached_produce = {.description = "Uncached write"};
+    transfer_time_t uncached_consume = {.description = "Uncached read"};
+    transfer_time_t cached_produce = {.description = "Write-back write + clean"};
+    transfer_time_t cached_consume = {.description = "Flush + write-back read"};
+    cmem_drv_context_t *context;
+    cmem_host_buf_desc_t cached_buffer;
+    cmem_ioctl_t uncached_ioctl;
+    cmem_cache_range_t *ranges;
+    uint32_t num_ranges;
+    uint64_t *uncached_words;
+    size_t num_words;
+    int uncached_fd;
+    int64_t start_time_ns;
+    uint64_t cached_sum = 0;
+    uint64_t uncached_sum = 0;
+    bool success = true;
+    int32_t rc;
+
+    parse_command_line_arguments (argc, argv);
+
+    rc = cmem_drv_open (&context);
+    if (rc != 0)
+    {
+        return EXIT_FAILURE;
+    }
+
+    rc = cmem_drv_alloc (context, arg_dma_capability_a64, 1, arg_buffer_size, &cached_buffer);
+    if (rc != 0)
+    {
+        fprintf (stderr, "Failed to allocate buffer of %zu bytes\n", arg_buffer_size);
+        return EXIT_FAILURE;
+    }
+
+    /* Allocate and map the uncached buffer through a file descriptor opened with O_SYNC */
+    uncached_fd = open (CMEM_DRIVER_SIGNATURE, O_RDWR | O_SYNC);
+    if (uncached_fd == -1)
+    {
+        perror ("Failed to open cmem device with O_SYNC");
+        return EXIT_FAILURE;
+    }
+    uncached_ioctl.host_buf_info.num_buffers = 1;
+    uncached_ioctl.host_buf_info.buf_info[0].dma_address = 0;
+    uncached_ioctl.host_buf_info.buf_info[0].length = cached_buffer.length;
+    if (ioctl (uncached_fd, arg_dma_capability_a64 ? CMEM_IOCTL_ALLOC_A64_HOST_BUFFERS : CMEM_IOCTL_ALLOC_A32_HOST_BUFFERS,
+            &uncached_ioctl) != 0)
+    {
+        perror ("Failed to allocate uncached buffer");
+        return EXIT_FAILURE;
+    }
+    uncached_words = mmap (NULL, cached_buffer.length, PROT_READ | PROT_WRITE, MAP_SHARED, uncached_fd,
+            (off_t) uncached_ioctl.host_buf_info.buf_info[0].dma_address);
+    if (uncached_words == MAP_FAILED)
+    {
+        perror ("Failed to map uncached buffer");
+        return EXIT_FAILURE;
+    }
+
+    /* Divide the write-back buffer into the ranges which a device would access */
+    num_ranges = (uint32_t) ((cached_buffer.length + arg_range_size - 1) / arg_range_size);
+    ranges = calloc (num_ranges, sizeof (ranges[0]));
+    if (ranges == NULL)
+    {
+        perror ("Benchmark initialisation failed");
+        return EXIT_FAILURE;
+    }
+    for (uint32_t range_index = 0; range_index < num_ranges; range_index++)
+    {
+        const size_t offset = range_index * arg_range_size;
+
+        ranges[range_index].dma_address = cached_buffer.physAddr + offset;
+        ranges[range_index].length = ((cached_buffer.length - offset) < arg_range_size) ?
+                (cached_buffer.length - offset) : arg_range_size;
+    }
+
+    num_words = cached_buffer.length / sizeof (uint64_t);
+    printf ("Buffers of %zu bytes, with cache maintenance on %u ranges of %zu bytes\n",
+            cached_buffer.length, num_ranges, arg_range_size);
+    for (uint32_t iteration = 0; success && (iteration < arg_num_iterations); iteration++)
+    {
+        start_time_ns = get_monotonic_time_ns ();
+        produce_data (uncached_words, num_words, iteration);
+        uncached_produce.total_time_ns += get_monotonic_time_ns () - start_time_ns;
+
+        start_time_ns = get_monotonic_time_ns ();
+        uncached_sum += consume_data (uncached_words, num_words);
+        uncached_consume.total_time_ns += get_monotonic_time_ns () - start_time_ns;
+
+        start_time_ns = get_monotonic_time_ns ();
+        produce_data ((uint64_t *) cached_buffer.userAddr, num_words, iteration);
+        success = perform_maintenance (context, false, num_ranges, ranges, &cached_produce);
+        cached_produce.total_time_ns += get_monotonic_time_ns () - start_time_ns;
+
+        start_time_ns = get_monotonic_time_ns ();
+        success = success && perform_maintenance (context, true, num_ranges, ranges, &cached_consume);
+        cached_sum += consume_data ((const uint64_t *) cached_buffer.userAddr, num_words);
+        cached_consume.total_time_ns += get_monotonic_time_ns () - start_time_ns;
+    }
+
+    if (success)
+    {
+        display_transfer_time (&uncached_produce, cached_buffer.length);
+        display_transfer_time (&uncached_consume, cached_buffer.length);
+        display_transfer_time (&cached_produce, cached_buffer.length);
+        display_transfer_time (&cached_consume, cached_buffer.length);
+        if (cached_sum != uncached_sum)
+        {
+            printf ("Data read from the write-back and uncached buffers differs\n");
+            success = false;
+        }
+    }
+
+    /* Free the buffers explicitly, rather than relying on the driver freeing them when the process closes the device */
+    free (ranges);
+    munmap (uncached_words, cached_buffer.length);
+    ioctl (uncached_fd, CMEM_IOCTL_FREE_HOST_BUFFERS, &uncached_ioctl);
+    cmem_drv_free (context, 1, &cached_buffer);
+    close (uncached_fd);
+    cmem_drv_close (context);
+
+    return success ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,438 @@
+/*
+ * colour_benchmark.c
+ *
+ *  Created on: 18 Oct 2026
+ *      Author: Mr_Halfword
+ *
+ * Measures the conflict misses of a multi-ring workload, where a thread walks slot 0 of many equally sized ring buffers
+ * which were allocated back-to-back by cmem_drv_alloc(). Without cache colouring the starts of the rings are separated
+ * by a multiple of the ring length, so when the ring length is a multiple of the size of one way of a cache the slots
+ * all map to the same cache sets, and once there are more rings than the associativity the walk misses.
+ *
+ * When the cache_colours module parameter is writable, i.e. when run as root, the rings are allocated and walked with
+ * the parameter zero and then set to the number of colours, to compare the placement without and with colouring.
+ * Otherwise only the current placement is measured.
+ *
+ * The number of colours defaults to the size of one way of the last level cache in pages, as reported by the C library.
+ * The time per slot is always reported, and the last level cache references and misses are counted with
+ * perf_event_open() when permitted by /proc/sys/kernel/perf_event_paranoid. A raw PMU event may also be counted, e.g.
+ * for misses in the L2 cache which is not shared so isn't affected by the hashing of addresses across cache slices.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "cmem_drv.h"
+#include "benchmarks.h"
+#include "benchmark_utils.h"
+
+
+/* The module parameter which selects the cache colouring of allocations */
+#define CACHE_COLOURS_PARAMETER_PATH "/sys/module/cmem_dev/parameters/cache_colours"
+
+/* The maximum number of rings which may be walked */
+#define MAX_RINGS 4096
+
+/* The size of the cache lines written in each slot */
+#define CACHE_LINE_SIZE 64
+
+/* The number of hardware counters, which are the last level cache references and misses, and an optional raw event */
+#define NUM_COUNTERS 3
+
+
+/* The options for the benchmark */
+static bool arg_dma_capability_a64 = true;
+static uint32_t arg_num_rings = 64;
+static size_t arg_ring_length = 2 * 1024 * 1024;
+static size_t arg_slot_size = CACHE_LINE_SIZE;
+static uint32_t arg_num_passes = 100000;
+static uint32_t arg_cache_colours;
+static bool arg_raw_event_set;
+static uint64_t arg_raw_event;
+
+
+/* One hardware counter opened with perf_event_open() */
+typedef struct
+{
+    /* Describes the event for the report */
+    const char *name;
+    /* The file descriptor for the counter, or -1 if not available */
+    int fd;
+    /* The value of the counter after a walk */
+    uint64_t value;
+} hardware_counter_t;
+
+
+static void display_usage (const char *const program_name)
+{
+    printf ("Usage: %s [-a] [-n <rings>] [-l <ring_length>] [-s <slot_size>] [-p <passes>] [-k <colours>] [-e <raw_event>]\n",
+            program_name);
+    printf ("  -a  Allocate the rings with A32 physical addresses, rather than A64\n");
+    printf ("  -n  Number of rings, maximum %u\n", MAX_RINGS);
+    printf ("  -l  Length of each ring in bytes\n");
+    printf ("  -s  Size of slot 0 of each ring, which is written on each pass\n");
+    printf ("  -p  Number of passes over slot 0 of every ring\n");
+    printf ("  -k  Number of page colours in one way of the cache, used for the cache_colours module parameter\n");
+    printf ("  -e  Raw PMU event to count in addition to the last level cache references and misses\n");
+}
+
+
+static uint64_t parse_uint_arg (const char *const program_name, const char *const arg,
+                                const uint64_t min_value, const uint64_t max_value)
+{
+    char *end;
+    const unsigned long long value = strtoull (arg, &end, 0);
+
+    if ((*end != '\0') || (value < min_value) || (value > max_value))
+    {
+        fprintf (stderr, "Invalid numeric argument %s\n", arg);
+        display_usage (program_name);
+        exit (EXIT_FAILURE);
+    }
+
+    return value;
+}
+
+
+static void parse_command_line_arguments (int argc, char *argv[])
+{
+    const char *const optstring = "an:l:s:p:k:e:h";
+    int option;
+
+    optind = 1;
+    while ((option = getopt (argc, argv, optstring)) != -1)
+    {
+        switch (option)
+        {
+        case 'a':
+            arg_dma_capability_a64 = false;
+            break;
+
+        case 'n':
+            arg_num_rings = (uint32_t) parse_uint_arg (argv[0], optarg, 1, MAX_RINGS);
+            break;
+
+        case 'l':
+            arg_ring_length = (size_t) parse_uint_arg (argv[0], optarg, CACHE_LINE_SIZE, SIZE_MAX);
+            break;
+
+        case 's':
+            arg_slot_size = (size_t) parse_uint_arg (argv[0], optarg, CACHE_LINE_SIZE, SIZE_MAX);
+            break;
+
+        case 'p':
+            arg_num_passes = (uint32_t) parse_uint_arg (argv[0], optarg, 1, UINT32_MAX);
+            break;
+
+        case 'k':
+            arg_cache_colours = (uint32_t) parse_uint_arg (argv[0], optarg, 2, UINT32_MAX);
+            break;
+
+        case 'e':
+            arg_raw_event = parse_uint_arg (argv[0], optarg, 0, UINT64_MAX);
+            arg_raw_event_set = true;
+            break;
+
+        case 'h':
+        default:
+            display_usage (argv[0]);
+            exit (EXIT_FAILURE);
+        }
+    }
+
+    if (arg_slot_size > arg_ring_length)
+    {
+        fprintf (stderr, "The slot size can't be larger than the ring length\n");
+        exit (EXIT_FAILURE);
+    }
+}
+
+
+/**
+ * @brief Get the number of page colours in one way of the last level cache reported by the C library
+ * @return The number of colours rounded down to a power of two, or zero if the cache geometry isn't known
+ */
+static uint32_t get_default_cache_colours (void)
+{
+    const long cache_size = sysconf (_SC_LEVEL3_CACHE_SIZE);
+    const long cache_assoc = sysconf (_SC_LEVEL3_CACHE_ASSOC);
+    const long page_size = sysconf (_SC_PAGESIZE);
+    uint32_t num_colours = 0;
+
+    if ((cache_size > 0) && (cache_assoc > 0) && (page_size > 0))
+    {
+        const uint64_t way_colours = (uint64_t) (cache_size / cache_assoc) / (uint64_t) page_size;
+
+        for (num_colours = 1; ((uint64_t) num_colours * 2) <= way_colours; num_colours *= 2)
+        {
+        }
+    }
+
+    return (num_colours >= 2) ? num_colours : 0;
+}
+
+
+/**
+ * @brief Read the current value of the cache_colours module parameter
+ * @param[out] cache_colours The current value
+ * @return Returns true if the parameter was read
+ */
+static bool read_cache_colours (uint32_t *const cache_colours)
+{
+    FILE *const parameter_file = fopen (CACHE_COLOURS_PARAMETER_PATH, "r");
+    bool success = false;
+
+    if (parameter_file != NULL)
+    {
+        success = fscanf (parameter_file, "%u", cache_colours) == 1;
+        fclose (parameter_file);
+    }
+
+    return success;
+}
+
+
+/**
+ * @brief Attempt to change the cache_colours module parameter
+ * @param[in] cache_colours The value to set
+ * @return Returns true if the parameter was changed
+ */
+static bool write_cache_colours (const uint32_t cache_colours)
+{
+    FILE *const parameter_file = fopen (CACHE_COLOURS_PARAMETER_PATH, "w");
+    bool success = false;
+
+    if (parameter_file != NULL)
+    {
+        success = fprintf (parameter_file, "%u", cache_colours) > 0;
+        success = (fclose (parameter_file) == 0) && success;
+    }
+
+    return success;
+}
+
+
+/**
+ * @brief Open a disabled hardware counter for the calling thread, which only counts in user space
+ * @param[out] counter The counter to open, which is left with fd -1 if perf_event_open() fails
+ * @param[in] name Describes the event for the report
+ * @param[in] type The perf_type_id of the event
+ * @param[in] config The event within the type
+ */
+static void open_hardware_counter (hardware_counter_t *const counter, const char *const name,
+                                   const uint32_t type, const uint64_t config)
+{
+    struct perf_event_attr attr;
+
+    memset (&attr, 0, sizeof (attr));
+    attr.size = sizeof (attr);
+    attr.type = type;
+    attr.config = config;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+
+    counter->name = name;
+    counter->value = 0;
+    counter->fd = (int) syscall (SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+
+/**
+ * @brief Walk slot 0 of every ring for the number of passes, writing every cache line of the slot on each pass
+ * @param[in] num_rings The number of rings to walk
+ * @param[in/out] rings The rings to walk
+ * @param[in] num_passes The number of passes over the rings
+ */
+static void walk_rings (const uint32_t num_rings, const cmem_host_buf_desc_t rings[const num_rings],
+                        const uint32_t num_passes)
+{
+    for (uint32_t pass = 0; pass < num_passes; pass++)
+    {
+        for (uint32_t ring_index = 0; ring_index < num_rings; ring_index++)
+        {
+            for (size_t offset = 0; offset < arg_slot_size; offset += CACHE_LINE_SIZE)
+            {
+                volatile uint64_t *const line = (volatile uint64_t *) &rings[ring_index].userAddr[offset];
+
+                *line = *line + 1;
+            }
+        }
+    }
+}
+
+
+/**
+ * @brief Allocate the rings, report the colours of their starts, and measure the walk of slot 0 of every ring
+ * @param[in] context The context used to allocate the rings
+ * @param[in] cache_colours The number of page colours used to report the starts of the rings
+ * @param[in/out] counters The hardware counters used to measure the walk
+ * @param[in] description Describes the placement for the report
+ * @return Returns true if the rings were allocated
+ */
+static bool measure_ring_walk (cmem_drv_context_t *const context, const uint32_t cache_colours,
+                               hardware_counter_t counters[const NUM_COUNTERS], const char *const description)
+{
+    const uint64_t page_size = (uint64_t) sysconf (_SC_PAGESIZE);
+    const uint64_t num_slots = (uint64_t) arg_num_rings * arg_num_passes;
+    cmem_host_buf_desc_t *const rings = calloc (arg_num_rings, sizeof (rings[0]));
+    bool *const colour_used = calloc (cache_colours, sizeof (colour_used[0]));
+    uint32_t num_colours_used = 0;
+    uint64_t unused_bytes = 0;
+    int64_t start_time_ns;
+    int64_t end_time_ns;
+
+    if ((rings == NULL) || (colour_used == NULL))
+    {
+        fprintf (stderr, "Out of memory\n");
+        exit (EXIT_FAILURE);
+    }
+
+    if (cmem_drv_alloc (context, arg_dma_capability_a64, arg_num_rings, arg_ring_length, rings) != 0)
+    {
+        fprintf (stderr, "%s : failed to allocate %u rings of %zu bytes\n", description, arg_num_rings, arg_ring_length);
+        free (colour_used);
+        free (rings);
+        return false;
+    }
+
+    /* Count the distinct colours of the ring starts, and the space left between rings which follow each other */
+    for (uint32_t ring_index = 0; ring_index < arg_num_rings; ring_index++)
+    {
+        const uint32_t colour = (uint32_t) ((rings[ring_index].physAddr / page_size) % cache_colours);
+
+        if (!colour_used[colour])
+        {
+            colour_used[colour] = true;
+            num_colours_used++;
+        }
+        if ((ring_index > 0) && (rings[ring_index].physAddr > rings[ring_index - 1].physAddr))
+        {
+            const uint64_t previous_end = rings[ring_index - 1].physAddr + rings[ring_index - 1].length;
+
+            if ((rings[ring_index].physAddr >= previous_end) &&
+                ((rings[ring_index].physAddr - previous_end) < arg_ring_length))
+            {
+                unused_bytes += rings[ring_index].physAddr - previous_end;
+            }
+        }
+        memset (rings[ring_index].userAddr, 0, arg_slot_size);
+    }
+
+    /* Warm the caches with one pass, then measure */
+    walk_rings (arg_num_rings, rings, 1);
+    for (uint32_t counter_index = 0; counter_index < NUM_COUNTERS; counter_index++)
+    {
+        if (counters[counter_index].fd != -1)
+        {
+            ioctl (counters[counter_index].fd, PERF_EVENT_IOC_RESET, 0);
+            ioctl (counters[counter_index].fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+    start_time_ns = get_monotonic_time_ns ();
+    walk_rings (arg_num_rings, rings, arg_num_passes);
+    end_time_ns = get_monotonic_time_ns ();
+    for (uint32_t counter_index = 0; counter_index < NUM_COUNTERS; counter_index++)
+    {
+        if (counters[counter_index].fd != -1)
+        {
+            ioctl (counters[counter_index].fd, PERF_EVENT_IOC_DISABLE, 0);
+            if (read (counters[counter_index].fd, &counters[counter_index].value,
+                      sizeof (counters[counter_index].value)) != sizeof (counters[counter_index].value))
+            {
+                counters[counter_index].value = 0;
+            }
+        }
+    }
+
+    printf ("%s : %u of %u colours used by the ring starts, %lu bytes unused between rings\n",
+            description, num_colours_used, cache_colours, unused_bytes);
+    printf ("  %.2f ns per slot", (double) (end_time_ns - start_time_ns) / (double) num_slots);
+    for (uint32_t counter_index = 0; counter_index < NUM_COUNTERS; counter_index++)
+    {
+        if (counters[counter_index].fd != -1)
+        {
+            printf (", %.3f %s per slot", (double) counters[counter_index].value / (double) num_slots,
+                    counters[counter_index].name);
+        }
+    }
+    printf ("\n");
+
+    cmem_drv_free (context, arg_num_rings, rings);
+    free (colour_used);
+    free (rings);
+
+    return true;
+}
+
+
+int colour_benchmark_main (int argc, char *argv[])
+{
+    cmem_drv_context_t *context;
+    hardware_counter_t counters[NUM_COUNTERS];
+    uint32_t initial_cache_colours;
+    bool success;
+
+    parse_command_line_arguments (argc, argv);
+
+    if (arg_cache_colours == 0)
+    {
+        arg_cache_colours = get_default_cache_colours ();
+        if (arg_cache_colours == 0)
+        {
+            fprintf (stderr, "The last level cache geometry isn't known, so the number of colours must be given with -k\n");
+            return EXIT_FAILURE;
+        }
+    }
+
+    open_hardware_counter (&counters[0], "LLC references", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_REFERENCES);
+    open_hardware_counter (&counters[1], "LLC misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+    counters[2].fd = -1;
+    if (arg_raw_event_set)
+    {
+        open_hardware_counter (&counters[2], "raw events", PERF_TYPE_RAW, arg_raw_event);
+    }
+    if (counters[1].fd == -1)
+    {
+        printf ("Unable to open the hardware counters, so only measuring the time\n");
+    }
+
+    if (cmem_drv_open (&context) != 0)
+    {
+        return EXIT_FAILURE;
+    }
+
+    printf ("Walking %u bytes of slot 0 of %u rings of %zu bytes for %u passes, with %u page colours\n",
+            (uint32_t) arg_slot_size, arg_num_rings, arg_ring_length, arg_num_passes, arg_cache_colours);
+    if (read_cache_colours (&initial_cache_colours) && write_cache_colours (initial_cache_colours))
+    {
+        /* Able to change the placement, so compare without and with colouring */
+        success = write_cache_colours (0) &&
+                measure_ring_walk (context, arg_cache_colours, counters, "Without colouring");
+        success = write_cache_colours (arg_cache_colours) &&
+                measure_ring_walk (context, arg_cache_colours, counters, "With colouring") && success;
+        write_cache_colours (initial_cache_colours);
+    }
+    else
+    {
+        printf ("Unable to change %s, so only measuring the current placement\n", CACHE_COLOURS_PARAMETER_PATH);
+        success = measure_ring_walk (context, arg_cache_colours, counters, "Current placement");
+    }
+
+    cmem_drv_close (context);
+    for (uint32_t counter_index = 0; counter_index < NUM_COUNTERS; counter_index++)
+    {
+        if (counters[counter_index].fd != -1)
+        {
+            close (counters[counter_index].fd);
+        }
+    }
+
+    return success ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,269 @@
+/*
+ * copy_benchmark.c
+ *
+ *  Created on: 18 Oct 2026
+ *      Author: Mr_Halfword
+ *
+ * Compares the throughput of the cmem_copy routines against the C library, when copying to and from a cmem buffer,
+ * filling a cmem buffer and comparing a cmem buffer with a host buffer.
+ *
+ * The cmem_copy routines are measured both with the write-back cache type of the cmem buffer mapping, which only uses
+ * non-temporal stores for buffers larger than the last level cache, and with the write-combining cache type to force
+ * the use of non-temporal stores.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <getopt.h>
+
+#include "cmem_drv.h"
+#include "cmem_copy.h"
+#include "benchmarks.h"
+#include "benchmark_utils.h"
+
+
+/* The options for the benchmark */
+static bool arg_dma_capability_a64 = true;
+static size_t arg_buffer_size = 256 * 1024 * 1024;
+static uint32_t arg_num_iterations = 4;
+static uint32_t arg_num_threads = 1;
+
+
+/* The operations which are measured */
+typedef enum
+{
+    COPY_TO_CMEM,
+    COPY_FROM_CMEM,
+    FILL_CMEM,
+    COMPARE_CMEM
+} copy_operation_t;
+
+/* Defines one measurement */
+typedef struct
+{
+    /* Describes the measurement for the report */
+    const char *description;
+    /* The operation measured */
+    copy_operation_t operation;
+    /* When true the C library is used, otherwise the cmem_copy routines */
+    bool use_libc;
+    /* The cache type passed to the cmem_copy routines */
+    cmem_mapping_type_t dest_type;
+} copy_measurement_t;
+
+static const copy_measurement_t measurements[] =
+{
+    {"memcpy to cmem", COPY_TO_CMEM, true, CMEM_MAPPING_WRITE_BACK},
+    {"cmem_copy to cmem", COPY_TO_CMEM, false, CMEM_MAPPING_WRITE_BACK},
+    {"cmem_copy to cmem (streaming)", COPY_TO_CMEM, false, CMEM_MAPPING_WRITE_COMBINING},
+    {"memcpy from cmem", COPY_FROM_CMEM, true, CMEM_MAPPING_WRITE_BACK},
+    {"cmem_copy from cmem", COPY_FROM_CMEM, false, CMEM_MAPPING_WRITE_BACK},
+    {"cmem_copy from cmem (streaming)", COPY_FROM_CMEM, false, CMEM_MAPPING_WRITE_COMBINING},
+    {"memset cmem", FILL_CMEM, true, CMEM_MAPPING_WRITE_BACK},
+    {"cmem_fill cmem", FILL_CMEM, false, CMEM_MAPPING_WRITE_BACK},
+    {"cmem_fill cmem (streaming)", FILL_CMEM, false, CMEM_MAPPING_WRITE_COMBINING},
+    {"memcmp cmem", COMPARE_CMEM, true, CMEM_MAPPING_WRITE_BACK},
+    {"cmem_compare cmem", COMPARE_CMEM, false, CMEM_MAPPING_WRITE_BACK}
+};
+
+#define NUM_MEASUREMENTS (sizeof (measurements) / sizeof (measurements[0]))
+
+
+static void display_usage (const char *const program_name)
+{
+    printf ("Usage: %s [-a] [-s <buffer_size>] [-i <iterations>] [-t <threads>]\n", program_name);
+    printf ("  -a  Allocate the buffer with A32 physical addresses, rather than A64\n");
+    printf ("  -s  Size of the buffer in bytes\n");
+    printf ("  -i  Number of times each operation is performed on the entire buffer\n");
+    printf ("  -t  Number of threads used by the cmem_copy routines for large buffers\n");
+}
+
+
+static size_t parse_size_arg (const char *const program_name, const char *const arg)
+{
+    char *end;
+    const unsigned long long value = strtoull (arg, &end, 0);
+
+    if ((*end != '\0') || (value == 0) || (value > SIZE_MAX))
+    {
+        fprintf (stderr, "Invalid numeric argument %s\n", arg);
+        display_usage (program_name);
+        exit (EXIT_FAILURE);
+    }
+
+    return (size_t) value;
+}
+
+
+static void parse_command_line_arguments (int argc, char *argv[])
+{
+    const char *const optstring = "as:i:t:h";
+    int option;
+
+    optind = 1;
+    while ((option = getopt (argc, argv, optstring)) != -1)
+    {
+        switch (option)
+        {
+        case 'a':
+            arg_dma_capability_a64 = false;
+            break;
+
+        case 's':
+            arg_buffer_size = parse_size_arg (argv[0], optarg);
+            break;
+
+        case 'i':
+            arg_num_iterations = (uint32_t) parse_size_arg (argv[0], optarg);
+            break;
+
+        case 't':
+            arg_num_threads = (uint32_t) parse_size_arg (argv[0], optarg);
+            break;
+
+        case 'h':
+        default:
+            display_usage (argv[0]);
+            exit (EXIT_FAILURE);
+        }
+    }
+}
+
+
+/**
+ * @brief Perform one measurement, reporting the throughput
+ * @param[in] measurement The measurement to perform
+ * @param[in/out] cmem_buffer The mapped cmem buffer
+ * @param[in/out] host_buffer A host buffer of the same length as the cmem buffer
+ * @param[in] length The length of the buffers
+ * @return Returns true if the buffer contents were as expected after the operation
+ */
+static bool perform_measurement (const copy_measurement_t *const measurement, uint8_t *const cmem_buffer,
+                                 uint8_t *const host_buffer, const size_t length)
+{
+    uint8_t *const dest = (measurement->operation == COPY_FROM_CMEM) ? host_buffer : cmem_buffer;
+    const uint8_t *const src = (measurement->operation == COPY_FROM_CMEM) ? cmem_buffer : host_buffer;
+    int64_t start_time_ns;
+    int64_t end_time_ns;
+    double duration_secs;
+    bool success = true;
+
+    start_time_ns = get_monotonic_time_ns ();
+    for (uint32_t iteration = 0; success && (iteration < arg_num_iterations); iteration++)
+    {
+        switch (measurement->operation)
+        {
+        case COPY_TO_CMEM:
+        case COPY_FROM_CMEM:
+            if (measurement->use_libc)
+            {
+                memcpy (dest, src, length);
+            }
+            else
+            {
+                cmem_copy (dest, src, length, measurement->dest_type);
+            }
+            break;
+
+        case FILL_CMEM:
+            if (measurement->use_libc)
+            {
+                memset (dest, (int) iteration, length);
+            }
+            else
+            {
+                cmem_fill (dest, (uint8_t) iteration, length, measurement->dest_type);
+            }
+            break;
+
+        case COMPARE_CMEM:
+            success = measurement->use_libc ? (memcmp (cmem_buffer, host_buffer, length) == 0) :
+                    (cmem_compare (cmem_buffer, host_buffer, length) == 0);
+            break;
+        }
+    }
+    end_time_ns = get_monotonic_time_ns ();
+    duration_secs = (double) (end_time_ns - start_time_ns) / 1E9;
+
+    /* Check the results, using the C library */
+    switch (measurement->operation)
+    {
+    case COPY_TO_CMEM:
+    case COPY_FROM_CMEM:
+        success = memcmp (cmem_buffer, host_buffer, length) == 0;
+        break;
+
+    case FILL_CMEM:
+        for (size_t offset = 0; success && (offset < length); offset++)
+        {
+            success = cmem_buffer[offset] == (uint8_t) (arg_num_iterations - 1);
+        }
+
+        /* Restore the cmem buffer contents for the next measurement */
+        memcpy (cmem_buffer, host_buffer, length);
+        break;
+
+    case COMPARE_CMEM:
+        break;
+    }
+
+    printf ("%-32s : %.2f MB/sec%s\n", measurement->description,
+            ((double) length * arg_num_iterations / duration_secs) / 1E6, success ? "" : " (incorrect result)");
+
+    return success;
+}
+
+
+int copy_benchmark_main (int argc, char *argv[])
+{
+    cmem_drv_context_t *context;
+    cmem_host_buf_desc_t buffer;
+    uint8_t *host_buffer;
+    bool success = true;
+    int32_t rc;
+
+    parse_command_line_arguments (argc, argv);
+
+    rc = cmem_drv_open (&context);
+    if (rc != 0)
+    {
+        return EXIT_FAILURE;
+    }
+
+    rc = cmem_drv_alloc (context, arg_dma_capability_a64, 1, arg_buffer_size, &buffer);
+    if (rc != 0)
+    {
+        fprintf (stderr, "Failed to allocate buffer of %zu bytes\n", arg_buffer_size);
+        return EXIT_FAILURE;
+    }
+
+    host_buffer = malloc (buffer.length);
+    if (host_buffer == NULL)
+    {
+        perror ("Benchmark initialisation failed");
+        return EXIT_FAILURE;
+    }
+
+    /* Fill the buffers with a pattern which differs in each word, so each page is populated */
+    for (size_t word_index = 0; word_index < (buffer.length / sizeof (uint32_t)); word_index++)
+    {
+        ((uint32_t *) host_buffer)[word_index] = (uint32_t) word_index * 0x9E3779B1u;
+    }
+    memcpy (buffer.userAddr, host_buffer, buffer.length);
+
+    cmem_copy_set_num_threads (arg_num_threads);
+    printf ("Buffer of %zu bytes at physical 0x%lx, using %s with %u threads for large buffers\n",
+            buffer.length, buffer.physAddr, cmem_copy_isa_name (), arg_num_threads);
+    for (uint32_t measurement_index = 0; measurement_index < NUM_MEASUREMENTS; measurement_index++)
+    {
+        success = perform_measurement (&measurements[measurement_index], buffer.userAddr, host_buffer, buffer.length) &&
+                success;
+    }
+
+    free (host_buffer);
+    cmem_drv_free (context, 1, &buffer);
+    cmem_drv_close (context);
+
+    return success ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,118 @@
+/*
+ * main.c
+ *
+ *  Created on: 18 Oct 2026
+ *      Author: Mr_Halfword
+ *
+ * Runs one benchmark of the cmem driver and userspace library, selected by the first command line argument.
+ * The remaining command line arguments are passed to the selected benchmark.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "benchmarks.h"
+
+
+/* Defines one benchmark which can be selected */
+typedef struct
+{
+    /* The name used to select the benchmark on the command line */
+    const char *name;
+    /* Description of the benchmark for the usage message */
+    const char *description;
+    /* Runs the benchmark, returning the exit status for the program */
+    int (*main_function) (int argc, char *argv[]);
+} benchmark_definition_t;
+
+static const benchmark_definition_t benchmarks[] =
+{
+    {
+        .name = "ring",
+        .description = "Throughput of a cmem_ring between producer and consumer threads on different cores",
+        .main_function = ring_benchmark_main
+    },
+    {
+        .name = "access",
+        .description = "Rate at which a debugger can read a mapped buffer, using /proc/self/mem",
+        .main_function = access_benchmark_main
+    },
+    {
+        .name = "stress",
+        .description = "Concurrent random allocations and frees from multiple processes, with pool consistency check",
+        .main_function = stress_benchmark_main
+    },
+    {
+        .name = "alloc",
+        .description = "Latency of the region allocator compared to the granule bitmap allocator for small buffers",
+        .main_function = alloc_benchmark_main
+    },
+    {
+        .name = "copy",
+        .description = "Throughput of the cmem_copy routines compared to the C library",
+        .main_function = copy_benchmark_main
+    },
+    {
+        .name = "cache",
+        .description = "CPU cost of uncached mappings compared to write-back mappings with cache maintenance ioctls",
+        .main_function = cache_benchmark_main
+    },
+    {
+        .name = "recycle",
+        .description = "Latency of allocating and freeing buffers of a few lengths, with and without the cache of freed buffers",
+        .main_function = recycle_benchmark_main
+    },
+    {
+        .name = "pipeline",
+        .description = "End to end cost of allocating buffers, passing them through a ring to the loopback DMA engine, and consuming them",
+        .main_function = pipeline_benchmark_main
+    },
+    {
+        .name = "replay",
+        .description = "Replays an allocation trace captured from the driver through the region engine, comparing fit policies",
+        .main_function = replay_benchmark_main
+    },
+    {
+        .name = "colour",
+        .description = "Conflict misses walking slot 0 of many rings, with and without cache colouring of the allocations",
+        .main_function = colour_benchmark_main
+    }
+};
+
+#define NUM_BENCHMARKS (sizeof (benchmarks) / sizeof (benchmarks[0]))
+
+
+static void display_usage (const char *const program_name)
+{
+    printf ("Usage: %s <benchmark> [<benchmark options>]\n", program_name);
+    printf ("Where <benchmark> is one of:\n");
+    for (size_t benchmark_index = 0; benchmark_index < NUM_BENCHMARKS; benchmark_index++)
+    {
+        printf ("  %-10s %s\n", benchmarks[benchmark_index].name, benchmarks[benchmark_index].description);
+    }
+    printf ("Use -h after the benchmark name to get the options for the benchmark\n");
+}
+
+
+int main (int argc, char *argv[])
+{
+    if (argc < 2)
+    {
+        display_usage (argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    for (size_t benchmark_index = 0; benchmark_index < NUM_BENCHMARKS; benchmark_index++)
+    {
+        if (strcmp (argv[1], benchmarks[benchmark_index].name) == 0)
+        {
+            /* Pass the remaining arguments, with the benchmark name in place of the program name for getopt() */
+            return benchmarks[benchmark_index].main_function (argc - 1, &argv[1]);
+        }
+    }
+
+    fprintf (stderr, "Unknown benchmark %s\n", argv[1]);
+    display_usage (argv[0]);
+    return EXIT_FAILURE;
+}
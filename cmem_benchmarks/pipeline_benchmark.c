@@ -0,0 +1,400 @@
+/*
+ * pipeline_benchmark.c
+ *
+ *  Created on: 18 Oct 2026
+ *      Author: Mr_Halfword
+ *
+ * Measures the full path of a DMA pipeline, using the loopback engine in the driver as a stand-in for a DMA device:
+ * a. The producer allocates a source and destination buffer, writes the source and passes a copy descriptor
+ *    containing the physical addresses to the engine through a descriptor ring.
+ * b. The engine copies the source to the destination, at an optionally throttled rate and latency, and writes
+ *    a completion to a completion ring.
+ * c. The consumer thread waits for the completion, verifies the destination and frees the buffers.
+ *
+ * The latency of each message is measured from the start of the allocation to the buffers being freed.
+ * The cache of freed buffers may be enabled, to measure its effect on the allocation cost in the pipeline.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include "cmem_drv.h"
+#include "cmem_ring.h"
+#include "benchmarks.h"
+#include "benchmark_utils.h"
+
+
+/* The maximum number of completions dequeued by the consumer at once */
+#define COMPLETION_BATCH_SIZE 32
+
+
+/* A message which has been submitted to the engine and not yet consumed */
+typedef struct
+{
+    /* The source and destination buffers of the copy descriptor */
+    cmem_host_buf_desc_t buffers[2];
+    /* When the allocation of the buffers started */
+    int64_t start_ns;
+} pipeline_message_t;
+
+
+/* The options for the benchmark */
+static bool arg_dma_capability_a64 = true;
+static uint32_t arg_num_messages = 100000;
+static size_t arg_message_size = 64 * 1024;
+static uint32_t arg_depth = 64;
+static uint64_t arg_bytes_per_second = 0;
+static uint32_t arg_latency_ns = 0;
+static bool arg_verify = false;
+static bool arg_recycle = false;
+static bool arg_busy_poll = false;
+
+
+/* Shared between the producer and consumer */
+static cmem_drv_context_t *context;
+static cmem_ring_t descriptor_ring;
+static cmem_ring_t completion_ring;
+static pipeline_message_t *messages;
+static uint32_t num_consumed;
+static uint64_t num_verify_errors;
+static uint64_t num_status_errors;
+static latency_histogram_t message_latency;
+
+
+static void display_usage (const char *const program_name)
+{
+    printf ("Usage: %s [-a] [-n <messages>] [-s <size>] [-d <depth>] [-r <bytes_per_second>] [-l <latency_ns>] [-v] [-c] [-p]\n",
+            program_name);
+    printf ("  -a  Allocate the buffers with A32 physical addresses, rather than A64\n");
+    printf ("  -n  Number of messages passed through the pipeline\n");
+    printf ("  -s  Size of each message in bytes\n");
+    printf ("  -d  Maximum number of messages in the pipeline at once\n");
+    printf ("  -r  Throttle the loopback engine to this rate, default no limit\n");
+    printf ("  -l  Minimum time taken by the loopback engine for each message\n");
+    printf ("  -v  Write all of each source, and verify all of each destination\n");
+    printf ("  -c  Enable the cache of freed buffers\n");
+    printf ("  -p  The consumer busy-polls the completion ring, rather than waiting with poll()\n");
+}
+
+
+static uint64_t parse_uint_arg (const char *const program_name, const char *const arg,
+                                const uint64_t min_value, const uint64_t max_value)
+{
+    char *end;
+    const unsigned long long value = strtoull (arg, &end, 0);
+
+    if ((*end != '\0') || (value < min_value) || (value > max_value))
+    {
+        fprintf (stderr, "Invalid numeric argument %s\n", arg);
+        display_usage (program_name);
+        exit (EXIT_FAILURE);
+    }
+
+    return value;
+}
+
+
+static void parse_command_line_arguments (int argc, char *argv[])
+{
+    const char *const optstring = "an:s:d:r:l:vcph";
+    int option;
+
+    optind = 1;
+    while ((option = getopt (argc, argv, optstring)) != -1)
+    {
+        switch (option)
+        {
+        case 'a':
+            arg_dma_capability_a64 = false;
+            break;
+
+        case 'n':
+            arg_num_messages = (uint32_t) parse_uint_arg (argv[0], optarg, 1, UINT32_MAX);
+            break;
+
+        case 's':
+            arg_message_size = (size_t) parse_uint_arg (argv[0], optarg, sizeof (uint64_t), CMEM_LOOPBACK_MAX_LENGTH);
+            break;
+
+        case 'd':
+            arg_depth = (uint32_t) parse_uint_arg (argv[0], optarg, 1, 65536);
+            break;
+
+        case 'r':
+            arg_bytes_per_second = parse_uint_arg (argv[0], optarg, 0, UINT64_MAX);
+            break;
+
+        case 'l':
+            arg_latency_ns = (uint32_t) parse_uint_arg (argv[0], optarg, 0, UINT32_MAX);
+            break;
+
+        case 'v':
+            arg_verify = true;
+            break;
+
+        case 'c':
+            arg_recycle = true;
+            break;
+
+        case 'p':
+            arg_busy_poll = true;
+            break;
+
+        case 'h':
+        default:
+            display_usage (argv[0]);
+            exit (EXIT_FAILURE);
+        }
+    }
+}
+
+
+/**
+ * @brief Get the value of a word in the source of a message, so the consumer can detect stale or misplaced data
+ */
+static inline uint64_t message_word (const uint32_t message_index, const size_t word_index)
+{
+    return ((uint64_t) message_index << 32) | (uint32_t) word_index;
+}
+
+
+/**
+ * @brief Consumer thread, which verifies and frees each message once the loopback engine has completed it
+ */
+static void *consumer_thread (void *arg)
+{
+    cmem_loopback_completion_t completions[COMPLETION_BATCH_SIZE];
+
+    while (__atomic_load_n (&num_consumed, __ATOMIC_RELAXED) < arg_num_messages)
+    {
+        const uint32_t num_dequeued = cmem_ring_dequeue_burst (&completion_ring, completions, COMPLETION_BATCH_SIZE);
+
+        if (num_dequeued == 0)
+        {
+            if (!arg_busy_poll)
+            {
+                cmem_drv_loopback_wait (context, 100);
+            }
+            continue;
+        }
+
+        for (uint32_t completion_index = 0; completion_index < num_dequeued; completion_index++)
+        {
+            const cmem_loopback_completion_t *const completion = &completions[completion_index];
+            const uint32_t message_index = (uint32_t) completion->user_data;
+            pipeline_message_t *const message = &messages[message_index % arg_depth];
+            const uint64_t *const dest_words = (const uint64_t *) message->buffers[1].userAddr;
+
+            if (completion->status != 0)
+            {
+                num_status_errors++;
+            }
+            else if (arg_verify)
+            {
+                for (size_t word_index = 0; word_index < (arg_message_size / sizeof (uint64_t)); word_index++)
+                {
+                    if (dest_words[word_index] != message_word (message_index, word_index))
+                    {
+                        num_verify_errors++;
+                        break;
+                    }
+                }
+            }
+            else if (dest_words[0] != message_word (message_index, 0))
+            {
+                num_verify_errors++;
+            }
+
+            cmem_drv_free (context, 2, message->buffers);
+            latency_histogram_add (&message_latency, (uint64_t) (get_monotonic_time_ns () - message->start_ns));
+
+            /* Release the message slot to the producer */
+            __atomic_store_n (&num_consumed, num_consumed + 1, __ATOMIC_RELEASE);
+        }
+    }
+
+    return NULL;
+}
+
+
+/**
+ * @brief Producer, which allocates and writes each message and submits it to the loopback engine
+ * @return Returns true if all messages were submitted
+ */
+static bool produce_messages (void)
+{
+    cmem_loopback_descriptor_t descriptor;
+
+    memset (&descriptor, 0, sizeof (descriptor));
+    descriptor.opcode = CMEM_LOOPBACK_OP_COPY;
+    descriptor.length = arg_message_size;
+    for (uint32_t message_index = 0; message_index < arg_num_messages; message_index++)
+    {
+        pipeline_message_t *const message = &messages[message_index % arg_depth];
+        uint64_t *src_words;
+
+        /* Wait for the consumer to release the slot used by the message which was depth messages earlier */
+        while ((message_index - __atomic_load_n (&num_consumed, __ATOMIC_ACQUIRE)) >= arg_depth)
+        {
+            sched_yield ();
+        }
+
+        message->start_ns = get_monotonic_time_ns ();
+        if (cmem_drv_alloc (context, arg_dma_capability_a64, 2, arg_message_size, message->buffers) != 0)
+        {
+            fprintf (stderr, "Failed to allocate buffers for message %u\n", message_index);
+            return false;
+        }
+
+        src_words = (uint64_t *) message->buffers[0].userAddr;
+        if (arg_verify)
+        {
+            for (size_t word_index = 0; word_index < (arg_message_size / sizeof (uint64_t)); word_index++)
+            {
+                src_words[word_index] = message_word (message_index, word_index);
+            }
+        }
+        else
+        {
+            src_words[0] = message_word (message_index, 0);
+        }
+
+        descriptor.src_dma_address = message->buffers[0].physAddr;
+        descriptor.dest_dma_address = message->buffers[1].physAddr;
+        descriptor.user_data = message_index;
+        while (cmem_ring_enqueue_burst (&descriptor_ring, &descriptor, 1) == 0)
+        {
+            sched_yield ();
+        }
+        if (cmem_drv_loopback_doorbell (context) != 0)
+        {
+            perror ("Loopback doorbell failed");
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+/**
+ * @brief Round up to a power of two, of at least two since that is the minimum number of ring slots
+ */
+static uint32_t round_up_ring_slots (const uint32_t num_slots)
+{
+    uint32_t rounded = 2;
+
+    while (rounded < num_slots)
+    {
+        rounded <<= 1;
+    }
+
+    return rounded;
+}
+
+
+int pipeline_benchmark_main (int argc, char *argv[])
+{
+    cmem_ioctl_loopback_t loopback;
+    cmem_ioctl_loopback_stats_t stats;
+    cmem_drv_recycle_config_t recycle_config;
+    pthread_t consumer;
+    uint32_t num_ring_slots;
+    int64_t start_time_ns;
+    double duration_secs;
+    bool success;
+    int32_t rc;
+
+    parse_command_line_arguments (argc, argv);
+    num_ring_slots = round_up_ring_slots (arg_depth);
+
+    messages = calloc (arg_depth, sizeof (messages[0]));
+    if (messages == NULL)
+    {
+        perror ("Benchmark initialisation failed");
+        return EXIT_FAILURE;
+    }
+
+    rc = cmem_drv_open (&context);
+    if (rc != 0)
+    {
+        return EXIT_FAILURE;
+    }
+    if (arg_recycle)
+    {
+        memset (&recycle_config, 0, sizeof (recycle_config));
+        recycle_config.max_cached_bytes = 4 * (uint64_t) arg_depth * arg_message_size;
+        cmem_drv_recycle_configure (context, &recycle_config);
+    }
+
+    /* The ring sizes are set from the depth, so the rings never limit the number of messages in the pipeline */
+    if ((cmem_ring_create (&descriptor_ring, context, arg_dma_capability_a64, CMEM_RING_SPSC,
+            num_ring_slots, sizeof (cmem_loopback_descriptor_t)) != 0) ||
+        (cmem_ring_create (&completion_ring, context, arg_dma_capability_a64, CMEM_RING_SPSC,
+                num_ring_slots, sizeof (cmem_loopback_completion_t)) != 0))
+    {
+        fprintf (stderr, "cmem_ring_create failed\n");
+        return EXIT_FAILURE;
+    }
+
+    memset (&loopback, 0, sizeof (loopback));
+    loopback.descriptor_ring_dma_address = descriptor_ring.control_phys_addr;
+    loopback.completion_ring_dma_address = completion_ring.control_phys_addr;
+    loopback.num_descriptor_slots = descriptor_ring.num_slots;
+    loopback.num_completion_slots = completion_ring.num_slots;
+    loopback.bytes_per_second = arg_bytes_per_second;
+    loopback.descriptor_latency_ns = arg_latency_ns;
+    rc = cmem_drv_loopback_start (context, &loopback);
+    if (rc != 0)
+    {
+        fprintf (stderr, "Failed to start loopback engine : %s\n", strerror (rc));
+        return EXIT_FAILURE;
+    }
+
+    printf ("%u messages of %zu bytes with depth %u, rings of %u slots\n",
+            arg_num_messages, arg_message_size, arg_depth, num_ring_slots);
+    start_time_ns = get_monotonic_time_ns ();
+    rc = pthread_create (&consumer, NULL, consumer_thread, NULL);
+    if (rc != 0)
+    {
+        fprintf (stderr, "pthread_create failed\n");
+        return EXIT_FAILURE;
+    }
+    success = produce_messages ();
+    if (!success)
+    {
+        return EXIT_FAILURE;
+    }
+    pthread_join (consumer, NULL);
+    duration_secs = (double) (get_monotonic_time_ns () - start_time_ns) / 1E9;
+
+    cmem_drv_loopback_stop (context, &stats);
+    printf ("%u messages in %.3f secs = %.0f messages/sec %.2f MB/sec\n", arg_num_messages, duration_secs,
+            (double) arg_num_messages / duration_secs, ((double) arg_num_messages * arg_message_size / duration_secs) / 1E6);
+    latency_histogram_display ("Alloc to free latency", &message_latency);
+    printf ("Loopback engine: %lu descriptors %lu bytes %lu errors\n", stats.num_descriptors, stats.num_bytes, stats.num_errors);
+    if (arg_recycle)
+    {
+        cmem_drv_recycle_stats_t recycle_stats;
+
+        cmem_drv_recycle_get_stats (context, &recycle_stats);
+        printf ("Cache hits %lu misses %lu evicted %lu\n", recycle_stats.hits, recycle_stats.misses, recycle_stats.evicted);
+    }
+    if ((num_status_errors > 0) || (num_verify_errors > 0))
+    {
+        printf ("%lu completions with error status, %lu messages failed verification\n",
+                num_status_errors, num_verify_errors);
+        success = false;
+    }
+
+    cmem_ring_destroy (&completion_ring);
+    cmem_ring_destroy (&descriptor_ring);
+    cmem_drv_close (context);
+    free (messages);
+
+    return success ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,216 @@
+/*
+ * recycle_benchmark.c
+ *
+ *  Created on: 18 Oct 2026
+ *      Author: Mr_Halfword
+ *
+ * Measures the latency of cmem_drv_alloc() followed by cmem_drv_free() for buffers of a small number of lengths, as
+ * made by request-scoped workloads, first without and then with the cache of freed buffers enabled.
+ *
+ * Each cycle allocates a set of buffers with lengths chosen at random from the set of lengths, writes to each buffer
+ * and then frees the buffers. The hit and miss statistics of the cache are reported, to help tune the high-water marks.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <getopt.h>
+
+#include "cmem_drv.h"
+#include "benchmarks.h"
+#include "benchmark_utils.h"
+
+
+#define MAX_BUFFERS_PER_CYCLE 64
+
+
+/* The options for the benchmark */
+static bool arg_dma_capability_a64 = true;
+static uint32_t arg_num_lengths = 4;
+static size_t arg_length_step = 16 * 1024;
+static uint32_t arg_buffers_per_cycle = 4;
+static uint32_t arg_num_cycles = 100000;
+static uint64_t arg_max_cached_bytes = 16 * 1024 * 1024;
+static uint32_t arg_max_buffers_per_class = 8;
+static uint64_t arg_seed = 1;
+
+
+static void display_usage (const char *const program_name)
+{
+    printf ("Usage: %s [-a] [-n <lengths>] [-l <length_step>] [-b <buffers>] [-c <cycles>] [-m <max_cached_bytes>] [-p <max_per_class>] [-s <seed>]\n",
+            program_name);
+    printf ("  -a  Allocate the buffers with A32 physical addresses, rather than A64\n");
+    printf ("  -n  Number of different buffer lengths\n");
+    printf ("  -l  The buffer lengths are multiples of this\n");
+    printf ("  -b  Number of buffers allocated and freed in each cycle, maximum %u\n", MAX_BUFFERS_PER_CYCLE);
+    printf ("  -c  Number of cycles measured with and without the cache\n");
+    printf ("  -m  High-water mark for the total length of the buffers in the cache\n");
+    printf ("  -p  High-water mark for the number of buffers of each length in the cache\n");
+    printf ("  -s  Seed for the random number generator, to make a run repeatable\n");
+}
+
+
+static uint64_t parse_uint_arg (const char *const program_name, const char *const arg,
+                                const uint64_t min_value, const uint64_t max_value)
+{
+    char *end;
+    const unsigned long long value = strtoull (arg, &end, 0);
+
+    if ((*end != '\0') || (value < min_value) || (value > max_value))
+    {
+        fprintf (stderr, "Invalid numeric argument %s\n", arg);
+        display_usage (program_name);
+        exit (EXIT_FAILURE);
+    }
+
+    return value;
+}
+
+
+static void parse_command_line_arguments (int argc, char *argv[])
+{
+    const char *const optstring = "an:l:b:c:m:p:s:h";
+    int option;
+
+    optind = 1;
+    while ((option = getopt (argc, argv, optstring)) != -1)
+    {
+        switch (option)
+        {
+        case 'a':
+            arg_dma_capability_a64 = false;
+            break;
+
+        case 'n':
+            arg_num_lengths = (uint32_t) parse_uint_arg (argv[0], optarg, 1, UINT32_MAX);
+            break;
+
+        case 'l':
+            arg_length_step = (size_t) parse_uint_arg (argv[0], optarg, 1, SIZE_MAX);
+            break;
+
+        case 'b':
+            arg_buffers_per_cycle = (uint32_t) parse_uint_arg (argv[0], optarg, 1, MAX_BUFFERS_PER_CYCLE);
+            break;
+
+        case 'c':
+            arg_num_cycles = (uint32_t) parse_uint_arg (argv[0], optarg, 1, UINT32_MAX);
+            break;
+
+        case 'm':
+            arg_max_cached_bytes = parse_uint_arg (argv[0], optarg, 1, UINT64_MAX);
+            break;
+
+        case 'p':
+            arg_max_buffers_per_class = (uint32_t) parse_uint_arg (argv[0], optarg, 0, UINT32_MAX);
+            break;
+
+        case 's':
+            arg_seed = parse_uint_arg (argv[0], optarg, 0, UINT64_MAX);
+            break;
+
+        case 'h':
+        default:
+            display_usage (argv[0]);
+            exit (EXIT_FAILURE);
+        }
+    }
+}
+
+
+/**
+ * @brief Get the next value from a xorshift64* random number generator
+ * @param[in/out] state The state of the generator, which must be non-zero
+ * @return The next random value
+ */
+static uint64_t next_random (uint64_t *const state)
+{
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+
+    return *state * 0x2545F4914F6CDD1DULL;
+}
+
+
+/**
+ * @brief Perform the allocation and free cycles, recording the latency of each cycle
+ * @param[in] context The context used for the allocations, whose cache has been configured
+ * @param[in] description Describes the measurement for the report
+ * @return Returns true if all allocations and frees succeeded
+ */
+static bool measure_cycles (cmem_drv_context_t *const context, const char *const description)
+{
+    cmem_host_buf_desc_t buffers[MAX_BUFFERS_PER_CYCLE];
+    latency_histogram_t cycle_latency;
+    uint64_t random_state = (arg_seed * 0x9E3779B97F4A7C15ULL) ^ 0x5DEECE66DULL;
+    int64_t start_ns;
+    bool success = true;
+
+    memset (&cycle_latency, 0, sizeof (cycle_latency));
+    for (uint32_t cycle = 0; success && (cycle < arg_num_cycles); cycle++)
+    {
+        start_ns = get_monotonic_time_ns ();
+        for (uint32_t buffer_index = 0; success && (buffer_index < arg_buffers_per_cycle); buffer_index++)
+        {
+            const size_t length = (1 + (next_random (&random_state) % arg_num_lengths)) * arg_length_step;
+
+            success = cmem_drv_alloc (context, arg_dma_capability_a64, 1, length, &buffers[buffer_index]) == 0;
+            if (success)
+            {
+                buffers[buffer_index].userAddr[0] = (uint8_t) cycle;
+            }
+        }
+        success = success && (cmem_drv_free (context, arg_buffers_per_cycle, buffers) == 0);
+        latency_histogram_add (&cycle_latency, (uint64_t) (get_monotonic_time_ns () - start_ns));
+    }
+
+    if (success)
+    {
+        latency_histogram_display (description, &cycle_latency);
+    }
+    else
+    {
+        fprintf (stderr, "%s : allocation or free failed\n", description);
+    }
+
+    return success;
+}
+
+
+int recycle_benchmark_main (int argc, char *argv[])
+{
+    cmem_drv_context_t *context;
+    cmem_drv_recycle_config_t config;
+    cmem_drv_recycle_stats_t stats;
+    bool success;
+
+    parse_command_line_arguments (argc, argv);
+
+    if (cmem_drv_open (&context) != 0)
+    {
+        return EXIT_FAILURE;
+    }
+
+    printf ("%u cycles of %u buffers with %u lengths from %zu to %zu bytes\n", arg_num_cycles, arg_buffers_per_cycle,
+            arg_num_lengths, arg_length_step, arg_num_lengths * arg_length_step);
+    success = measure_cycles (context, "Cycle without cache");
+
+    memset (&config, 0, sizeof (config));
+    config.max_cached_bytes = arg_max_cached_bytes;
+    config.max_buffers_per_class = arg_max_buffers_per_class;
+    success = success && (cmem_drv_recycle_configure (context, &config) == 0) &&
+            measure_cycles (context, "Cycle with cache");
+
+    cmem_drv_recycle_get_stats (context, &stats);
+    printf ("Cache hits %lu misses %lu (%.1f%% hit rate) retained %lu rejected %lu evicted %lu\n",
+            stats.hits, stats.misses,
+            ((stats.hits + stats.misses) > 0) ? ((100.0 * (double) stats.hits) / (double) (stats.hits + stats.misses)) : 0.0,
+            stats.retained, stats.rejected, stats.evicted);
+    printf ("Cache holds %u buffers of %lu bytes in %u size classes\n",
+            stats.cached_buffers, stats.cached_bytes, stats.num_size_classes);
+
+    cmem_drv_close (context);
+
+    return success ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,799 @@
+/*
+ * replay_benchmark.c
+ *
+ *  Created on: 18 Oct 2026
+ *      Author: Mr_Halfword
+ *
+ * Replays an allocation trace captured from the cmem driver through the region engine compiled in user space, to
+ * compare the fit policies and pool sizes against a real workload without reloading the driver.
+ *
+ * The trace is read from the trace file in the cmem directory of debugfs, when the module was loaded with the
+ * trace_records parameter, e.g. "cat /sys/kernel/debug/cmem/trace > trace.bin". The pools are recreated from the
+ * pool records in the trace, unless overridden from the command line. Each allocation is made from the class of pools
+ * recorded in the trace, and pools given on the command line are all in CMEM_POOL_CLASS_DRAM.
+ *
+ * Each allocation is placed in the same way as cmem_allocate_region(), with allocations for 64-bit capable devices
+ * first attempted above the first 4 GiB. The a32_reserve module parameter isn't modelled. The chunks of a
+ * scatter-gather buffer are replayed as individual allocations of the lengths the driver chose. The cache_colours module
+ * parameter may be modelled with the -k option, to measure the space it leaves unused.
+ *
+ * Since the replay may place allocations differently to the driver, an allocation may fail in the replay which
+ * succeeded in the driver, or vice-versa. These are counted, so that a policy which avoids failures can be identified.
+ * An allocation which only succeeded in the replay is freed immediately, and the later free of an allocation which
+ * only failed in the replay is ignored.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <getopt.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+
+#include "cmem.h"
+#include "cmem_regions.h"
+#include "benchmarks.h"
+#include "benchmark_utils.h"
+
+
+/* The maximum number of pools which may be specified on the command line */
+#define MAX_POOLS CMEM_STATUS_MAX_POOLS
+
+/* The start of the addresses which cmem_allocate_region() first attempts to use for 64-bit capable devices */
+#define A64_MIN_START 0x100000000ULL
+
+
+/* Defines one pool specified on the command line */
+typedef struct
+{
+    /* The physical address of the start of the pool */
+    uint64_t start;
+    /* The size of the pool in bytes */
+    uint64_t size;
+} replay_pool_t;
+
+/* Names of the fit policies on the command line, indexed by cmem_fit_policy_t */
+static const char *const policy_names[CMEM_FIT_NUM_POLICIES] =
+{
+    [CMEM_FIT_BEST] = "best",
+    [CMEM_FIT_FIRST] = "first",
+    [CMEM_FIT_WORST] = "worst"
+};
+
+
+/* The options for the benchmark */
+static const char *arg_trace_pathname;
+static bool arg_policies[CMEM_FIT_NUM_POLICIES] = {true, true, true};
+static replay_pool_t arg_pools[MAX_POOLS];
+static uint32_t arg_num_pools;
+static uint32_t arg_cache_colours;
+
+
+/* Maps the address of an allocation made by the driver to the allocation made by the replay */
+typedef struct
+{
+    /* The physical address of the allocation made by the driver */
+    uint64_t original_address;
+    /* The physical address of the allocation made by the replay */
+    uint64_t start;
+    /* The length of the allocation */
+    uint64_t length;
+    /* The owner of the allocation */
+    pid_t owner;
+} replay_allocation_t;
+
+/* The state of replaying the trace with one policy */
+typedef struct
+{
+    /* The region engine the trace is replayed through */
+    cmem_allocation_regions_t allocator;
+    /* The live allocations, sorted by original_address */
+    replay_allocation_t *allocations;
+    uint32_t num_allocations;
+    uint32_t allocations_length;
+    /* The number of allocation attempts in the trace, and those which failed in the driver and in the replay */
+    uint64_t num_alloc_attempts;
+    uint64_t num_original_failures;
+    uint64_t num_replay_failures;
+    /* The number of allocations which failed only in the driver, or only in the replay */
+    uint64_t num_original_only_failures;
+    uint64_t num_replay_only_failures;
+    /* The number of resizes which failed in the driver and in the replay */
+    uint64_t num_original_resize_failures;
+    uint64_t num_replay_resize_failures;
+    /* The number of frees of an allocation unknown to the replay, due to only failing in the replay or lost records */
+    uint64_t num_unmatched_frees;
+    /* The number of records the driver lost when the trace was full */
+    uint64_t num_lost_records;
+    /* The number of records for buffers from the granule pools, which are skipped */
+    uint64_t num_granule_records;
+    /* The number of bytes currently allocated, and the peak */
+    uint64_t allocated_bytes;
+    uint64_t peak_allocated_bytes;
+    /* The largest number of regions in the allocator */
+    uint32_t max_regions;
+    /* The fragmentation of the free space after each allocation and free, which is 1 - largest free / total free */
+    double fragmentation_sum;
+    double max_fragmentation;
+    uint64_t num_fragmentation_samples;
+    /* The latency of the region engine for allocations and frees */
+    latency_histogram_t alloc_latency;
+    latency_histogram_t free_latency;
+} replay_state_t;
+
+
+static void display_usage (const char *const program_name)
+{
+    printf ("Usage: %s -f <trace_file> [-P <policy>[,<policy>...]] [-k <colours>] [-m <size>[@<start>]]...\n", program_name);
+    printf ("  -f  The allocation trace read from the trace file in the cmem directory of debugfs\n");
+    printf ("  -P  The fit policies to compare, from best, first and worst. Default is all\n");
+    printf ("  -k  Stagger the allocations across this many page colours, as the cache_colours module parameter\n");
+    printf ("  -m  Replace the pools from the trace with a pool of size bytes at a physical start address, which\n");
+    printf ("      defaults to following the previous pool. May be given up to %u times\n", MAX_POOLS);
+}
+
+
+static uint64_t parse_uint_arg (const char *const program_name, const char *const arg, char **const end)
+{
+    const unsigned long long value = strtoull (arg, end, 0);
+
+    if (*end == arg)
+    {
+        fprintf (stderr, "Invalid numeric argument %s\n", arg);
+        display_usage (program_name);
+        exit (EXIT_FAILURE);
+    }
+
+    return value;
+}
+
+
+/**
+ * @brief Parse the list of fit policies to compare
+ * @param[in] program_name Used for the usage message on error
+ * @param[in] arg The comma separated list of policy names
+ */
+static void parse_policies (const char *const program_name, const char *const arg)
+{
+    char *const policies = strdup (arg);
+    char *saveptr = NULL;
+    char *name;
+    cmem_fit_policy_t policy;
+
+    memset (arg_policies, 0, sizeof (arg_policies));
+    for (name = strtok_r (policies, ",", &saveptr); name != NULL; name = strtok_r (NULL, ",", &saveptr))
+    {
+        for (policy = 0; (policy < CMEM_FIT_NUM_POLICIES) && (strcmp (name, policy_names[policy]) != 0); policy++)
+        {
+        }
+        if (policy == CMEM_FIT_NUM_POLICIES)
+        {
+            fprintf (stderr, "Unknown fit policy %s\n", name);
+            display_usage (program_name);
+            exit (EXIT_FAILURE);
+        }
+        arg_policies[policy] = true;
+    }
+    free (policies);
+}
+
+
+/**
+ * @brief Parse a pool specified on the command line
+ * @param[in] program_name Used for the usage message on error
+ * @param[in] arg The pool as <size>[@<start>]
+ */
+static void parse_pool (const char *const program_name, const char *const arg)
+{
+    replay_pool_t *const pool = &arg_pools[arg_num_pools];
+    char *end;
+
+    if (arg_num_pools == MAX_POOLS)
+    {
+        fprintf (stderr, "Too many pools\n");
+        exit (EXIT_FAILURE);
+    }
+
+    pool->size = parse_uint_arg (program_name, arg, &end);
+    if (*end == '@')
+    {
+        pool->start = parse_uint_arg (program_name, end + 1, &end);
+    }
+    else
+    {
+        pool->start = (arg_num_pools > 0) ? (arg_pools[arg_num_pools - 1].start + arg_pools[arg_num_pools - 1].size) : 0;
+    }
+    if ((*end != '\0') || (pool->size == 0) || ((pool->start + pool->size - 1) < pool->start))
+    {
+        fprintf (stderr, "Invalid pool %s\n", arg);
+        display_usage (program_name);
+        exit (EXIT_FAILURE);
+    }
+    arg_num_pools++;
+}
+
+
+static void parse_command_line_arguments (int argc, char *argv[])
+{
+    const char *const optstring = "f:P:k:m:h";
+    char *end;
+    int option;
+
+    optind = 1;
+    while ((option = getopt (argc, argv, optstring)) != -1)
+    {
+        switch (option)
+        {
+        case 'f':
+            arg_trace_pathname = optarg;
+            break;
+
+        case 'P':
+            parse_policies (argv[0], optarg);
+            break;
+
+        case 'k':
+            arg_cache_colours = (uint32_t) parse_uint_arg (argv[0], optarg, &end);
+            if (*end != '\0')
+            {
+                fprintf (stderr, "Invalid numeric argument %s\n", optarg);
+                display_usage (argv[0]);
+                exit (EXIT_FAILURE);
+            }
+            break;
+
+        case 'm':
+            parse_pool (argv[0], optarg);
+            break;
+
+        case 'h':
+        default:
+            display_usage (argv[0]);
+            exit (EXIT_FAILURE);
+        }
+    }
+
+    if (arg_trace_pathname == NULL)
+    {
+        fprintf (stderr, "A trace file must be specified\n");
+        display_usage (argv[0]);
+        exit (EXIT_FAILURE);
+    }
+}
+
+
+/**
+ * @brief Read the allocation trace from a file
+ * @param[out] num_records The number of records read
+ * @return The records read, or NULL on error
+ */
+static cmem_trace_record_t *read_trace (size_t *const num_records)
+{
+    FILE *const trace_file = fopen (arg_trace_pathname, "rb");
+    cmem_trace_record_t *records = NULL;
+    size_t records_length = 0;
+    size_t num_read;
+
+    if (trace_file == NULL)
+    {
+        fprintf (stderr, "Unable to open %s : %s\n", arg_trace_pathname, strerror (errno));
+        return NULL;
+    }
+
+    *num_records = 0;
+    do
+    {
+        if (*num_records == records_length)
+        {
+            records_length = (records_length == 0) ? 65536 : (records_length * 2);
+            records = realloc (records, records_length * sizeof (cmem_trace_record_t));
+            if (records == NULL)
+            {
+                fprintf (stderr, "Unable to allocate %zu trace records\n", records_length);
+                fclose (trace_file);
+                return NULL;
+            }
+        }
+        num_read = fread (&records[*num_records], sizeof (cmem_trace_record_t), records_length - *num_records, trace_file);
+        *num_records += num_read;
+    } while (num_read > 0);
+    fclose (trace_file);
+
+    return records;
+}
+
+
+/**
+ * @brief Find the live allocation made from an allocation by the driver
+ * @param[in] state The replay state to search
+ * @param[in] original_address The physical address of the allocation made by the driver
+ * @return The index of the allocation, or where it would be inserted if not found
+ */
+static uint32_t find_allocation (const replay_state_t *const state, const uint64_t original_address)
+{
+    uint32_t low = 0;
+    uint32_t high = state->num_allocations;
+
+    while (low < high)
+    {
+        const uint32_t mid = low + ((high - low) / 2);
+
+        if (state->allocations[mid].original_address < original_address)
+        {
+            low = mid + 1;
+        }
+        else
+        {
+            high = mid;
+        }
+    }
+
+    return low;
+}
+
+
+/**
+ * @brief Record a live allocation made by the replay
+ * @param[in/out] state The replay state to record the allocation in
+ * @param[in] allocation The allocation to record
+ */
+static void insert_allocation (replay_state_t *const state, const replay_allocation_t *const allocation)
+{
+    const uint32_t index = find_allocation (state, allocation->original_address);
+
+    if (state->num_allocations == state->allocations_length)
+    {
+        state->allocations_length = (state->allocations_length == 0) ? 1024 : (state->allocations_length * 2);
+        state->allocations = realloc (state->allocations, state->allocations_length * sizeof (replay_allocation_t));
+        if (state->allocations == NULL)
+        {
+            fprintf (stderr, "Unable to allocate %u live allocations\n", state->allocations_length);
+            exit (EXIT_FAILURE);
+        }
+    }
+
+    memmove (&state->allocations[index + 1], &state->allocations[index],
+             (state->num_allocations - index) * sizeof (replay_allocation_t));
+    state->allocations[index] = *allocation;
+    state->num_allocations++;
+}
+
+
+/**
+ * @brief Ensure the region engine has enough unused region entries for the next record
+ * @details As in the driver, the regions[] array is grown before an operation rather than by the region engine, so
+ *          the time taken to grow the array isn't included in the latencies.
+ * @param[in/out] state The replay state to grow the regions of
+ */
+static void reserve_regions (replay_state_t *const state)
+{
+    const uint32_t headroom = 2 * CMEM_REGIONS_UPDATE_HEADROOM;
+    cmem_allocation_region_t *new_regions;
+    uint32_t new_length;
+
+    if (cmem_regions_headroom (&state->allocator) < headroom)
+    {
+        new_length = (state->allocator.regions_allocated_length == 0) ?
+                1024 : (state->allocator.regions_allocated_length * 2);
+        new_regions = malloc (new_length * sizeof (cmem_allocation_region_t));
+        if (new_regions == NULL)
+        {
+            fprintf (stderr, "Unable to allocate %u regions\n", new_length);
+            exit (EXIT_FAILURE);
+        }
+        free (cmem_replace_regions (&state->allocator, new_regions, new_length));
+    }
+}
+
+
+/**
+ * @brief Free a region in the region engine, recording the latency
+ * @param[in/out] state The replay state to free the region in
+ * @param[in] start The start address of the region
+ * @param[in] length The length of the region
+ */
+static void free_region (replay_state_t *const state, const uint64_t start, const uint64_t length)
+{
+    const cmem_allocation_region_t region_to_free =
+    {
+        .start = start,
+        .end = start + length - 1,
+        .allocated = false,
+        .allocation_pid = -1
+    };
+    int64_t start_ns;
+
+    start_ns = get_monotonic_time_ns ();
+    cmem_update_regions (&state->allocator, &region_to_free);
+    latency_histogram_add (&state->free_latency, (uint64_t) (get_monotonic_time_ns () - start_ns));
+    state->allocated_bytes -= length;
+}
+
+
+/**
+ * @brief Free a live allocation made by the replay
+ * @param[in/out] state The replay state to free the allocation in
+ * @param[in] index The index of the allocation in the live allocations
+ */
+static void free_allocation (replay_state_t *const state, const uint32_t index)
+{
+    free_region (state, state->allocations[index].start, state->allocations[index].length);
+    state->num_allocations--;
+    memmove (&state->allocations[index], &state->allocations[index + 1],
+             (state->num_allocations - index) * sizeof (replay_allocation_t));
+}
+
+
+/**
+ * @brief Replay an allocation, placing it in the same way as cmem_allocate_region()
+ * @param[in/out] state The replay state to allocate in
+ * @param[in] policy The fit policy to use
+ * @param[in] record The allocation record from the trace
+ */
+static void replay_alloc (replay_state_t *const state, const cmem_fit_policy_t policy,
+                          const cmem_trace_record_t *const record)
+{
+    const unsigned int cmd = ((record->flags & CMEM_TRACE_FLAG_A32) != 0) ?
+            CMEM_IOCTL_ALLOC_A32_HOST_BUFFERS : CMEM_IOCTL_ALLOC_A64_HOST_BUFFERS;
+    const uint64_t alignment = 1ULL << record->alignment_shift;
+    const bool original_failed = (record->flags & CMEM_TRACE_FLAG_FAILED) != 0;
+    cmem_allocation_region_t region =
+    {
+        .start = 0,
+        .end = 0,
+        .allocated = false,
+        .allocation_pid = -1
+    };
+    int64_t start_ns;
+
+    start_ns = get_monotonic_time_ns ();
+    if (cmd == CMEM_IOCTL_ALLOC_A64_HOST_BUFFERS)
+    {
+        cmem_attempt_allocation (cmd, &state->allocator, record->pool_class, A64_MIN_START, record->length, alignment,
+                policy, record->owner, &region);
+    }
+    if (!region.allocated)
+    {
+        cmem_attempt_allocation (cmd, &state->allocator, record->pool_class, 0, record->length, alignment, policy,
+                record->owner, &region);
+    }
+    if (region.allocated)
+    {
+        cmem_update_regions (&state->allocator, &region);
+    }
+    latency_histogram_add (&state->alloc_latency, (uint64_t) (get_monotonic_time_ns () - start_ns));
+
+    state->num_alloc_attempts++;
+    if (original_failed)
+    {
+        state->num_original_failures++;
+    }
+    if (!region.allocated)
+    {
+        state->num_replay_failures++;
+        if (!original_failed)
+        {
+            state->num_replay_only_failures++;
+        }
+        return;
+    }
+
+    state->allocated_bytes += record->length;
+    if (state->allocated_bytes > state->peak_allocated_bytes)
+    {
+        state->peak_allocated_bytes = state->allocated_bytes;
+    }
+
+    if (original_failed)
+    {
+        /* The driver has no allocation for the trace to free later */
+        state->num_original_only_failures++;
+        free_region (state, region.start, record->length);
+    }
+    else
+    {
+        const replay_allocation_t allocation =
+        {
+            .original_address = record->address,
+            .start = region.start,
+            .length = record->length,
+            .owner = record->owner
+        };
+
+        insert_allocation (state, &allocation);
+    }
+}
+
+
+/**
+ * @brief Replay a resize in the same way as cmem_resize_region(), which can only grow into a following free region
+ * @param[in/out] state The replay state to resize in
+ * @param[in] record The resize record from the trace
+ */
+static void replay_resize (replay_state_t *const state, const cmem_trace_record_t *const record)
+{
+    const uint32_t index = find_allocation (state, record->address);
+    replay_allocation_t *allocation;
+    uint64_t new_end;
+    uint32_t region_index;
+
+    if ((record->flags & CMEM_TRACE_FLAG_FAILED) != 0)
+    {
+        state->num_original_resize_failures++;
+    }
+    if ((index == state->num_allocations) || (state->allocations[index].original_address != record->address))
+    {
+        return;
+    }
+
+    allocation = &state->allocations[index];
+    new_end = allocation->start + record->length - 1;
+    region_index = cmem_find_region_index (&state->allocator, allocation->start);
+    if (record->length < allocation->length)
+    {
+        free_region (state, new_end + 1, allocation->length - record->length);
+        allocation->length = record->length;
+    }
+    else if (record->length > allocation->length)
+    {
+        const cmem_allocation_region_t *const next_region = ((region_index + 1) < state->allocator.num_regions) ?
+                &state->allocator.regions[region_index + 1] : NULL;
+
+        if ((next_region == NULL) || next_region->allocated ||
+            (next_region->start != (allocation->start + allocation->length)) || (next_region->end < new_end) ||
+            (next_region->pool_class != state->allocator.regions[region_index].pool_class) ||
+            (((record->flags & CMEM_TRACE_FLAG_A32) != 0) && (new_end >= A64_MIN_START)))
+        {
+            state->num_replay_resize_failures++;
+        }
+        else
+        {
+            const cmem_allocation_region_t extension_region =
+            {
+                .start = allocation->start + allocation->length,
+                .end = new_end,
+                .allocated = true,
+                .allocation_pid = allocation->owner
+            };
+
+            cmem_update_regions (&state->allocator, &extension_region);
+            state->allocator.regions[region_index].end = new_end;
+            cmem_remove_region (&state->allocator, region_index + 1);
+            state->allocated_bytes += record->length - allocation->length;
+            if (state->allocated_bytes > state->peak_allocated_bytes)
+            {
+                state->peak_allocated_bytes = state->allocated_bytes;
+            }
+            allocation->length = record->length;
+        }
+    }
+}
+
+
+/**
+ * @brief Sample the fragmentation of the free space in the replay
+ * @param[in/out] state The replay state to sample
+ */
+static void sample_fragmentation (replay_state_t *const state)
+{
+    uint64_t total_free = 0;
+    uint64_t largest_free = 0;
+    double fragmentation;
+
+    for (uint32_t region_index = 0; region_index < state->allocator.num_regions; region_index++)
+    {
+        const cmem_allocation_region_t *const region = &state->allocator.regions[region_index];
+
+        if (!region->allocated)
+        {
+            const uint64_t length = (region->end + 1) - region->start;
+
+            total_free += length;
+            if (length > largest_free)
+            {
+                largest_free = length;
+            }
+        }
+    }
+
+    fragmentation = (total_free > 0) ? (1.0 - ((double) largest_free / (double) total_free)) : 0.0;
+    state->fragmentation_sum += fragmentation;
+    if (fragmentation > state->max_fragmentation)
+    {
+        state->max_fragmentation = fragmentation;
+    }
+    state->num_fragmentation_samples++;
+    if (state->allocator.num_regions > state->max_regions)
+    {
+        state->max_regions = state->allocator.num_regions;
+    }
+}
+
+
+/**
+ * @brief Replay the trace through the region engine with one fit policy
+ * @param[in] policy The fit policy to use
+ * @param[in] records The trace to replay
+ * @param[in] num_records The number of records in the trace
+ * @param[out] state The results of the replay
+ */
+static void replay_trace (const cmem_fit_policy_t policy,
+                          const cmem_trace_record_t *const records, const size_t num_records,
+                          replay_state_t *const state)
+{
+    memset (state, 0, sizeof (*state));
+    state->allocator.num_colours = arg_cache_colours;
+    state->allocator.colour_size = (uint64_t) sysconf (_SC_PAGESIZE);
+
+    for (uint32_t pool_index = 0; pool_index < arg_num_pools; pool_index++)
+    {
+        const cmem_allocation_region_t pool_region =
+        {
+            .start = arg_pools[pool_index].start,
+            .end = arg_pools[pool_index].start + arg_pools[pool_index].size - 1,
+            .allocated = false,
+            .allocation_pid = -1
+        };
+
+        reserve_regions (state);
+        cmem_update_regions (&state->allocator, &pool_region);
+    }
+
+    for (size_t record_index = 0; record_index < num_records; record_index++)
+    {
+        const cmem_trace_record_t *const record = &records[record_index];
+        uint32_t index;
+
+        if ((record->flags & CMEM_TRACE_FLAG_GRANULE) != 0)
+        {
+            /* The granule pools aren't managed by the region engine */
+            state->num_granule_records++;
+            continue;
+        }
+
+        reserve_regions (state);
+        switch (record->event)
+        {
+        case CMEM_TRACE_EVENT_POOL:
+            if (arg_num_pools == 0)
+            {
+                const cmem_allocation_region_t pool_region =
+                {
+                    .start = record->address,
+                    .end = record->address + record->length - 1,
+                    .allocated = false,
+                    .pool_class = record->pool_class,
+                    .allocation_pid = -1
+                };
+
+                cmem_update_regions (&state->allocator, &pool_region);
+            }
+            break;
+
+        case CMEM_TRACE_EVENT_ALLOC:
+            replay_alloc (state, policy, record);
+            sample_fragmentation (state);
+            break;
+
+        case CMEM_TRACE_EVENT_FREE:
+            index = find_allocation (state, record->address);
+            if ((index < state->num_allocations) && (state->allocations[index].original_address == record->address))
+            {
+                free_allocation (state, index);
+                sample_fragmentation (state);
+            }
+            else
+            {
+                state->num_unmatched_frees++;
+            }
+            break;
+
+        case CMEM_TRACE_EVENT_RESIZE:
+            replay_resize (state, record);
+            sample_fragmentation (state);
+            break;
+
+        case CMEM_TRACE_EVENT_RELEASE:
+            /* Free any allocations of the owner which the driver freed without a record, due to lost records */
+            index = 0;
+            while (index < state->num_allocations)
+            {
+                if (state->allocations[index].owner == record->owner)
+                {
+                    free_allocation (state, index);
+                }
+                else
+                {
+                    index++;
+                }
+            }
+            break;
+
+        case CMEM_TRACE_EVENT_LOST:
+            state->num_lost_records += record->length;
+            break;
+        }
+    }
+
+    free (state->allocations);
+    free (state->allocator.regions);
+}
+
+
+/**
+ * @brief Display the results of replaying the trace with one fit policy
+ * @param[in] policy The fit policy used
+ * @param[in] state The results of the replay
+ */
+static void display_results (const cmem_fit_policy_t policy, const replay_state_t *const state)
+{
+    printf ("\nPolicy %s\n", policy_names[policy]);
+    printf ("  %lu allocations, %lu failed in the replay and %lu in the driver\n",
+            state->num_alloc_attempts, state->num_replay_failures, state->num_original_failures);
+    printf ("  %lu failed only in the replay, %lu failed only in the driver, %lu unmatched frees\n",
+            state->num_replay_only_failures, state->num_original_only_failures, state->num_unmatched_frees);
+    printf ("  %lu resizes failed in the replay and %lu in the driver\n",
+            state->num_replay_resize_failures, state->num_original_resize_failures);
+    printf ("  Peak allocated %lu bytes, maximum of %u regions\n",
+            state->peak_allocated_bytes, state->max_regions);
+    printf ("  Fragmentation average %.1f%% maximum %.1f%%\n",
+            (state->num_fragmentation_samples > 0) ?
+                    ((100.0 * state->fragmentation_sum) / (double) state->num_fragmentation_samples) : 0.0,
+            100.0 * state->max_fragmentation);
+    latency_histogram_display ("  Allocation", &state->alloc_latency);
+    latency_histogram_display ("  Free", &state->free_latency);
+}
+
+
+int replay_benchmark_main (int argc, char *argv[])
+{
+    cmem_trace_record_t *records;
+    size_t num_records;
+    replay_state_t state;
+    uint64_t num_lost_records = 0;
+    uint64_t num_granule_records = 0;
+
+    parse_command_line_arguments (argc, argv);
+
+    records = read_trace (&num_records);
+    if (records == NULL)
+    {
+        return EXIT_FAILURE;
+    }
+    if (num_records == 0)
+    {
+        fprintf (stderr, "%s contains no trace records\n", arg_trace_pathname);
+        free (records);
+        return EXIT_FAILURE;
+    }
+
+    printf ("Trace of %zu records spanning %.3f seconds\n", num_records,
+            (double) (records[num_records - 1].timestamp_ns - records[0].timestamp_ns) / 1E9);
+    for (cmem_fit_policy_t policy = 0; policy < CMEM_FIT_NUM_POLICIES; policy++)
+    {
+        if (arg_policies[policy])
+        {
+            replay_trace (policy, records, num_records, &state);
+            display_results (policy, &state);
+            num_lost_records = state.num_lost_records;
+            num_granule_records = state.num_granule_records;
+        }
+    }
+    if (num_granule_records > 0)
+    {
+        printf ("\nSkipped %lu records for buffers from the granule pools, which the region engine doesn't manage\n",
+                num_granule_records);
+    }
+    if (num_lost_records > 0)
+    {
+        printf ("\nThe driver lost %lu records since the trace was full, so the replay is approximate\n",
+                num_lost_records);
+    }
+
+    free (records);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,288 @@
+/*
+ * ring_benchmark.c
+ *
+ *  Created on: 18 Oct 2026
+ *      Author: Mr_Halfword
+ *
+ * Measures the throughput of a cmem_ring, with one or more producer threads and a consumer thread each pinned to a
+ * different core. Each message carries the producer number and a sequence number, which the consumer checks to
+ * verify that no messages are lost, duplicated or reordered.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <pthread.h>
+
+#include "cmem_drv.h"
+#include "cmem_ring.h"
+#include "benchmarks.h"
+#include "benchmark_utils.h"
+
+
+#define MAX_PRODUCERS 32
+
+/* The first bytes of each message, the remainder of the slot is padding */
+typedef struct
+{
+    uint32_t producer_index;
+    uint32_t sequence;
+} ring_message_t;
+
+
+/* The options for the benchmark */
+static bool arg_dma_capability_a64 = true;
+static uint32_t arg_num_producers = 1;
+static uint32_t arg_batch_size = 32;
+static uint32_t arg_num_slots = 1024;
+static uint32_t arg_slot_size = 64;
+static uint32_t arg_messages_per_producer = 10000000;
+static int arg_cpus[MAX_PRODUCERS + 1];
+static uint32_t arg_num_cpus;
+
+
+/* Shared between the benchmark threads */
+static cmem_ring_t ring;
+static pthread_barrier_t start_barrier;
+static int64_t start_time_ns;
+static int64_t end_time_ns;
+static uint64_t num_sequence_errors;
+
+
+static void display_usage (const char *const program_name)
+{
+    printf ("Usage: %s [-a] [-p <producers>] [-b <batch>] [-s <slots>] [-z <slot_size>] [-n <messages>] [-c <cpus>]\n",
+            program_name);
+    printf ("  -a  Allocate the ring with A32 physical addresses, rather than A64\n");
+    printf ("  -p  Number of producer threads. A value greater than one uses a MPSC rather than SPSC ring\n");
+    printf ("  -b  Maximum number of messages enqueued or dequeued in one call\n");
+    printf ("  -s  Number of slots in the ring, which must be a power of two\n");
+    printf ("  -z  Size of each slot in bytes\n");
+    printf ("  -n  Number of messages sent by each producer\n");
+    printf ("  -c  Comma separated list of CPUs. The first is for the consumer, the remainder for the producers\n");
+}
+
+
+static uint32_t parse_uint32_arg (const char *const program_name, const char *const arg, const uint32_t min_value)
+{
+    char *end;
+    const unsigned long value = strtoul (arg, &end, 0);
+
+    if ((*end != '\0') || (value < min_value) || (value > UINT32_MAX))
+    {
+        fprintf (stderr, "Invalid numeric argument %s\n", arg);
+        display_usage (program_name);
+        exit (EXIT_FAILURE);
+    }
+
+    return (uint32_t) value;
+}
+
+
+static void parse_command_line_arguments (int argc, char *argv[])
+{
+    const char *const optstring = "ap:b:s:z:n:c:h";
+    int option;
+
+    optind = 1;
+    while ((option = getopt (argc, argv, optstring)) != -1)
+    {
+        switch (option)
+        {
+        case 'a':
+            arg_dma_capability_a64 = false;
+            break;
+
+        case 'p':
+            arg_num_producers = parse_uint32_arg (argv[0], optarg, 1);
+            if (arg_num_producers > MAX_PRODUCERS)
+            {
+                fprintf (stderr, "A maximum of %u producers are supported\n", MAX_PRODUCERS);
+                exit (EXIT_FAILURE);
+            }
+            break;
+
+        case 'b':
+            arg_batch_size = parse_uint32_arg (argv[0], optarg, 1);
+            break;
+
+        case 's':
+            arg_num_slots = parse_uint32_arg (argv[0], optarg, 2);
+            break;
+
+        case 'z':
+            arg_slot_size = parse_uint32_arg (argv[0], optarg, sizeof (ring_message_t));
+            break;
+
+        case 'n':
+            arg_messages_per_producer = parse_uint32_arg (argv[0], optarg, 1);
+            break;
+
+        case 'c':
+            if (!parse_cpu_list (optarg, MAX_PRODUCERS + 1, arg_cpus, &arg_num_cpus))
+            {
+                fprintf (stderr, "Invalid CPU list %s\n", optarg);
+                exit (EXIT_FAILURE);
+            }
+            break;
+
+        case 'h':
+        default:
+            display_usage (argv[0]);
+            exit (EXIT_FAILURE);
+        }
+    }
+}
+
+
+/**
+ * @brief Producer thread, which sends a fixed number of messages as batches
+ * @param[in] arg The producer index
+ */
+static void *producer_thread (void *arg)
+{
+    const uint32_t producer_index = (uint32_t) (uintptr_t) arg;
+    uint8_t *const entries = calloc (arg_batch_size, arg_slot_size);
+    uint32_t sequence = 0;
+
+    pthread_barrier_wait (&start_barrier);
+    while (sequence < arg_messages_per_producer)
+    {
+        const uint32_t remaining = arg_messages_per_producer - sequence;
+        const uint32_t batch_size = (remaining < arg_batch_size) ? remaining : arg_batch_size;
+        uint32_t num_enqueued = 0;
+
+        for (uint32_t entry_index = 0; entry_index < batch_size; entry_index++)
+        {
+            ring_message_t *const message = (ring_message_t *) &entries[entry_index * arg_slot_size];
+
+            message->producer_index = producer_index;
+            message->sequence = sequence + entry_index;
+        }
+
+        while (num_enqueued < batch_size)
+        {
+            num_enqueued += cmem_ring_enqueue_burst (&ring, &entries[num_enqueued * arg_slot_size], batch_size - num_enqueued);
+        }
+        sequence += batch_size;
+    }
+
+    free (entries);
+    return NULL;
+}
+
+
+/**
+ * @brief Consumer thread, which receives all the messages from all the producers checking the sequence numbers
+ */
+static void *consumer_thread (void *arg)
+{
+    const uint64_t total_messages = (uint64_t) arg_num_producers * arg_messages_per_producer;
+    uint8_t *const entries = calloc (arg_batch_size, arg_slot_size);
+    uint32_t expected_sequences[MAX_PRODUCERS] = {0};
+    uint64_t num_received = 0;
+
+    pthread_barrier_wait (&start_barrier);
+    start_time_ns = get_monotonic_time_ns ();
+    while (num_received < total_messages)
+    {
+        const uint32_t num_dequeued = cmem_ring_dequeue_burst (&ring, entries, arg_batch_size);
+
+        for (uint32_t entry_index = 0; entry_index < num_dequeued; entry_index++)
+        {
+            const ring_message_t *const message = (const ring_message_t *) &entries[entry_index * arg_slot_size];
+
+            if ((message->producer_index >= arg_num_producers) ||
+                (message->sequence != expected_sequences[message->producer_index]))
+            {
+                num_sequence_errors++;
+            }
+            else
+            {
+                expected_sequences[message->producer_index]++;
+            }
+        }
+        num_received += num_dequeued;
+    }
+    end_time_ns = get_monotonic_time_ns ();
+
+    free (entries);
+    return NULL;
+}
+
+
+int ring_benchmark_main (int argc, char *argv[])
+{
+    pthread_t consumer;
+    pthread_t producers[MAX_PRODUCERS];
+    pthread_attr_t attr;
+    cmem_drv_context_t *context;
+    int32_t rc;
+
+    parse_command_line_arguments (argc, argv);
+
+    rc = cmem_drv_open (&context);
+    if (rc != 0)
+    {
+        return EXIT_FAILURE;
+    }
+
+    rc = cmem_ring_create (&ring, context, arg_dma_capability_a64, (arg_num_producers > 1) ? CMEM_RING_MPSC : CMEM_RING_SPSC,
+            arg_num_slots, arg_slot_size);
+    if (rc != 0)
+    {
+        fprintf (stderr, "cmem_ring_create failed\n");
+        return EXIT_FAILURE;
+    }
+    printf ("Ring of %u slots of %u bytes : control at virtual %p physical 0x%lx, slots at physical 0x%lx\n",
+            ring.num_slots, ring.slot_size, (void *) ring.control, ring.control_phys_addr, ring.slots_phys_addr);
+
+    /* Create the consumer and producer threads, which start at the same time once all are created */
+    pthread_barrier_init (&start_barrier, NULL, arg_num_producers + 1);
+    pthread_attr_init (&attr);
+    set_thread_attr_cpu (&attr, (arg_num_cpus > 0) ? arg_cpus[0] : -1);
+    rc = pthread_create (&consumer, &attr, consumer_thread, NULL);
+    if (rc != 0)
+    {
+        fprintf (stderr, "pthread_create failed\n");
+        return EXIT_FAILURE;
+    }
+    for (uint32_t producer_index = 0; producer_index < arg_num_producers; producer_index++)
+    {
+        pthread_attr_destroy (&attr);
+        pthread_attr_init (&attr);
+        set_thread_attr_cpu (&attr, ((producer_index + 1) < arg_num_cpus) ? arg_cpus[producer_index + 1] : -1);
+        rc = pthread_create (&producers[producer_index], &attr, producer_thread, (void *) (uintptr_t) producer_index);
+        if (rc != 0)
+        {
+            fprintf (stderr, "pthread_create failed\n");
+            return EXIT_FAILURE;
+        }
+    }
+    pthread_attr_destroy (&attr);
+
+    for (uint32_t producer_index = 0; producer_index < arg_num_producers; producer_index++)
+    {
+        pthread_join (producers[producer_index], NULL);
+    }
+    pthread_join (consumer, NULL);
+
+    const uint64_t total_messages = (uint64_t) arg_num_producers * arg_messages_per_producer;
+    const double duration_secs = (double) (end_time_ns - start_time_ns) / 1E9;
+    printf ("%s with %u producer(s) batch size %u : %lu messages in %.3f secs = %.2f Mmessages/sec %.2f MB/sec\n",
+            (ring.mode == CMEM_RING_MPSC) ? "MPSC" : "SPSC", arg_num_producers, arg_batch_size,
+            total_messages, duration_secs, ((double) total_messages / duration_secs) / 1E6,
+            ((double) (total_messages * arg_slot_size) / duration_secs) / 1E6);
+    if (num_sequence_errors > 0)
+    {
+        printf ("%lu message sequence errors\n", num_sequence_errors);
+    }
+
+    pthread_barrier_destroy (&start_barrier);
+    cmem_ring_destroy (&ring);
+    cmem_drv_close (context);
+
+    return (num_sequence_errors == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,618 @@
+/*
+ * stress_benchmark.c
+ *
+ *  Created on: 18 Oct 2026
+ *      Author: Mr_Halfword
+ *
+ * Concurrency stress test of the cmem driver, used to qualify a driver build.
+ *
+ * Forks a number of worker processes, each of which runs a number of threads. Each thread performs randomised cycles
+ * of allocating buffers of random size, writing a pattern, and later verifying the pattern and freeing the buffer.
+ * Optionally worker processes are killed at random and replaced, to exercise cmem_release() freeing the allocations
+ * of a process which died, possibly part way through an allocation. When the run finishes each worker process
+ * leaves some of its buffers allocated when it exits, for cmem_release() to free.
+ *
+ * By default the threads of a worker process share one cmem_drv context. Optionally each thread opens its own context,
+ * which exercises the driver only freeing the allocations of a process once all its contexts have been closed.
+ *
+ * Reports the operation throughput and latency percentiles. Pool consistency is checked by finding the free space
+ * before and after the run, by repeatedly allocating the largest possible buffer until no more can be allocated.
+ * Since all worker processes have exited at the end of the run, the free space should be the same as at the start.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <signal.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include "cmem_drv.h"
+#include "benchmarks.h"
+#include "benchmark_utils.h"
+
+
+#define MAX_PROCESSES 64
+#define MAX_THREADS_PER_PROCESS 16
+#define MAX_BUFFERS_PER_THREAD 64
+
+/* Maximum number of buffers allocated by find_pool_free_space() */
+#define MAX_PROBE_BUFFERS 1024
+
+#define PAGE_SIZE_BYTES 4096
+
+
+/* The results for one worker thread, placed in memory shared with the parent process.
+ * Accumulates across replacements of a killed worker process. */
+typedef struct
+{
+    /* Number of successful allocations */
+    uint64_t num_allocs;
+    /* Number of allocations which failed, e.g. due to the pools being exhausted */
+    uint64_t num_alloc_failures;
+    /* Number of successful frees */
+    uint64_t num_frees;
+    /* Number of frees which failed, which is an error */
+    uint64_t num_free_failures;
+    /* Number of buffers in which the pattern read back didn't match that written, which is an error */
+    uint64_t num_verify_failures;
+    /* Latency of cmem_drv_alloc(), which includes the allocation ioctl and mmap */
+    latency_histogram_t alloc_latency;
+    /* Latency of cmem_drv_free(), which includes munmap and the free ioctl */
+    latency_histogram_t free_latency;
+} worker_thread_results_t;
+
+/* The memory shared between the parent and worker processes */
+typedef struct
+{
+    /* Set by the parent to tell the workers to stop */
+    volatile bool stop;
+    /* The results for each worker thread, indexed by [process][thread] */
+    worker_thread_results_t results[MAX_PROCESSES][MAX_THREADS_PER_PROCESS];
+} shared_state_t;
+
+/* The context for one worker thread */
+typedef struct
+{
+    /* Identifies the worker thread */
+    uint32_t process_index;
+    uint32_t thread_index;
+    /* The state of the random number generator for the thread */
+    uint64_t random_state;
+    /* Where to store the results */
+    worker_thread_results_t *results;
+    /* The cmem_drv context used by the thread, which may be shared with other threads of the process */
+    cmem_drv_context_t *drv_context;
+    /* The buffers currently allocated by the thread */
+    cmem_host_buf_desc_t buffers[MAX_BUFFERS_PER_THREAD];
+    /* Seed for the pattern in each allocated buffer */
+    uint32_t pattern_seeds[MAX_BUFFERS_PER_THREAD];
+    uint32_t num_buffers;
+} worker_thread_context_t;
+
+/* Result of measuring the free space in the pools */
+typedef struct
+{
+    /* Total number of bytes which could be allocated */
+    uint64_t free_bytes;
+    /* The largest buffer which could be allocated */
+    uint64_t largest_free;
+    /* The number of buffers allocated to consume all free space */
+    uint32_t num_free_regions;
+} pool_free_space_t;
+
+
+/* The options for the benchmark */
+static uint32_t arg_num_processes = 4;
+static uint32_t arg_threads_per_process = 1;
+static uint32_t arg_duration_secs = 10;
+static size_t arg_max_buffer_size = 1024 * 1024;
+static uint32_t arg_max_buffers_per_thread = 16;
+static uint32_t arg_kill_interval_ms = 0;
+static uint64_t arg_seed = 1;
+static bool arg_context_per_thread = false;
+
+
+static shared_state_t *shared;
+
+/* Buffer sizes are rounded up to a multiple of this, so that every buffer starts on a page boundary and can be mapped */
+static size_t page_size;
+
+
+static void display_usage (const char *const program_name)
+{
+    printf ("Usage: %s [-p <processes>] [-t <threads>] [-d <secs>] [-m <max_size>] [-b <max_buffers>] [-k <ms>] [-s <seed>] [-c]\n",
+            program_name);
+    printf ("  -p  Number of worker processes, maximum %u\n", MAX_PROCESSES);
+    printf ("  -t  Number of threads in each worker process, maximum %u\n", MAX_THREADS_PER_PROCESS);
+    printf ("  -d  Duration of the run in seconds\n");
+    printf ("  -m  Maximum size of each buffer in bytes. Buffer sizes are random between one byte and this,\n");
+    printf ("      rounded up to a multiple of the page size\n");
+    printf ("  -b  Maximum number of buffers allocated at once by each thread, maximum %u\n", MAX_BUFFERS_PER_THREAD);
+    printf ("  -k  Interval in milliseconds at which a random worker process is killed and replaced. Zero disables\n");
+    printf ("  -s  Seed for the random number generators, to make a run repeatable\n");
+    printf ("  -c  Each thread opens its own cmem_drv context, rather than sharing one context per process\n");
+}
+
+
+static uint64_t parse_uint_arg (const char *const program_name, const char *const arg,
+                                const uint64_t min_value, const uint64_t max_value)
+{
+    char *end;
+    const unsigned long long value = strtoull (arg, &end, 0);
+
+    if ((*end != '\0') || (value < min_value) || (value > max_value))
+    {
+        fprintf (stderr, "Invalid numeric argument %s\n", arg);
+        display_usage (program_name);
+        exit (EXIT_FAILURE);
+    }
+
+    return value;
+}
+
+
+static void parse_command_line_arguments (int argc, char *argv[])
+{
+    const char *const optstring = "p:t:d:m:b:k:s:ch";
+    int option;
+
+    optind = 1;
+    while ((option = getopt (argc, argv, optstring)) != -1)
+    {
+        switch (option)
+        {
+        case 'p':
+            arg_num_processes = (uint32_t) parse_uint_arg (argv[0], optarg, 1, MAX_PROCESSES);
+            break;
+
+        case 't':
+            arg_threads_per_process = (uint32_t) parse_uint_arg (argv[0], optarg, 1, MAX_THREADS_PER_PROCESS);
+            break;
+
+        case 'd':
+            arg_duration_secs = (uint32_t) parse_uint_arg (argv[0], optarg, 1, UINT32_MAX);
+            break;
+
+        case 'm':
+            arg_max_buffer_size = (size_t) parse_uint_arg (argv[0], optarg, 1, SIZE_MAX);
+            break;
+
+        case 'b':
+            arg_max_buffers_per_thread = (uint32_t) parse_uint_arg (argv[0], optarg, 1, MAX_BUFFERS_PER_THREAD);
+            break;
+
+        case 'k':
+            arg_kill_interval_ms = (uint32_t) parse_uint_arg (argv[0], optarg, 0, UINT32_MAX);
+            break;
+
+        case 's':
+            arg_seed = parse_uint_arg (argv[0], optarg, 0, UINT64_MAX);
+            break;
+
+        case 'c':
+            arg_context_per_thread = true;
+            break;
+
+        case 'h':
+        default:
+            display_usage (argv[0]);
+            exit (EXIT_FAILURE);
+        }
+    }
+}
+
+
+/**
+ * @brief Get the next value from a xorshift64* random number generator
+ * @param[in/out] state The state of the generator, which must be non-zero
+ * @return The next random value
+ */
+static uint64_t next_random (uint64_t *const state)
+{
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 0x2545F4914F6CDD1DULL;
+}
+
+
+/**
+ * @brief Write or verify the pattern in a buffer, which is a sequence derived from a seed
+ * @param[in/out] buffer The buffer to write or verify
+ * @param[in] seed The seed for the pattern
+ * @param[in] write When true writes the pattern, when false verifies the pattern
+ * @return Returns true if the pattern was written, or verified as matching
+ */
+static bool buffer_pattern (const cmem_host_buf_desc_t *const buffer, const uint32_t seed, const bool write)
+{
+    uint32_t *const words = (uint32_t *) buffer->userAddr;
+    const size_t num_words = buffer->length / sizeof (uint32_t);
+    uint32_t value = seed;
+
+    for (size_t word_index = 0; word_index < num_words; word_index++)
+    {
+        if (write)
+        {
+            words[word_index] = value;
+        }
+        else if (words[word_index] != value)
+        {
+            return false;
+        }
+        value = (value * 1664525u) + 1013904223u;
+    }
+
+    return true;
+}
+
+
+/**
+ * @brief Verify and free one buffer allocated by a worker thread
+ * @param[in/out] context The worker thread
+ * @param[in] buffer_index Which buffer to free, which is replaced by the last buffer
+ */
+static void worker_free_buffer (worker_thread_context_t *const context, const uint32_t buffer_index)
+{
+    int64_t start_ns;
+    int32_t rc;
+
+    if (!buffer_pattern (&context->buffers[buffer_index], context->pattern_seeds[buffer_index], false))
+    {
+        context->results->num_verify_failures++;
+    }
+
+    start_ns = get_monotonic_time_ns ();
+    rc = cmem_drv_free (context->drv_context, 1, &context->buffers[buffer_index]);
+    latency_histogram_add (&context->results->free_latency, (uint64_t) (get_monotonic_time_ns () - start_ns));
+    if (rc == 0)
+    {
+        context->results->num_frees++;
+    }
+    else
+    {
+        context->results->num_free_failures++;
+    }
+
+    context->num_buffers--;
+    context->buffers[buffer_index] = context->buffers[context->num_buffers];
+    context->pattern_seeds[buffer_index] = context->pattern_seeds[context->num_buffers];
+}
+
+
+/**
+ * @brief Worker thread, which performs random allocations and frees until told to stop
+ */
+static void *worker_thread (void *arg)
+{
+    worker_thread_context_t *const context = arg;
+
+    while (!shared->stop)
+    {
+        const uint64_t random = next_random (&context->random_state);
+        const bool do_free = (context->num_buffers == arg_max_buffers_per_thread) ||
+                ((context->num_buffers > 0) && ((random & 1) != 0));
+
+        if (do_free)
+        {
+            worker_free_buffer (context, (uint32_t) ((random >> 1) % context->num_buffers));
+        }
+        else
+        {
+            cmem_host_buf_desc_t *const buffer = &context->buffers[context->num_buffers];
+            const size_t random_size = 1 + (size_t) ((random >> 8) % arg_max_buffer_size);
+            const size_t size = ((random_size + page_size - 1) / page_size) * page_size;
+            const bool dma_capability_a64 = ((random >> 1) & 3) != 0;
+            const int64_t start_ns = get_monotonic_time_ns ();
+            const int32_t rc = cmem_drv_alloc (context->drv_context, dma_capability_a64, 1, size, buffer);
+
+            latency_histogram_add (&context->results->alloc_latency, (uint64_t) (get_monotonic_time_ns () - start_ns));
+            if (rc == 0)
+            {
+                context->results->num_allocs++;
+                context->pattern_seeds[context->num_buffers] = (uint32_t) (random >> 32);
+                buffer_pattern (buffer, context->pattern_seeds[context->num_buffers], true);
+                context->num_buffers++;
+            }
+            else
+            {
+                context->results->num_alloc_failures++;
+            }
+        }
+    }
+
+    /* Free about half of the remaining buffers, leaving the remainder for cmem_release() to free on exit */
+    for (uint32_t buffer_index = 0; buffer_index < context->num_buffers; buffer_index++)
+    {
+        if ((next_random (&context->random_state) & 1) != 0)
+        {
+            worker_free_buffer (context, buffer_index);
+        }
+    }
+
+    return NULL;
+}
+
+
+/**
+ * @brief The main function for a worker process, which runs the worker threads until told to stop
+ * @param[in] process_index Which worker process
+ * @param[in] generation Incremented each time the worker process is replaced, to change the random sequence
+ */
+static void worker_process (const uint32_t process_index, const uint32_t generation)
+{
+    worker_thread_context_t contexts[MAX_THREADS_PER_PROCESS];
+    pthread_t threads[MAX_THREADS_PER_PROCESS];
+    cmem_drv_context_t *process_drv_context = NULL;
+
+    /* Each worker process opens the device, so that cmem_release() is called when the process exits */
+    if (!arg_context_per_thread && (cmem_drv_open (&process_drv_context) != 0))
+    {
+        _exit (EXIT_FAILURE);
+    }
+
+    for (uint32_t thread_index = 0; thread_index < arg_threads_per_process; thread_index++)
+    {
+        worker_thread_context_t *const context = &contexts[thread_index];
+
+        memset (context, 0, sizeof (*context));
+        context->process_index = process_index;
+        context->thread_index = thread_index;
+        context->random_state = (arg_seed * 0x9E3779B97F4A7C15ULL) ^
+                (((uint64_t) process_index << 40) | ((uint64_t) thread_index << 32) | generation) ^ 0x5DEECE66DULL;
+        context->results = &shared->results[process_index][thread_index];
+        context->drv_context = process_drv_context;
+        if (arg_context_per_thread && (cmem_drv_open (&context->drv_context) != 0))
+        {
+            _exit (EXIT_FAILURE);
+        }
+        if (pthread_create (&threads[thread_index], NULL, worker_thread, context) != 0)
+        {
+            _exit (EXIT_FAILURE);
+        }
+    }
+
+    for (uint32_t thread_index = 0; thread_index < arg_threads_per_process; thread_index++)
+    {
+        pthread_join (threads[thread_index], NULL);
+    }
+
+    _exit (EXIT_SUCCESS);
+}
+
+
+/**
+ * @brief Start a worker process
+ * @param[in] process_index Which worker process
+ * @param[in] generation Incremented each time the worker process is replaced
+ * @return The pid of the worker process
+ */
+static pid_t start_worker_process (const uint32_t process_index, const uint32_t generation)
+{
+    const pid_t pid = fork ();
+
+    if (pid == 0)
+    {
+        worker_process (process_index, generation);
+    }
+    else if (pid < 0)
+    {
+        perror ("fork failed");
+        exit (EXIT_FAILURE);
+    }
+
+    return pid;
+}
+
+
+/**
+ * @brief Find the free space in the pools, by allocating the largest possible buffer until no more can be allocated
+ * @details The largest buffer is found by a binary search of the allocation size. All buffers are then freed.
+ * @param[out] free_space The free space found
+ * @return Returns true if the free space was found, or false if an error occurred
+ */
+static bool find_pool_free_space (pool_free_space_t *const free_space)
+{
+    static cmem_host_buf_desc_t buffers[MAX_PROBE_BUFFERS];
+    uint32_t num_buffers = 0;
+    bool success = true;
+    bool more_space = true;
+    cmem_drv_context_t *context;
+
+    memset (free_space, 0, sizeof (*free_space));
+    if (cmem_drv_open (&context) != 0)
+    {
+        return false;
+    }
+
+    while (success && more_space)
+    {
+        /* Binary search for the largest number of pages which can be allocated */
+        uint64_t min_pages = 0;
+        uint64_t max_pages = 1ULL << 40;
+
+        while (max_pages > min_pages)
+        {
+            const uint64_t try_pages = min_pages + ((max_pages - min_pages + 1) / 2);
+            cmem_host_buf_desc_t buffer;
+
+            if (cmem_drv_alloc (context, true, 1, try_pages * PAGE_SIZE_BYTES, &buffer) == 0)
+            {
+                cmem_drv_free (context, 1, &buffer);
+                min_pages = try_pages;
+            }
+            else
+            {
+                max_pages = try_pages - 1;
+            }
+        }
+
+        if (min_pages == 0)
+        {
+            more_space = false;
+        }
+        else if (num_buffers == MAX_PROBE_BUFFERS)
+        {
+            fprintf (stderr, "Pools are too fragmented to measure the free space\n");
+            success = false;
+        }
+        else if (cmem_drv_alloc (context, true, 1, min_pages * PAGE_SIZE_BYTES, &buffers[num_buffers]) != 0)
+        {
+            fprintf (stderr, "Failed to allocate buffer of size found by search\n");
+            success = false;
+        }
+        else
+        {
+            if (num_buffers == 0)
+            {
+                free_space->largest_free = min_pages * PAGE_SIZE_BYTES;
+            }
+            free_space->free_bytes += min_pages * PAGE_SIZE_BYTES;
+            num_buffers++;
+        }
+    }
+    free_space->num_free_regions = num_buffers;
+
+    if (num_buffers > 0)
+    {
+        cmem_drv_free (context, num_buffers, buffers);
+    }
+    cmem_drv_close (context);
+
+    return success;
+}
+
+
+int stress_benchmark_main (int argc, char *argv[])
+{
+    pid_t worker_pids[MAX_PROCESSES];
+    uint32_t worker_generations[MAX_PROCESSES] = {0};
+    worker_thread_results_t total;
+    pool_free_space_t initial_free_space;
+    pool_free_space_t final_free_space;
+    uint64_t random_state;
+    uint64_t num_kills = 0;
+    uint64_t num_worker_failures = 0;
+    int64_t start_time_ns;
+    int64_t end_time_ns;
+    double duration_secs;
+    bool pools_consistent;
+    bool success;
+
+    parse_command_line_arguments (argc, argv);
+    page_size = (size_t) sysconf (_SC_PAGESIZE);
+    random_state = arg_seed ^ 0xD1B54A32D192ED03ULL;
+    if (random_state == 0)
+    {
+        random_state = 1;
+    }
+
+    /* The device isn't held open by this process while the workers run, since the workers would inherit the file
+     * which would prevent cmem_release() being called when a worker process exits */
+    if (!find_pool_free_space (&initial_free_space))
+    {
+        return EXIT_FAILURE;
+    }
+    printf ("Initial free space %lu bytes in %u regions, largest %lu bytes\n",
+            initial_free_space.free_bytes, initial_free_space.num_free_regions, initial_free_space.largest_free);
+
+    shared = mmap (NULL, sizeof (*shared), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (shared == MAP_FAILED)
+    {
+        perror ("mmap of shared state failed");
+        return EXIT_FAILURE;
+    }
+
+    printf ("Running %u processes with %u threads each for %u secs, max buffer size %zu, kill interval %u ms\n",
+            arg_num_processes, arg_threads_per_process, arg_duration_secs, arg_max_buffer_size, arg_kill_interval_ms);
+    fflush (stdout);
+    start_time_ns = get_monotonic_time_ns ();
+    for (uint32_t process_index = 0; process_index < arg_num_processes; process_index++)
+    {
+        worker_pids[process_index] = start_worker_process (process_index, 0);
+    }
+
+    /* Kill and replace random workers until the end of the run */
+    end_time_ns = start_time_ns + ((int64_t) arg_duration_secs * 1000000000LL);
+    while (get_monotonic_time_ns () < end_time_ns)
+    {
+        if (arg_kill_interval_ms > 0)
+        {
+            const uint32_t process_index = (uint32_t) (next_random (&random_state) % arg_num_processes);
+
+            usleep (arg_kill_interval_ms * 1000);
+            kill (worker_pids[process_index], SIGKILL);
+            waitpid (worker_pids[process_index], NULL, 0);
+            num_kills++;
+            worker_generations[process_index]++;
+            worker_pids[process_index] = start_worker_process (process_index, worker_generations[process_index]);
+        }
+        else
+        {
+            usleep (100000);
+        }
+    }
+
+    /* Tell the workers to stop, and wait for them to exit */
+    shared->stop = true;
+    for (uint32_t process_index = 0; process_index < arg_num_processes; process_index++)
+    {
+        int status;
+
+        waitpid (worker_pids[process_index], &status, 0);
+        if (!WIFEXITED (status) || (WEXITSTATUS (status) != EXIT_SUCCESS))
+        {
+            num_worker_failures++;
+        }
+    }
+    duration_secs = (double) (get_monotonic_time_ns () - start_time_ns) / 1E9;
+
+    /* Combine the results from all worker threads */
+    memset (&total, 0, sizeof (total));
+    for (uint32_t process_index = 0; process_index < arg_num_processes; process_index++)
+    {
+        for (uint32_t thread_index = 0; thread_index < arg_threads_per_process; thread_index++)
+        {
+            const worker_thread_results_t *const results = &shared->results[process_index][thread_index];
+
+            total.num_allocs += results->num_allocs;
+            total.num_alloc_failures += results->num_alloc_failures;
+            total.num_frees += results->num_frees;
+            total.num_free_failures += results->num_free_failures;
+            total.num_verify_failures += results->num_verify_failures;
+            latency_histogram_merge (&total.alloc_latency, &results->alloc_latency);
+            latency_histogram_merge (&total.free_latency, &results->free_latency);
+        }
+    }
+
+    printf ("%lu allocs (%lu failed), %lu frees in %.3f secs = %.0f ops/sec\n",
+            total.num_allocs, total.num_alloc_failures, total.num_frees, duration_secs,
+            (double) (total.num_allocs + total.num_alloc_failures + total.num_frees) / duration_secs);
+    latency_histogram_display ("alloc+mmap", &total.alloc_latency);
+    latency_histogram_display ("munmap+free", &total.free_latency);
+    printf ("%lu worker processes killed, %lu workers failed, %lu free failures, %lu verify failures\n",
+            num_kills, num_worker_failures, total.num_free_failures, total.num_verify_failures);
+
+    if (!find_pool_free_space (&final_free_space))
+    {
+        return EXIT_FAILURE;
+    }
+    pools_consistent = (final_free_space.free_bytes == initial_free_space.free_bytes) &&
+            (final_free_space.largest_free == initial_free_space.largest_free) &&
+            (final_free_space.num_free_regions == initial_free_space.num_free_regions);
+    printf ("Final free space %lu bytes in %u regions, largest %lu bytes : pools %s\n",
+            final_free_space.free_bytes, final_free_space.num_free_regions, final_free_space.largest_free,
+            pools_consistent ? "consistent" : "INCONSISTENT");
+
+    munmap (shared, sizeof (*shared));
+
+    success = pools_consistent && (num_worker_failures == 0) &&
+            (total.num_free_failures == 0) && (total.num_verify_failures == 0);
+    printf ("Stress test %s\n", success ? "PASSED" : "FAILED");
+
+    return success ? EXIT_SUCCESS : EXIT_FAILURE;
+}
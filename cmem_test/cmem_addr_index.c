@@ -0,0 +1,234 @@
+/*
+ * cmem_addr_index.c
+ *
+ *  Created on: 18 Oct 2026
+ *      Author: Mr_Halfword
+ *
+ * Process wide index of the physically contiguous segments of the cmem buffers mapped by the process.
+ *
+ * The segments are held in an array sorted by virtual address, so a lookup is a binary search.
+ * Lookups are expected to be much more frequent than the insertions and removals performed when buffers are
+ * allocated and freed, so a read-write lock is used to allow lookups from multiple threads to run in parallel.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "cmem_addr_index.h"
+
+
+/* One physically contiguous segment of a mapped cmem buffer */
+typedef struct
+{
+    /* The virtual address of the start of the segment */
+    uintptr_t user_addr;
+    /* The physical address of the start of the segment */
+    uint64_t phys_addr;
+    /* The length of the segment in bytes */
+    size_t length;
+    /* Identifies which cmem_drv context mapped the segment */
+    const void *owner;
+} cmem_addr_index_segment_t;
+
+
+/* Dynamically sized array of segments, sorted in ascending order of user_addr */
+static cmem_addr_index_segment_t *index_segments;
+/* The current number of valid entries in the index_segments[] array */
+static size_t index_num_segments;
+/* The current allocated length of the index_segments[] array, dynamically grown as required */
+static size_t index_allocated_length;
+
+/* Protects the index, allowing concurrent lookups */
+static pthread_rwlock_t index_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+
+/**
+ * @brief Find the position in the index of a virtual address
+ * @details Must be called with index_lock held
+ * @param[in] user_addr The virtual address to search for
+ * @return The index of the first segment whose start is greater than user_addr.
+ *         I.e. the segment which may contain user_addr is the one before the returned index.
+ */
+static size_t cmem_addr_index_upper_bound (const uintptr_t user_addr)
+{
+    size_t low = 0;
+    size_t high = index_num_segments;
+
+    while (low < high)
+    {
+        const size_t mid = low + ((high - low) / 2);
+
+        if (index_segments[mid].user_addr <= user_addr)
+        {
+            low = mid + 1;
+        }
+        else
+        {
+            high = mid;
+        }
+    }
+
+    return low;
+}
+
+
+/**
+ * @brief Insert a physically contiguous segment of a mapped buffer into the index
+ * @param[in] user_addr The virtual address of the start of the segment
+ * @param[in] phys_addr The physical address of the start of the segment
+ * @param[in] length The length of the segment in bytes
+ * @param[in] owner Identifies which cmem_drv context mapped the segment
+ * @return Zero indicates success, any other value failure
+ */
+int32_t cmem_addr_index_insert (const void *const user_addr, const uint64_t phys_addr, const size_t length,
+                                const void *const owner)
+{
+    const uintptr_t start = (uintptr_t) user_addr;
+    size_t insert_index;
+    int32_t rc = 0;
+
+    pthread_rwlock_wrlock (&index_lock);
+
+    if (index_num_segments == index_allocated_length)
+    {
+        const size_t grow_length = 64;
+        cmem_addr_index_segment_t *const grown_segments =
+                realloc (index_segments, (index_allocated_length + grow_length) * sizeof (index_segments[0]));
+
+        if (grown_segments == NULL)
+        {
+            rc = ENOMEM;
+        }
+        else
+        {
+            index_segments = grown_segments;
+            index_allocated_length += grow_length;
+        }
+    }
+
+    if (rc == 0)
+    {
+        insert_index = cmem_addr_index_upper_bound (start);
+        memmove (&index_segments[insert_index + 1], &index_segments[insert_index],
+                (index_num_segments - insert_index) * sizeof (index_segments[0]));
+        index_segments[insert_index].user_addr = start;
+        index_segments[insert_index].phys_addr = phys_addr;
+        index_segments[insert_index].length = length;
+        index_segments[insert_index].owner = owner;
+        index_num_segments++;
+    }
+
+    pthread_rwlock_unlock (&index_lock);
+
+    return rc;
+}
+
+
+/**
+ * @brief Remove all segments mapped by one owner from the index
+ * @param[in] owner Identifies the cmem_drv context whose segments are removed
+ * @param[in] removed_callback Called for each segment removed, after the segments have been removed from the index,
+ *                             which is used to unmap and free the segments
+ * @param[in] callback_arg Passed to removed_callback
+ * @return Zero indicates success, or ENOMEM in which case the index is unchanged
+ */
+int32_t cmem_addr_index_remove_owned (const void *const owner, const cmem_addr_index_removed_callback_t removed_callback,
+                                      void *const callback_arg)
+{
+    cmem_addr_index_segment_t *removed_segments;
+    size_t num_removed_segments = 0;
+    size_t num_kept_segments = 0;
+
+    pthread_rwlock_wrlock (&index_lock);
+    removed_segments = malloc ((index_num_segments > 0 ? index_num_segments : 1) * sizeof (removed_segments[0]));
+    if (removed_segments == NULL)
+    {
+        pthread_rwlock_unlock (&index_lock);
+        return ENOMEM;
+    }
+    for (size_t segment_index = 0; segment_index < index_num_segments; segment_index++)
+    {
+        if (index_segments[segment_index].owner == owner)
+        {
+            removed_segments[num_removed_segments] = index_segments[segment_index];
+            num_removed_segments++;
+        }
+        else
+        {
+            index_segments[num_kept_segments] = index_segments[segment_index];
+            num_kept_segments++;
+        }
+    }
+    index_num_segments = num_kept_segments;
+    pthread_rwlock_unlock (&index_lock);
+
+    for (size_t segment_index = 0; segment_index < num_removed_segments; segment_index++)
+    {
+        removed_callback (callback_arg, (void *) removed_segments[segment_index].user_addr,
+                removed_segments[segment_index].phys_addr, removed_segments[segment_index].length);
+    }
+    free (removed_segments);
+
+    return 0;
+}
+
+
+/**
+ * @brief Remove the segment which starts at a virtual address from the index
+ * @param[in] user_addr The virtual address of the start of the segment to remove
+ */
+void cmem_addr_index_remove (const void *const user_addr)
+{
+    const uintptr_t start = (uintptr_t) user_addr;
+    size_t segment_index;
+
+    pthread_rwlock_wrlock (&index_lock);
+
+    segment_index = cmem_addr_index_upper_bound (start);
+    if ((segment_index > 0) && (index_segments[segment_index - 1].user_addr == start))
+    {
+        segment_index--;
+        memmove (&index_segments[segment_index], &index_segments[segment_index + 1],
+                (index_num_segments - (segment_index + 1)) * sizeof (index_segments[0]));
+        index_num_segments--;
+    }
+
+    pthread_rwlock_unlock (&index_lock);
+}
+
+
+/**
+ * @brief Translate a virtual address in a mapped cmem buffer to a physical address
+ * @param[in] user_addr The virtual address to translate, which may be anywhere inside a buffer
+ * @param[out] phys_addr The physical address corresponding to user_addr
+ * @param[out] contiguous_length The number of bytes from user_addr to the end of the physically contiguous segment
+ * @return Zero indicates success, or EFAULT if user_addr isn't in a mapped cmem buffer
+ */
+int32_t cmem_addr_index_lookup (const void *const user_addr, uint64_t *const phys_addr, size_t *const contiguous_length)
+{
+    const uintptr_t addr = (uintptr_t) user_addr;
+    size_t segment_index;
+    int32_t rc = EFAULT;
+
+    pthread_rwlock_rdlock (&index_lock);
+
+    segment_index = cmem_addr_index_upper_bound (addr);
+    if (segment_index > 0)
+    {
+        const cmem_addr_index_segment_t *const segment = &index_segments[segment_index - 1];
+        const uintptr_t offset = addr - segment->user_addr;
+
+        if (offset < segment->length)
+        {
+            *phys_addr = segment->phys_addr + offset;
+            *contiguous_length = segment->length - offset;
+            rc = 0;
+        }
+    }
+
+    pthread_rwlock_unlock (&index_lock);
+
+    return rc;
+}
@@ -0,0 +1,28 @@
+/*
+ * cmem_addr_index.h
+ *
+ *  Created on: 18 Oct 2026
+ *      Author: Mr_Halfword
+ *
+ * Process wide index of the physically contiguous segments of the cmem buffers mapped by the process,
+ * used to translate virtual addresses to physical addresses.
+ */
+
+#ifndef CMEM_ADDR_INDEX_H_
+#define CMEM_ADDR_INDEX_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* Called for each segment removed by cmem_addr_index_remove_owned() */
+typedef void (*cmem_addr_index_removed_callback_t) (void *callback_arg, void *user_addr, uint64_t phys_addr,
+                                                    size_t length);
+
+int32_t cmem_addr_index_insert (const void *const user_addr, const uint64_t phys_addr, const size_t length,
+                                const void *const owner);
+void cmem_addr_index_remove (const void *const user_addr);
+int32_t cmem_addr_index_remove_owned (const void *const owner, const cmem_addr_index_removed_callback_t removed_callback,
+                                      void *const callback_arg);
+int32_t cmem_addr_index_lookup (const void *const user_addr, uint64_t *const phys_addr, size_t *const contiguous_length);
+
+#endif /* CMEM_ADDR_INDEX_H_ */
@@ -0,0 +1,544 @@
+/*
+ * cmem_copy.c
+ *
+ *  Created on: 18 Oct 2026
+ *      Author: Mr_Halfword
+ *
+ * Copy, fill and compare routines for cmem buffers.
+ *
+ * Writes to a write-combining or uncached destination, or to a write-back destination which is larger than the last
+ * level cache, use non-temporal vector stores. Non-temporal stores don't read the destination cache lines for ownership
+ * and don't evict other data from the caches, and the widest vectors minimise the number of transactions to a
+ * write-combining or uncached destination. Smaller writes to a write-back destination use the C library, which is
+ * faster when the data stays in the cache.
+ *
+ * The vector width is selected at run time from the CPU features, in the order AVX-512, AVX2 and SSE2. The routines
+ * for each are compiled using target attributes, so the library doesn't need to be compiled for a specific CPU.
+ *
+ * When set by cmem_copy_set_num_threads(), buffers of at least CMEM_COPY_MT_MIN_LENGTH are divided between threads,
+ * since a single core can't saturate the memory bandwidth.
+ */
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#include "cmem_copy.h"
+
+
+/* The minimum length which is divided between multiple threads */
+#define CMEM_COPY_MT_MIN_LENGTH (64UL * 1024 * 1024)
+
+/* The length of the part for each thread is a multiple of this, to not share pages between threads */
+#define CMEM_COPY_MT_PART_ALIGNMENT 4096UL
+
+/* The maximum number of threads used for one operation */
+#define CMEM_COPY_MAX_THREADS 64
+
+/* The non-temporal threshold used for a write-back destination if the size of the last level cache isn't known */
+#define CMEM_COPY_DEFAULT_NT_THRESHOLD (8UL * 1024 * 1024)
+
+
+/* The implementation of the routines for one instruction set */
+typedef struct
+{
+    /* Describes the instruction set */
+    const char *name;
+    /* The size of the vectors, which is the alignment required by the non-temporal stores */
+    size_t vector_size;
+    /* Copy using non-temporal stores. dest is aligned to vector_size, and length is a multiple of vector_size. */
+    void (*stream_copy) (uint8_t *const dest, const uint8_t *const src, const size_t length);
+    /* Fill using non-temporal stores. dest is aligned to vector_size, and length is a multiple of vector_size. */
+    void (*stream_fill) (uint8_t *const dest, const uint8_t value, const size_t length);
+    /* Find the offset of the first byte which differs between two buffers, or length if the buffers are equal */
+    size_t (*find_difference) (const uint8_t *const buffer_a, const uint8_t *const buffer_b, const size_t length);
+} cmem_copy_isa_t;
+
+
+/* The operations which may be divided between threads */
+typedef enum
+{
+    CMEM_COPY_OP_COPY,
+    CMEM_COPY_OP_FILL,
+    CMEM_COPY_OP_COMPARE
+} cmem_copy_operation_t;
+
+/* The part of an operation performed by one thread */
+typedef struct
+{
+    /* The thread performing the part, when started */
+    pthread_t thread;
+    bool thread_started;
+    /* The operation, and the part of the buffers operated on */
+    cmem_copy_operation_t operation;
+    uint8_t *dest;
+    const uint8_t *src;
+    uint8_t value;
+    size_t length;
+    /* For CMEM_COPY_OP_COMPARE the offset of the first difference in the part, or length if equal */
+    size_t difference;
+} cmem_copy_part_t;
+
+
+/* The selected instruction set, and the length above which writes to a write-back destination use non-temporal stores */
+static pthread_once_t cmem_copy_init_once = PTHREAD_ONCE_INIT;
+static const cmem_copy_isa_t *cmem_copy_isa;
+static size_t cmem_copy_nt_threshold;
+
+/* The number of threads used for large buffers */
+static uint32_t cmem_copy_num_threads = 1;
+
+
+/**
+ * @brief Generic implementation of find_difference, used for the tail of a buffer
+ */
+static size_t find_difference_bytes (const uint8_t *const buffer_a, const uint8_t *const buffer_b, const size_t length)
+{
+    size_t offset = 0;
+
+    while ((offset < length) && (buffer_a[offset] == buffer_b[offset]))
+    {
+        offset++;
+    }
+
+    return offset;
+}
+
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("sse2")))
+static void stream_copy_sse2 (uint8_t *const dest, const uint8_t *const src, const size_t length)
+{
+    for (size_t offset = 0; offset < length; offset += sizeof (__m128i))
+    {
+        _mm_stream_si128 ((__m128i *) &dest[offset], _mm_loadu_si128 ((const __m128i *) &src[offset]));
+    }
+    _mm_sfence ();
+}
+
+
+__attribute__((target("sse2")))
+static void stream_fill_sse2 (uint8_t *const dest, const uint8_t value, const size_t length)
+{
+    const __m128i fill = _mm_set1_epi8 ((char) value);
+
+    for (size_t offset = 0; offset < length; offset += sizeof (__m128i))
+    {
+        _mm_stream_si128 ((__m128i *) &dest[offset], fill);
+    }
+    _mm_sfence ();
+}
+
+
+__attribute__((target("sse2")))
+static size_t find_difference_sse2 (const uint8_t *const buffer_a, const uint8_t *const buffer_b, const size_t length)
+{
+    size_t offset;
+
+    for (offset = 0; (offset + sizeof (__m128i)) <= length; offset += sizeof (__m128i))
+    {
+        const uint32_t equal_mask = (uint32_t) _mm_movemask_epi8 (_mm_cmpeq_epi8 (
+                _mm_loadu_si128 ((const __m128i *) &buffer_a[offset]),
+                _mm_loadu_si128 ((const __m128i *) &buffer_b[offset])));
+
+        if (equal_mask != 0xFFFFu)
+        {
+            return offset + (size_t) __builtin_ctz (~equal_mask);
+        }
+    }
+
+    return offset + find_difference_bytes (&buffer_a[offset], &buffer_b[offset], length - offset);
+}
+
+
+__attribute__((target("avx2")))
+static void stream_copy_avx2 (uint8_t *const dest, const uint8_t *const src, const size_t length)
+{
+    for (size_t offset = 0; offset < length; offset += sizeof (__m256i))
+    {
+        _mm256_stream_si256 ((__m256i *) &dest[offset], _mm256_loadu_si256 ((const __m256i *) &src[offset]));
+    }
+    _mm_sfence ();
+}
+
+
+__attribute__((target("avx2")))
+static void stream_fill_avx2 (uint8_t *const dest, const uint8_t value, const size_t length)
+{
+    const __m256i fill = _mm256_set1_epi8 ((char) value);
+
+    for (size_t offset = 0; offset < length; offset += sizeof (__m256i))
+    {
+        _mm256_stream_si256 ((__m256i *) &dest[offset], fill);
+    }
+    _mm_sfence ();
+}
+
+
+__attribute__((target("avx2")))
+static size_t find_difference_avx2 (const uint8_t *const buffer_a, const uint8_t *const buffer_b, const size_t length)
+{
+    size_t offset;
+
+    for (offset = 0; (offset + sizeof (__m256i)) <= length; offset += sizeof (__m256i))
+    {
+        const uint32_t equal_mask = (uint32_t) _mm256_movemask_epi8 (_mm256_cmpeq_epi8 (
+                _mm256_loadu_si256 ((const __m256i *) &buffer_a[offset]),
+                _mm256_loadu_si256 ((const __m256i *) &buffer_b[offset])));
+
+        if (equal_mask != 0xFFFFFFFFu)
+        {
+            return offset + (size_t) __builtin_ctz (~equal_mask);
+        }
+    }
+
+    return offset + find_difference_bytes (&buffer_a[offset], &buffer_b[offset], length - offset);
+}
+
+
+__attribute__((target("avx512f,avx512bw")))
+static void stream_copy_avx512 (uint8_t *const dest, const uint8_t *const src, const size_t length)
+{
+    for (size_t offset = 0; offset < length; offset += sizeof (__m512i))
+    {
+        _mm512_stream_si512 ((__m512i *) &dest[offset], _mm512_loadu_si512 (&src[offset]));
+    }
+    _mm_sfence ();
+}
+
+
+__attribute__((target("avx512f,avx512bw")))
+static void stream_fill_avx512 (uint8_t *const dest, const uint8_t value, const size_t length)
+{
+    const __m512i fill = _mm512_set1_epi8 ((char) value);
+
+    for (size_t offset = 0; offset < length; offset += sizeof (__m512i))
+    {
+        _mm512_stream_si512 ((__m512i *) &dest[offset], fill);
+    }
+    _mm_sfence ();
+}
+
+
+__attribute__((target("avx512f,avx512bw")))
+static size_t find_difference_avx512 (const uint8_t *const buffer_a, const uint8_t *const buffer_b, const size_t length)
+{
+    size_t offset;
+
+    for (offset = 0; (offset + sizeof (__m512i)) <= length; offset += sizeof (__m512i))
+    {
+        const __mmask64 differ_mask = _mm512_cmpneq_epi8_mask (_mm512_loadu_si512 (&buffer_a[offset]),
+                _mm512_loadu_si512 (&buffer_b[offset]));
+
+        if (differ_mask != 0)
+        {
+            return offset + (size_t) __builtin_ctzll (differ_mask);
+        }
+    }
+
+    return offset + find_difference_bytes (&buffer_a[offset], &buffer_b[offset], length - offset);
+}
+
+
+static const cmem_copy_isa_t cmem_copy_isa_avx512 =
+{
+    .name = "AVX-512",
+    .vector_size = sizeof (__m512i),
+    .stream_copy = stream_copy_avx512,
+    .stream_fill = stream_fill_avx512,
+    .find_difference = find_difference_avx512
+};
+
+static const cmem_copy_isa_t cmem_copy_isa_avx2 =
+{
+    .name = "AVX2",
+    .vector_size = sizeof (__m256i),
+    .stream_copy = stream_copy_avx2,
+    .stream_fill = stream_fill_avx2,
+    .find_difference = find_difference_avx2
+};
+
+static const cmem_copy_isa_t cmem_copy_isa_sse2 =
+{
+    .name = "SSE2",
+    .vector_size = sizeof (__m128i),
+    .stream_copy = stream_copy_sse2,
+    .stream_fill = stream_fill_sse2,
+    .find_difference = find_difference_sse2
+};
+#else
+/**
+ * @brief Generic implementations for CPUs without non-temporal vector stores, which use the C library
+ */
+static void stream_copy_generic (uint8_t *const dest, const uint8_t *const src, const size_t length)
+{
+    memcpy (dest, src, length);
+}
+
+
+static void stream_fill_generic (uint8_t *const dest, const uint8_t value, const size_t length)
+{
+    memset (dest, value, length);
+}
+
+
+static const cmem_copy_isa_t cmem_copy_isa_generic =
+{
+    .name = "generic",
+    .vector_size = 1,
+    .stream_copy = stream_copy_generic,
+    .stream_fill = stream_fill_generic,
+    .find_difference = find_difference_bytes
+};
+#endif
+
+
+/**
+ * @brief Select the instruction set from the CPU features, and the non-temporal threshold from the cache size
+ */
+static void cmem_copy_init (void)
+{
+    const long l3_cache_size = sysconf (_SC_LEVEL3_CACHE_SIZE);
+
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init ();
+    if (__builtin_cpu_supports ("avx512f") && __builtin_cpu_supports ("avx512bw"))
+    {
+        cmem_copy_isa = &cmem_copy_isa_avx512;
+    }
+    else if (__builtin_cpu_supports ("avx2"))
+    {
+        cmem_copy_isa = &cmem_copy_isa_avx2;
+    }
+    else
+    {
+        cmem_copy_isa = &cmem_copy_isa_sse2;
+    }
+#else
+    cmem_copy_isa = &cmem_copy_isa_generic;
+#endif
+
+    /* A write-back destination larger than the last level cache would evict all other data from the cache */
+    cmem_copy_nt_threshold = (l3_cache_size > 0) ? (size_t) l3_cache_size : CMEM_COPY_DEFAULT_NT_THRESHOLD;
+}
+
+
+/**
+ * @brief Get the name of the instruction set used for the non-temporal stores
+ * @return The name of the instruction set
+ */
+const char *cmem_copy_isa_name (void)
+{
+    pthread_once (&cmem_copy_init_once, cmem_copy_init);
+    return cmem_copy_isa->name;
+}
+
+
+/**
+ * @brief Set the number of threads used for buffers of at least CMEM_COPY_MT_MIN_LENGTH
+ * @param[in] num_threads The number of threads, including the calling thread. 1 performs all operations in the
+ *                        calling thread.
+ */
+void cmem_copy_set_num_threads (const uint32_t num_threads)
+{
+    cmem_copy_num_threads = (num_threads < 1) ? 1 : ((num_threads > CMEM_COPY_MAX_THREADS) ? CMEM_COPY_MAX_THREADS : num_threads);
+}
+
+
+/**
+ * @brief Perform a part of an operation
+ * @details For a copy or fill, the unaligned start and end of the part are written using the C library.
+ * @param[in/out] part The part to perform
+ */
+static void cmem_copy_perform_part (cmem_copy_part_t *const part)
+{
+    const size_t vector_size = cmem_copy_isa->vector_size;
+    const size_t head = ((-(uintptr_t) part->dest) & (vector_size - 1)) < part->length ?
+            ((-(uintptr_t) part->dest) & (vector_size - 1)) : part->length;
+    const size_t body = (part->length - head) & ~(vector_size - 1);
+    const size_t tail = part->length - head - body;
+
+    switch (part->operation)
+    {
+    case CMEM_COPY_OP_COPY:
+        memcpy (part->dest, part->src, head);
+        cmem_copy_isa->stream_copy (&part->dest[head], &part->src[head], body);
+        memcpy (&part->dest[head + body], &part->src[head + body], tail);
+        break;
+
+    case CMEM_COPY_OP_FILL:
+        memset (part->dest, part->value, head);
+        cmem_copy_isa->stream_fill (&part->dest[head], part->value, body);
+        memset (&part->dest[head + body], part->value, tail);
+        break;
+
+    case CMEM_COPY_OP_COMPARE:
+        part->difference = cmem_copy_isa->find_difference (part->dest, part->src, part->length);
+        break;
+    }
+}
+
+
+/**
+ * @brief Thread entry point to perform a part of an operation
+ */
+static void *cmem_copy_part_thread (void *arg)
+{
+    cmem_copy_perform_part (arg);
+    return NULL;
+}
+
+
+/**
+ * @brief Perform an operation, dividing large buffers between threads
+ * @param[in] operation The operation to perform
+ * @param[in/out] dest The destination buffer, or the first buffer to compare
+ * @param[in] src The source buffer, or the second buffer to compare. Not used for a fill.
+ * @param[in] value The value for a fill
+ * @param[in] length The length of the buffers
+ * @return For CMEM_COPY_OP_COMPARE the offset of the first difference, or length if the buffers are equal
+ */
+static size_t cmem_copy_perform (const cmem_copy_operation_t operation, uint8_t *const dest, const uint8_t *const src,
+                                 const uint8_t value, const size_t length)
+{
+    cmem_copy_part_t parts[CMEM_COPY_MAX_THREADS];
+    uint32_t num_parts = 1;
+    size_t part_length = length;
+    size_t offset = 0;
+
+    if ((length >= CMEM_COPY_MT_MIN_LENGTH) && (cmem_copy_num_threads > 1))
+    {
+        part_length = (((length / cmem_copy_num_threads) + CMEM_COPY_MT_PART_ALIGNMENT - 1) /
+                CMEM_COPY_MT_PART_ALIGNMENT) * CMEM_COPY_MT_PART_ALIGNMENT;
+        num_parts = (uint32_t) ((length + part_length - 1) / part_length);
+    }
+
+    for (uint32_t part_index = 0; part_index < num_parts; part_index++)
+    {
+        cmem_copy_part_t *const part = &parts[part_index];
+
+        part->operation = operation;
+        part->dest = &dest[offset];
+        part->src = (src != NULL) ? &src[offset] : NULL;
+        part->value = value;
+        part->length = ((length - offset) < part_length) ? (length - offset) : part_length;
+        part->difference = part->length;
+        offset += part->length;
+
+        /* The first part is performed by the calling thread. If a thread can't be created the part is performed
+         * by the calling thread, which is slower but still correct. */
+        part->thread_started = (part_index > 0) &&
+                (pthread_create (&part->thread, NULL, cmem_copy_part_thread, part) == 0);
+    }
+
+    for (uint32_t part_index = 0; part_index < num_parts; part_index++)
+    {
+        if (!parts[part_index].thread_started)
+        {
+            cmem_copy_perform_part (&parts[part_index]);
+        }
+    }
+
+    for (uint32_t part_index = 0; part_index < num_parts; part_index++)
+    {
+        if (parts[part_index].thread_started)
+        {
+            pthread_join (parts[part_index].thread, NULL);
+        }
+    }
+
+    offset = 0;
+
+    for (uint32_t part_index = 0; part_index < num_parts; part_index++)
+    {
+        if (parts[part_index].difference < parts[part_index].length)
+        {
+            return offset + parts[part_index].difference;
+        }
+        offset += parts[part_index].length;
+    }
+
+    return length;
+}
+
+
+/**
+ * @brief Determine if a write to a destination should use non-temporal stores
+ */
+static bool cmem_copy_use_stream (const size_t length, const cmem_mapping_type_t dest_type)
+{
+    pthread_once (&cmem_copy_init_once, cmem_copy_init);
+    return (dest_type != CMEM_MAPPING_WRITE_BACK) || (length >= cmem_copy_nt_threshold);
+}
+
+
+/**
+ * @brief Copy between buffers which don't overlap
+ * @param[out] dest The destination buffer
+ * @param[in] src The source buffer
+ * @param[in] length The number of bytes to copy
+ * @param[in] dest_type The cache type of the mapping of the destination
+ */
+void cmem_copy (void *const dest, const void *const src, const size_t length, const cmem_mapping_type_t dest_type)
+{
+    if (cmem_copy_use_stream (length, dest_type))
+    {
+        cmem_copy_perform (CMEM_COPY_OP_COPY, dest, src, 0, length);
+    }
+    else
+    {
+        memcpy (dest, src, length);
+    }
+}
+
+
+/**
+ * @brief Fill a buffer with a byte value
+ * @param[out] dest The buffer to fill
+ * @param[in] value The value to fill the buffer with
+ * @param[in] length The number of bytes to fill
+ * @param[in] dest_type The cache type of the mapping of the buffer
+ */
+void cmem_fill (void *const dest, const uint8_t value, const size_t length, const cmem_mapping_type_t dest_type)
+{
+    if (cmem_copy_use_stream (length, dest_type))
+    {
+        cmem_copy_perform (CMEM_COPY_OP_FILL, dest, NULL, value, length);
+    }
+    else
+    {
+        memset (dest, value, length);
+    }
+}
+
+
+/**
+ * @brief Compare two buffers, using the widest vectors to minimise the number of reads of an uncached or
+ *        write-combining buffer
+ * @param[in] buffer_a The first buffer
+ * @param[in] buffer_b The second buffer
+ * @param[in] length The number of bytes to compare
+ * @return Zero if the buffers are equal, otherwise negative or positive according to whether the first byte which
+ *         differs is less or greater in buffer_a, in the same way as memcmp()
+ */
+int cmem_compare (const void *const buffer_a, const void *const buffer_b, const size_t length)
+{
+    const uint8_t *const bytes_a = buffer_a;
+    const uint8_t *const bytes_b = buffer_b;
+    size_t difference;
+
+    pthread_once (&cmem_copy_init_once, cmem_copy_init);
+    difference = cmem_copy_perform (CMEM_COPY_OP_COMPARE, (uint8_t *) bytes_a, bytes_b, 0, length);
+    if (difference == length)
+    {
+        return 0;
+    }
+
+    return (bytes_a[difference] < bytes_b[difference]) ? -1 : 1;
+}
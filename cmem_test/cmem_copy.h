@@ -0,0 +1,34 @@
+/*
+ * cmem_copy.h
+ *
+ *  Created on: 18 Oct 2026
+ *      Author: Mr_Halfword
+ *
+ * Copy, fill and compare routines for cmem buffers, which use non-temporal vector stores where they are faster than
+ * the C library, according to the cache type of the mapping and the size of the buffer.
+ */
+
+#ifndef CMEM_COPY_H_
+#define CMEM_COPY_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* The cache type of the mapping of a destination buffer */
+typedef enum
+{
+    /* Write-back, which is the cache type of buffers mapped by cmem_drv_alloc() */
+    CMEM_MAPPING_WRITE_BACK,
+    /* Write-combining, e.g. a prefetchable PCIe BAR */
+    CMEM_MAPPING_WRITE_COMBINING,
+    /* Uncached */
+    CMEM_MAPPING_UNCACHED
+} cmem_mapping_type_t;
+
+void cmem_copy (void *const dest, const void *const src, const size_t length, const cmem_mapping_type_t dest_type);
+void cmem_fill (void *const dest, const uint8_t value, const size_t length, const cmem_mapping_type_t dest_type);
+int cmem_compare (const void *const buffer_a, const void *const buffer_b, const size_t length);
+void cmem_copy_set_num_threads (const uint32_t num_threads);
+const char *cmem_copy_isa_name (void);
+
+#endif /* CMEM_COPY_H_ */
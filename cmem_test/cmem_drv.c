@@ -41,54 +41,128 @@
 #include <stdint.h>
 #include <errno.h>
 #include <semaphore.h>
+#include <pthread.h>
 
 #include <linux/ioctl.h>
 #include <sys/mman.h>
 #include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#include <linux/io_uring.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <poll.h>
+
+/* Defined by Linux 4.17 onwards, for older C libraries */
+#ifndef MAP_FIXED_NOREPLACE
+#define MAP_FIXED_NOREPLACE 0x100000
+#endif
 
 #include "cmem.h"
 #include "cmem_drv.h"
+#include "cmem_addr_index.h"
+#include "cmem_recycle.h"
+
+/* The physical address range and class of one pool, which don't change while the module is loaded */
+typedef struct
+{
+    uint64_t start;
+    uint64_t size;
+    uint32_t pool_class;
+} cmem_drv_pool_range_t;
 
-static int32_t dev_desc;
+/* A context for using the cmem driver. The file descriptor is only read after cmem_drv_open(), and the ioctls
+ * are serialised by the driver, so the only state which needs locking is the lazily created status page mapping
+ * and table of pools. */
+struct cmem_drv_context_s
+{
+    /* The file descriptor for the cmem device */
+    int32_t dev_desc;
+    /* Protects the creation of status_page */
+    pthread_mutex_t status_page_lock;
+    /* The mapping of the read-only status page, created on the first call to cmem_drv_read_status().
+     * Read with atomic loads so that only the first call takes status_page_lock. */
+    const cmem_status_page_t *status_page;
+    /* The pools, read from the status page by the first free with the cache of freed buffers enabled so that each
+     * free doesn't need to take a snapshot of the status page. Read once pool_ranges_valid is set with an atomic
+     * store, which is performed with status_page_lock held. */
+    cmem_drv_pool_range_t pool_ranges[CMEM_STATUS_MAX_POOLS];
+    uint32_t num_pool_ranges;
+    bool pool_ranges_valid;
+    /* The cache of freed buffers, which has its own lock and is disabled until cmem_drv_recycle_configure() */
+    cmem_recycle_t *recycle;
+};
 
 static char* progname = "cmem_drv";
 
+static int32_t cmem_drv_recycle_evict (cmem_drv_context_t *const context, const bool remove_all);
+static int32_t cmem_drv_free_buffers (cmem_drv_context_t *const context, const uint32_t num_of_buffers,
+                                      const cmem_host_buf_desc_t buf_desc[const num_of_buffers]);
+
 /* Local functions */
 /**
  *  @brief Function cmem_drv_open() Open dma mem driver
- *  @param    none 
+ *  @details Each context has its own file descriptor. Allocations belong to the process rather than the context,
+ *           and are freed by the driver once all contexts opened by the process have been closed and all buffers
+ *           unmapped.
+ *  @param[out] context The opened context, or NULL on failure
  *  @retval          0: success, -1 : failure
  *  @pre  
  *  @post 
  */
-int32_t cmem_drv_open(void)
+int32_t cmem_drv_open(cmem_drv_context_t **const context)
 {
     char dev_name[128];
+    cmem_drv_context_t *new_context;
 
+    *context = NULL;
     sprintf(dev_name, CMEM_DRIVER_SIGNATURE);
 
-    dev_desc = open(dev_name, O_RDWR);
-    if (-1 == dev_desc) {
+    new_context = calloc (1, sizeof (*new_context));
+    if (new_context != NULL) {
+        new_context->recycle = cmem_recycle_create ();
+        if (new_context->recycle == NULL) {
+            free (new_context);
+            new_context = NULL;
+        }
+    }
+    if (new_context == NULL) {
+        fprintf(stderr, "%s: ERROR: Failed to allocate context\n", progname);
+        return -1;
+    }
+
+    new_context->dev_desc = open(dev_name, O_RDWR);
+    if (-1 == new_context->dev_desc) {
         fprintf(stderr, "%s: ERROR: DMA MEM Device \"%s\" could not opened\n", progname, dev_name);
+        cmem_recycle_destroy (new_context->recycle);
+        free (new_context);
         return -1;
     }
+    pthread_mutex_init (&new_context->status_page_lock, NULL);
 #ifdef CMEM_VERBOSE 
-    printf("Opened DMA MEM device : %s (dev_desc = 0x%08X)\n",dev_name, dev_desc);
+    printf("Opened DMA MEM device : %s (dev_desc = 0x%08X)\n",dev_name, new_context->dev_desc);
 #endif
+    *context = new_context;
     return(0);
 }
 /**
  *  @brief Function cmem_drv_close() Close dma mem driver
- *  @param    none 
+ *  @details No other thread may be using the context. Any buffers in the cache of freed buffers are freed.
+ *  @param[in] context The context to close, which is freed
  *  @retval           0: success, -1 : failure
  *  @pre  
  *  @post 
  */
-int32_t cmem_drv_close(void)
+int32_t cmem_drv_close(cmem_drv_context_t *const context)
 {
-    close(dev_desc);
+    cmem_drv_recycle_evict (context, true);
+    cmem_recycle_destroy (context->recycle);
+    if (context->status_page != NULL)
+    {
+        munmap ((void *) context->status_page, (size_t) sysconf (_SC_PAGESIZE));
+    }
+    close(context->dev_desc);
+    pthread_mutex_destroy (&context->status_page_lock);
+    free (context);
 #ifdef CMEM_VERBOSE
     printf("Memory Driver closed \n");
 #endif
@@ -96,23 +170,237 @@ int32_t cmem_drv_close(void)
 }
 
 
+/**
+ * @brief Map buffers allocated by CMEM_IOCTL_ALLOC_A64_HOST_BUFFERS or CMEM_IOCTL_ALLOC_A32_HOST_BUFFERS into the
+ *        address space of the calling process
+ * @details Used by cmem_drv_alloc(), and after the completion of an allocation submitted using io_uring since
+ *          the mapping can't be performed by the cmem driver.
+ * @param[in] context The context used to map the buffers
+ * @param[in] cmem_ioctl The completed allocation
+ * @param[out] buf_desc The mapped buffers, with one entry for each allocated buffer
+ * @return Zero indicates success, any other value failure
+ */
+int32_t cmem_drv_map_buffers (cmem_drv_context_t *const context,
+                              const cmem_ioctl_t *const cmem_ioctl, cmem_host_buf_desc_t buf_desc[const])
+{
+    int32_t rc = 0;
+
+    for (uint32_t buffer_index = 0; (rc == 0) && (buffer_index < cmem_ioctl->host_buf_info.num_buffers); buffer_index++)
+    {
+        const cmem_host_buf_entry_t *const buffer = &cmem_ioctl->host_buf_info.buf_info[buffer_index];
+
+#ifdef CMEM_VERBOSE
+        printf("Debug: mmap param length 0x%zx, Addr: 0x%lx \n", buffer->length, buffer->dma_address);
+#endif
+        errno = 0;
+        buf_desc[buffer_index].userAddr = mmap (NULL,
+                buffer->length,
+                PROT_READ | PROT_WRITE,
+                MAP_SHARED,
+                context->dev_desc,
+                (off_t) buffer->dma_address);
+        buf_desc[buffer_index].physAddr = buffer->dma_address;
+        buf_desc[buffer_index].length = buffer->length;
+        if (buf_desc[buffer_index].userAddr == MAP_FAILED)
+        {
+            rc = errno;
+        }
+        else
+        {
+            rc = cmem_addr_index_insert (buf_desc[buffer_index].userAddr, buf_desc[buffer_index].physAddr,
+                    buf_desc[buffer_index].length, context);
+        }
+#ifdef CMEM_VERBOSE
+        printf("Buff num %d: Phys addr : 0x%lx User Addr: 0x%lx \n", buffer_index, buf_desc[buffer_index].physAddr,
+                (uintptr_t) buf_desc[buffer_index].userAddr);
+#endif
+    }
+
+    return rc;
+}
+
+
+/**
+ * @brief Unmap buffers from the address space of the calling process, and prepare the parameters to free them
+ * @details Used before a free is submitted using io_uring.
+ * @param[in] num_of_buffers The number of buffers, which must not exceed CMEM_MAX_BUF_PER_ALLOC
+ * @param[in] buf_desc The buffers to unmap
+ * @param[out] cmem_ioctl The parameters for CMEM_IOCTL_FREE_HOST_BUFFERS
+ * @return Zero indicates success, any other value failure
+ */
+int32_t cmem_drv_unmap_buffers (const uint32_t num_of_buffers, const cmem_host_buf_desc_t buf_desc[const num_of_buffers],
+                                cmem_ioctl_t *const cmem_ioctl)
+{
+    int32_t rc = 0;
+
+    if (num_of_buffers > CMEM_MAX_BUF_PER_ALLOC)
+    {
+        return EINVAL;
+    }
+
+    memset (cmem_ioctl, 0, sizeof (*cmem_ioctl));
+    cmem_ioctl->host_buf_info.num_buffers = num_of_buffers;
+    for (uint32_t buffer_index = 0; (rc == 0) && (buffer_index < num_of_buffers); buffer_index++)
+    {
+        cmem_ioctl->host_buf_info.buf_info[buffer_index].dma_address = buf_desc[buffer_index].physAddr;
+        cmem_ioctl->host_buf_info.buf_info[buffer_index].length = buf_desc[buffer_index].length;
+        cmem_addr_index_remove (buf_desc[buffer_index].userAddr);
+        rc = munmap ((void *)buf_desc[buffer_index].userAddr, buf_desc[buffer_index].length);
+    }
+
+    return rc;
+}
+
+
+/**
+ * @brief Prepare an io_uring SQE to perform a cmem operation asynchronously
+ * @details The completion has a result of zero on success, or a negative errno value. The results of the operation are
+ *          written to the parameters, in the same way as for the ioctl. Following the completion of an allocation
+ *          cmem_drv_map_buffers() maps the buffers. Before submitting a free, cmem_drv_unmap_buffers() unmaps the
+ *          buffers and prepares the parameters.
+ *
+ *          Requires a Kernel which supports IORING_OP_URING_CMD.
+ * @param[in] context The context whose file descriptor the command is submitted to
+ * @param[out] sqe The SQE to prepare, obtained from the submission queue
+ * @param[in] cmd_op The cmem operation, one of the CMEM_IOCTL_* values
+ * @param[in] arg The parameters for the operation, which must remain valid until the completion
+ * @param[in] user_data Returned in the completion, to identify the operation
+ */
+void cmem_drv_prep_uring_cmd (cmem_drv_context_t *const context,
+                              struct io_uring_sqe *const sqe, const uint32_t cmd_op, void *const arg,
+                              const uint64_t user_data)
+{
+    cmem_uring_cmd_t *const uring_cmd = (cmem_uring_cmd_t *) sqe->cmd;
+
+    memset (sqe, 0, sizeof (*sqe));
+    sqe->opcode = IORING_OP_URING_CMD;
+    sqe->fd = context->dev_desc;
+    sqe->cmd_op = cmd_op;
+    sqe->user_data = user_data;
+    uring_cmd->arg = (uintptr_t) arg;
+}
+
+
+/**
+ * @brief Allocate buffers using one of the allocation ioctls, and map them into the address space of the calling process
+ * @param[in] context The context used to allocate and map the buffers
+ * @param[in] command The allocation ioctl, which takes a cmem_ioctl_t
+ * @param[in] num_of_buffers The number of buffers to allocate
+ * @param[in] size_of_buffer The size of each buffer in bytes
+ * @param[out] buf_desc The allocated buffers
+ * @return Zero indicates success, any other value failure
+ */
+static int32_t cmem_drv_alloc_with_command (cmem_drv_context_t *const context, const unsigned long command,
+                                            const uint32_t num_of_buffers, const size_t size_of_buffer,
+                                            cmem_host_buf_desc_t buf_desc[const num_of_buffers])
+{
+    cmem_ioctl_t cmem_ioctl;
+    uint32_t buffer_index = 0;
+    uint32_t remaining_num_buffers = num_of_buffers;
+    int rc = 0;
+
+    while ((rc == 0) && (remaining_num_buffers > 0))
+    {
+        const uint32_t alloc_num_buffers = (remaining_num_buffers < CMEM_MAX_BUF_PER_ALLOC) ?
+                remaining_num_buffers : CMEM_MAX_BUF_PER_ALLOC;
+
+        /* Allocate physical address buffers */
+        memset (&cmem_ioctl, 0, sizeof (cmem_ioctl));
+        cmem_ioctl.host_buf_info.num_buffers = alloc_num_buffers;
+        for (uint32_t ioctl_index = 0; ioctl_index < alloc_num_buffers; ioctl_index++)
+        {
+            cmem_ioctl.host_buf_info.buf_info[ioctl_index].length = size_of_buffer;
+        }
+        rc = ioctl (context->dev_desc, command, &cmem_ioctl);
+
+        /* Map the buffers into the process address space */
+        if (rc == 0)
+        {
+            rc = cmem_drv_map_buffers (context, &cmem_ioctl, &buf_desc[buffer_index]);
+        }
+        buffer_index += alloc_num_buffers;
+
+        remaining_num_buffers -= alloc_num_buffers;
+    }
+
+    return rc;
+}
+
+
 /**
  * @brief Allocate physically contiguous host memory buffers, and map them into the address space of the calling process
+ * @details When the cache of freed buffers is enabled, buffers of exactly size_of_buffer are taken from the cache
+ *          and only the remainder are allocated by the driver.
  * @pram[in] dma_capability_a64 Determines the type of physical addresses to allocate:
  *                              - When false allocates physical addresses only in the first 4 GiB,
  *                                for devices which can only address 32-bits
  *                              - When true allocates addresses in any part of the physical address spaces,
  *                                for devices which can address 64-bits.
+ * @param[in] context The context used to allocate and map the buffers
  * @param[in] dma_capability_a64 The number of buffers to allocate
  * @param[in] size_of_buffer The size of each buffer in bytes
  * @param[out] buf_desc The allocated buffers
  * @return Zero indicates success, any other value failure
  */
-int32_t cmem_drv_alloc (const bool dma_capability_a64,
+int32_t cmem_drv_alloc (cmem_drv_context_t *const context, const bool dma_capability_a64,
                         const uint32_t num_of_buffers, const size_t size_of_buffer,
                         cmem_host_buf_desc_t buf_desc[const num_of_buffers])
 {
-    const unsigned long command = dma_capability_a64 ? CMEM_IOCTL_ALLOC_A64_HOST_BUFFERS : CMEM_IOCTL_ALLOC_A32_HOST_BUFFERS;
+    uint32_t num_recycled = 0;
+    int32_t rc;
+
+    /* Place the buffers taken from the cache at the start of buf_desc[] */
+    if (cmem_recycle_enabled (context->recycle))
+    {
+        for (uint32_t buffer_index = 0; buffer_index < num_of_buffers; buffer_index++)
+        {
+            if (cmem_recycle_take (context->recycle, dma_capability_a64, size_of_buffer, &buf_desc[num_recycled]))
+            {
+                num_recycled++;
+            }
+        }
+    }
+
+    rc = cmem_drv_alloc_with_command (context,
+            dma_capability_a64 ? CMEM_IOCTL_ALLOC_A64_HOST_BUFFERS : CMEM_IOCTL_ALLOC_A32_HOST_BUFFERS,
+            num_of_buffers - num_recycled, size_of_buffer, &buf_desc[num_recycled]);
+    if (rc != 0)
+    {
+        /* The caller doesn't free buf_desc[] on failure, so return the buffers taken from the cache.
+         * Any which no longer fit in the cache are freed by the driver. */
+        for (uint32_t buffer_index = 0; buffer_index < num_recycled; buffer_index++)
+        {
+            if ((cmem_recycle_put (context->recycle, &buf_desc[buffer_index]) != 0) &&
+                (cmem_drv_free_buffers (context, 1, &buf_desc[buffer_index]) != 0))
+            {
+                fprintf (stderr, "%s: ERROR: Failed to free buffer taken from the cache\n", progname);
+            }
+        }
+    }
+
+    return rc;
+}
+
+
+/**
+ * @brief Allocate physically contiguous host memory buffers from one class of pools, and map them into the address
+ *        space of the calling process
+ * @details E.g. large buffers which are accessed infrequently can be allocated from CMEM_POOL_CLASS_BULK, leaving
+ *          CMEM_POOL_CLASS_DRAM for latency critical buffers. The buffers are freed by cmem_drv_free(), but are never
+ *          placed in the cache of freed buffers, which only holds buffers for cmem_drv_alloc().
+ * @param[in] context The context used to allocate and map the buffers
+ * @param[in] pool_class The CMEM_POOL_CLASS_* to allocate from
+ * @param[in] dma_capability_a64 Determines the type of physical addresses to allocate, as for cmem_drv_alloc()
+ * @param[in] num_of_buffers The number of buffers to allocate
+ * @param[in] size_of_buffer The size of each buffer in bytes
+ * @param[out] buf_desc The allocated buffers
+ * @return Zero indicates success, any other value failure
+ */
+int32_t cmem_drv_alloc_class (cmem_drv_context_t *const context, const uint32_t pool_class,
+                              const bool dma_capability_a64, const uint32_t num_of_buffers, const size_t size_of_buffer,
+                              cmem_host_buf_desc_t buf_desc[const num_of_buffers])
+{
+    cmem_ioctl_class_buf_t class_buf;
     cmem_ioctl_t cmem_ioctl;
     uint32_t buffer_index = 0;
     uint32_t remaining_num_buffers = num_of_buffers;
@@ -123,41 +411,22 @@ int32_t cmem_drv_alloc (const bool dma_capability_a64,
         const uint32_t alloc_num_buffers = (remaining_num_buffers < CMEM_MAX_BUF_PER_ALLOC) ?
                 remaining_num_buffers : CMEM_MAX_BUF_PER_ALLOC;
 
-        /* Allocate physical address buffers */
-        memset (&cmem_ioctl, 0, sizeof (cmem_ioctl));
-        cmem_ioctl.host_buf_info.num_buffers = alloc_num_buffers;
+        memset (&class_buf, 0, sizeof (class_buf));
+        class_buf.pool_class = pool_class;
+        class_buf.a32 = !dma_capability_a64;
+        class_buf.host_buf_info.num_buffers = alloc_num_buffers;
         for (uint32_t ioctl_index = 0; ioctl_index < alloc_num_buffers; ioctl_index++)
         {
-            cmem_ioctl.host_buf_info.buf_info[ioctl_index].length = size_of_buffer;
+            class_buf.host_buf_info.buf_info[ioctl_index].length = size_of_buffer;
         }
-        rc = ioctl (dev_desc, command, &cmem_ioctl);
+        rc = ioctl (context->dev_desc, CMEM_IOCTL_ALLOC_CLASS_BUFFERS, &class_buf);
 
-        /* Map the buffers into the process address space */
-        for (uint32_t ioctl_index = 0; (rc == 0) && (ioctl_index < alloc_num_buffers); ioctl_index++)
+        if (rc == 0)
         {
-#ifdef CMEM_VERBOSE
-            printf("Debug: mmap param length 0x%zx, Addr: 0x%lx \n", cmem_ioctl.host_buf_info.buf_info[ioctl_index].length,
-                    cmem_ioctl.host_buf_info.buf_info[ioctl_index].dma_address);
-#endif
-            errno = 0;
-            buf_desc[buffer_index].userAddr = mmap (NULL,
-                    cmem_ioctl.host_buf_info.buf_info[ioctl_index].length,
-                    PROT_READ | PROT_WRITE,
-                    MAP_SHARED,
-                    dev_desc,
-                    (off_t) cmem_ioctl.host_buf_info.buf_info[ioctl_index].dma_address);
-            if (buf_desc[buffer_index].userAddr == MAP_FAILED)
-            {
-                rc = errno;
-            }
-            buf_desc[buffer_index].physAddr = cmem_ioctl.host_buf_info.buf_info[ioctl_index].dma_address;
-            buf_desc[buffer_index].length = cmem_ioctl.host_buf_info.buf_info[ioctl_index].length;
-#ifdef CMEM_VERBOSE
-            printf("Buff num %d: Phys addr : 0x%lx User Addr: 0x%lx \n", buffer_index, buf_desc[buffer_index].physAddr,
-                    (uintptr_t) buf_desc[buffer_index].userAddr);
-#endif
-            buffer_index++;
+            cmem_ioctl.host_buf_info = class_buf.host_buf_info;
+            rc = cmem_drv_map_buffers (context, &cmem_ioctl, &buf_desc[buffer_index]);
         }
+        buffer_index += alloc_num_buffers;
 
         remaining_num_buffers -= alloc_num_buffers;
     }
@@ -167,40 +436,925 @@ int32_t cmem_drv_alloc (const bool dma_capability_a64,
 
 
 /**
- * @brief Free contiguous DMA host buffers
+ * @brief Allocate buffers from the pools managed by the granule bitmap allocator, and map them into the address space
+ *        of the calling process
+ * @details The length of each buffer is rounded up to a multiple of the granule_size module parameter.
+ *          The buffers are freed by cmem_drv_free().
+ * @param[in] context The context used to allocate and map the buffers
+ * @param[in] dma_capability_a64 Determines the type of physical addresses to allocate, as for cmem_drv_alloc()
+ * @param[in] num_of_buffers The number of buffers to allocate
+ * @param[in] size_of_buffer The size of each buffer in bytes
+ * @param[out] buf_desc The allocated buffers
+ * @return Zero indicates success, any other value failure
+ */
+int32_t cmem_drv_alloc_granules (cmem_drv_context_t *const context, const bool dma_capability_a64,
+                                 const uint32_t num_of_buffers, const size_t size_of_buffer,
+                                 cmem_host_buf_desc_t buf_desc[const num_of_buffers])
+{
+    return cmem_drv_alloc_with_command (context,
+            dma_capability_a64 ? CMEM_IOCTL_ALLOC_A64_GRANULE_BUFFERS : CMEM_IOCTL_ALLOC_A32_GRANULE_BUFFERS,
+            num_of_buffers, size_of_buffer, buf_desc);
+}
+
+
+/* A physically contiguous range of buffers, used to sort the buffers to be freed */
+typedef struct
+{
+    uint64_t start;
+    uint64_t length;
+} cmem_drv_free_range_t;
+
+
+/**
+ * @brief qsort comparison function for ranges to free, which compares the start values
+ */
+static int cmem_drv_free_range_compare (const void *const compare_a, const void *const compare_b)
+{
+    const cmem_drv_free_range_t *const range_a = compare_a;
+    const cmem_drv_free_range_t *const range_b = compare_b;
+
+    return (range_a->start < range_b->start) ? -1 : ((range_a->start > range_b->start) ? 1 : 0);
+}
+
+
+/**
+ * @brief Free the allocations of the process inside physical address ranges using the driver
+ * @details The ranges are sorted by physical address, and ranges which are physically adjacent are merged. The ranges
+ *          are freed with CMEM_IOCTL_FREE_RANGES, which frees up to CMEM_MAX_BUF_PER_ALLOC ranges with a single
+ *          coalescing of the free space, rather than freeing each buffer individually.
+ * @param[in] context The context used to free the ranges
+ * @param[in] num_of_ranges The number of ranges to free
+ * @param[in/out] ranges The ranges to free, which are sorted and merged
+ * @return The number of allocations freed, or -1 if the driver failed to free any of the ranges
+ */
+static long cmem_drv_free_ranges (cmem_drv_context_t *const context, const uint32_t num_of_ranges,
+                                  cmem_drv_free_range_t ranges[const num_of_ranges])
+{
+    cmem_ioctl_t cmem_ioctl;
+    uint32_t num_ranges = 0;
+    uint32_t range_index;
+    long num_freed = 0;
+    bool ioctl_failed = false;
+
+    /* Merge the ranges which are physically adjacent */
+    qsort (ranges, num_of_ranges, sizeof (ranges[0]), cmem_drv_free_range_compare);
+    for (uint32_t sorted_index = 0; sorted_index < num_of_ranges; sorted_index++)
+    {
+        if ((num_ranges > 0) &&
+            ((ranges[num_ranges - 1].start + ranges[num_ranges - 1].length) == ranges[sorted_index].start))
+        {
+            ranges[num_ranges - 1].length += ranges[sorted_index].length;
+        }
+        else
+        {
+            ranges[num_ranges] = ranges[sorted_index];
+            num_ranges++;
+        }
+    }
+
+    range_index = 0;
+    while (range_index < num_ranges)
+    {
+        const uint32_t remaining_num_ranges = num_ranges - range_index;
+        const uint32_t free_num_ranges = (remaining_num_ranges < CMEM_MAX_BUF_PER_ALLOC) ?
+                remaining_num_ranges : CMEM_MAX_BUF_PER_ALLOC;
+        int ioctl_rc;
+
+        memset (&cmem_ioctl, 0, sizeof (cmem_ioctl));
+        cmem_ioctl.host_buf_info.num_buffers = free_num_ranges;
+        for (uint32_t ioctl_index = 0; ioctl_index < free_num_ranges; ioctl_index++)
+        {
+            cmem_ioctl.host_buf_info.buf_info[ioctl_index].dma_address = ranges[range_index].start;
+            cmem_ioctl.host_buf_info.buf_info[ioctl_index].length = ranges[range_index].length;
+            range_index++;
+        }
+        ioctl_rc = ioctl (context->dev_desc, CMEM_IOCTL_FREE_RANGES, &cmem_ioctl);
+        if (ioctl_rc < 0)
+        {
+            ioctl_failed = true;
+        }
+        else
+        {
+            num_freed += ioctl_rc;
+        }
+    }
+
+    return ioctl_failed ? -1 : num_freed;
+}
+
+
+/**
+ * @brief Free contiguous DMA host buffers using the driver
  * @details This unmaps the host buffers from the process address space, and then free the physical address allocations.
  *          Watching the output of /sys/kernel/debug/x86/pat_memtype_list as each munmap() is performed shows the
  *          physical buffers with write-back mappings being removed.
+ * @param[in] context The context used to free the buffers
  * @param[in] num_of_buffers The number of buffers to free
  * @param[in] buf_desc The array of buffers to free
  * @return Zero indicates success, any other value failure
  */
-int32_t cmem_drv_free (const uint32_t num_of_buffers, const cmem_host_buf_desc_t buf_desc[const num_of_buffers])
+static int32_t cmem_drv_free_buffers (cmem_drv_context_t *const context, const uint32_t num_of_buffers,
+                                      const cmem_host_buf_desc_t buf_desc[const num_of_buffers])
 {
-    cmem_ioctl_t cmem_ioctl;
-    uint32_t buffer_index = 0;
-    uint32_t remaining_num_buffers = num_of_buffers;
+    cmem_drv_free_range_t *const ranges = calloc (num_of_buffers, sizeof (ranges[0]));
     int rc = 0;
 
-    while ((rc == 0) && (remaining_num_buffers > 0))
+    if ((ranges == NULL) && (num_of_buffers > 0))
     {
-        const uint32_t free_num_buffers = (remaining_num_buffers < CMEM_MAX_BUF_PER_ALLOC) ?
-                remaining_num_buffers : CMEM_MAX_BUF_PER_ALLOC;
+        return ENOMEM;
+    }
 
-        memset (&cmem_ioctl, 0, sizeof (cmem_ioctl));
-        cmem_ioctl.host_buf_info.num_buffers = free_num_buffers;
-        for (uint32_t ioctl_index = 0; (rc == 0) && (ioctl_index < free_num_buffers); ioctl_index++)
+    for (uint32_t buffer_index = 0; buffer_index < num_of_buffers; buffer_index++)
+    {
+        cmem_addr_index_remove (buf_desc[buffer_index].userAddr);
+        if (munmap ((void *)buf_desc[buffer_index].userAddr, buf_desc[buffer_index].length) != 0)
+        {
+            rc = -1;
+        }
+        ranges[buffer_index].start = buf_desc[buffer_index].physAddr;
+        ranges[buffer_index].length = buf_desc[buffer_index].length;
+    }
+
+    /* Fail if not all buffers were found as allocations of this process */
+    if (cmem_drv_free_ranges (context, num_of_buffers, ranges) != num_of_buffers)
+    {
+        rc = -1;
+    }
+    free (ranges);
+
+    return rc;
+}
+
+
+/**
+ * @brief Free buffers removed from the cache of freed buffers
+ * @param[in] context The context whose cache is trimmed
+ * @param[in] remove_all When true all buffers in the cache are freed, otherwise the oldest buffers are freed until the
+ *                       cache is under the high-water marks
+ * @return Zero indicates success, any other value failure
+ */
+static int32_t cmem_drv_recycle_evict (cmem_drv_context_t *const context, const bool remove_all)
+{
+    cmem_host_buf_desc_t evicted[CMEM_MAX_BUF_PER_ALLOC];
+    uint32_t num_evicted;
+    int32_t rc = 0;
+
+    do
+    {
+        num_evicted = cmem_recycle_trim (context->recycle, remove_all, CMEM_MAX_BUF_PER_ALLOC, evicted);
+        if ((num_evicted > 0) && (cmem_drv_free_buffers (context, num_evicted, evicted) != 0))
+        {
+            rc = -1;
+        }
+    } while (num_evicted == CMEM_MAX_BUF_PER_ALLOC);
+
+    return rc;
+}
+
+
+/**
+ * @brief Read the table of pools of a context from the status page, the first time it is required
+ * @details Racing threads may each take a snapshot of the status page, but only the first stores the table.
+ * @param[in/out] context The context whose table of pools is read
+ * @return Returns true if the table is valid, or false if the status page couldn't be read
+ */
+static bool cmem_drv_read_pool_ranges (cmem_drv_context_t *const context)
+{
+    cmem_status_page_t status;
+
+    if (__atomic_load_n (&context->pool_ranges_valid, __ATOMIC_ACQUIRE))
+    {
+        return true;
+    }
+    if (cmem_drv_read_status (context, &status) != 0)
+    {
+        return false;
+    }
+
+    pthread_mutex_lock (&context->status_page_lock);
+    if (!context->pool_ranges_valid)
+    {
+        context->num_pool_ranges = (status.num_pools < CMEM_STATUS_MAX_POOLS) ? status.num_pools : CMEM_STATUS_MAX_POOLS;
+        for (uint32_t pool_index = 0; pool_index < context->num_pool_ranges; pool_index++)
+        {
+            context->pool_ranges[pool_index].start = status.pools[pool_index].start;
+            context->pool_ranges[pool_index].size = status.pools[pool_index].size;
+            context->pool_ranges[pool_index].pool_class = status.pools[pool_index].pool_class;
+        }
+        __atomic_store_n (&context->pool_ranges_valid, true, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock (&context->status_page_lock);
+
+    return true;
+}
+
+
+/**
+ * @brief Determine if a buffer can be placed in the cache of freed buffers, which only holds buffers in the
+ *        CMEM_POOL_CLASS_DRAM pools used by cmem_drv_alloc()
+ * @param[in] context The context whose table of pools has been read by cmem_drv_read_pool_ranges()
+ * @param[in] buf_desc The buffer being freed
+ * @return Returns true if the buffer isn't in a pool of another class
+ */
+static bool cmem_drv_recyclable (const cmem_drv_context_t *const context, const cmem_host_buf_desc_t *const buf_desc)
+{
+    for (uint32_t pool_index = 0; pool_index < context->num_pool_ranges; pool_index++)
+    {
+        const cmem_drv_pool_range_t *const pool = &context->pool_ranges[pool_index];
+
+        if ((buf_desc->physAddr >= pool->start) && (buf_desc->physAddr < (pool->start + pool->size)))
+        {
+            return pool->pool_class == CMEM_POOL_CLASS_DRAM;
+        }
+    }
+
+    return true;
+}
+
+
+/**
+ * @brief Free contiguous DMA host buffers
+ * @details When the cache of freed buffers is enabled the buffers are placed in the cache, where they remain mapped
+ *          and allocated, and then the oldest buffers in the cache are freed by the driver to keep the cache under the
+ *          high-water marks. Otherwise, or for buffers which can't be cached, the buffers are freed by the driver.
+ *          Buffers allocated by cmem_drv_alloc_class() from other than CMEM_POOL_CLASS_DRAM aren't cached.
+ * @param[in] context The context used to free the buffers
+ * @param[in] num_of_buffers The number of buffers to free
+ * @param[in] buf_desc The array of buffers to free
+ * @return Zero indicates success, any other value failure
+ */
+int32_t cmem_drv_free (cmem_drv_context_t *const context,
+                       const uint32_t num_of_buffers, const cmem_host_buf_desc_t buf_desc[const num_of_buffers])
+{
+    cmem_host_buf_desc_t *uncached_buffers;
+    uint32_t num_uncached_buffers = 0;
+    bool pools_known;
+    int32_t put_rc;
+    int32_t rc = 0;
+
+    if (!cmem_recycle_enabled (context->recycle))
+    {
+        return cmem_drv_free_buffers (context, num_of_buffers, buf_desc);
+    }
+
+    /* When the pools can't be read all buffers are treated as in CMEM_POOL_CLASS_DRAM pools */
+    pools_known = cmem_drv_read_pool_ranges (context);
+
+    uncached_buffers = calloc (num_of_buffers, sizeof (uncached_buffers[0]));
+    if ((uncached_buffers == NULL) && (num_of_buffers > 0))
+    {
+        return ENOMEM;
+    }
+
+    for (uint32_t buffer_index = 0; buffer_index < num_of_buffers; buffer_index++)
+    {
+        put_rc = (!pools_known || cmem_drv_recyclable (context, &buf_desc[buffer_index])) ?
+                cmem_recycle_put (context->recycle, &buf_desc[buffer_index]) : ENOSPC;
+        if (put_rc == EINVAL)
+        {
+            /* Already in the cache, so freeing it again would free a buffer which may be handed out */
+            rc = -1;
+        }
+        else if (put_rc != 0)
         {
-            cmem_ioctl.host_buf_info.buf_info[ioctl_index].dma_address = buf_desc[buffer_index].physAddr;
-            cmem_ioctl.host_buf_info.buf_info[ioctl_index].length = buf_desc[buffer_index].length;
-            rc = munmap ((void *)buf_desc[buffer_index].userAddr, buf_desc[buffer_index].length);
-            buffer_index++;
+            uncached_buffers[num_uncached_buffers] = buf_desc[buffer_index];
+            num_uncached_buffers++;
         }
-        rc = ioctl (dev_desc, CMEM_IOCTL_FREE_HOST_BUFFERS, &cmem_ioctl);
+    }
 
-        remaining_num_buffers -= free_num_buffers;
+    if ((num_uncached_buffers > 0) && (cmem_drv_free_buffers (context, num_uncached_buffers, uncached_buffers) != 0))
+    {
+        rc = -1;
+    }
+    free (uncached_buffers);
+    if (cmem_drv_recycle_evict (context, false) != 0)
+    {
+        rc = -1;
     }
 
     return rc;
 }
 
+
+/**
+ * @brief Configure the cache of freed buffers of a context
+ * @details The cache is intended for workloads which repeatedly allocate and free buffers of the same lengths, and
+ *          avoids the allocation ioctl, mmap, munmap and free ioctl for each buffer. Buffers in the cache remain
+ *          allocated to the process, so aren't available to other processes. The cache is trimmed to the new
+ *          high-water marks, and disabling the cache frees all buffers in it.
+ * @param[in] context The context whose cache is configured
+ * @param[in] config The high-water marks for the cache, where max_cached_bytes of zero disables the cache
+ * @return Zero indicates success, any other value failure
+ */
+int32_t cmem_drv_recycle_configure (cmem_drv_context_t *const context, const cmem_drv_recycle_config_t *const config)
+{
+    cmem_recycle_configure (context->recycle, config);
+
+    return cmem_drv_recycle_evict (context, config->max_cached_bytes == 0);
+}
+
+
+/**
+ * @brief Free all buffers in the cache of freed buffers of a context, leaving the cache enabled
+ * @details E.g. to release memory for other processes after a burst of activity
+ * @param[in] context The context whose cache is flushed
+ * @return Zero indicates success, any other value failure
+ */
+int32_t cmem_drv_recycle_flush (cmem_drv_context_t *const context)
+{
+    return cmem_drv_recycle_evict (context, true);
+}
+
+
+/**
+ * @brief Get the statistics for the cache of freed buffers of a context
+ * @param[in] context The context whose cache statistics are returned
+ * @param[out] stats The statistics
+ */
+void cmem_drv_recycle_get_stats (cmem_drv_context_t *const context, cmem_drv_recycle_stats_t *const stats)
+{
+    cmem_recycle_get_stats (context->recycle, stats);
+}
+
+
+/* The segments removed from the index by cmem_drv_free_all(), which are freed once all have been unmapped */
+typedef struct
+{
+    cmem_drv_free_range_t *ranges;
+    uint32_t num_ranges;
+    uint32_t ranges_length;
+    int32_t rc;
+} cmem_drv_free_all_ranges_t;
+
+
+/**
+ * @brief Callback to unmap a segment removed from the index by cmem_drv_free_all(), and record its physical range
+ */
+static void cmem_drv_unmap_segment (void *const callback_arg, void *const user_addr, const uint64_t phys_addr,
+                                    const size_t length)
+{
+    cmem_drv_free_all_ranges_t *const free_all = callback_arg;
+    cmem_drv_free_range_t *grown_ranges;
+
+    if (munmap (user_addr, length) != 0)
+    {
+        free_all->rc = -1;
+    }
+
+    if (free_all->num_ranges == free_all->ranges_length)
+    {
+        grown_ranges = realloc (free_all->ranges, (free_all->ranges_length + 64) * sizeof (free_all->ranges[0]));
+        if (grown_ranges == NULL)
+        {
+            /* The allocation remains until the process exits */
+            free_all->rc = -1;
+            return;
+        }
+        free_all->ranges = grown_ranges;
+        free_all->ranges_length += 64;
+    }
+    free_all->ranges[free_all->num_ranges].start = phys_addr;
+    free_all->ranges[free_all->num_ranges].length = length;
+    free_all->num_ranges++;
+}
+
+
+/**
+ * @brief Free all host buffers mapped through a context
+ * @details Unmaps all buffers mapped through the context, including those in its cache of freed buffers, and frees
+ *          the physical address allocations with CMEM_IOCTL_FREE_RANGES. Attached named buffers are unmapped, but not
+ *          destroyed.
+ *
+ *          Buffers allocated through other contexts of the process, and the caches of freed buffers of other contexts,
+ *          are left unchanged.
+ * @param[in] context The context used to free the buffers
+ * @return Zero indicates success, any other value failure
+ */
+int32_t cmem_drv_free_all (cmem_drv_context_t *const context)
+{
+    cmem_host_buf_desc_t discarded[CMEM_MAX_BUF_PER_ALLOC];
+    cmem_drv_free_all_ranges_t free_all = {0};
+
+    /* The cached buffers are still mapped through the context, so are unmapped and freed along with all other buffers */
+    while (cmem_recycle_trim (context->recycle, true, CMEM_MAX_BUF_PER_ALLOC, discarded) > 0)
+    {
+    }
+    if (cmem_addr_index_remove_owned (context, cmem_drv_unmap_segment, &free_all) != 0)
+    {
+        return -1;
+    }
+
+    /* Named buffers in the ranges aren't freed, since they aren't owned by the process */
+    if ((free_all.num_ranges > 0) && (cmem_drv_free_ranges (context, free_all.num_ranges, free_all.ranges) < 0))
+    {
+        free_all.rc = -1;
+    }
+    free (free_all.ranges);
+
+    return free_all.rc;
+}
+
+
+/**
+ * @brief Resize a buffer allocated by cmem_drv_alloc() or cmem_drv_alloc_granules() without moving the contents
+ * @details Shrinking returns the tail of the buffer to the pool, and then unmaps the tail. munmap() is used rather than
+ *          mremap(), since a buffer which has grown may be mapped by more than one VMA.
+ *
+ *          Growing first extends the physical allocation into the free space which follows the buffer. The mapping
+ *          can't be grown by mremap() since the cmem mappings are VM_PFNMAP, so the extension is mapped immediately
+ *          after the existing mapping with MAP_FIXED_NOREPLACE. If that address range is in use the entire buffer is
+ *          mapped at a new virtual address, and the old mapping removed. In both cases the physical memory is
+ *          unchanged and so no data is copied.
+ * @param[in] context The context used to resize and map the buffer
+ * @param[in] dma_capability_a64 When false the buffer may not grow beyond the first 4 GiB of physical addresses
+ * @param[in/out] buf_desc The buffer to resize. On success updated with the new length, and the virtual address which
+ *                         may have changed when the buffer grows.
+ * @param[in] new_size The required size of the buffer in bytes
+ * @return Zero indicates success, any other value failure. ENOMEM means there isn't enough free space following the
+ *         buffer, in which case the buffer is unchanged. If the extension of a grown buffer can't be mapped the
+ *         buffer is shrunk back to its original length. If the tail of a shrunk buffer can't be unmapped the
+ *         failure is returned with buf_desc updated, since the tail has already been returned to the pool.
+ */
+int32_t cmem_drv_resize (cmem_drv_context_t *const context, const bool dma_capability_a64,
+                         cmem_host_buf_desc_t *const buf_desc, const size_t new_size)
+{
+    const size_t page_size = (size_t) sysconf (_SC_PAGESIZE);
+    const size_t old_map_length = ((buf_desc->length + page_size - 1) / page_size) * page_size;
+    size_t new_map_length;
+    cmem_ioctl_resize_buf_t resize_buf =
+    {
+        .dma_address = buf_desc->physAddr,
+        .length = buf_desc->length,
+        .new_length = new_size
+    };
+    uint8_t *new_user_addr = buf_desc->userAddr;
+    void *extension_addr;
+    int32_t unmap_rc = 0;
+    int32_t map_rc;
+    int32_t rc;
+
+    if (new_size < buf_desc->length)
+    {
+        /* The tail is only unmapped once the driver has returned it to the pool, so that a failed resize leaves
+         * the whole buffer mapped */
+        if (ioctl (context->dev_desc,
+                dma_capability_a64 ? CMEM_IOCTL_RESIZE_A64_BUFFER : CMEM_IOCTL_RESIZE_A32_BUFFER, &resize_buf) != 0)
+        {
+            return errno;
+        }
+        new_map_length = ((resize_buf.length + page_size - 1) / page_size) * page_size;
+        if ((new_map_length < old_map_length) &&
+            (munmap (buf_desc->userAddr + new_map_length, old_map_length - new_map_length) != 0))
+        {
+            /* The buffer has still been shrunk, so record the new length before reporting the failure */
+            unmap_rc = errno;
+        }
+    }
+    else
+    {
+        if (ioctl (context->dev_desc,
+                dma_capability_a64 ? CMEM_IOCTL_RESIZE_A64_BUFFER : CMEM_IOCTL_RESIZE_A32_BUFFER, &resize_buf) != 0)
+        {
+            return errno;
+        }
+
+        new_map_length = ((resize_buf.length + page_size - 1) / page_size) * page_size;
+        if (new_map_length > old_map_length)
+        {
+            extension_addr = mmap (buf_desc->userAddr + old_map_length, new_map_length - old_map_length,
+                    PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED_NOREPLACE, context->dev_desc,
+                    (off_t) (buf_desc->physAddr + old_map_length));
+            if (extension_addr != (void *) (buf_desc->userAddr + old_map_length))
+            {
+                /* Kernels before 4.17 ignore MAP_FIXED_NOREPLACE, and may map the extension at another address */
+                if (extension_addr != MAP_FAILED)
+                {
+                    munmap (extension_addr, new_map_length - old_map_length);
+                }
+
+                new_user_addr = mmap (NULL, new_map_length, PROT_READ | PROT_WRITE, MAP_SHARED, context->dev_desc,
+                        (off_t) buf_desc->physAddr);
+                if (new_user_addr == MAP_FAILED)
+                {
+                    /* Shrink the buffer back to its original length, so the driver doesn't hold an extension
+                     * which isn't mapped or recorded in buf_desc */
+                    map_rc = errno;
+                    resize_buf.new_length = buf_desc->length;
+                    ioctl (context->dev_desc,
+                            dma_capability_a64 ? CMEM_IOCTL_RESIZE_A64_BUFFER : CMEM_IOCTL_RESIZE_A32_BUFFER,
+                            &resize_buf);
+                    return map_rc;
+                }
+                munmap (buf_desc->userAddr, old_map_length);
+            }
+        }
+    }
+
+    cmem_addr_index_remove (buf_desc->userAddr);
+    buf_desc->userAddr = new_user_addr;
+    buf_desc->length = resize_buf.length;
+    rc = cmem_addr_index_insert (buf_desc->userAddr, buf_desc->physAddr, buf_desc->length, context);
+
+    return (unmap_rc != 0) ? unmap_rc : rc;
+}
+
+
+/**
+ * @brief Read a consistent snapshot of the capacity of the pools, without a system call once the status page is mapped
+ * @details The status page is mapped on the first call for the context, under a mutex in case multiple threads make
+ *          the first call at once. The contents are copied while the sequence count is even and unchanged, retrying if
+ *          the driver updated the page during the copy.
+ * @param[in] context The context used to map the status page
+ * @param[out] status The snapshot of the status page
+ * @return Zero indicates success, any other value failure
+ */
+int32_t cmem_drv_read_status (cmem_drv_context_t *const context, cmem_status_page_t *const status)
+{
+    const cmem_status_page_t *status_page = __atomic_load_n (&context->status_page, __ATOMIC_ACQUIRE);
+    uint32_t sequence;
+    int32_t rc = 0;
+
+    if (status_page == NULL)
+    {
+        pthread_mutex_lock (&context->status_page_lock);
+        status_page = context->status_page;
+        if (status_page == NULL)
+        {
+            const void *const mapping = mmap (NULL, (size_t) sysconf (_SC_PAGESIZE), PROT_READ, MAP_SHARED,
+                    context->dev_desc, (off_t) CMEM_STATUS_PAGE_OFFSET);
+
+            if (mapping == MAP_FAILED)
+            {
+                rc = errno;
+            }
+            else
+            {
+                status_page = mapping;
+                __atomic_store_n (&context->status_page, status_page, __ATOMIC_RELEASE);
+            }
+        }
+        pthread_mutex_unlock (&context->status_page_lock);
+        if (rc != 0)
+        {
+            return rc;
+        }
+    }
+
+    do
+    {
+        sequence = __atomic_load_n (&status_page->sequence, __ATOMIC_ACQUIRE);
+        memcpy (status, (const void *) status_page, sizeof (*status));
+        __atomic_thread_fence (__ATOMIC_ACQUIRE);
+    } while (((sequence & 1) != 0) || (__atomic_load_n (&status_page->sequence, __ATOMIC_RELAXED) != sequence));
+
+    return 0;
+}
+
+
+/**
+ * @brief Allocate a scatter-gather host memory buffer, and map it into the address space of the calling process
+ * @details The buffer is made up of one or more physically contiguous chunks, which are mapped back-to-back into
+ *          one contiguous virtual address range. A single chunk is used when a large enough free region is available.
+ * @param[in] context The context used to allocate and map the buffer
+ * @param[in] dma_capability_a64 Determines the type of physical addresses to allocate, as for cmem_drv_alloc()
+ * @param[in] size_of_buffer The size of the buffer in bytes, which is rounded up to a multiple of chunk_granularity
+ * @param[in] chunk_granularity The length of each chunk is a multiple of this, which must be a power of two
+ *                              and at least the page size
+ * @param[in] chunk_alignment The physical start address of each chunk is aligned to this, which must be a power of two
+ *                            and at least the page size
+ * @param[out] sg_buf_desc The allocated buffer, with the table of chunks
+ * @return Zero indicates success, any other value failure
+ */
+int32_t cmem_drv_alloc_sg (cmem_drv_context_t *const context, const bool dma_capability_a64, const size_t size_of_buffer,
+                           const size_t chunk_granularity, const size_t chunk_alignment,
+                           cmem_host_sg_buf_desc_t *const sg_buf_desc)
+{
+    _Static_assert (CMEM_HOST_SG_MAX_CHUNKS == CMEM_MAX_SG_CHUNKS, "Inconsistent maximum number of SG chunks");
+    const unsigned long command = dma_capability_a64 ? CMEM_IOCTL_ALLOC_A64_SG_BUFFER : CMEM_IOCTL_ALLOC_A32_SG_BUFFER;
+    cmem_ioctl_sg_buf_t sg_buf;
+    size_t chunk_offset;
+    int rc;
+
+    memset (sg_buf_desc, 0, sizeof (*sg_buf_desc));
+    memset (&sg_buf, 0, sizeof (sg_buf));
+    sg_buf.length = (chunk_granularity > 0) ?
+            ((size_of_buffer + chunk_granularity - 1) / chunk_granularity) * chunk_granularity : size_of_buffer;
+    sg_buf.chunk_granularity = chunk_granularity;
+    sg_buf.chunk_alignment = chunk_alignment;
+    rc = ioctl (context->dev_desc, command, &sg_buf);
+    if (rc != 0)
+    {
+        return rc;
+    }
+
+    /* Map all the chunks, using the physical address of the first chunk to identify the scatter-gather buffer */
+    errno = 0;
+    sg_buf_desc->userAddr = mmap (NULL, sg_buf.length, PROT_READ | PROT_WRITE, MAP_SHARED, context->dev_desc,
+            (off_t) sg_buf.chunks[0].dma_address);
+    if (sg_buf_desc->userAddr == MAP_FAILED)
+    {
+        rc = errno;
+        ioctl (context->dev_desc, CMEM_IOCTL_FREE_SG_BUFFER, &sg_buf);
+        return rc;
+    }
+
+    sg_buf_desc->length = sg_buf.length;
+    sg_buf_desc->num_chunks = sg_buf.num_chunks;
+    chunk_offset = 0;
+    for (uint32_t chunk_index = 0; (rc == 0) && (chunk_index < sg_buf.num_chunks); chunk_index++)
+    {
+        cmem_host_buf_desc_t *const chunk = &sg_buf_desc->chunks[chunk_index];
+
+        chunk->physAddr = sg_buf.chunks[chunk_index].dma_address;
+        chunk->userAddr = &sg_buf_desc->userAddr[chunk_offset];
+        chunk->length = sg_buf.chunks[chunk_index].length;
+        rc = cmem_addr_index_insert (chunk->userAddr, chunk->physAddr, chunk->length, context);
+#ifdef CMEM_VERBOSE
+        printf("SG chunk %u: Phys addr : 0x%lx User Addr: 0x%lx Length: 0x%zx\n", chunk_index, chunk->physAddr,
+                (uintptr_t) chunk->userAddr, chunk->length);
+#endif
+        chunk_offset += chunk->length;
+    }
+
+    return rc;
+}
+
+
+/**
+ * @brief Free a scatter-gather host memory buffer allocated by cmem_drv_alloc_sg()
+ * @param[in] context The context used to free the buffer
+ * @param[in] sg_buf_desc The buffer to free
+ * @return Zero indicates success, any other value failure
+ */
+int32_t cmem_drv_free_sg (cmem_drv_context_t *const context, const cmem_host_sg_buf_desc_t *const sg_buf_desc)
+{
+    cmem_ioctl_sg_buf_t sg_buf;
+    int rc;
+
+    for (uint32_t chunk_index = 0; chunk_index < sg_buf_desc->num_chunks; chunk_index++)
+    {
+        cmem_addr_index_remove (sg_buf_desc->chunks[chunk_index].userAddr);
+    }
+    rc = munmap (sg_buf_desc->userAddr, sg_buf_desc->length);
+
+    memset (&sg_buf, 0, sizeof (sg_buf));
+    sg_buf.chunks[0].dma_address = sg_buf_desc->chunks[0].physAddr;
+    if (ioctl (context->dev_desc, CMEM_IOCTL_FREE_SG_BUFFER, &sg_buf) != 0)
+    {
+        rc = -1;
+    }
+
+    return rc;
+}
+
+
+/**
+ * @brief Attach to a named host memory buffer, creating it if it doesn't exist, and map it into the address space of
+ *        the calling process
+ * @details A named buffer isn't freed when the process exits, so a restarted process can attach to the buffer by name
+ *          and find the contents intact. The buffer persists until destroyed by cmem_drv_destroy_named(), by writing
+ *          the name to /sys/class/cmem/cmem/destroy_named_buffer, or the cmem module is unloaded.
+ *          The buffers in existence are listed by /sys/class/cmem/cmem/named_buffers.
+ * @param[in] context The context used to attach to and map the buffer
+ * @param[in] dma_capability_a64 Determines the type of physical addresses to allocate, as for cmem_drv_alloc()
+ * @param[in] name The name of the buffer, which must be shorter than CMEM_MAX_NAME_LENGTH
+ * @param[in] size_of_buffer The size of the buffer to create. When attaching to an existing buffer, the existing
+ *                           buffer must be at least this size. Zero only attaches to an existing buffer.
+ * @param[out] buf_desc The buffer, where the length is that of the named buffer
+ * @param[out] created Set true if the buffer was created, or false if attached to an existing buffer
+ * @return Zero indicates success, otherwise the errno value for the failure
+ */
+int32_t cmem_drv_alloc_named (cmem_drv_context_t *const context, const bool dma_capability_a64,
+                              const char *const name, const size_t size_of_buffer,
+                              cmem_host_buf_desc_t *const buf_desc, bool *const created)
+{
+    const unsigned long command = dma_capability_a64 ? CMEM_IOCTL_ALLOC_A64_NAMED_BUFFER : CMEM_IOCTL_ALLOC_A32_NAMED_BUFFER;
+    cmem_ioctl_named_buf_t named_buf;
+    int32_t rc;
+
+    memset (buf_desc, 0, sizeof (*buf_desc));
+    memset (&named_buf, 0, sizeof (named_buf));
+    if (strlen (name) >= sizeof (named_buf.name))
+    {
+        return EINVAL;
+    }
+    strcpy (named_buf.name, name);
+    named_buf.length = size_of_buffer;
+    if (ioctl (context->dev_desc, command, &named_buf) != 0)
+    {
+        return errno;
+    }
+
+    buf_desc->userAddr = mmap (NULL, named_buf.length, PROT_READ | PROT_WRITE, MAP_SHARED, context->dev_desc,
+            (off_t) named_buf.dma_address);
+    if (buf_desc->userAddr == MAP_FAILED)
+    {
+        buf_desc->userAddr = NULL;
+        return errno;
+    }
+    buf_desc->physAddr = named_buf.dma_address;
+    buf_desc->length = named_buf.length;
+    *created = named_buf.created != 0;
+
+    rc = cmem_addr_index_insert (buf_desc->userAddr, buf_desc->physAddr, buf_desc->length, context);
+
+    return rc;
+}
+
+
+/**
+ * @brief Unmap a named host memory buffer from the calling process, leaving the buffer and its contents in existence
+ * @param[in] buf_desc The buffer returned by cmem_drv_alloc_named()
+ * @return Zero indicates success, otherwise the errno value for the failure
+ */
+int32_t cmem_drv_detach_named (const cmem_host_buf_desc_t *const buf_desc)
+{
+    cmem_addr_index_remove (buf_desc->userAddr);
+
+    return (munmap (buf_desc->userAddr, buf_desc->length) == 0) ? 0 : errno;
+}
+
+
+/**
+ * @brief Destroy a named host memory buffer, freeing the physical memory
+ * @details Any process may destroy a named buffer. The buffer should have been detached by all processes first.
+ * @param[in] context The context used to destroy the buffer
+ * @param[in] name The name of the buffer to destroy
+ * @return Zero indicates success, otherwise the errno value for the failure. ENOENT if the buffer doesn't exist.
+ */
+int32_t cmem_drv_destroy_named (cmem_drv_context_t *const context, const char *const name)
+{
+    cmem_ioctl_named_buf_t named_buf;
+
+    memset (&named_buf, 0, sizeof (named_buf));
+    if (strlen (name) >= sizeof (named_buf.name))
+    {
+        return EINVAL;
+    }
+    strcpy (named_buf.name, name);
+
+    return (ioctl (context->dev_desc, CMEM_IOCTL_DESTROY_NAMED_BUFFER, &named_buf) == 0) ? 0 : errno;
+}
+
+
+/**
+ * @brief Translate a virtual address inside a cmem buffer mapped by cmem_drv_alloc() to a physical address
+ * @details May be called from any thread, including while other threads are allocating or freeing buffers.
+ *          Uses a binary search of the buffers mapped by the process.
+ * @param[in] user_addr The virtual address to translate, which may be anywhere inside a buffer
+ * @param[out] phys_addr The physical address corresponding to user_addr
+ * @param[out] contiguous_length The number of bytes from user_addr which are physically contiguous
+ * @return Zero indicates success, or EFAULT if user_addr isn't in a mapped cmem buffer
+ */
+int32_t cmem_drv_virt_to_phys (const void *const user_addr, uint64_t *const phys_addr, size_t *const contiguous_length)
+{
+    return cmem_addr_index_lookup (user_addr, phys_addr, contiguous_length);
+}
+
+
+/**
+ * @brief Write the contents of physically contiguous cmem memory to a file descriptor, such as a file or pipe
+ * @details Uses sendfile() from the cmem device, where the file position is the physical address, so that the
+ *          contents are copied by the Kernel without passing through user space. The memory must be part of a buffer
+ *          allocated by this process. For a scatter-gather buffer call once for each chunk.
+ * @param[in] context The context used to read the memory
+ * @param[in] phys_addr The physical address of the start of the memory to write
+ * @param[in] length The number of bytes to write
+ * @param[in] out_fd The file descriptor to write to, at its current file position
+ * @return Zero indicates success, otherwise the errno value for the failure
+ */
+int32_t cmem_drv_export_to_fd (cmem_drv_context_t *const context,
+                               const uint64_t phys_addr, const size_t length, const int out_fd)
+{
+    off_t offset = (off_t) phys_addr;
+    size_t remaining = length;
+
+    while (remaining > 0)
+    {
+        const ssize_t num_sent = sendfile (out_fd, context->dev_desc, &offset, remaining);
+
+        if (num_sent < 0)
+        {
+            if (errno != EINTR)
+            {
+                return errno;
+            }
+        }
+        else if (num_sent == 0)
+        {
+            return EIO;
+        }
+        else
+        {
+            remaining -= (size_t) num_sent;
+        }
+    }
+
+    return 0;
+}
+
+
+/**
+ * @brief Perform CPU cache maintenance on ranges of buffers, for devices which don't snoop the CPU caches
+ * @details Allows buffers to keep write-back mappings, only paying the coherency cost for the ranges which a device
+ *          accesses. The ranges are passed to the driver in batches of up to CMEM_MAX_CACHE_RANGES per ioctl.
+ * @param[in] context The context used to perform the maintenance
+ * @param[in] flush When false the cache lines are written back and remain valid, which is used before a device reads
+ *                  the ranges. When true the cache lines are also invalidated, which is used after a device has written
+ *                  the ranges and before the CPU reads them.
+ * @param[in] num_ranges The number of ranges
+ * @param[in] ranges The physical address and length of each range, which must be inside one buffer
+ * @return Zero indicates success, any other value failure
+ */
+int32_t cmem_drv_cache_maintenance (cmem_drv_context_t *const context, const bool flush, const uint32_t num_ranges,
+                                    const cmem_cache_range_t ranges[const num_ranges])
+{
+    const unsigned long command = flush ? CMEM_IOCTL_FLUSH_CACHE_RANGES : CMEM_IOCTL_CLEAN_CACHE_RANGES;
+    cmem_ioctl_cache_ranges_t cache_ranges;
+    uint32_t range_index = 0;
+
+    while (range_index < num_ranges)
+    {
+        const uint32_t remaining = num_ranges - range_index;
+
+        cache_ranges.num_ranges = (remaining < CMEM_MAX_CACHE_RANGES) ? remaining : CMEM_MAX_CACHE_RANGES;
+        memcpy (cache_ranges.ranges, &ranges[range_index], cache_ranges.num_ranges * sizeof (ranges[0]));
+        if (ioctl (context->dev_desc, command, &cache_ranges) != 0)
+        {
+            return -1;
+        }
+        range_index += cache_ranges.num_ranges;
+    }
+
+    return 0;
+}
+
+
+/**
+ * @brief Start the loopback engine of a context, a kernel thread in the driver which stands in for a DMA engine
+ * @details The engine consumes cmem_loopback_descriptor_t from the descriptor ring, and produces a
+ *          cmem_loopback_completion_t in the completion ring for each. The rings are cmem_ring_t created with the same
+ *          context, with slot sizes of the descriptor and completion. Each context has at most one engine.
+ * @param[in] context The context to start the engine for
+ * @param[in] params The physical addresses and sizes of the rings, and the rate and latency of the engine
+ * @return Zero indicates success, any other value failure
+ */
+int32_t cmem_drv_loopback_start (cmem_drv_context_t *const context, const cmem_ioctl_loopback_t *const params)
+{
+    return (ioctl (context->dev_desc, CMEM_IOCTL_LOOPBACK_START, params) == 0) ? 0 : errno;
+}
+
+
+/**
+ * @brief Wake the loopback engine of a context, after publishing descriptors
+ * @details Without the doorbell an idle engine only polls the descriptor ring every millisecond.
+ * @param[in] context The context whose engine is woken
+ * @return Zero indicates success, any other value failure
+ */
+int32_t cmem_drv_loopback_doorbell (cmem_drv_context_t *const context)
+{
+    return (ioctl (context->dev_desc, CMEM_IOCTL_LOOPBACK_DOORBELL) == 0) ? 0 : errno;
+}
+
+
+/**
+ * @brief Wait for the loopback engine of a context to write to the completion ring
+ * @param[in] context The context whose engine is waited for
+ * @param[in] timeout_ms The maximum time to wait in milliseconds, or -1 to wait indefinitely
+ * @return Zero when the completion ring isn't empty, ETIMEDOUT if the timeout expired, or another errno value on failure
+ */
+int32_t cmem_drv_loopback_wait (cmem_drv_context_t *const context, const int timeout_ms)
+{
+    struct pollfd poll_fd =
+    {
+        .fd = context->dev_desc,
+        .events = POLLIN
+    };
+    int num_ready;
+
+    do
+    {
+        num_ready = poll (&poll_fd, 1, timeout_ms);
+    } while ((num_ready < 0) && (errno == EINTR));
+
+    if (num_ready < 0)
+    {
+        return errno;
+    }
+
+    return (num_ready == 0) ? ETIMEDOUT : 0;
+}
+
+
+/**
+ * @brief Stop the loopback engine of a context
+ * @details Descriptors which haven't been consumed by the engine are left in the descriptor ring.
+ *          The engine is also stopped when the context is closed.
+ * @param[in] context The context whose engine is stopped
+ * @param[out] stats The statistics of the engine since it was started
+ * @return Zero indicates success, any other value failure
+ */
+int32_t cmem_drv_loopback_stop (cmem_drv_context_t *const context, cmem_ioctl_loopback_stats_t *const stats)
+{
+    return (ioctl (context->dev_desc, CMEM_IOCTL_LOOPBACK_STOP, stats) == 0) ? 0 : errno;
+}
@@ -42,16 +42,97 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <stddef.h>
+#include <linux/ioctl.h>
+#include <linux/io_uring.h>
 #include "inc/buffdesc.h"
+#include "cmem.h"
 
 #undef CMEM_VERBOSE
 
-int32_t cmem_drv_open(void);
-int32_t cmem_drv_close(void);
-int32_t cmem_drv_alloc (const bool dma_capability_a64,
+/* A context for using the cmem driver, created by cmem_drv_open(). Opaque to callers.
+ * A context may be used by multiple threads at once, and a process may open more than one context. */
+typedef struct cmem_drv_context_s cmem_drv_context_t;
+
+/* Configures the optional cache of freed buffers of a context, which keeps freed buffers mapped and allocated so that
+ * a later cmem_drv_alloc() of the same length is satisfied without calling the driver. Disabled by default. */
+typedef struct
+{
+    /* High-water mark for the total length of the buffers in the cache. Zero disables the cache. */
+    uint64_t max_cached_bytes;
+    /* High-water mark for the number of buffers of each length in the cache. Zero means only max_cached_bytes applies. */
+    uint32_t max_buffers_per_class;
+    /* Freed buffers longer than this are always freed by the driver. Zero means only max_cached_bytes applies. */
+    uint64_t max_buffer_length;
+} cmem_drv_recycle_config_t;
+
+/* Statistics for the cache of freed buffers of a context, used to tune the cmem_drv_recycle_config_t */
+typedef struct
+{
+    /* Buffers allocated from the cache */
+    uint64_t hits;
+    /* Buffers allocated by the driver while the cache was enabled, since no buffer of the length was in the cache */
+    uint64_t misses;
+    /* Freed buffers placed in the cache */
+    uint64_t retained;
+    /* Freed buffers which were freed by the driver while the cache was enabled, since they exceeded max_buffer_length
+     * or max_cached_bytes */
+    uint64_t rejected;
+    /* Buffers removed from the cache and freed by the driver, to keep the cache under the high-water marks or when
+     * the cache is flushed or disabled */
+    uint64_t evicted;
+    /* The number of buffers currently in the cache, and their total length in bytes */
+    uint32_t cached_buffers;
+    uint64_t cached_bytes;
+    /* The number of distinct lengths of the buffers currently in the cache */
+    uint32_t num_size_classes;
+} cmem_drv_recycle_stats_t;
+
+int32_t cmem_drv_open (cmem_drv_context_t **const context);
+int32_t cmem_drv_close (cmem_drv_context_t *const context);
+int32_t cmem_drv_alloc (cmem_drv_context_t *const context, const bool dma_capability_a64,
                         const uint32_t num_of_buffers, const size_t size_of_buffer,
                         cmem_host_buf_desc_t buf_desc[const num_of_buffers]);
-int32_t cmem_drv_free (const uint32_t num_of_buffers, const cmem_host_buf_desc_t buf_desc[const num_of_buffers]);
+int32_t cmem_drv_alloc_class (cmem_drv_context_t *const context, const uint32_t pool_class,
+                              const bool dma_capability_a64, const uint32_t num_of_buffers, const size_t size_of_buffer,
+                              cmem_host_buf_desc_t buf_desc[const num_of_buffers]);
+int32_t cmem_drv_alloc_granules (cmem_drv_context_t *const context, const bool dma_capability_a64,
+                                 const uint32_t num_of_buffers, const size_t size_of_buffer,
+                                 cmem_host_buf_desc_t buf_desc[const num_of_buffers]);
+int32_t cmem_drv_free (cmem_drv_context_t *const context,
+                       const uint32_t num_of_buffers, const cmem_host_buf_desc_t buf_desc[const num_of_buffers]);
+int32_t cmem_drv_free_all (cmem_drv_context_t *const context);
+int32_t cmem_drv_resize (cmem_drv_context_t *const context, const bool dma_capability_a64,
+                         cmem_host_buf_desc_t *const buf_desc, const size_t new_size);
+int32_t cmem_drv_map_buffers (cmem_drv_context_t *const context,
+                              const cmem_ioctl_t *const cmem_ioctl, cmem_host_buf_desc_t buf_desc[const]);
+int32_t cmem_drv_unmap_buffers (const uint32_t num_of_buffers, const cmem_host_buf_desc_t buf_desc[const num_of_buffers],
+                                cmem_ioctl_t *const cmem_ioctl);
+void cmem_drv_prep_uring_cmd (cmem_drv_context_t *const context,
+                              struct io_uring_sqe *const sqe, const uint32_t cmd_op, void *const arg,
+                              const uint64_t user_data);
+int32_t cmem_drv_alloc_sg (cmem_drv_context_t *const context, const bool dma_capability_a64, const size_t size_of_buffer,
+                           const size_t chunk_granularity, const size_t chunk_alignment,
+                           cmem_host_sg_buf_desc_t *const sg_buf_desc);
+int32_t cmem_drv_free_sg (cmem_drv_context_t *const context, const cmem_host_sg_buf_desc_t *const sg_buf_desc);
+int32_t cmem_drv_alloc_named (cmem_drv_context_t *const context, const bool dma_capability_a64,
+                              const char *const name, const size_t size_of_buffer,
+                              cmem_host_buf_desc_t *const buf_desc, bool *const created);
+int32_t cmem_drv_detach_named (const cmem_host_buf_desc_t *const buf_desc);
+int32_t cmem_drv_destroy_named (cmem_drv_context_t *const context, const char *const name);
+int32_t cmem_drv_virt_to_phys (const void *const user_addr, uint64_t *const phys_addr, size_t *const contiguous_length);
+int32_t cmem_drv_export_to_fd (cmem_drv_context_t *const context,
+                               const uint64_t phys_addr, const size_t length, const int out_fd);
+int32_t cmem_drv_read_status (cmem_drv_context_t *const context, cmem_status_page_t *const status);
+int32_t cmem_drv_recycle_configure (cmem_drv_context_t *const context, const cmem_drv_recycle_config_t *const config);
+int32_t cmem_drv_recycle_flush (cmem_drv_context_t *const context);
+void cmem_drv_recycle_get_stats (cmem_drv_context_t *const context, cmem_drv_recycle_stats_t *const stats);
+int32_t cmem_drv_cache_maintenance (cmem_drv_context_t *const context, const bool flush, const uint32_t num_ranges,
+                                    const cmem_cache_range_t ranges[const num_ranges]);
+int32_t cmem_drv_loopback_start (cmem_drv_context_t *const context, const cmem_ioctl_loopback_t *const params);
+int32_t cmem_drv_loopback_doorbell (cmem_drv_context_t *const context);
+int32_t cmem_drv_loopback_wait (cmem_drv_context_t *const context, const int timeout_ms);
+int32_t cmem_drv_loopback_stop (cmem_drv_context_t *const context, cmem_ioctl_loopback_stats_t *const stats);
 
 #endif /* _CMEM_DRV_H */
 
@@ -0,0 +1,477 @@
+/*
+ * cmem_recycle.c
+ *
+ *  Created on: 18 Oct 2026
+ *      Author: Mr_Halfword
+ *
+ * Cache of freed cmem buffers which remain mapped and allocated, used by cmem_drv to satisfy a later allocation of the
+ * same length without the allocation ioctl, mmap, munmap and free ioctl.
+ *
+ * The cached buffers are grouped into size classes, one for each buffer length. Each length has separate classes for
+ * buffers wholly in the first 4 GiB of physical addresses, which can satisfy both A32 and A64 allocations, and for
+ * buffers which can only satisfy A64 allocations. The classes are held in an array sorted by length, so finding the
+ * class for an allocation is a binary search. The buffers in each class are ordered oldest first, and allocations take
+ * the most recently freed buffer, whose contents are the most likely to still be in the CPU caches.
+ *
+ * Trimming removes the oldest buffers of a class over max_buffers_per_class, and then the oldest buffers over all
+ * classes while the cache is over max_cached_bytes. The removed buffers are returned to the caller to be freed, so the
+ * ioctls to free them aren't performed with the lock held.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "cmem_recycle.h"
+#include "cmem_addr_index.h"
+
+
+/* Buffers which end at or below this physical address can satisfy A32 allocations */
+#define CMEM_RECYCLE_A32_LIMIT 0x100000000ULL
+
+
+/* One buffer in the cache */
+typedef struct
+{
+    /* The mapped buffer */
+    cmem_host_buf_desc_t buffer;
+    /* Incremented for each buffer placed in the cache, used to find the oldest buffer over all size classes */
+    uint64_t sequence;
+} cmem_recycle_entry_t;
+
+
+/* The cached buffers of one length */
+typedef struct
+{
+    /* The length of the buffers in the class */
+    size_t length;
+    /* True when the buffers are wholly in the first 4 GiB of physical addresses */
+    bool a32_capable;
+    /* Dynamically sized array of the buffers, ordered oldest first */
+    cmem_recycle_entry_t *entries;
+    /* The current number of valid entries in the entries[] array */
+    uint32_t num_entries;
+    /* The current allocated length of the entries[] array, dynamically grown as required */
+    uint32_t allocated_entries;
+} cmem_recycle_class_t;
+
+
+struct cmem_recycle_s
+{
+    /* Protects all other fields, apart from enabled which is also read without the lock */
+    pthread_mutex_t lock;
+    /* Set when config.max_cached_bytes is non-zero */
+    bool enabled;
+    /* The high-water marks */
+    cmem_drv_recycle_config_t config;
+    /* Dynamically sized array of classes, sorted in ascending order of length and then a32_capable.
+     * Empty classes are retained, until the array needs to grow. */
+    cmem_recycle_class_t *classes;
+    /* The current number of valid entries in the classes[] array */
+    uint32_t num_classes;
+    /* The current allocated length of the classes[] array */
+    uint32_t allocated_classes;
+    /* The sequence for the next buffer placed in the cache */
+    uint64_t next_sequence;
+    /* The statistics, of which num_size_classes is only calculated by cmem_recycle_get_stats() */
+    cmem_drv_recycle_stats_t stats;
+};
+
+
+/**
+ * @brief Create an empty cache, which is disabled until configured
+ * @return The created cache, or NULL if failed to allocate memory
+ */
+cmem_recycle_t *cmem_recycle_create (void)
+{
+    cmem_recycle_t *const recycle = calloc (1, sizeof (*recycle));
+
+    if (recycle != NULL)
+    {
+        pthread_mutex_init (&recycle->lock, NULL);
+    }
+
+    return recycle;
+}
+
+
+/**
+ * @brief Destroy a cache
+ * @details Any buffers still in the cache are discarded without being freed, so the cache should have been emptied
+ *          with cmem_recycle_trim() first unless the buffers have been freed some other way.
+ * @param[in] recycle The cache to destroy
+ */
+void cmem_recycle_destroy (cmem_recycle_t *const recycle)
+{
+    for (uint32_t class_index = 0; class_index < recycle->num_classes; class_index++)
+    {
+        free (recycle->classes[class_index].entries);
+    }
+    free (recycle->classes);
+    pthread_mutex_destroy (&recycle->lock);
+    free (recycle);
+}
+
+
+/**
+ * @brief Change the high-water marks of a cache
+ * @details The cache isn't trimmed to the new high-water marks until the next call to cmem_recycle_trim().
+ * @param[in/out] recycle The cache to configure
+ * @param[in] config The new high-water marks
+ */
+void cmem_recycle_configure (cmem_recycle_t *const recycle, const cmem_drv_recycle_config_t *const config)
+{
+    pthread_mutex_lock (&recycle->lock);
+    recycle->config = *config;
+    __atomic_store_n (&recycle->enabled, config->max_cached_bytes > 0, __ATOMIC_RELAXED);
+    pthread_mutex_unlock (&recycle->lock);
+}
+
+
+/**
+ * @brief Determine if a cache is enabled, without taking the lock
+ * @param[in] recycle The cache to check
+ * @return Returns true if buffers may be placed in the cache
+ */
+bool cmem_recycle_enabled (cmem_recycle_t *const recycle)
+{
+    return __atomic_load_n (&recycle->enabled, __ATOMIC_RELAXED);
+}
+
+
+/**
+ * @brief Find the position of a size class in the array of classes
+ * @details Must be called with the lock held
+ * @param[in] recycle The cache to search
+ * @param[in] length The length of the buffers in the class
+ * @param[in] a32_capable Selects the class for buffers wholly in the first 4 GiB
+ * @param[out] class_index The index of the class if found, otherwise the index at which to insert the class
+ * @return Returns true if the class was found
+ */
+static bool cmem_recycle_find_class (const cmem_recycle_t *const recycle, const size_t length, const bool a32_capable,
+                                     uint32_t *const class_index)
+{
+    uint32_t low = 0;
+    uint32_t high = recycle->num_classes;
+
+    while (low < high)
+    {
+        const uint32_t mid = low + ((high - low) / 2);
+        const cmem_recycle_class_t *const size_class = &recycle->classes[mid];
+
+        if ((size_class->length < length) || ((size_class->length == length) && (size_class->a32_capable < a32_capable)))
+        {
+            low = mid + 1;
+        }
+        else
+        {
+            high = mid;
+        }
+    }
+    *class_index = low;
+
+    return (low < recycle->num_classes) && (recycle->classes[low].length == length) &&
+            (recycle->classes[low].a32_capable == a32_capable);
+}
+
+
+/**
+ * @brief Get the size class with cached buffers which can satisfy an allocation
+ * @details Must be called with the lock held. An A64 allocation prefers buffers which aren't A32 capable, to leave
+ *          the A32 capable buffers for A32 allocations.
+ * @param[in] recycle The cache to search
+ * @param[in] dma_capability_a64 The type of physical addresses required, as for cmem_drv_alloc()
+ * @param[in] length The length of buffer required
+ * @return The class to take a buffer from, or NULL if there are no suitable cached buffers
+ */
+static cmem_recycle_class_t *cmem_recycle_class_for_allocation (cmem_recycle_t *const recycle,
+                                                                const bool dma_capability_a64, const size_t length)
+{
+    uint32_t class_index;
+
+    if (dma_capability_a64 && cmem_recycle_find_class (recycle, length, false, &class_index) &&
+        (recycle->classes[class_index].num_entries > 0))
+    {
+        return &recycle->classes[class_index];
+    }
+    if (cmem_recycle_find_class (recycle, length, true, &class_index) && (recycle->classes[class_index].num_entries > 0))
+    {
+        return &recycle->classes[class_index];
+    }
+
+    return NULL;
+}
+
+
+/**
+ * @brief Take a cached buffer to satisfy an allocation
+ * @param[in/out] recycle The cache to take the buffer from
+ * @param[in] dma_capability_a64 The type of physical addresses required, as for cmem_drv_alloc()
+ * @param[in] length The length of buffer required, which must match the length of the cached buffer exactly
+ * @param[out] buf_desc The buffer taken from the cache
+ * @return Returns true if a buffer was taken, or false if the allocation must be performed by the driver
+ */
+bool cmem_recycle_take (cmem_recycle_t *const recycle, const bool dma_capability_a64, const size_t length,
+                        cmem_host_buf_desc_t *const buf_desc)
+{
+    cmem_recycle_class_t *size_class;
+    bool hit = false;
+
+    pthread_mutex_lock (&recycle->lock);
+    if (recycle->enabled)
+    {
+        size_class = cmem_recycle_class_for_allocation (recycle, dma_capability_a64, length);
+        if (size_class != NULL)
+        {
+            size_class->num_entries--;
+            *buf_desc = size_class->entries[size_class->num_entries].buffer;
+            recycle->stats.cached_buffers--;
+            recycle->stats.cached_bytes -= length;
+            recycle->stats.hits++;
+            hit = true;
+        }
+        else
+        {
+            recycle->stats.misses++;
+        }
+    }
+    pthread_mutex_unlock (&recycle->lock);
+
+    return hit;
+}
+
+
+/**
+ * @brief Create a size class
+ * @details Must be called with the lock held. When the array of classes is full the empty classes are removed,
+ *          before growing the array, so the array doesn't grow with every length ever freed.
+ * @param[in/out] recycle The cache to create the class in
+ * @param[in] length The length of the buffers in the class
+ * @param[in] a32_capable Selects the class for buffers wholly in the first 4 GiB
+ * @return The created class, or NULL if failed to allocate memory
+ */
+static cmem_recycle_class_t *cmem_recycle_create_class (cmem_recycle_t *const recycle, const size_t length,
+                                                        const bool a32_capable)
+{
+    uint32_t num_retained_classes = 0;
+    uint32_t class_index;
+
+    if (recycle->num_classes == recycle->allocated_classes)
+    {
+        for (class_index = 0; class_index < recycle->num_classes; class_index++)
+        {
+            if (recycle->classes[class_index].num_entries > 0)
+            {
+                recycle->classes[num_retained_classes] = recycle->classes[class_index];
+                num_retained_classes++;
+            }
+            else
+            {
+                free (recycle->classes[class_index].entries);
+            }
+        }
+        recycle->num_classes = num_retained_classes;
+    }
+
+    if (recycle->num_classes == recycle->allocated_classes)
+    {
+        const uint32_t grow_length = 16;
+        cmem_recycle_class_t *const grown_classes =
+                realloc (recycle->classes, (recycle->allocated_classes + grow_length) * sizeof (recycle->classes[0]));
+
+        if (grown_classes == NULL)
+        {
+            return NULL;
+        }
+        recycle->classes = grown_classes;
+        recycle->allocated_classes += grow_length;
+    }
+
+    cmem_recycle_find_class (recycle, length, a32_capable, &class_index);
+    memmove (&recycle->classes[class_index + 1], &recycle->classes[class_index],
+            (recycle->num_classes - class_index) * sizeof (recycle->classes[0]));
+    memset (&recycle->classes[class_index], 0, sizeof (recycle->classes[class_index]));
+    recycle->classes[class_index].length = length;
+    recycle->classes[class_index].a32_capable = a32_capable;
+    recycle->num_classes++;
+
+    return &recycle->classes[class_index];
+}
+
+
+/**
+ * @brief Place a freed buffer in the cache, where it remains mapped and allocated
+ * @details The cache may exceed the high-water marks until the next call to cmem_recycle_trim().
+ * @param[in/out] recycle The cache to place the buffer in
+ * @param[in] buf_desc The buffer being freed
+ * @return Zero if the buffer was placed in the cache. Otherwise the buffer wasn't placed in the cache, and:
+ *         - EINVAL means the buffer is already in the cache, i.e. is being freed twice, and must not be freed.
+ *         - Any other value means the buffer should be freed by the driver.
+ */
+int32_t cmem_recycle_put (cmem_recycle_t *const recycle, const cmem_host_buf_desc_t *const buf_desc)
+{
+    const bool a32_capable = (buf_desc->physAddr + buf_desc->length) <= CMEM_RECYCLE_A32_LIMIT;
+    cmem_recycle_class_t *size_class;
+    cmem_recycle_entry_t *grown_entries;
+    uint64_t phys_addr;
+    size_t contiguous_length;
+    uint32_t class_index;
+    int32_t rc = 0;
+
+    /* Only cache a buffer which is mapped as a whole, so the mapping can be handed out again */
+    if ((cmem_addr_index_lookup (buf_desc->userAddr, &phys_addr, &contiguous_length) != 0) ||
+        (phys_addr != buf_desc->physAddr) || (contiguous_length != buf_desc->length))
+    {
+        return EFAULT;
+    }
+
+    pthread_mutex_lock (&recycle->lock);
+    if (!recycle->enabled)
+    {
+        rc = ENOSPC;
+    }
+    else if ((buf_desc->length > recycle->config.max_cached_bytes) ||
+             ((recycle->config.max_buffer_length > 0) && (buf_desc->length > recycle->config.max_buffer_length)))
+    {
+        recycle->stats.rejected++;
+        rc = E2BIG;
+    }
+    else
+    {
+        size_class = cmem_recycle_find_class (recycle, buf_desc->length, a32_capable, &class_index) ?
+                &recycle->classes[class_index] : cmem_recycle_create_class (recycle, buf_desc->length, a32_capable);
+        if (size_class == NULL)
+        {
+            rc = ENOMEM;
+        }
+        else
+        {
+            for (uint32_t entry_index = 0; (rc == 0) && (entry_index < size_class->num_entries); entry_index++)
+            {
+                if (size_class->entries[entry_index].buffer.userAddr == buf_desc->userAddr)
+                {
+                    rc = EINVAL;
+                }
+            }
+        }
+
+        if ((rc == 0) && (size_class->num_entries == size_class->allocated_entries))
+        {
+            const uint32_t grow_length = 16;
+
+            grown_entries = realloc (size_class->entries,
+                    (size_class->allocated_entries + grow_length) * sizeof (size_class->entries[0]));
+            if (grown_entries == NULL)
+            {
+                rc = ENOMEM;
+            }
+            else
+            {
+                size_class->entries = grown_entries;
+                size_class->allocated_entries += grow_length;
+            }
+        }
+
+        if (rc == 0)
+        {
+            size_class->entries[size_class->num_entries].buffer = *buf_desc;
+            size_class->entries[size_class->num_entries].sequence = recycle->next_sequence;
+            size_class->num_entries++;
+            recycle->next_sequence++;
+            recycle->stats.cached_buffers++;
+            recycle->stats.cached_bytes += buf_desc->length;
+            recycle->stats.retained++;
+        }
+    }
+    pthread_mutex_unlock (&recycle->lock);
+
+    return rc;
+}
+
+
+/**
+ * @brief Select the size class to remove the oldest buffer from when trimming
+ * @details Must be called with the lock held
+ * @param[in] recycle The cache being trimmed
+ * @param[in] remove_all When true selects any class with buffers, rather than only when over a high-water mark
+ * @return The class to remove the oldest buffer from, or NULL if the cache doesn't need trimming
+ */
+static cmem_recycle_class_t *cmem_recycle_class_to_trim (cmem_recycle_t *const recycle, const bool remove_all)
+{
+    cmem_recycle_class_t *oldest_class = NULL;
+
+    for (uint32_t class_index = 0; class_index < recycle->num_classes; class_index++)
+    {
+        cmem_recycle_class_t *const size_class = &recycle->classes[class_index];
+
+        if (size_class->num_entries > 0)
+        {
+            if (remove_all || ((recycle->config.max_buffers_per_class > 0) &&
+                               (size_class->num_entries > recycle->config.max_buffers_per_class)))
+            {
+                return size_class;
+            }
+            if ((oldest_class == NULL) || (size_class->entries[0].sequence < oldest_class->entries[0].sequence))
+            {
+                oldest_class = size_class;
+            }
+        }
+    }
+
+    return (recycle->stats.cached_bytes > recycle->config.max_cached_bytes) ? oldest_class : NULL;
+}
+
+
+/**
+ * @brief Remove the oldest buffers from the cache until it is under the high-water marks
+ * @details The caller must free the removed buffers, and call again if max_evicted buffers were removed.
+ * @param[in/out] recycle The cache to trim
+ * @param[in] remove_all When true all buffers are removed, e.g. when the cache is disabled or the context closed
+ * @param[in] max_evicted The maximum number of buffers to remove
+ * @param[out] evicted The removed buffers
+ * @return The number of buffers removed
+ */
+uint32_t cmem_recycle_trim (cmem_recycle_t *const recycle, const bool remove_all,
+                            const uint32_t max_evicted, cmem_host_buf_desc_t evicted[const max_evicted])
+{
+    cmem_recycle_class_t *size_class;
+    uint32_t num_evicted = 0;
+
+    pthread_mutex_lock (&recycle->lock);
+    while ((num_evicted < max_evicted) && ((size_class = cmem_recycle_class_to_trim (recycle, remove_all)) != NULL))
+    {
+        evicted[num_evicted] = size_class->entries[0].buffer;
+        num_evicted++;
+        size_class->num_entries--;
+        memmove (&size_class->entries[0], &size_class->entries[1],
+                size_class->num_entries * sizeof (size_class->entries[0]));
+        recycle->stats.cached_buffers--;
+        recycle->stats.cached_bytes -= size_class->length;
+        recycle->stats.evicted++;
+    }
+    pthread_mutex_unlock (&recycle->lock);
+
+    return num_evicted;
+}
+
+
+/**
+ * @brief Get the statistics of a cache
+ * @param[in] recycle The cache to get the statistics for
+ * @param[out] stats The statistics
+ */
+void cmem_recycle_get_stats (cmem_recycle_t *const recycle, cmem_drv_recycle_stats_t *const stats)
+{
+    pthread_mutex_lock (&recycle->lock);
+    *stats = recycle->stats;
+    stats->num_size_classes = 0;
+    for (uint32_t class_index = 0; class_index < recycle->num_classes; class_index++)
+    {
+        if (recycle->classes[class_index].num_entries > 0)
+        {
+            stats->num_size_classes++;
+        }
+    }
+    pthread_mutex_unlock (&recycle->lock);
+}
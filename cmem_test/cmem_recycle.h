@@ -0,0 +1,33 @@
+/*
+ * cmem_recycle.h
+ *
+ *  Created on: 18 Oct 2026
+ *      Author: Mr_Halfword
+ *
+ * Cache of freed cmem buffers which remain mapped and allocated, used by cmem_drv to satisfy a later allocation of the
+ * same length without calling the driver.
+ */
+
+#ifndef CMEM_RECYCLE_H_
+#define CMEM_RECYCLE_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "cmem_drv.h"
+
+typedef struct cmem_recycle_s cmem_recycle_t;
+
+cmem_recycle_t *cmem_recycle_create (void);
+void cmem_recycle_destroy (cmem_recycle_t *const recycle);
+void cmem_recycle_configure (cmem_recycle_t *const recycle, const cmem_drv_recycle_config_t *const config);
+bool cmem_recycle_enabled (cmem_recycle_t *const recycle);
+bool cmem_recycle_take (cmem_recycle_t *const recycle, const bool dma_capability_a64, const size_t length,
+                        cmem_host_buf_desc_t *const buf_desc);
+int32_t cmem_recycle_put (cmem_recycle_t *const recycle, const cmem_host_buf_desc_t *const buf_desc);
+uint32_t cmem_recycle_trim (cmem_recycle_t *const recycle, const bool remove_all,
+                            const uint32_t max_evicted, cmem_host_buf_desc_t evicted[const max_evicted]);
+void cmem_recycle_get_stats (cmem_recycle_t *const recycle, cmem_drv_recycle_stats_t *const stats);
+
+#endif /* CMEM_RECYCLE_H_ */
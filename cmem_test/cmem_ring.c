@@ -0,0 +1,288 @@
+/*
+ * cmem_ring.c
+ *
+ *  Created on: 18 Oct 2026
+ *      Author: Mr_Halfword
+ *
+ * Ring buffer of fixed size slots placed in a physically contiguous cmem buffer.
+ *
+ * The memory ordering is:
+ * - A producer writes the contents of the slots before publishing them to the consumer with a release store of tail.
+ *   The consumer uses an acquire load of tail before reading the contents of the slots.
+ * - The consumer reads the contents of the slots before returning them to the producers with a release store of head.
+ *   A producer uses an acquire load of head before overwriting the contents of the slots.
+ * - With multiple producers, slots are reserved using a compare-and-swap on tail_reserve. Since producers may
+ *   finish writing their reserved slots out of order, a producer waits for all earlier reservations to be published
+ *   before publishing its own slots, so that tail only ever covers completely written slots.
+ */
+
+#include <string.h>
+#include <stddef.h>
+#include <errno.h>
+
+#include "cmem_drv.h"
+#include "cmem_ring.h"
+
+
+/**
+ * @brief Hint to the CPU that are in a spin loop waiting for another agent
+ */
+static inline void cmem_ring_spin_pause (void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause ();
+#endif
+}
+
+
+/**
+ * @brief Create a ring by allocating a cmem buffer for the control block and slots
+ * @param[out] ring The created ring
+ * @param[in] context The context used to allocate the cmem buffer, which must remain open until the ring is destroyed
+ * @param[in] dma_capability_a64 Passed to cmem_drv_alloc() to select the type of physical address for the ring
+ * @param[in] mode Selects if the ring supports a single or multiple producers
+ * @param[in] num_slots The number of slots in the ring, which must be a power of two
+ * @param[in] slot_size The size of each slot in bytes
+ * @return Zero indicates success, any other value failure
+ */
+int32_t cmem_ring_create (cmem_ring_t *const ring, cmem_drv_context_t *const context,
+                          const bool dma_capability_a64, const cmem_ring_mode_t mode, const uint32_t num_slots, const uint32_t slot_size)
+{
+    int32_t rc;
+
+    /* The loopback engine in the driver accesses rings using the layout defined in cmem.h */
+    _Static_assert ((offsetof (cmem_ring_control_t, tail_reserve) == CMEM_RING_TAIL_RESERVE_OFFSET) &&
+                    (offsetof (cmem_ring_control_t, tail) == CMEM_RING_TAIL_OFFSET) &&
+                    (offsetof (cmem_ring_control_t, head) == CMEM_RING_HEAD_OFFSET) &&
+                    (sizeof (cmem_ring_control_t) == CMEM_RING_CONTROL_LENGTH), "Inconsistent ring layout");
+
+    memset (ring, 0, sizeof (*ring));
+    if ((num_slots < 2) || ((num_slots & (num_slots - 1)) != 0) || (slot_size == 0))
+    {
+        return EINVAL;
+    }
+
+    /* The slots immediately follow the control block, which is a multiple of the cache line size */
+    rc = cmem_drv_alloc (context, dma_capability_a64, 1, sizeof (cmem_ring_control_t) + ((size_t) num_slots * slot_size),
+            &ring->buffer);
+    if (rc != 0)
+    {
+        return rc;
+    }
+
+    ring->context = context;
+    ring->control = (cmem_ring_control_t *) ring->buffer.userAddr;
+    ring->control_phys_addr = ring->buffer.physAddr;
+    ring->mode = mode;
+    ring->num_slots = num_slots;
+    ring->slot_mask = num_slots - 1;
+    ring->slot_size = slot_size;
+    ring->slots_user_addr = ring->buffer.userAddr + sizeof (cmem_ring_control_t);
+    ring->slots_phys_addr = ring->buffer.physAddr + sizeof (cmem_ring_control_t);
+
+    /* Start with an empty ring */
+    memset (ring->control, 0, sizeof (*ring->control));
+    __atomic_thread_fence (__ATOMIC_RELEASE);
+
+    return 0;
+}
+
+
+/**
+ * @brief Destroy a ring, freeing the cmem buffer
+ * @param[in/out] ring The ring to destroy
+ * @return Zero indicates success, any other value failure
+ */
+int32_t cmem_ring_destroy (cmem_ring_t *const ring)
+{
+    int32_t rc = 0;
+
+    if (ring->control != NULL)
+    {
+        rc = cmem_drv_free (ring->context, 1, &ring->buffer);
+        memset (ring, 0, sizeof (*ring));
+    }
+
+    return rc;
+}
+
+
+/**
+ * @brief Reserve empty slots in a ring for a producer to fill
+ * @details The caller must write the contents of the reserved slots and then call cmem_ring_publish().
+ *          When the ring is single producer this must only be called from one thread at once.
+ * @param[in/out] ring The ring to reserve slots in
+ * @param[in] max_slots The maximum number of slots to reserve
+ * @param[out] first_slot The free running index of the first reserved slot
+ * @return The number of slots reserved, which may be less than max_slots (including zero) when the ring is full
+ */
+uint32_t cmem_ring_reserve (cmem_ring_t *const ring, const uint32_t max_slots, uint32_t *const first_slot)
+{
+    uint32_t tail;
+    uint32_t head;
+    uint32_t num_slots;
+
+    if (ring->mode == CMEM_RING_SPSC)
+    {
+        tail = __atomic_load_n (&ring->control->tail, __ATOMIC_RELAXED);
+        head = __atomic_load_n (&ring->control->head, __ATOMIC_ACQUIRE);
+        num_slots = ring->num_slots - (tail - head);
+        if (num_slots > max_slots)
+        {
+            num_slots = max_slots;
+        }
+    }
+    else
+    {
+        tail = __atomic_load_n (&ring->control->tail_reserve, __ATOMIC_RELAXED);
+        do
+        {
+            head = __atomic_load_n (&ring->control->head, __ATOMIC_ACQUIRE);
+            num_slots = ring->num_slots - (tail - head);
+            if (num_slots > max_slots)
+            {
+                num_slots = max_slots;
+            }
+        } while ((num_slots > 0) &&
+                 !__atomic_compare_exchange_n (&ring->control->tail_reserve, &tail, tail + num_slots,
+                         true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+    }
+
+    *first_slot = tail;
+    return num_slots;
+}
+
+
+/**
+ * @brief Publish slots previously reserved by cmem_ring_reserve() to the consumer
+ * @param[in/out] ring The ring to publish the slots in
+ * @param[in] first_slot The free running index of the first slot, as returned by cmem_ring_reserve()
+ * @param[in] num_slots The number of slots to publish, as returned by cmem_ring_reserve()
+ */
+void cmem_ring_publish (cmem_ring_t *const ring, const uint32_t first_slot, const uint32_t num_slots)
+{
+    if ((ring->mode == CMEM_RING_MPSC) && (num_slots > 0))
+    {
+        /* Wait for producers which reserved earlier slots to publish them.
+         * The acquire ensures the slots written by earlier producers are visible to the consumer which
+         * synchronises with our release of tail. */
+        while (__atomic_load_n (&ring->control->tail, __ATOMIC_ACQUIRE) != first_slot)
+        {
+            cmem_ring_spin_pause ();
+        }
+    }
+
+    __atomic_store_n (&ring->control->tail, first_slot + num_slots, __ATOMIC_RELEASE);
+}
+
+
+/**
+ * @brief Obtain filled slots from a ring for the consumer to read
+ * @details The caller must read the contents of the slots and then call cmem_ring_release().
+ * @param[in/out] ring The ring to obtain the slots from
+ * @param[in] max_slots The maximum number of slots to obtain
+ * @param[out] first_slot The free running index of the first filled slot
+ * @return The number of filled slots, which may be less than max_slots (including zero) when the ring is empty
+ */
+uint32_t cmem_ring_peek (cmem_ring_t *const ring, const uint32_t max_slots, uint32_t *const first_slot)
+{
+    const uint32_t head = __atomic_load_n (&ring->control->head, __ATOMIC_RELAXED);
+    const uint32_t tail = __atomic_load_n (&ring->control->tail, __ATOMIC_ACQUIRE);
+    const uint32_t num_slots = tail - head;
+
+    *first_slot = head;
+    return (num_slots < max_slots) ? num_slots : max_slots;
+}
+
+
+/**
+ * @brief Return slots read by the consumer to the producers
+ * @param[in/out] ring The ring to return the slots to
+ * @param[in] num_slots The number of slots to return, which must not exceed the value returned by cmem_ring_peek()
+ */
+void cmem_ring_release (cmem_ring_t *const ring, const uint32_t num_slots)
+{
+    const uint32_t head = __atomic_load_n (&ring->control->head, __ATOMIC_RELAXED);
+
+    __atomic_store_n (&ring->control->head, head + num_slots, __ATOMIC_RELEASE);
+}
+
+
+/**
+ * @brief Copy entries into a ring, where each entry is the size of a slot
+ * @param[in/out] ring The ring to enqueue the entries in
+ * @param[in] entries The entries to enqueue, which are stored consecutively
+ * @param[in] num_entries The number of entries to enqueue
+ * @return The number of entries enqueued, which may be less than num_entries when the ring is full
+ */
+uint32_t cmem_ring_enqueue_burst (cmem_ring_t *const ring, const void *const entries, const uint32_t num_entries)
+{
+    uint32_t first_slot;
+    const uint32_t num_slots = cmem_ring_reserve (ring, num_entries, &first_slot);
+
+    if (num_slots > 0)
+    {
+        /* Copy in up to two parts, to handle the reserved slots wrapping around the end of the ring */
+        const uint32_t slots_before_wrap = ring->num_slots - (first_slot & ring->slot_mask);
+        const uint32_t first_part = (num_slots < slots_before_wrap) ? num_slots : slots_before_wrap;
+        const uint8_t *const source = entries;
+
+        memcpy (cmem_ring_slot_user_addr (ring, first_slot), source, (size_t) first_part * ring->slot_size);
+        if (num_slots > first_part)
+        {
+            memcpy (ring->slots_user_addr, &source[(size_t) first_part * ring->slot_size],
+                    (size_t) (num_slots - first_part) * ring->slot_size);
+        }
+
+        cmem_ring_publish (ring, first_slot, num_slots);
+    }
+
+    return num_slots;
+}
+
+
+/**
+ * @brief Copy entries out of a ring, where each entry is the size of a slot
+ * @param[in/out] ring The ring to dequeue the entries from
+ * @param[out] entries Where to store the dequeued entries consecutively
+ * @param[in] max_entries The maximum number of entries to dequeue
+ * @return The number of entries dequeued, which may be less than max_entries when the ring is empty
+ */
+uint32_t cmem_ring_dequeue_burst (cmem_ring_t *const ring, void *const entries, const uint32_t max_entries)
+{
+    uint32_t first_slot;
+    const uint32_t num_slots = cmem_ring_peek (ring, max_entries, &first_slot);
+
+    if (num_slots > 0)
+    {
+        const uint32_t slots_before_wrap = ring->num_slots - (first_slot & ring->slot_mask);
+        const uint32_t first_part = (num_slots < slots_before_wrap) ? num_slots : slots_before_wrap;
+        uint8_t *const destination = entries;
+
+        memcpy (destination, cmem_ring_slot_user_addr (ring, first_slot), (size_t) first_part * ring->slot_size);
+        if (num_slots > first_part)
+        {
+            memcpy (&destination[(size_t) first_part * ring->slot_size], ring->slots_user_addr,
+                    (size_t) (num_slots - first_part) * ring->slot_size);
+        }
+
+        cmem_ring_release (ring, num_slots);
+    }
+
+    return num_slots;
+}
+
+
+/**
+ * @brief Get the number of filled slots in a ring
+ * @details The returned value is only a snapshot when other threads are accessing the ring
+ * @param[in] ring The ring to get the count for
+ * @return The number of slots published and not yet consumed
+ */
+uint32_t cmem_ring_count (const cmem_ring_t *const ring)
+{
+    const uint32_t head = __atomic_load_n (&ring->control->head, __ATOMIC_ACQUIRE);
+    const uint32_t tail = __atomic_load_n (&ring->control->tail, __ATOMIC_ACQUIRE);
+
+    return tail - head;
+}
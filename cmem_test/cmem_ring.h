@@ -0,0 +1,105 @@
+/*
+ * cmem_ring.h
+ *
+ *  Created on: 18 Oct 2026
+ *      Author: Mr_Halfword
+ *
+ * Ring buffer of fixed size slots placed in a physically contiguous cmem buffer, so that the slots and the ring
+ * indices can be accessed both by user space using their virtual address and by a device using their physical address.
+ */
+
+#ifndef CMEM_RING_H_
+#define CMEM_RING_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "inc/buffdesc.h"
+
+/* The assumed size of a CPU cache line, used to stop the ring indices sharing cache lines */
+#define CMEM_CACHE_LINE_SIZE 64
+
+/* The control block at the start of the cmem buffer for a ring.
+ * The indices are free running, and are masked with (num_slots - 1) to obtain the slot index.
+ * Each index is on a separate cache line, since are written by different agents:
+ * - tail_reserve is written by producers to claim slots, only used with multiple producers.
+ * - tail is written by producers to publish filled slots to the consumer.
+ * - head is written by the consumer to return emptied slots to the producers. */
+typedef struct
+{
+    /* The next slot to be reserved by a producer */
+    uint32_t tail_reserve __attribute__ ((aligned (CMEM_CACHE_LINE_SIZE)));
+    /* The next slot to be published to the consumer */
+    uint32_t tail __attribute__ ((aligned (CMEM_CACHE_LINE_SIZE)));
+    /* The next slot to be consumed */
+    uint32_t head __attribute__ ((aligned (CMEM_CACHE_LINE_SIZE)));
+} cmem_ring_control_t;
+
+/* Defines how many producers may concurrently add to a ring. There is always a single consumer. */
+typedef enum
+{
+    /* Single Producer Single Consumer */
+    CMEM_RING_SPSC,
+    /* Multiple Producer Single Consumer */
+    CMEM_RING_MPSC
+} cmem_ring_mode_t;
+
+/* A ring buffer allocated in a cmem buffer. The cmem buffer contains the control block followed by the slots. */
+typedef struct
+{
+    /* The context used to allocate the cmem buffer, and to free it when the ring is destroyed */
+    cmem_drv_context_t *context;
+    /* The cmem buffer containing the ring */
+    cmem_host_buf_desc_t buffer;
+    /* The control block at the start of the cmem buffer */
+    cmem_ring_control_t *control;
+    /* The physical address of the control block, which a device can use to access the indices */
+    uint64_t control_phys_addr;
+    /* Defines the number of producers */
+    cmem_ring_mode_t mode;
+    /* The number of slots, which is a power of two */
+    uint32_t num_slots;
+    /* Mask applied to the free running indices to obtain a slot index */
+    uint32_t slot_mask;
+    /* The size of each slot in bytes */
+    uint32_t slot_size;
+    /* The virtual and physical addresses of the first slot */
+    uint8_t *slots_user_addr;
+    uint64_t slots_phys_addr;
+} cmem_ring_t;
+
+int32_t cmem_ring_create (cmem_ring_t *const ring, cmem_drv_context_t *const context,
+                          const bool dma_capability_a64, const cmem_ring_mode_t mode, const uint32_t num_slots, const uint32_t slot_size);
+int32_t cmem_ring_destroy (cmem_ring_t *const ring);
+uint32_t cmem_ring_reserve (cmem_ring_t *const ring, const uint32_t max_slots, uint32_t *const first_slot);
+void cmem_ring_publish (cmem_ring_t *const ring, const uint32_t first_slot, const uint32_t num_slots);
+uint32_t cmem_ring_peek (cmem_ring_t *const ring, const uint32_t max_slots, uint32_t *const first_slot);
+void cmem_ring_release (cmem_ring_t *const ring, const uint32_t num_slots);
+uint32_t cmem_ring_enqueue_burst (cmem_ring_t *const ring, const void *const entries, const uint32_t num_entries);
+uint32_t cmem_ring_dequeue_burst (cmem_ring_t *const ring, void *const entries, const uint32_t max_entries);
+uint32_t cmem_ring_count (const cmem_ring_t *const ring);
+
+
+/**
+ * @brief Get the virtual address of a ring slot
+ * @param[in] ring The ring containing the slot
+ * @param[in] slot A free running slot index, as returned by cmem_ring_reserve() or cmem_ring_peek()
+ * @return The virtual address of the slot
+ */
+static inline void *cmem_ring_slot_user_addr (const cmem_ring_t *const ring, const uint32_t slot)
+{
+    return &ring->slots_user_addr[(size_t) (slot & ring->slot_mask) * ring->slot_size];
+}
+
+
+/**
+ * @brief Get the physical address of a ring slot, to be passed to a device
+ * @param[in] ring The ring containing the slot
+ * @param[in] slot A free running slot index, as returned by cmem_ring_reserve() or cmem_ring_peek()
+ * @return The physical address of the slot
+ */
+static inline uint64_t cmem_ring_slot_phys_addr (const cmem_ring_t *const ring, const uint32_t slot)
+{
+    return ring->slots_phys_addr + ((uint64_t) (slot & ring->slot_mask) * ring->slot_size);
+}
+
+#endif /* CMEM_RING_H_ */
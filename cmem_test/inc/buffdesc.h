@@ -48,5 +48,18 @@ typedef struct
     size_t length;              /* Length of host buffer */
 } cmem_host_buf_desc_t;
 
+/* Maximum number of chunks in a scatter-gather buffer, which must match CMEM_MAX_SG_CHUNKS in cmem.h */
+#define CMEM_HOST_SG_MAX_CHUNKS 64
+
+typedef struct
+{
+    uint8_t *userAddr;            /* Host user space Virtual address of the
+                                     contiguous mapping of all chunks */
+    size_t length;                /* Total length of host buffer */
+    uint32_t num_chunks;          /* Number of physically contiguous chunks */
+    cmem_host_buf_desc_t chunks[CMEM_HOST_SG_MAX_CHUNKS]; /* The chunks, in
+                                     virtual address order */
+} cmem_host_sg_buf_desc_t;
+
 #endif /* _BUFFDESC_H */
 
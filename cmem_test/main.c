@@ -16,22 +16,25 @@
 int main (int argc, char *argv[])
 {
     int32_t rc;
+    cmem_drv_context_t *context;
     cmem_host_buf_desc_t buffer_descs[NUM_BUFFERS];
+    cmem_host_sg_buf_desc_t sg_buffer_desc;
     int buffer_index;
+    uint32_t chunk_index;
     char *buffer_text;
 
     /* Any command line argument selected allocation of 32-bit address buffers */
     const bool dma_capability_a64 = argc == 1;
 
     printf ("Testing using DMA capability %s\n", dma_capability_a64 ? "A64" : "A32");
-    rc = cmem_drv_open ();
+    rc = cmem_drv_open (&context);
     if (rc != 0)
     {
         fprintf (stderr, "cmem_drv_open failed\n");
         return EXIT_FAILURE;
     }
 
-    rc = cmem_drv_alloc (dma_capability_a64, NUM_BUFFERS, BUFFER_SIZE, buffer_descs);
+    rc = cmem_drv_alloc (context, dma_capability_a64, NUM_BUFFERS, BUFFER_SIZE, buffer_descs);
     if (rc != 0)
     {
         fprintf (stderr, "cmem_drv_alloc failed\n");
@@ -46,14 +49,53 @@ int main (int argc, char *argv[])
         printf ("%s", buffer_text);
     }
 
-    rc = cmem_drv_free (NUM_BUFFERS, buffer_descs);
+    /* Check the translation of an address inside each buffer back to a physical address */
+    for (buffer_index = 0; buffer_index < NUM_BUFFERS; buffer_index++)
+    {
+        const size_t offset = BUFFER_SIZE / 2;
+        uint64_t phys_addr;
+        size_t contiguous_length;
+
+        rc = cmem_drv_virt_to_phys (&buffer_descs[buffer_index].userAddr[offset], &phys_addr, &contiguous_length);
+        if ((rc != 0) || (phys_addr != (buffer_descs[buffer_index].physAddr + offset)) ||
+            (contiguous_length != (BUFFER_SIZE - offset)))
+        {
+            fprintf (stderr, "cmem_drv_virt_to_phys failed for buffer %d\n", buffer_index);
+            return EXIT_FAILURE;
+        }
+    }
+
+    rc = cmem_drv_free (context, NUM_BUFFERS, buffer_descs);
     if (rc != 0)
     {
         fprintf (stderr, "cmem_drv_free failed\n");
         return EXIT_FAILURE;
     }
 
-    rc = cmem_drv_close ();
+    /* Allocate a scatter-gather buffer, and display the chunks it was allocated from */
+    rc = cmem_drv_alloc_sg (context, dma_capability_a64, NUM_BUFFERS * BUFFER_SIZE, 4096, 4096, &sg_buffer_desc);
+    if (rc != 0)
+    {
+        fprintf (stderr, "cmem_drv_alloc_sg failed\n");
+        return EXIT_FAILURE;
+    }
+    for (chunk_index = 0; chunk_index < sg_buffer_desc.num_chunks; chunk_index++)
+    {
+        buffer_text = (char *) sg_buffer_desc.chunks[chunk_index].userAddr;
+        sprintf (buffer_text, "SG chunk %u of length 0x%zx at virtual address %p physical address 0x%lx\n",
+                chunk_index, sg_buffer_desc.chunks[chunk_index].length,
+                sg_buffer_desc.chunks[chunk_index].userAddr, sg_buffer_desc.chunks[chunk_index].physAddr);
+        printf ("%s", buffer_text);
+    }
+
+    rc = cmem_drv_free_sg (context, &sg_buffer_desc);
+    if (rc != 0)
+    {
+        fprintf (stderr, "cmem_drv_free_sg failed\n");
+        return EXIT_FAILURE;
+    }
+
+    rc = cmem_drv_close (context);
     if (rc != 0)
     {
         fprintf (stderr, "cmem_drv_close failed\n");
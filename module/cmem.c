@@ -38,6 +38,7 @@
 
 #include <linux/string.h>
 #include <linux/sort.h>
+#include <linux/list.h>
 #include <linux/mutex.h>
 #include <linux/sched.h>
 
@@ -46,11 +47,46 @@
 
 #include <linux/slab.h>
 #include <linux/kallsyms.h>
+#include <linux/kref.h>
+#include <linux/io.h>
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/uio.h>
+#include <linux/fs.h>
+#include <linux/version.h>
+#include <linux/vmalloc.h>
+#include <linux/mm.h>
+#include <linux/gfp.h>
+#include <linux/bitmap.h>
+#include <linux/log2.h>
+#include <linux/kthread.h>
+#include <linux/wait.h>
+#include <linux/delay.h>
+#include <linux/ktime.h>
+#include <linux/debugfs.h>
+#include <linux/memremap.h>
+#include <linux/workqueue.h>
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6,7,0)
+#include <linux/io_uring/cmd.h>
+#elif LINUX_VERSION_CODE >= KERNEL_VERSION(5,19,0)
+#include <linux/io_uring.h>
+#endif
 
 #include <asm/e820/api.h>
+#ifdef CONFIG_X86
+#include <asm/cacheflush.h>
+#include <linux/libnvdimm.h>
+#endif
+
+/* Page backed pools need ZONE_DEVICE, and the range member of struct dev_pagemap added in Linux 5.10 */
+#if IS_ENABLED(CONFIG_ZONE_DEVICE) && (LINUX_VERSION_CODE >= KERNEL_VERSION(5,10,0))
+#define CMEM_PAGE_BACKED_SUPPORTED
+#endif
 
 
 #include "cmem.h"
+#include "cmem_regions.h"
+#include "cmem_kernel.h"
 
 /* Used to create the cmem device */
 static dev_t cmem_dev_id;
@@ -62,534 +98,4345 @@ static int cmem_minor;
 struct device *cmem_dev;
 
 
-/* Defines one physically contiguous address region allocated by this module */
+static cmem_allocation_regions_t cmem_allocation_regions;
+
+/* Records one scatter-gather allocation, made up of physically discontiguous chunks.
+ * Each chunk is also an allocated region in cmem_allocation_regions. This record is used by cmem_mmap() to map
+ * the chunks back-to-back into one contiguous virtual address range. */
+typedef struct
+{
+    /* Entry in cmem_sg_allocations */
+    struct list_head list;
+    /* Which process performed the allocation */
+    pid_t allocation_pid;
+    /* The number of chunks in the chunks[] array */
+    uint32_t num_chunks;
+    /* The chunks in the order they are mapped. The scatter-gather allocation is identified by the first chunk. */
+    cmem_host_buf_entry_t chunks[CMEM_MAX_SG_CHUNKS];
+} cmem_sg_allocation_t;
+static LIST_HEAD (cmem_sg_allocations);
+
+/* The allocation_pid used for regions of named allocations, which are not freed when a process exits */
+#define CMEM_NAMED_ALLOCATION_PID (-2)
+
+/* Records one named allocation, which is an allocated region in cmem_allocation_regions with an allocation_pid of
+ * CMEM_NAMED_ALLOCATION_PID. Persists until destroyed by CMEM_IOCTL_DESTROY_NAMED_BUFFER or the destroy_named_buffer
+ * device attribute, so that a restarted process can attach to the buffer by name with its contents intact. */
+typedef struct
+{
+    /* Entry in cmem_named_allocations */
+    struct list_head list;
+    /* The nul terminated name of the allocation */
+    char name[CMEM_MAX_NAME_LENGTH];
+    /* The physical address of the start of the allocation */
+    uint64_t start;
+    /* The length of the allocation in bytes */
+    uint64_t length;
+    /* The pid of the process which created the allocation, for information only */
+    pid_t creator_pid;
+} cmem_named_allocation_t;
+static LIST_HEAD (cmem_named_allocations);
+
+/* Counts the files a process has opened on the cmem device. A process may have more than one file open, e.g. when
+ * the user space library is used with multiple contexts, and its allocations are only freed when the last file is
+ * released. Otherwise closing one file would free allocations still in use through another. */
+typedef struct
+{
+    /* Entry in cmem_open_processes */
+    struct list_head list;
+    /* The thread group id of the process, which is the owner of its allocations */
+    pid_t owner;
+    /* The number of files opened by the process which haven't yet been released */
+    uint32_t num_open_files;
+} cmem_open_process_t;
+static LIST_HEAD (cmem_open_processes);
+
+/* The allocation_pid of allocations in page backed pools which have been freed while their pages are still pinned,
+ * e.g. by get_user_pages() for O_DIRECT or an io_uring fixed buffer. The memory remains allocated until the pins are
+ * released, since a device may still be transferring to it. */
+#define CMEM_PINNED_ALLOCATION_PID (-3)
+
+/* The allocation_pid of the regions of the first Kernel module registered by cmem_kernel_register(). Subsequent
+ * modules are given decreasing values, so they can't be mistaken for a process, CMEM_NAMED_ALLOCATION_PID or
+ * CMEM_PINNED_ALLOCATION_PID. */
+#define CMEM_FIRST_KERNEL_OWNER_PID (CMEM_PINNED_ALLOCATION_PID - 1)
+
+/* A Kernel module which allocates from the pools through the API in cmem_kernel.h */
+struct cmem_kernel_owner_s
+{
+    /* Entry in cmem_kernel_owners */
+    struct list_head list;
+    /* The nul terminated name of the module, for information only */
+    char name[CMEM_MAX_NAME_LENGTH];
+    /* The allocation_pid of the regions allocated by the module */
+    pid_t owner;
+    /* The number of allocations by the module which haven't been freed, and their total length in bytes */
+    uint32_t num_allocations;
+    uint64_t allocated_bytes;
+    /* The number of allocations by the module which failed for lack of free memory */
+    uint64_t allocation_failures;
+};
+static LIST_HEAD (cmem_kernel_owners);
+static pid_t cmem_next_kernel_owner_pid = CMEM_FIRST_KERNEL_OWNER_PID;
+
+/* A physical address range which the driver accesses through a kernel mapping outside of
+ * cmem_allocation_regions_lock, for a read or write of the device or by a loopback engine. While in cmem_busy_ranges
+ * the allocations which overlap the range can't be freed or shrunk, so the memory can't be reallocated while the
+ * driver is still accessing it. */
 typedef struct
 {
-    /* The start address of the region */
+    /* Entry in cmem_busy_ranges, or initialised as empty when the range isn't busy */
+    struct list_head list;
+    /* The physical address of the start of the range */
     uint64_t start;
-    /* The inclusive end address of the region */
+    /* The inclusive physical address of the end of the range */
     uint64_t end;
-    /* Defines if the region is in-use:
-     * - false means free for allocation
-     * - true means has been allocated */
-    bool allocated;
-    /* When allocate is true which process performed the allocation.
-     * Used to automatically free the allocation if the process terminates. */
-    pid_t allocation_pid;
-} cmem_allocation_region_t;
+} cmem_busy_range_t;
+static LIST_HEAD (cmem_busy_ranges);
 
+/* A kernel mapping of part of a buffer kept by a loopback engine between descriptors, so that descriptors which access
+ * the same part of a buffer reuse the mapping rather than each creating and removing one. While idle the mapping is
+ * removed by cmem_unmap_loopback_windows() when any of its memory is about to be freed, shrunk or mapped uncached, so
+ * it never outlives the allocation. */
+typedef struct
+{
+    /* The physical address range of the mapping, which is only in cmem_busy_ranges while a descriptor accesses it */
+    cmem_busy_range_t busy;
+    /* Entry in cmem_loopback_windows while mapped, or initialised as empty */
+    struct list_head list;
+    /* The kernel mapping of busy.start, or NULL when not mapped */
+    void *kernel_addr;
+} cmem_loopback_window_t;
+static LIST_HEAD (cmem_loopback_windows);
 
-/* Used to perform allocations of physically contiguous address regions to user processes.
- * No specific alignment for allocations is performed by this module. */
+/* The state of a started loopback engine */
 typedef struct
 {
-    /* Dynamically sized array of regions.
-     *
-     * Initialised to free regions.
-     * Updated as regions are allocated and freed. */
-    cmem_allocation_region_t *regions;
-    /* The current number of valid entries in the regions[] array */
-    uint32_t num_regions;
-    /* The current allocated length of the regions[] array, dynamically grown as required */
-    uint32_t regions_allocated_length;
-} cmem_allocation_regions_t;
-static cmem_allocation_regions_t cmem_allocation_regions;
+    /* The kernel thread which performs the descriptors */
+    struct task_struct *thread;
+    /* The owner of the buffers which the engine may access, which is the process which started the engine */
+    pid_t owner;
+    /* The parameters the engine was started with */
+    cmem_ioctl_loopback_t params;
+    /* Kernel mappings of the descriptor and completion rings, from the start of the control block */
+    void *descriptor_ring;
+    void *completion_ring;
+    /* The length of each ring mapping */
+    size_t descriptor_ring_length;
+    size_t completion_ring_length;
+    /* Prevent the rings being freed while the engine is started */
+    cmem_busy_range_t descriptor_ring_busy;
+    cmem_busy_range_t completion_ring_busy;
+    /* Prevent the buffers of the descriptor being performed from being freed during the copy or fill */
+    cmem_busy_range_t dest_busy;
+    cmem_busy_range_t src_busy;
+    /* The kernel mappings of the destination and source buffers, reused by subsequent descriptors */
+    cmem_loopback_window_t dest_window;
+    cmem_loopback_window_t src_window;
+    /* The wait queue of the file, woken when a completion is written */
+    wait_queue_head_t *completion_wait;
+    /* Updated by the engine thread, and only read once the thread has stopped */
+    cmem_ioctl_loopback_stats_t stats;
+} cmem_loopback_t;
 
-/* mutex used to protect cmem_allocation_regions from operations from multiple processes */
+/* The private data of each open file */
+typedef struct
+{
+    /* The count of open files of the process which opened the file */
+    cmem_open_process_t *open_process;
+    /* The loopback engine of the file, or NULL when not started */
+    cmem_loopback_t *loopback;
+    /* Woken by the loopback engine when a completion is written, for poll() */
+    wait_queue_head_t completion_wait;
+} cmem_file_t;
+
+/* mutex used to protect cmem_allocation_regions, cmem_sg_allocations, cmem_named_allocations, cmem_open_processes,
+ * cmem_kernel_owners, cmem_busy_ranges and cmem_loopback_windows from operations from multiple processes and Kernel
+ * modules */
 static DEFINE_MUTEX (cmem_allocation_regions_lock);
 
+/* mutex used to protect the loopback member of each cmem_file_t. Separate from cmem_allocation_regions_lock, since
+ * stopping an engine waits for its thread which may be waiting for cmem_allocation_regions_lock. */
+static DEFINE_MUTEX (cmem_loopback_lock);
 
-static struct vm_operations_struct custom_vm_ops = {
-    .access = generic_access_phys
-};
+
+/**
+ * @brief Get the identity of the process performing an operation, used as the owner of allocations
+ * @details Uses the thread group id, i.e. the process id, since allocations belong to the process. io_uring commands
+ *          may be issued by io-wq or SQPOLL threads of the submitting process, which have different thread ids.
+ * @return The process id
+ */
+static inline pid_t cmem_current_owner (void)
+{
+    return task_tgid_nr (current);
+}
 
 
 /**
- * @brief sort comparison function for cmem regions, which compares the start values
+ * @brief Remove the idle kernel mappings kept by loopback engines which overlap a physical address range
+ * @details Called with cmem_allocation_regions_lock held, when the range is about to be freed or mapped with a memory
+ *          type which would conflict with the write-back kernel mappings. Windows being accessed by a descriptor, which
+ *          are in cmem_busy_ranges, are left mapped.
+ * @param[in] start The physical address of the start of the range
+ * @param[in] end The inclusive physical address of the end of the range
  */
-static int cmem_region_compare (const void *const compare_a, const void *const compare_b)
+static void cmem_unmap_loopback_windows (const uint64_t start, const uint64_t end)
 {
-    const cmem_allocation_region_t *const region_a = compare_a;
-    const cmem_allocation_region_t *const region_b = compare_b;
+    cmem_loopback_window_t *window;
+    cmem_loopback_window_t *next_window;
 
-    if (region_a->start < region_b->start)
-    {
-        return -1;
-    }
-    else if (region_a->start == region_b->start)
-    {
-        return 0;
-    }
-    else
+    list_for_each_entry_safe (window, next_window, &cmem_loopback_windows, list)
     {
-        return 1;
+        if ((start <= window->busy.end) && (end >= window->busy.start) && list_empty (&window->busy.list))
+        {
+            list_del_init (&window->list);
+            memunmap (window->kernel_addr);
+            window->kernel_addr = NULL;
+        }
     }
 }
 
 
 /**
- * @brief Append a new cmem region to the end of array.
- * @details This is a helper function which can leave the regions[] un-sorted
- * @param[in/out] allocator Contains the cmem regions to modify
- * @param[in] new_region The new cmem region to append
+ * @brief Determine if any part of a physical address range is being accessed by the driver
+ * @details Called with cmem_allocation_regions_lock held, by the operations which free or shrink allocations.
+ *          When the range isn't busy, removes the idle kernel mappings of the range kept by loopback engines since the
+ *          range is about to be freed.
+ * @param[in] start The physical address of the start of the range
+ * @param[in] end The inclusive physical address of the end of the range
+ * @return Returns true if the range overlaps a range in cmem_busy_ranges, in which case it mustn't be freed
  */
-static void cmem_append_region (cmem_allocation_regions_t *const allocator, const cmem_allocation_region_t *const new_region)
+static bool cmem_range_busy (const uint64_t start, const uint64_t end)
 {
-    const uint32_t grow_length = 64;
+    const cmem_busy_range_t *busy_range;
 
-    /* Increase the allocated length of the array to ensure has space for the region */
-    if (allocator->num_regions == allocator->regions_allocated_length)
+    list_for_each_entry (busy_range, &cmem_busy_ranges, list)
     {
-        size_t required_size;
-
-        allocator->regions_allocated_length += grow_length;
-        required_size = allocator->regions_allocated_length * sizeof (allocator->regions[0]);
-        allocator->regions = krealloc (allocator->regions, required_size, GFP_KERNEL);
-
-        if (allocator->regions == NULL)
+        if ((start <= busy_range->end) && (end >= busy_range->start))
         {
-            dev_err (cmem_dev, "krealloc of %zu bytes failed", required_size);
-            return;
+            return true;
         }
     }
 
-    /* Append the new region to the end of the array. May not be address order, is sorted later */
-    allocator->regions[allocator->num_regions] = *new_region;
-    allocator->num_regions++;
+    cmem_unmap_loopback_windows (start, end);
+
+    return false;
 }
 
 
+/* The maximum number of memmap regions which can be used as pools, which are all reported in the status page */
+#define CMEM_MAX_POOLS CMEM_STATUS_MAX_POOLS
+
+/* Defines one pool of reserved memory, obtained from a memmap Kernel parameter, from which allocations are made */
+typedef struct
+{
+    /* The start address of the pool */
+    uint64_t start;
+    /* The inclusive end address of the pool */
+    uint64_t end;
+    /* The NUMA node of the memory in the pool, or NUMA_NO_NODE if not known */
+    int numa_node;
+    /* The CMEM_POOL_CLASS_* of the pool */
+    uint32_t pool_class;
+    /* True when the pool has struct pages created by memremap_pages() */
+    bool page_backed;
+#ifdef CMEM_PAGE_BACKED_SUPPORTED
+    /* Describes the struct pages of the pool to memremap_pages() */
+    struct dev_pagemap pgmap;
+    /* The cmem_page_pin_count() of a page of the pool which isn't pinned, which depends on the Kernel version */
+    int idle_pin_count;
+#endif
+} cmem_pool_t;
+static cmem_pool_t cmem_pools[CMEM_MAX_POOLS];
+static uint32_t cmem_num_pools;
+
+/* When true the pools are given struct pages, so that user mappings of buffers can be pinned by get_user_pages() */
+static bool cmem_page_backed;
+module_param_named (page_backed, cmem_page_backed, bool, 0444);
+MODULE_PARM_DESC (page_backed, "Give the pools struct pages, so mapped buffers can be used for O_DIRECT and io_uring fixed buffers");
+
+/* The number of entries in the regions[] array of cmem_allocation_regions allocated for each pool at initialisation,
+ * so that the array only has to grow once that number of regions are in use */
+static uint cmem_region_reserve = 1024;
+module_param_named (region_reserve, cmem_region_reserve, uint, 0444);
+MODULE_PARM_DESC (region_reserve, "Number of region entries preallocated per pool, before the region array has to grow");
+
+/* The number of unused entries in the regions[] array needed before taking cmem_allocation_regions_lock for an
+ * operation which may add regions. One ioctl allocates at most CMEM_MAX_BUF_PER_ALLOC buffers or CMEM_MAX_SG_CHUNKS
+ * chunks, each of which may split one free region into three. */
+#define CMEM_REGIONS_LOCKED_HEADROOM \
+    ((2 * max (CMEM_MAX_BUF_PER_ALLOC, CMEM_MAX_SG_CHUNKS)) + CMEM_REGIONS_UPDATE_HEADROOM)
+
+
 /**
- * @brief Remove one cmem region, shuffling down the following entries in the array
- * @param[in/out] allocator Contains the cmem regions to modify
- * @param[in] region_index Identifies which region to remove
+ * @brief Grow the regions[] array of cmem_allocation_regions, so that it has at least a number of unused entries
+ * @details Called without cmem_allocation_regions_lock held, so that allocating the new array, which may perform
+ *          memory reclaim, doesn't block other operations. The lock is only held to copy the regions into the new array.
+ *          The array at least doubles in length each time it grows.
+ * @param[in] headroom The number of unused entries required
+ * @return Returns zero on success, or -ENOMEM if the new array couldn't be allocated
  */
-static void cmem_remove_region (cmem_allocation_regions_t *const allocator, const uint32_t region_index)
+static int cmem_grow_regions (const uint32_t headroom)
 {
-    const uint32_t num_regions_to_shuffle = allocator->num_regions - region_index;
+    cmem_allocation_region_t *new_regions;
+    cmem_allocation_region_t *unused_regions;
+    uint32_t new_length;
+
+    mutex_lock (&cmem_allocation_regions_lock);
+    new_length = cmem_allocation_regions.num_regions +
+            max (headroom, cmem_allocation_regions.regions_allocated_length);
+    mutex_unlock (&cmem_allocation_regions_lock);
+
+    new_regions = kvmalloc_array (new_length, sizeof (new_regions[0]), GFP_KERNEL);
+    if (new_regions == NULL)
+    {
+        pr_err(CMEM_DRVNAME ": Failed to allocate %u region entries\n", new_length);
+        return -ENOMEM;
+    }
+
+    /* Another caller may have grown the array while the lock was released */
+    mutex_lock (&cmem_allocation_regions_lock);
+    if (new_length > cmem_allocation_regions.regions_allocated_length)
+    {
+        unused_regions = cmem_replace_regions (&cmem_allocation_regions, new_regions, new_length);
+    }
+    else
+    {
+        unused_regions = new_regions;
+    }
+    mutex_unlock (&cmem_allocation_regions_lock);
+    kvfree (unused_regions);
 
-    memmove (&allocator->regions[region_index], &allocator->regions[region_index + 1],
-            sizeof (allocator->regions[region_index]) * num_regions_to_shuffle);
-    allocator->num_regions--;
+    return 0;
 }
 
 
 /**
- * @brief Update the array of cmem regions with a new region.
- * @brief The new region can either:
- *        a. Add a free region at initialisation.
- *        b. Mark a region as allocated. This may split an existing free region.
- *        c. Free a previously allocated region. This may combine adjacent free regions.
- * @param[in/out] allocator Contains the cmem regions to update
- * @param[in] new_region Defines the new region
+ * @brief Take cmem_allocation_regions_lock for an operation which may add regions
+ * @details Grows the regions[] array first if it has fewer than CMEM_REGIONS_LOCKED_HEADROOM unused entries, so that
+ *          memory is never allocated while the lock is held.
+ * @return Returns zero with the lock held, or -ENOMEM without the lock held
  */
-static void cmem_update_regions (cmem_allocation_regions_t *const allocator, const cmem_allocation_region_t *const new_region)
+static int cmem_lock_regions (void)
 {
-    bool new_region_processed = false;
-    uint32_t region_index;
-
-    /* Search for which existing region the region overlaps */
-    for (region_index = 0; !new_region_processed && (region_index < allocator->num_regions); region_index++)
+    mutex_lock (&cmem_allocation_regions_lock);
+    while (cmem_regions_headroom (&cmem_allocation_regions) < CMEM_REGIONS_LOCKED_HEADROOM)
     {
-        /* Take a copy of the existing region, since cmem_append_region() may change the pointers */
-        const cmem_allocation_region_t existing_region = allocator->regions[region_index];
-
-        if ((new_region->start >= existing_region.start) && (new_region->end <= existing_region.end))
+        mutex_unlock (&cmem_allocation_regions_lock);
+        if (cmem_grow_regions (CMEM_REGIONS_LOCKED_HEADROOM) != 0)
         {
-            /* Remove the existing region */
-            cmem_remove_region (allocator, region_index);
+            return -ENOMEM;
+        }
+        mutex_lock (&cmem_allocation_regions_lock);
+    }
 
-            /* If the new region doesn't start at the beginning of the existing region, then append a region
-             * with the same allocated state as the existing region to fill up to the start of the new region */
-            if (new_region->start > existing_region.start)
-            {
-                const cmem_allocation_region_t before_region =
-                {
-                    .start = existing_region.start,
-                    .end = new_region->start - 1,
-                    .allocated = existing_region.allocated,
-                    .allocation_pid = existing_region.allocated ? existing_region.allocation_pid : -1
-                };
+    return 0;
+}
 
-                cmem_append_region (allocator, &before_region);
-            }
+/* A pool managed by the granule bitmap allocator, rather than cmem_allocation_regions, intended for small buffers.
+ * The pool is divided into fixed size granules, and an allocation is a run of whole granules. Allocations search the
+ * bitmaps a word at a time, so the latency is bounded by the size of the pool rather than the number of allocations. */
+typedef struct
+{
+    /* The physical address of the first granule, aligned to the granule size */
+    uint64_t start;
+    /* The number of granules in the pool */
+    unsigned long num_granules;
+    /* The number of granules which are not allocated */
+    unsigned long num_free_granules;
+    /* One bit per granule, set when the granule is allocated */
+    unsigned long *allocated_map;
+    /* One bit per granule, set for the first granule of each allocation, to separate adjacent allocations */
+    unsigned long *first_map;
+    /* Indexed by granule, the owner of the allocation which starts at the granule */
+    pid_t *owners;
+} cmem_granule_pool_t;
+static cmem_granule_pool_t cmem_granule_pools[CMEM_MAX_POOLS];
+static uint32_t cmem_num_granule_pools;
 
-            /* Append the new region */
-            cmem_append_region (allocator, new_region);
+/* Bit mask of the memmap pools, in the order they appear on the Kernel command line, which are managed by the
+ * granule bitmap allocator. The other pools are managed by cmem_allocation_regions. */
+static uint cmem_granule_pool_mask;
+module_param_named (granule_pools, cmem_granule_pool_mask, uint, 0444);
+MODULE_PARM_DESC (granule_pools, "Bit mask of the memmap pools, in command line order, managed by the granule bitmap allocator");
 
-            /* If the new region ends before that of the existing region, then append a region with the same
-             * allocated state as the existing region to fill up to the end of the existing region */
-            if (new_region->end < existing_region.end)
-            {
-                const cmem_allocation_region_t after_region =
-                {
-                    .start = new_region->end + 1,
-                    .end = existing_region.end,
-                    .allocated = existing_region.allocated,
-                    .allocation_pid = existing_region.allocated ? existing_region.allocation_pid : -1
-                };
+/* The size of the granules of pools managed by the granule bitmap allocator, and log2 of the size */
+static uint cmem_granule_size = 4096;
+module_param_named (granule_size, cmem_granule_size, uint, 0444);
+MODULE_PARM_DESC (granule_size, "Granule size in bytes for the granule bitmap allocator, a power of two of at least the page size");
+static unsigned int cmem_granule_shift;
 
-                cmem_append_region (allocator, &after_region);
-            }
+/* The number of bytes of free memory in the first 4 GiB which allocations for 64-bit capable devices may not use,
+ * to guarantee capacity for devices which are only 32-bit capable */
+static ulong cmem_a32_reserve;
+module_param_named (a32_reserve, cmem_a32_reserve, ulong, 0644);
+MODULE_PARM_DESC (a32_reserve, "Bytes of free memory in the first 4 GiB which allocations for 64-bit capable devices may not use");
 
-            new_region_processed = true;
-        }
-    }
+/* Selects which free region cmem_allocate_region() uses, as a cmem_fit_policy_t */
+static uint cmem_fit_policy = CMEM_FIT_BEST;
+module_param_named (fit_policy, cmem_fit_policy, uint, 0644);
+MODULE_PARM_DESC (fit_policy, "Free region used for allocations: 0 best fit (smallest), 1 first fit (lowest address), 2 worst fit (largest)");
 
-    if (!new_region_processed)
-    {
-        /* The new region doesn't overlap an existing region. Must be inserting free regions at initialisation */
-        cmem_append_region (allocator, new_region);
-    }
+/* When non-zero the number of page sized colours in one way of the last level cache, i.e. the cache size divided by
+ * the associativity and PAGE_SIZE, which causes cmem_allocate_region() to stagger the start of allocations across the
+ * colours */
+static uint cmem_cache_colours;
+module_param_named (cache_colours, cmem_cache_colours, uint, 0644);
+MODULE_PARM_DESC (cache_colours, "Page colours in one way of the last level cache to stagger allocation starts across, 0 disables");
+
+/* The memmap=nn$ss pools which are in CMEM_POOL_CLASS_BULK rather than CMEM_POOL_CLASS_DRAM */
+static uint cmem_bulk_pool_mask;
+module_param_named (bulk_pools, cmem_bulk_pool_mask, uint, 0444);
+MODULE_PARM_DESC (bulk_pools, "Bit mask of the memmap pools, in command line order, in the bulk pool class");
+
+/* The cmem_fit_policy_t of CMEM_POOL_CLASS_BULK and CMEM_POOL_CLASS_PMEM. CMEM_POOL_CLASS_DRAM uses fit_policy. */
+static uint cmem_bulk_fit_policy = CMEM_FIT_FIRST;
+module_param_named (bulk_fit_policy, cmem_bulk_fit_policy, uint, 0644);
+MODULE_PARM_DESC (bulk_fit_policy, "fit_policy for allocations from the bulk pool class");
+static uint cmem_pmem_fit_policy = CMEM_FIT_FIRST;
+module_param_named (pmem_fit_policy, cmem_pmem_fit_policy, uint, 0644);
+MODULE_PARM_DESC (pmem_fit_policy, "fit_policy for allocations from the persistent memory pool class");
+
+/* Counts of allocations which failed for lack of free memory, by the addressing capability of the device and by the
+ * class of pools, and of the times an allocation for a 64-bit capable device was refused free memory in the first
+ * 4 GiB by a32_reserve */
+static uint64_t cmem_a32_allocation_failures;
+static uint64_t cmem_a64_allocation_failures;
+static uint64_t cmem_class_allocation_failures[CMEM_NUM_POOL_CLASSES];
+static uint64_t cmem_a32_reserve_refusals;
 
-    /* Sort the cmem regions into ascending start order */
-    sort (allocator->regions, allocator->num_regions, sizeof (allocator->regions[0]), cmem_region_compare, NULL);
 
-    /* Combine adjacent cmem regions which are free.
-     * Adjacent cmem regions which are allocated need to be kept as separate regions to support freeing them
-     * automatically when the allocating process exits. */
-    region_index = 0;
-    while ((region_index + 1) < allocator->num_regions)
+/**
+ * @brief Get the fit policy for allocations from a class of pools
+ * @param[in] pool_class The CMEM_POOL_CLASS_* of the allocation
+ * @return The policy, which is best fit if the module parameter for the class is out of range
+ */
+static cmem_fit_policy_t cmem_class_fit_policy (const uint32_t pool_class)
+{
+    uint fit_policy;
+
+    switch (pool_class)
     {
-        cmem_allocation_region_t *const this_region = &allocator->regions[region_index];
-        const uint32_t next_region_index = region_index + 1;
-        const cmem_allocation_region_t *const next_region = &allocator->regions[next_region_index];
+    case CMEM_POOL_CLASS_BULK:
+        fit_policy = READ_ONCE (cmem_bulk_fit_policy);
+        break;
 
-        if (((this_region->end + 1) == next_region->start) && !this_region->allocated && !next_region->allocated)
-        {
-            this_region->end = next_region->end;
-            cmem_remove_region (allocator, next_region_index);
-        }
-        else if (this_region->end >= next_region->start)
-        {
-            /* Bug if the adjacent IOVA regions are overlapping */
-            dev_err (cmem_dev, "Adjacent iova_regions overlap");
-        }
-        else
-        {
-            region_index++;
-        }
+    case CMEM_POOL_CLASS_PMEM:
+        fit_policy = READ_ONCE (cmem_pmem_fit_policy);
+        break;
+
+    default:
+        fit_policy = READ_ONCE (cmem_fit_policy);
+        break;
     }
+
+    return (fit_policy < CMEM_FIT_NUM_POLICIES) ? fit_policy : CMEM_FIT_BEST;
 }
 
+/* The page which reports the capacity of the pools to user space, updated by cmem_update_status_page() */
+static cmem_status_page_t *cmem_status_page;
+
+/* Set when the allocations may have changed since the status page was last updated, so that
+ * cmem_update_status_page() only scans the pools after a change. Every change to the allocations is recorded by
+ * cmem_trace_event(), which sets this whether or not the trace is enabled. Protected by cmem_allocation_regions_lock. */
+static bool cmem_status_page_stale = true;
+
+
+/* One physically contiguous chunk of a user mapping */
+typedef struct
+{
+    /* The physical address of the start of the chunk */
+    uint64_t phys_addr;
+    /* The length of the chunk in bytes */
+    uint64_t length;
+} cmem_mapping_chunk_t;
+
+/* The state of a user mapping of pool memory created by cmem_mmap(), used to provide fast access by a debugger.
+ * Shared by all VMAs which result from the original mapping being split, moved or copied on fork. */
+typedef struct
+{
+    /* Number of VMAs referencing the mapping */
+    struct kref refcount;
+    /* The vm_pgoff of the original mapping, used to find the offset into the mapping of an address in a VMA */
+    unsigned long base_pgoff;
+    /* The number of entries in the chunks[] array */
+    uint32_t num_chunks;
+    /* The chunks in the order they are mapped */
+    cmem_mapping_chunk_t chunks[];
+} cmem_mapping_t;
+
+
+/* The maximum length of each kernel mapping created to service a read, write, debugger access or cache maintenance,
+ * to limit the kernel virtual address space used for large buffers */
+#define CMEM_RW_MAX_MAP_LENGTH (4UL * 1024 * 1024)
+
+/* When true cmem_vma_access() copies the entire span requested through kernel mappings of up to
+ * CMEM_RW_MAX_MAP_LENGTH of the pool memory. When false uses generic_access_phys(), which maps and unmaps the memory
+ * for each page accessed. */
+static bool cmem_fast_access = true;
+module_param_named (fast_access, cmem_fast_access, bool, 0644);
+MODULE_PARM_DESC (fast_access, "Use multi-page kernel mappings for debugger access to mapped buffers, rather than generic_access_phys");
+
+/* The number of records in the allocation trace, or zero when the trace is disabled */
+static uint cmem_trace_num_records;
+module_param_named (trace_records, cmem_trace_num_records, uint, 0444);
+MODULE_PARM_DESC (trace_records, "Number of records in the allocation trace read from debugfs, or zero to disable the trace");
+
+/* The allocation trace, which is a ring of cmem_trace_num_records records. NULL when the trace is disabled.
+ * The head and tail are free-running counts of the records written and read, and lost counts the records which
+ * couldn't be written since the trace was full. Protected by cmem_allocation_regions_lock. */
+static cmem_trace_record_t *cmem_trace_records;
+static uint64_t cmem_trace_head;
+static uint64_t cmem_trace_tail;
+static uint64_t cmem_trace_lost;
+
+/* The debugfs directory of the module, which contains the trace file */
+static struct dentry *cmem_debugfs_dir;
+
 
 /**
- * @brief Attempt to perform an cmem allocation, by searching the free cmem regions
- * @param[in] cmd CMEM_IOCTL_ALLOC_A32_HOST_BUFFERS or CMEM_IOCTL_ALLOC_A64_HOST_BUFFERS to indicate the type of allocation.
- * @param[in/out] allocator Contains the cmem regions to allocate from
- * @param[in] min_start Minimum start IOVA to use for the allocation.
- *                      May be non-zero to cause a 64-bit DMA capable device to initially avoid the
- *                      first 4 GiB of address space.
- * @param[in] length The length of the allocation required
- * @param[out] region The allocated region. Success is indicated when allocated is true
+ * @brief Write one record to the allocation trace, if there is space
+ * @details Called with cmem_allocation_regions_lock held
+ * @param[in] event One of the CMEM_TRACE_EVENT_* values
+ * @param[in] flags CMEM_TRACE_FLAG_* values
+ * @param[in] address The physical address of the region
+ * @param[in] length The length of the region
+ * @param[in] alignment The required alignment of an allocation, which must be a power of two
+ * @param[in] owner The owner of the region
+ * @param[in] pool_class The CMEM_POOL_CLASS_* of a pool region or an allocation, otherwise zero
+ * @return Returns true if the record was written
  */
-static void cmem_attempt_allocation (const unsigned int cmd,
-                                     cmem_allocation_regions_t *const allocator,
-                                     const uint64_t min_start, const size_t length,
-                                     cmem_allocation_region_t *const region)
+static bool cmem_trace_write (const uint8_t event, const uint8_t flags, const uint64_t address, const uint64_t length,
+                              const uint64_t alignment, const pid_t owner, const uint32_t pool_class)
 {
-    const uint64_t max_a32_end = 0xffffffffUL;
-    uint32_t region_index;
-    size_t min_unused_space;
+    cmem_trace_record_t *record;
 
-    /* Search for the smallest existing free region in which the aligned size will fit,
-     * to try and reduce running out of IOVA addresses due to fragmentation. */
-    min_unused_space = 0;
-    for (region_index = 0; region_index < allocator->num_regions; region_index++)
+    if ((cmem_trace_head - cmem_trace_tail) >= cmem_trace_num_records)
     {
-        const cmem_allocation_region_t *const existing_region = &allocator->regions[region_index];
+        return false;
+    }
 
-        if (existing_region->allocated)
-        {
-            /* Skip this region, as not free */
-        }
-        else if (existing_region->end < min_start)
-        {
-            /* Skip this region, as all of it is below the minimum start */
-        }
-        else if ((cmd == CMEM_IOCTL_ALLOC_A32_HOST_BUFFERS) && (existing_region->start > max_a32_end))
-        {
-            /* Skip this region, as all of it is above what can be addressed the device which is only 32-bit capable */
-        }
-        else
-        {
-            /* Limit the usable start for the region to the minimum */
-            const uint64_t usable_region_start = (existing_region->start >= min_start) ? existing_region->start : min_start;
+    record = &cmem_trace_records[cmem_trace_head % cmem_trace_num_records];
+    record->timestamp_ns = ktime_get_ns ();
+    record->address = address;
+    record->length = length;
+    record->owner = owner;
+    record->event = event;
+    record->flags = flags;
+    record->alignment_shift = ilog2 (alignment);
+    record->pool_class = pool_class;
+    cmem_trace_head++;
 
-            /* When the device is only 32-bit address capable limit the end to the first 4 GiB */
-            const uint64_t usable_region_end =
-                    ((cmd == CMEM_IOCTL_ALLOC_A32_HOST_BUFFERS) && (max_a32_end < existing_region->end)) ?
-                            max_a32_end : existing_region->end;
+    return true;
+}
 
-            const uint64_t usable_region_size = (usable_region_end + 1) - usable_region_start;
 
-            if (usable_region_size >= length)
-            {
-                const uint64_t region_unused_space = usable_region_size - length;
+/**
+ * @brief Record an event in the allocation trace, when enabled
+ * @details Called with cmem_allocation_regions_lock held. When records have been lost, a CMEM_TRACE_EVENT_LOST
+ *          record is written before the event once there is space, so a reader knows the trace is incomplete.
+ * @param[in] event One of the CMEM_TRACE_EVENT_* values
+ * @param[in] flags CMEM_TRACE_FLAG_* values
+ * @param[in] address The physical address of the region
+ * @param[in] length The length of the region
+ * @param[in] alignment The required alignment of an allocation, which must be a power of two
+ * @param[in] owner The owner of the region
+ * @param[in] pool_class The CMEM_POOL_CLASS_* of a pool region or an allocation, otherwise zero
+ */
+static void cmem_trace_event (const uint8_t event, const uint8_t flags, const uint64_t address, const uint64_t length,
+                              const uint64_t alignment, const pid_t owner, const uint32_t pool_class)
+{
+    cmem_status_page_stale = true;
+    if (cmem_trace_records == NULL)
+    {
+        return;
+    }
 
-                if (!region->allocated || (region_unused_space < min_unused_space))
-                {
-                    region->start = usable_region_start;
-                    region->end = region->start + (length - 1);
-                    region->allocated = true;
-                    region->allocation_pid = task_pid_nr (current);
-                    min_unused_space = region_unused_space;
-                }
-            }
-        }
+    if ((cmem_trace_lost > 0) && cmem_trace_write (CMEM_TRACE_EVENT_LOST, 0, 0, cmem_trace_lost, 1, -1, 0))
+    {
+        cmem_trace_lost = 0;
+    }
+    if ((cmem_trace_lost > 0) || !cmem_trace_write (event, flags, address, length, alignment, owner, pool_class))
+    {
+        cmem_trace_lost++;
     }
 }
 
 
 /**
- * @brief Allocate a cmem region for use by a DMA mapping for a device
- * @param[in] cmd CMEM_IOCTL_ALLOC_A32_HOST_BUFFERS or CMEM_IOCTL_ALLOC_A64_HOST_BUFFERS to indicate the type of allocation.
- * @param[in/out] allocator Contains the cmem regions to allocate from
- * @param[in] length The length of the allocation required
- * @param[out] region The allocated region. Success is indicated when allocated is true
+ * @brief Read records from the allocation trace, which consumes them
+ * @details Only whole records are read. The records are copied from the trace to a bounce buffer with
+ *          cmem_allocation_regions_lock held, and then copied to user space once the lock has been released.
+ * @param[in] filp The trace file in debugfs
+ * @param[out] buf The user space buffer to read into
+ * @param[in] count The length of buf, which must be at least one record
+ * @param[in/out] ppos Unused, since the trace isn't seekable
+ * @return The number of bytes read, zero when the trace is empty, or a negative errno value on failure
  */
-static void cmem_allocate_region (const unsigned int cmd,
-                                  cmem_allocation_regions_t *const allocator,
-                                  const size_t length,
-                                  cmem_allocation_region_t *const region)
+static ssize_t cmem_trace_read (struct file *const filp, char __user *const buf, const size_t count,
+                                loff_t *const ppos)
 {
-    /* Default to no allocation */
-    region->start = 0;
-    region->end = 0;
-    region->allocated = false;
-    region->allocation_pid = -1;
+    const size_t max_records = min (count, (size_t) PAGE_SIZE) / sizeof (cmem_trace_record_t);
+    cmem_trace_record_t *bounce;
+    size_t num_records;
+    size_t record_index;
 
-    if (cmd == CMEM_IOCTL_ALLOC_A64_HOST_BUFFERS)
+    if (max_records == 0)
     {
-        /* For 64-bit capable devices first attempt to allocate addresses above the first 4 GiB,
-         * to try and keep the first 4 GiB for devices which are only 32-bit capable. */
-        const uint64_t a64_min_start = 0x100000000UL;
+        return -EINVAL;
+    }
 
-        cmem_attempt_allocation (cmd, allocator, a64_min_start, length, region);
+    bounce = kmalloc_array (max_records, sizeof (cmem_trace_record_t), GFP_KERNEL);
+    if (bounce == NULL)
+    {
+        return -ENOMEM;
     }
 
-    /* If allocation wasn't successful, or only a 32-bit capable device, try the allocation with no minimum start */
-    if (!region->allocated)
+    mutex_lock (&cmem_allocation_regions_lock);
+    num_records = min ((size_t) (cmem_trace_head - cmem_trace_tail), max_records);
+    for (record_index = 0; record_index < num_records; record_index++)
     {
-        cmem_attempt_allocation (cmd, allocator, 0, length, region);
+        bounce[record_index] = cmem_trace_records[cmem_trace_tail % cmem_trace_num_records];
+        cmem_trace_tail++;
     }
+    mutex_unlock (&cmem_allocation_regions_lock);
 
-    if (region->allocated)
+    if (copy_to_user (buf, bounce, num_records * sizeof (cmem_trace_record_t)))
     {
-        /* Record the region as now allocated */
-        cmem_update_regions (allocator, region);
+        kfree (bounce);
+        return -EFAULT;
     }
+    kfree (bounce);
+
+    return num_records * sizeof (cmem_trace_record_t);
 }
 
 
+static const struct file_operations cmem_trace_fops =
+{
+    .owner = THIS_MODULE,
+    .read = cmem_trace_read
+};
+
+
 /**
-* cmem_ioctl() - Application interface for cmem module to allocate or free contiguous memory regions
-*/
-static long cmem_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
+ * @brief Create the allocation trace when enabled by the trace_records module parameter
+ * @details Records the free regions of the pools managed by cmem_allocation_regions, so a replay can recreate the
+ *          pools. Failure to create the trace isn't fatal, and leaves the trace disabled.
+ */
+static void cmem_trace_create (void)
 {
-    int ret = 0;
-    uint32_t buffer_index;
     uint32_t region_index;
 
-    /* cmem_ioctl_t is more than 1K in size, so allocate a local copy on the heap to avoid -Wframe-larger-than= warnings
-     * on some Kernels. */
-    cmem_ioctl_t *const cmem_ioctl_arg = kmalloc (sizeof (*cmem_ioctl_arg), GFP_KERNEL);;
-    if (cmem_ioctl_arg == NULL)
+    if (cmem_trace_num_records == 0)
     {
-        return -ENOMEM;
+        return;
     }
 
-    mutex_lock (&cmem_allocation_regions_lock);
+    cmem_trace_records = vmalloc ((size_t) cmem_trace_num_records * sizeof (cmem_trace_record_t));
+    if (cmem_trace_records == NULL)
+    {
+        pr_warn(CMEM_DRVNAME ": Failed to allocate a trace of %u records\n", cmem_trace_num_records);
+        return;
+    }
 
-    switch (cmd)
+    cmem_debugfs_dir = debugfs_create_dir (CMEM_DRVNAME, NULL);
+    debugfs_create_file ("trace", 0400, cmem_debugfs_dir, NULL, &cmem_trace_fops);
+
+    for (region_index = 0; region_index < cmem_allocation_regions.num_regions; region_index++)
     {
-    case CMEM_IOCTL_ALLOC_A64_HOST_BUFFERS:
-    case CMEM_IOCTL_ALLOC_A32_HOST_BUFFERS:
-        {
-            cmem_allocation_region_t allocated_region;
+        const cmem_allocation_region_t *const region = &cmem_allocation_regions.regions[region_index];
 
-            /* Allocate the specified buffers */
-            if (copy_from_user (cmem_ioctl_arg, (cmem_ioctl_t *) arg, sizeof (*cmem_ioctl_arg)))
-            {
-                ret = -EFAULT;
-            }
-            else if (cmem_ioctl_arg->host_buf_info.num_buffers > CMEM_MAX_BUF_PER_ALLOC)
-            {
-                ret = -EINVAL;
-            }
-            else
-            {
-                for (buffer_index = 0; (ret == 0) && (buffer_index < cmem_ioctl_arg->host_buf_info.num_buffers); buffer_index++)
-                {
-                    cmem_host_buf_entry_t *const buffer = &cmem_ioctl_arg->host_buf_info.buf_info[buffer_index];
+        cmem_trace_event (CMEM_TRACE_EVENT_POOL, 0, region->start, (region->end + 1) - region->start, 1, -1,
+                region->pool_class);
+    }
+}
 
-                    cmem_allocate_region (cmd, &cmem_allocation_regions, buffer->length, &allocated_region);
-                    if (allocated_region.allocated)
-                    {
-                        buffer->dma_address = allocated_region.start;
-                    }
-                    else
-                    {
-                        /* Indicate the individual allocation failed, and indicate an overall failure */
-                        buffer->length = 0;
-                        buffer->dma_address = 0;
-                        ret = -ENOMEM;
-                    }
-                }
 
-                if (copy_to_user ((cmem_ioctl_t *) arg, cmem_ioctl_arg, sizeof (*cmem_ioctl_arg)))
-                {
-                    ret = -EFAULT;
-                }
-            }
+/**
+ * @brief Determine if a physical address range is entirely inside one pool
+ * @param[in] start The start of the physical address range
+ * @param[in] length The length of the physical address range
+ * @return Returns true if the range is inside a pool
+ */
+static bool cmem_phys_in_pool (const uint64_t start, const uint64_t length)
+{
+    uint32_t pool_index;
+
+    for (pool_index = 0; pool_index < cmem_num_pools; pool_index++)
+    {
+        if ((length > 0) && (start >= cmem_pools[pool_index].start) && ((start + length - 1) <= cmem_pools[pool_index].end))
+        {
+            return true;
         }
-        break;
+    }
 
-    case CMEM_IOCTL_FREE_HOST_BUFFERS:
+    return false;
+}
+
+
+/**
+ * @brief Determine if a physical address range is entirely inside one pool which has struct pages
+ * @param[in] start The start of the physical address range
+ * @param[in] length The length of the physical address range
+ * @return Returns true if the range is inside a page backed pool
+ */
+static bool cmem_phys_page_backed (const uint64_t start, const uint64_t length)
+{
+    uint32_t pool_index;
+
+    for (pool_index = 0; pool_index < cmem_num_pools; pool_index++)
+    {
+        if (cmem_pools[pool_index].page_backed &&
+            (length > 0) && (start >= cmem_pools[pool_index].start) && ((start + length - 1) <= cmem_pools[pool_index].end))
         {
-            /* Free the specified buffers, checking the current process performed the allocations */
-            if (copy_from_user (cmem_ioctl_arg, (cmem_ioctl_t *) arg, sizeof (*cmem_ioctl_arg)))
-            {
-                ret = -EFAULT;
-            }
-            else if (cmem_ioctl_arg->host_buf_info.num_buffers > CMEM_MAX_BUF_PER_ALLOC)
-            {
-                ret = -EINVAL;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+
+#ifdef CMEM_PAGE_BACKED_SUPPORTED
+/**
+ * @brief Get the references to a page other than those of the user mappings which contain it
+ * @details get_user_pages() takes a reference on each page, and pin_user_pages() adds GUP_PIN_COUNTING_BIAS to the
+ *          reference count, neither of which change the map count. Excluding the references of the mappings allows a
+ *          buffer to be freed or shrunk before it is unmapped, as for pools without struct pages.
+ * @param[in] page The page to check
+ * @return The reference count less the map count
+ */
+static int cmem_page_pin_count (struct page *const page)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5,18,0)
+    return page_ref_count (page) - folio_mapcount (page_folio (page));
+#else
+    return page_ref_count (page) - page_mapcount (page);
+#endif
+}
+#endif
+
+
+/**
+ * @brief Determine if any page of a physical address range in a page backed pool is pinned
+ * @param[in] start The start of the physical address range
+ * @param[in] length The length of the physical address range
+ * @return Returns true if the range is in a page backed pool and any of its pages have references other than from
+ *         user mappings, in which case a device may still be transferring to it
+ */
+static bool cmem_phys_pinned (const uint64_t start, const uint64_t length)
+{
+#ifdef CMEM_PAGE_BACKED_SUPPORTED
+    uint32_t pool_index;
+    unsigned long pfn;
+
+    for (pool_index = 0; pool_index < cmem_num_pools; pool_index++)
+    {
+        const cmem_pool_t *const pool = &cmem_pools[pool_index];
+
+        if (pool->page_backed && (length > 0) && (start >= pool->start) && ((start + length - 1) <= pool->end))
+        {
+            for (pfn = PHYS_PFN (start); pfn <= PHYS_PFN (start + length - 1); pfn++)
+            {
+                if (cmem_page_pin_count (pfn_to_page (pfn)) > pool->idle_pin_count)
+                {
+                    return true;
+                }
+            }
+            return false;
+        }
+    }
+#endif
+
+    return false;
+}
+
+
+/* The interval at which allocations whose free was deferred while their pages were pinned are checked */
+#define CMEM_PINNED_REAP_INTERVAL_MS 1000
+
+/* The number of allocations with an owner of CMEM_PINNED_ALLOCATION_PID, protected by cmem_allocation_regions_lock */
+static uint32_t cmem_num_pinned_allocations;
+
+static void cmem_reap_pinned_allocations (struct work_struct *const work);
+
+/* Frees the allocations whose pins have been released, scheduled while cmem_num_pinned_allocations is non-zero */
+static DECLARE_DELAYED_WORK (cmem_reap_pinned_work, cmem_reap_pinned_allocations);
+
+
+/**
+ * @brief Record that the free of an allocation has been deferred since its pages are pinned
+ * @details Called with cmem_allocation_regions_lock held, after the owner of the allocation has been changed to
+ *          CMEM_PINNED_ALLOCATION_PID
+ */
+static void cmem_defer_pinned_allocation (void)
+{
+    cmem_num_pinned_allocations++;
+    schedule_delayed_work (&cmem_reap_pinned_work, msecs_to_jiffies (CMEM_PINNED_REAP_INTERVAL_MS));
+}
+
+
+/**
+ * @brief Give the pools struct pages, when enabled by the page_backed module parameter
+ * @details memremap_pages() creates ZONE_DEVICE struct pages for each pool, so that cmem_mmap() can insert the pages
+ *          into user mappings rather than using remap_pfn_range(). Such mappings aren't VM_PFNMAP, so can be pinned by
+ *          get_user_pages() for O_DIRECT, io_uring fixed buffers and RDMA memory registration.
+ *          memremap_pages() can only add memory in units of the memory hotplug subsection size, so a pool which isn't
+ *          aligned to the subsection size is left without struct pages. Failure isn't fatal, and leaves the pool
+ *          mapped by remap_pfn_range().
+ */
+static void cmem_create_page_backing (void)
+{
+#ifdef CMEM_PAGE_BACKED_SUPPORTED
+    uint32_t pool_index;
+    void *pages_addr;
+
+    for (pool_index = 0; pool_index < cmem_num_pools; pool_index++)
+    {
+        cmem_pool_t *const pool = &cmem_pools[pool_index];
+
+        if (!IS_ALIGNED (pool->start, SUBSECTION_SIZE) || !IS_ALIGNED (pool->end + 1, SUBSECTION_SIZE))
+        {
+            pr_info(CMEM_DRVNAME " Pool start 0x%llx end 0x%llx isn't page backed as not aligned to 0x%lx\n",
+                    pool->start, pool->end, (unsigned long) SUBSECTION_SIZE);
+            continue;
+        }
+
+        pool->pgmap.type = MEMORY_DEVICE_GENERIC;
+        pool->pgmap.range.start = pool->start;
+        pool->pgmap.range.end = pool->end;
+        pool->pgmap.nr_range = 1;
+        pages_addr = memremap_pages (&pool->pgmap, pool->numa_node);
+        if (IS_ERR (pages_addr))
+        {
+            pr_warn(CMEM_DRVNAME ": memremap_pages failed for pool start 0x%llx end 0x%llx : %ld\n",
+                    pool->start, pool->end, PTR_ERR (pages_addr));
+            memset (&pool->pgmap, 0, sizeof (pool->pgmap));
+        }
+        else
+        {
+            pool->page_backed = true;
+            pool->idle_pin_count = cmem_page_pin_count (pfn_to_page (PHYS_PFN (pool->start)));
+        }
+    }
+#else
+    pr_warn(CMEM_DRVNAME ": page_backed isn't supported since the Kernel doesn't have CONFIG_ZONE_DEVICE\n");
+#endif
+}
+
+
+/**
+ * @brief Remove the struct pages of the pools created by cmem_create_page_backing()
+ */
+static void cmem_free_page_backing (void)
+{
+#ifdef CMEM_PAGE_BACKED_SUPPORTED
+    uint32_t pool_index;
+
+    for (pool_index = 0; pool_index < cmem_num_pools; pool_index++)
+    {
+        if (cmem_pools[pool_index].page_backed)
+        {
+            memunmap_pages (&cmem_pools[pool_index].pgmap);
+            cmem_pools[pool_index].page_backed = false;
+        }
+    }
+#endif
+}
+
+
+/**
+ * @brief Called when the last VMA referencing a mapping is closed, to free the record of the mapped chunks
+ */
+static void cmem_mapping_release (struct kref *const refcount)
+{
+    cmem_mapping_t *const mapping = container_of (refcount, cmem_mapping_t, refcount);
+
+    kfree (mapping);
+}
+
+
+/**
+ * @brief Called when a VMA is created from an existing cmem mapping, by splitting or copying on fork
+ */
+static void cmem_vma_open (struct vm_area_struct *const vma)
+{
+    cmem_mapping_t *const mapping = vma->vm_private_data;
+
+    if (mapping != NULL)
+    {
+        kref_get (&mapping->refcount);
+    }
+}
+
+
+/**
+ * @brief Called when a VMA for a cmem mapping is removed
+ */
+static void cmem_vma_close (struct vm_area_struct *const vma)
+{
+    cmem_mapping_t *const mapping = vma->vm_private_data;
+
+    if (mapping != NULL)
+    {
+        kref_put (&mapping->refcount, cmem_mapping_release);
+    }
+}
+
+
+/**
+ * @brief Access function for cmem mappings, used by ptrace and /proc/<pid>/mem and therefore by a debugger.
+ * @details generic_access_phys() creates and removes a kernel mapping for every access, and only accesses up to the
+ *          end of one page per call. Instead, this copies the entire span requested through kernel mappings of at most
+ *          CMEM_RW_MAX_MAP_LENGTH, in the same way as cmem_rw_iter(). Each kernel mapping only covers the part of a
+ *          chunk being accessed and is removed after the copy, so that no kernel mapping outlives the access. A
+ *          persistent mapping would consume vmalloc space, hold a memory type reservation which prevents a later
+ *          uncached mapping of the memory, and remain over the tail of a buffer after it has been shrunk.
+ *
+ *          The kernel mappings are created with memremap() using the same cache type as the user mapping, to avoid
+ *          conflicting memory types, and only for mappings entirely inside the pools. Uses generic_access_phys()
+ *          for other mappings, e.g. uncached mappings for which memremap() has no equivalent.
+ *
+ *          The previous custom_vma_access() for 2.6 Kernels caused a "BUG: unable to handle kernel paging request"
+ *          with 4.15 Kernels, as the reserved memory isn't in the Kernel direct mapping. That is avoided by only
+ *          accessing the memory using the kernel mappings created by memremap().
+ * @param[in] vma The VMA being accessed
+ * @param[in] addr The user virtual address to access
+ * @param[in/out] buf The kernel buffer to copy from or to
+ * @param[in] len The number of bytes to access
+ * @param[in] write Non-zero to write to the mapping, zero to read
+ * @return The number of bytes accessed, or a negative errno value
+ */
+static int cmem_vma_access (struct vm_area_struct *const vma, const unsigned long addr, void *const buf,
+                            const int len, const int write)
+{
+    cmem_mapping_t *const mapping = vma->vm_private_data;
+    const pgprot_t default_prot = vm_get_page_prot (vma->vm_flags);
+    unsigned long memremap_flags = 0;
+    uint64_t mapping_offset;
+    uint64_t chunk_start_offset;
+    uint32_t chunk_index;
+    int copied = 0;
+    int access_len = len;
+
+    if (pgprot_val (vma->vm_page_prot) == pgprot_val (default_prot))
+    {
+        memremap_flags = MEMREMAP_WB;
+    }
+    else if (pgprot_val (vma->vm_page_prot) == pgprot_val (pgprot_writecombine (default_prot)))
+    {
+        memremap_flags = MEMREMAP_WC;
+    }
+
+    if (!cmem_fast_access || (mapping == NULL) || (memremap_flags == 0) || (write && !(vma->vm_flags & VM_WRITE)))
+    {
+        return generic_access_phys (vma, addr, buf, len, write);
+    }
+
+    /* Don't access beyond the end of the VMA, which may be smaller than the mapping after a split */
+    if ((unsigned long) access_len > (vma->vm_end - addr))
+    {
+        access_len = vma->vm_end - addr;
+    }
+
+    /* Find the chunk containing the start of the access */
+    mapping_offset = ((uint64_t) (vma->vm_pgoff - mapping->base_pgoff) << PAGE_SHIFT) + (addr - vma->vm_start);
+    chunk_start_offset = 0;
+    chunk_index = 0;
+    while ((chunk_index < mapping->num_chunks) &&
+           (mapping_offset >= (chunk_start_offset + mapping->chunks[chunk_index].length)))
+    {
+        chunk_start_offset += mapping->chunks[chunk_index].length;
+        chunk_index++;
+    }
+
+    /* Copy the requested span, which may cross chunks */
+    while ((copied < access_len) && (chunk_index < mapping->num_chunks))
+    {
+        const cmem_mapping_chunk_t *const chunk = &mapping->chunks[chunk_index];
+        const uint64_t offset_in_chunk = (mapping_offset + copied) - chunk_start_offset;
+        /* Each kernel mapping after the first in a chunk starts on a multiple of the maximum length */
+        const uint64_t map_start = chunk->phys_addr + offset_in_chunk;
+        const size_t map_length = min_t (uint64_t, min_t (uint64_t, access_len - copied, chunk->length - offset_in_chunk),
+                CMEM_RW_MAX_MAP_LENGTH - (map_start & (CMEM_RW_MAX_MAP_LENGTH - 1)));
+        void *const kernel_addr = memremap (map_start, map_length, memremap_flags);
+
+        if (kernel_addr == NULL)
+        {
+            break;
+        }
+
+        if (write)
+        {
+            memcpy (kernel_addr, (const uint8_t *) buf + copied, map_length);
+        }
+        else
+        {
+            memcpy ((uint8_t *) buf + copied, kernel_addr, map_length);
+        }
+        memunmap (kernel_addr);
+
+        copied += map_length;
+        if (map_length == (chunk->length - offset_in_chunk))
+        {
+            chunk_start_offset += chunk->length;
+            chunk_index++;
+        }
+    }
+
+    return (copied > 0) ? copied : generic_access_phys (vma, addr, buf, len, write);
+}
+
+
+static const struct vm_operations_struct custom_vm_ops = {
+    .open = cmem_vma_open,
+    .close = cmem_vma_close,
+    .access = cmem_vma_access
+};
+
+
+/**
+ * @brief Get the number of bytes of a physical address range which are in the first 4 GiB
+ * @param[in] start The start of the range
+ * @param[in] end The inclusive end of the range
+ * @return The number of bytes of the range in the first 4 GiB
+ */
+static uint64_t cmem_a32_zone_length (const uint64_t start, const uint64_t end)
+{
+    const uint64_t max_a32_end = 0xffffffffUL;
+
+    return (start > max_a32_end) ? 0 : ((min (end, max_a32_end) + 1) - start);
+}
+
+
+/**
+ * @brief Get the free memory in all pools, in the first 4 GiB and above the first 4 GiB
+ * @param[out] a32_free The number of free bytes in the first 4 GiB
+ * @param[out] a64_free The number of free bytes above the first 4 GiB
+ */
+static void cmem_get_zone_free_bytes (uint64_t *const a32_free, uint64_t *const a64_free)
+{
+    const uint64_t max_a32_end = 0xffffffffUL;
+    uint32_t region_index;
+    uint32_t pool_index;
+
+    *a32_free = 0;
+    *a64_free = 0;
+    for (region_index = 0; region_index < cmem_allocation_regions.num_regions; region_index++)
+    {
+        const cmem_allocation_region_t *const region = &cmem_allocation_regions.regions[region_index];
+
+        if (!region->allocated)
+        {
+            const uint64_t a32_length = cmem_a32_zone_length (region->start, region->end);
+
+            *a32_free += a32_length;
+            *a64_free += ((region->end + 1) - region->start) - a32_length;
+        }
+    }
+
+    for (pool_index = 0; pool_index < cmem_num_granule_pools; pool_index++)
+    {
+        const cmem_granule_pool_t *const pool = &cmem_granule_pools[pool_index];
+        const unsigned long a32_granules = (pool->start > max_a32_end) ? 0 :
+                min_t (uint64_t, pool->num_granules, ((max_a32_end + 1) - pool->start) >> cmem_granule_shift);
+        const unsigned long a32_free_granules = a32_granules - bitmap_weight (pool->allocated_map, a32_granules);
+
+        *a32_free += (uint64_t) a32_free_granules << cmem_granule_shift;
+        *a64_free += (uint64_t) (pool->num_free_granules - a32_free_granules) << cmem_granule_shift;
+    }
+}
+
+
+/**
+ * @brief Get the number of bytes of free memory in the first 4 GiB which an allocation for a 64-bit capable device
+ *        may use, which is the free memory above the a32_reserve module parameter
+ * @return The number of bytes which may be used
+ */
+static uint64_t cmem_a32_zone_allowance (void)
+{
+    const uint64_t reserve = READ_ONCE (cmem_a32_reserve);
+    uint64_t a32_free;
+    uint64_t a64_free;
+
+    if (reserve == 0)
+    {
+        return U64_MAX;
+    }
+    cmem_get_zone_free_bytes (&a32_free, &a64_free);
+
+    return (a32_free > reserve) ? (a32_free - reserve) : 0;
+}
+
+
+/**
+ * @brief Check if a32_reserve refuses an allocation for a 64-bit capable device, counting the refusals
+ * @param[in] a32_length The number of bytes of the allocation in the first 4 GiB
+ * @return Returns true if the allocation is refused
+ */
+static bool cmem_a32_reserve_refuses (const uint64_t a32_length)
+{
+    if ((a32_length == 0) || (a32_length <= cmem_a32_zone_allowance ()))
+    {
+        return false;
+    }
+    cmem_a32_reserve_refusals++;
+
+    return true;
+}
+
+
+/**
+ * @brief Allocate a cmem region for use by a DMA mapping for a device
+ * @param[in] cmd CMEM_IOCTL_ALLOC_A32_HOST_BUFFERS or CMEM_IOCTL_ALLOC_A64_HOST_BUFFERS to indicate the type of allocation.
+ * @param[in/out] allocator Contains the cmem regions to allocate from
+ * @param[in] pool_class The CMEM_POOL_CLASS_* to allocate from
+ * @param[in] length The length of the allocation required
+ * @param[in] alignment The required alignment of the start of the allocation, which must be a power of two.
+ * @param[in] owner The owner of the allocation
+ * @param[out] region The allocated region. Success is indicated when allocated is true
+ */
+static void cmem_allocate_region (const unsigned int cmd,
+                                  cmem_allocation_regions_t *const allocator, const uint32_t pool_class,
+                                  const size_t length, const uint64_t alignment, const pid_t owner,
+                                  cmem_allocation_region_t *const region)
+{
+    const cmem_fit_policy_t policy = cmem_class_fit_policy (pool_class);
+
+    /* Default to no allocation */
+    region->start = 0;
+    region->end = 0;
+    region->allocated = false;
+    region->pool_class = pool_class;
+    region->allocation_pid = -1;
+
+    /* The colouring is set from the module parameter while holding the lock, so may be changed at run time */
+    allocator->num_colours = READ_ONCE (cmem_cache_colours);
+    allocator->colour_size = PAGE_SIZE;
+
+    if (cmd == CMEM_IOCTL_ALLOC_A64_HOST_BUFFERS)
+    {
+        /* For 64-bit capable devices first attempt to allocate addresses above the first 4 GiB,
+         * to try and keep the first 4 GiB for devices which are only 32-bit capable. */
+        const uint64_t a64_min_start = 0x100000000UL;
+
+        cmem_attempt_allocation (cmd, allocator, pool_class, a64_min_start, length, alignment, policy, owner, region);
+    }
+
+    /* If allocation wasn't successful, or only a 32-bit capable device, try the allocation with no minimum start.
+     * The allocation for a 64-bit capable device is then treated as entirely in the first 4 GiB for a32_reserve. */
+    if (!region->allocated &&
+        ((cmd != CMEM_IOCTL_ALLOC_A64_HOST_BUFFERS) || !cmem_a32_reserve_refuses (length)))
+    {
+        cmem_attempt_allocation (cmd, allocator, pool_class, 0, length, alignment, policy, owner, region);
+    }
+
+    if (region->allocated)
+    {
+        /* Record the region as now allocated */
+        region->allocated = cmem_update_regions (allocator, region);
+    }
+    cmem_trace_event (CMEM_TRACE_EVENT_ALLOC,
+            ((cmd == CMEM_IOCTL_ALLOC_A32_HOST_BUFFERS) ? CMEM_TRACE_FLAG_A32 : 0) |
+            (region->allocated ? 0 : CMEM_TRACE_FLAG_FAILED), region->start, length, alignment, owner, pool_class);
+}
+
+
+/**
+ * @brief Attempt to allocate a run of granules from one granule pool, using the first free run which is long enough
+ * @details bitmap_find_next_zero_area() finds the free run using find_next_zero_bit() and find_next_bit(), which test
+ *          a word of granules at a time. A vectorised search isn't used since the Kernel would have to save the
+ *          FPU state with kernel_fpu_begin(), which costs more than searching the bitmaps of small pools.
+ * @param[in/out] pool The granule pool to allocate from
+ * @param[in] a32 When true the allocation must be in the first 4 GiB
+ * @param[in] min_start Minimum start address for the allocation
+ * @param[in] num_granules The number of granules to allocate
+ * @param[in] owner The owner of the allocation
+ * @param[out] start When successful the start address of the allocation
+ * @return Returns true if the allocation was successful
+ */
+static bool cmem_granule_pool_attempt_allocation (cmem_granule_pool_t *const pool, const bool a32,
+                                                  const uint64_t min_start, const unsigned long num_granules,
+                                                  const pid_t owner, uint64_t *const start)
+{
+    const uint64_t max_a32_end = 0xffffffffUL;
+    unsigned long search_start = 0;
+    unsigned long search_end = pool->num_granules;
+    unsigned long first_granule;
+
+    if (pool->num_free_granules < num_granules)
+    {
+        return false;
+    }
+
+    if (min_start > pool->start)
+    {
+        search_start = (min_start - pool->start + cmem_granule_size - 1) >> cmem_granule_shift;
+    }
+    if (a32)
+    {
+        if (pool->start > max_a32_end)
+        {
+            return false;
+        }
+        search_end = min_t (uint64_t, search_end, ((max_a32_end + 1) - pool->start) >> cmem_granule_shift);
+    }
+    if (search_start >= search_end)
+    {
+        return false;
+    }
+
+    first_granule = bitmap_find_next_zero_area (pool->allocated_map, search_end, search_start, num_granules, 0);
+    if ((first_granule + num_granules) > search_end)
+    {
+        return false;
+    }
+
+    bitmap_set (pool->allocated_map, first_granule, num_granules);
+    __set_bit (first_granule, pool->first_map);
+    pool->owners[first_granule] = owner;
+    pool->num_free_granules -= num_granules;
+    *start = pool->start + ((uint64_t) first_granule << cmem_granule_shift);
+
+    return true;
+}
+
+
+/**
+ * @brief Allocate a buffer from the granule pools
+ * @param[in] a32 When true the allocation must be in the first 4 GiB
+ * @param[in] length The length of the allocation required, which is rounded up to a multiple of the granule size
+ * @param[out] region The allocated region, which contains the rounded length. Success is indicated when allocated is true
+ */
+static void cmem_granule_allocate (const bool a32, const uint64_t length, cmem_allocation_region_t *const region)
+{
+    const unsigned long num_granules = (length + cmem_granule_size - 1) >> cmem_granule_shift;
+    const uint64_t a64_min_start = 0x100000000UL;
+    uint32_t pool_index;
+    uint64_t start;
+
+    /* Default to no allocation */
+    region->start = 0;
+    region->end = 0;
+    region->allocated = false;
+    region->allocation_pid = -1;
+
+    if (num_granules == 0)
+    {
+        return;
+    }
+
+    /* In the same way as cmem_allocate_region(), first attempt to keep the first 4 GiB for devices which are only
+     * 32-bit capable */
+    for (pool_index = 0; !a32 && !region->allocated && (pool_index < cmem_num_granule_pools); pool_index++)
+    {
+        region->allocated = cmem_granule_pool_attempt_allocation (&cmem_granule_pools[pool_index], false,
+                a64_min_start, num_granules, cmem_current_owner (), &start);
+    }
+    if (a32 || region->allocated || !cmem_a32_reserve_refuses ((uint64_t) num_granules << cmem_granule_shift))
+    {
+        for (pool_index = 0; !region->allocated && (pool_index < cmem_num_granule_pools); pool_index++)
+        {
+            region->allocated = cmem_granule_pool_attempt_allocation (&cmem_granule_pools[pool_index], a32,
+                    0, num_granules, cmem_current_owner (), &start);
+        }
+    }
+
+    if (region->allocated)
+    {
+        region->start = start;
+        region->end = start + ((uint64_t) num_granules << cmem_granule_shift) - 1;
+        region->allocation_pid = cmem_current_owner ();
+    }
+    cmem_trace_event (CMEM_TRACE_EVENT_ALLOC,
+            CMEM_TRACE_FLAG_GRANULE | (a32 ? CMEM_TRACE_FLAG_A32 : 0) | (region->allocated ? 0 : CMEM_TRACE_FLAG_FAILED),
+            region->start, length, 1, cmem_current_owner (), 0);
+}
+
+
+/**
+ * @brief Find the granule pool which contains a physical address
+ * @param[in] address The physical address to find
+ * @param[out] granule When found, the index of the granule in the pool which contains the address
+ * @return The granule pool, or NULL if the address isn't in a granule pool
+ */
+static cmem_granule_pool_t *cmem_find_granule_pool (const uint64_t address, unsigned long *const granule)
+{
+    uint32_t pool_index;
+
+    for (pool_index = 0; pool_index < cmem_num_granule_pools; pool_index++)
+    {
+        cmem_granule_pool_t *const pool = &cmem_granule_pools[pool_index];
+
+        if ((address >= pool->start) && (((address - pool->start) >> cmem_granule_shift) < pool->num_granules))
+        {
+            *granule = (address - pool->start) >> cmem_granule_shift;
+            return pool;
+        }
+    }
+
+    return NULL;
+}
+
+
+/**
+ * @brief Get the number of granules in an allocation from a granule pool, which ends at the next free granule
+ *        or the start of the next allocation
+ * @param[in] pool The granule pool containing the allocation
+ * @param[in] first_granule The first granule of the allocation
+ * @return The number of granules in the allocation
+ */
+static unsigned long cmem_granule_allocation_length (const cmem_granule_pool_t *const pool,
+                                                     const unsigned long first_granule)
+{
+    const unsigned long next_first = find_next_bit (pool->first_map, pool->num_granules, first_granule + 1);
+    const unsigned long next_free = find_next_zero_bit (pool->allocated_map, pool->num_granules, first_granule + 1);
+
+    return min (next_first, next_free) - first_granule;
+}
+
+
+/**
+ * @brief Return the granules of one allocation to a granule pool
+ * @param[in/out] pool The granule pool containing the allocation
+ * @param[in] first_granule The first granule of the allocation
+ */
+static void cmem_granule_release_allocation (cmem_granule_pool_t *const pool, const unsigned long first_granule)
+{
+    const unsigned long num_granules = cmem_granule_allocation_length (pool, first_granule);
+
+    bitmap_clear (pool->allocated_map, first_granule, num_granules);
+    __clear_bit (first_granule, pool->first_map);
+    pool->owners[first_granule] = -1;
+    pool->num_free_granules += num_granules;
+}
+
+
+/**
+ * @brief Free one allocation from a granule pool
+ * @details If the pages of the allocation are pinned the granules remain allocated with an owner of
+ *          CMEM_PINNED_ALLOCATION_PID, until cmem_reap_pinned_allocations() finds the pins have been released.
+ * @param[in/out] pool The granule pool containing the allocation
+ * @param[in] first_granule The first granule of the allocation
+ */
+static void cmem_granule_free_allocation (cmem_granule_pool_t *const pool, const unsigned long first_granule)
+{
+    const uint64_t start = pool->start + ((uint64_t) first_granule << cmem_granule_shift);
+    const uint64_t length = (uint64_t) cmem_granule_allocation_length (pool, first_granule) << cmem_granule_shift;
+
+    cmem_trace_event (CMEM_TRACE_EVENT_FREE, CMEM_TRACE_FLAG_GRANULE, start, length, 1, pool->owners[first_granule], 0);
+    if (cmem_phys_pinned (start, length))
+    {
+        pool->owners[first_granule] = CMEM_PINNED_ALLOCATION_PID;
+        cmem_defer_pinned_allocation ();
+    }
+    else
+    {
+        cmem_granule_release_allocation (pool, first_granule);
+    }
+}
+
+
+/**
+ * @brief Free a buffer allocated from a granule pool, checking the buffer was allocated by an owner
+ * @param[in] start The physical address of the buffer
+ * @param[in] length The length of the buffer, which may be either the requested or rounded length
+ * @param[in] owner The owner of the buffer
+ * @return Zero if the buffer was freed, -EINVAL if it isn't an allocation of the owner from a granule pool, or
+ *         -EBUSY if the buffer is being accessed by the driver
+ */
+static long cmem_granule_free_buffer (const uint64_t start, const uint64_t length, const pid_t owner)
+{
+    const unsigned long num_granules = (length + cmem_granule_size - 1) >> cmem_granule_shift;
+    unsigned long first_granule;
+    cmem_granule_pool_t *const pool = cmem_find_granule_pool (start, &first_granule);
+
+    if ((pool == NULL) || !IS_ALIGNED (start, cmem_granule_size) || !test_bit (first_granule, pool->first_map) ||
+        (pool->owners[first_granule] != owner) ||
+        (cmem_granule_allocation_length (pool, first_granule) != num_granules))
+    {
+        return -EINVAL;
+    }
+    if (cmem_range_busy (start, start + ((uint64_t) num_granules << cmem_granule_shift) - 1))
+    {
+        return -EBUSY;
+    }
+
+    cmem_granule_free_allocation (pool, first_granule);
+    return 0;
+}
+
+
+/**
+ * @brief Free all allocations from the granule pools of an owner which are entirely inside a physical address range
+ * @param[in] range_start The start of the physical address range
+ * @param[in] range_end The inclusive end of the physical address range
+ * @param[in] owner The owner of the allocations to free
+ * @param[in/out] num_busy Incremented for each allocation which isn't freed since the driver is accessing it
+ * @return The number of allocations freed
+ */
+static uint32_t cmem_granule_free_owned_in_range (const uint64_t range_start, const uint64_t range_end, const pid_t owner,
+                                                  uint32_t *const num_busy)
+{
+    uint32_t num_freed = 0;
+    uint32_t pool_index;
+    unsigned long granule;
+
+    for (pool_index = 0; pool_index < cmem_num_granule_pools; pool_index++)
+    {
+        cmem_granule_pool_t *const pool = &cmem_granule_pools[pool_index];
+        const uint64_t pool_end = pool->start + ((uint64_t) pool->num_granules << cmem_granule_shift) - 1;
+        const unsigned long first_granule = (range_start > pool->start) ?
+                ((range_start - pool->start + cmem_granule_size - 1) >> cmem_granule_shift) : 0;
+
+        if ((range_start > pool_end) || (range_end < pool->start))
+        {
+            continue;
+        }
+
+        for (granule = find_next_bit (pool->first_map, pool->num_granules, first_granule);
+             granule < pool->num_granules;
+             granule = find_next_bit (pool->first_map, pool->num_granules, granule + 1))
+        {
+            const uint64_t allocation_end = pool->start +
+                    ((uint64_t) (granule + cmem_granule_allocation_length (pool, granule)) << cmem_granule_shift) - 1;
+
+            if (allocation_end > range_end)
+            {
+                break;
+            }
+            if (pool->owners[granule] != owner)
+            {
+                continue;
+            }
+            if (cmem_range_busy (pool->start + ((uint64_t) granule << cmem_granule_shift), allocation_end))
+            {
+                (*num_busy)++;
+            }
+            else
+            {
+                cmem_granule_free_allocation (pool, granule);
+                num_freed++;
+            }
+        }
+    }
+
+    return num_freed;
+}
+
+
+/**
+ * @brief Find the number of bytes which a process may read or write from a physical address in a granule pool
+ * @details The start of the allocation containing the address is found by searching backwards a granule at a time,
+ *          since find_prev_bit() isn't available in all supported Kernels.
+ * @param[in] phys_addr The physical address at the start of the read or write
+ * @param[in] owner The process performing the read or write
+ * @return The number of bytes from phys_addr to the end of the allocation owned by owner which contains
+ *         phys_addr. Zero if phys_addr isn't in such an allocation.
+ */
+static uint64_t cmem_granule_owned_length (const uint64_t phys_addr, const pid_t owner)
+{
+    unsigned long granule;
+    const cmem_granule_pool_t *const pool = cmem_find_granule_pool (phys_addr, &granule);
+    unsigned long first_granule = granule;
+
+    if ((pool == NULL) || !test_bit (granule, pool->allocated_map))
+    {
+        return 0;
+    }
+
+    while (!test_bit (first_granule, pool->first_map))
+    {
+        first_granule--;
+    }
+    if (pool->owners[first_granule] != owner)
+    {
+        return 0;
+    }
+
+    return pool->start +
+            ((uint64_t) (first_granule + cmem_granule_allocation_length (pool, first_granule)) << cmem_granule_shift) -
+            phys_addr;
+}
+
+
+/**
+ * @brief Resize an allocation from a granule pool in place
+ * @param[in] a32 When true the allocation may not grow beyond the first 4 GiB
+ * @param[in] start The physical address of the allocation
+ * @param[in] length The current length of the allocation, which may be either the requested or rounded length
+ * @param[in] new_length The required length, which is rounded up to a multiple of the granule size
+ * @param[out] resized_length When successful the rounded length after the resize
+ * @return Zero on success, -EINVAL if not an allocation of the caller, -ENOMEM if the granules following the
+ *         allocation aren't free, or -EBUSY if the tail being freed is being accessed by the driver or its pages are
+ *         pinned
+ */
+static long cmem_granule_resize (const bool a32, const uint64_t start, const uint64_t length, const uint64_t new_length,
+                                 uint64_t *const resized_length)
+{
+    const uint64_t max_a32_end = 0xffffffffUL;
+    const unsigned long new_num_granules = (new_length + cmem_granule_size - 1) >> cmem_granule_shift;
+    unsigned long first_granule;
+    cmem_granule_pool_t *const pool = cmem_find_granule_pool (start, &first_granule);
+    unsigned long num_granules;
+
+    if ((pool == NULL) || !IS_ALIGNED (start, cmem_granule_size) || !test_bit (first_granule, pool->first_map) ||
+        (pool->owners[first_granule] != cmem_current_owner ()))
+    {
+        return -EINVAL;
+    }
+    num_granules = cmem_granule_allocation_length (pool, first_granule);
+    if (num_granules != ((length + cmem_granule_size - 1) >> cmem_granule_shift))
+    {
+        return -EINVAL;
+    }
+
+    if (new_num_granules < num_granules)
+    {
+        if (cmem_range_busy (start + ((uint64_t) new_num_granules << cmem_granule_shift),
+                start + ((uint64_t) num_granules << cmem_granule_shift) - 1) ||
+            cmem_phys_pinned (start + ((uint64_t) new_num_granules << cmem_granule_shift),
+                    (uint64_t) (num_granules - new_num_granules) << cmem_granule_shift))
+        {
+            return -EBUSY;
+        }
+        bitmap_clear (pool->allocated_map, first_granule + new_num_granules, num_granules - new_num_granules);
+        pool->num_free_granules += num_granules - new_num_granules;
+    }
+    else if (new_num_granules > num_granules)
+    {
+        if (((pool->num_granules - first_granule) < new_num_granules) ||
+            (a32 && ((start + ((uint64_t) new_num_granules << cmem_granule_shift) - 1) > max_a32_end)) ||
+            (find_next_bit (pool->allocated_map, first_granule + new_num_granules, first_granule + num_granules) <
+                    (first_granule + new_num_granules)) ||
+            (!a32 && cmem_a32_reserve_refuses (cmem_a32_zone_length (
+                    start + ((uint64_t) num_granules << cmem_granule_shift),
+                    start + ((uint64_t) new_num_granules << cmem_granule_shift) - 1))))
+        {
+            cmem_trace_event (CMEM_TRACE_EVENT_RESIZE,
+                    CMEM_TRACE_FLAG_GRANULE | (a32 ? CMEM_TRACE_FLAG_A32 : 0) | CMEM_TRACE_FLAG_FAILED,
+                    start, new_length, 1, cmem_current_owner (), 0);
+            return -ENOMEM;
+        }
+        bitmap_set (pool->allocated_map, first_granule + num_granules, new_num_granules - num_granules);
+        pool->num_free_granules -= new_num_granules - num_granules;
+    }
+
+    *resized_length = (uint64_t) new_num_granules << cmem_granule_shift;
+    cmem_trace_event (CMEM_TRACE_EVENT_RESIZE, CMEM_TRACE_FLAG_GRANULE | (a32 ? CMEM_TRACE_FLAG_A32 : 0),
+            start, *resized_length, 1, cmem_current_owner (), 0);
+    return 0;
+}
+
+
+/**
+ * @brief Create a granule pool to manage a memmap pool selected by the granule_pools module parameter
+ * @details The pool is trimmed to whole granules
+ * @param[in] pool The memmap pool
+ * @return Zero on success, or a negative errno value on failure
+ */
+static int cmem_create_granule_pool (const cmem_pool_t *const pool)
+{
+    cmem_granule_pool_t *const granule_pool = &cmem_granule_pools[cmem_num_granule_pools];
+    const uint64_t start = ALIGN (pool->start, (uint64_t) cmem_granule_size);
+    const uint64_t end = ALIGN_DOWN (pool->end + 1, (uint64_t) cmem_granule_size);
+    size_t map_size;
+
+    if (end <= start)
+    {
+        pr_info(CMEM_DRVNAME " Ignored granule pool start 0x%llx size 0x%llx smaller than a granule\n",
+                pool->start, (pool->end + 1) - pool->start);
+        return 0;
+    }
+
+    granule_pool->start = start;
+    granule_pool->num_granules = (end - start) >> cmem_granule_shift;
+    granule_pool->num_free_granules = granule_pool->num_granules;
+    map_size = BITS_TO_LONGS (granule_pool->num_granules) * sizeof (unsigned long);
+    granule_pool->allocated_map = vzalloc (map_size);
+    granule_pool->first_map = vzalloc (map_size);
+    granule_pool->owners = vzalloc (granule_pool->num_granules * sizeof (pid_t));
+    if ((granule_pool->allocated_map == NULL) || (granule_pool->first_map == NULL) || (granule_pool->owners == NULL))
+    {
+        vfree (granule_pool->allocated_map);
+        vfree (granule_pool->first_map);
+        vfree (granule_pool->owners);
+        return -ENOMEM;
+    }
+
+    cmem_num_granule_pools++;
+    pr_info(CMEM_DRVNAME " Granule pool start Addr : 0x%llx Size: 0x%llx Granule size: 0x%x\n",
+            start, end - start, cmem_granule_size);
+
+    return 0;
+}
+
+
+/**
+ * @brief Free the metadata of all granule pools
+ */
+static void cmem_free_granule_pools (void)
+{
+    uint32_t pool_index;
+
+    for (pool_index = 0; pool_index < cmem_num_granule_pools; pool_index++)
+    {
+        vfree (cmem_granule_pools[pool_index].allocated_map);
+        vfree (cmem_granule_pools[pool_index].first_map);
+        vfree (cmem_granule_pools[pool_index].owners);
+    }
+    cmem_num_granule_pools = 0;
+}
+
+
+/**
+ * @brief Find the largest run of free granules in a granule pool
+ * @param[in] pool The granule pool to search
+ * @return The number of granules in the largest free run
+ */
+static unsigned long cmem_granule_largest_free_run (const cmem_granule_pool_t *const pool)
+{
+    unsigned long largest_run = 0;
+    unsigned long run_start;
+    unsigned long run_end;
+
+    for (run_start = find_next_zero_bit (pool->allocated_map, pool->num_granules, 0);
+         run_start < pool->num_granules;
+         run_start = find_next_zero_bit (pool->allocated_map, pool->num_granules, run_end))
+    {
+        run_end = find_next_bit (pool->allocated_map, pool->num_granules, run_start);
+        largest_run = max (largest_run, run_end - run_start);
+    }
+
+    return largest_run;
+}
+
+
+/**
+ * @brief Update the status page with the current capacity of the pools
+ * @details Called with cmem_allocation_regions_lock held, which serialises the updates. The sequence count is made
+ *          odd for the duration of the update, with write barriers ordering the sequence count against the contents,
+ *          in the same way as the Kernel write_seqcount_begin() and write_seqcount_end(). seqcount_t isn't used since
+ *          its layout isn't part of the user space interface.
+ *
+ *          The pools are only scanned when cmem_status_page_stale indicates the allocations have changed, or a module
+ *          parameter reported in the page has been changed, so ioctls which don't change the allocations are O(1).
+ */
+static void cmem_update_status_page (void)
+{
+    cmem_status_page_t *const status = cmem_status_page;
+    uint32_t pool_index;
+    uint32_t region_index;
+    uint32_t granule_pool_index = 0;
+    uint32_t pool_class;
+    bool class_has_pools[CMEM_NUM_POOL_CLASSES] = {false};
+    bool params_changed;
+
+    if (status == NULL)
+    {
+        return;
+    }
+
+    if (!cmem_status_page_stale)
+    {
+        params_changed = status->a32_reserve != READ_ONCE (cmem_a32_reserve);
+        for (pool_class = 0; !params_changed && (pool_class < CMEM_NUM_POOL_CLASSES); pool_class++)
+        {
+            params_changed = status->classes[pool_class].fit_policy != cmem_class_fit_policy (pool_class);
+        }
+        if (!params_changed)
+        {
+            return;
+        }
+    }
+    cmem_status_page_stale = false;
+
+    WRITE_ONCE (status->sequence, status->sequence + 1);
+    smp_wmb ();
+
+    status->num_pools = cmem_num_pools;
+    status->total_free_bytes = 0;
+    status->a32_zone.size = 0;
+    status->a64_zone.size = 0;
+    for (pool_class = 0; pool_class < CMEM_NUM_POOL_CLASSES; pool_class++)
+    {
+        status->classes[pool_class].size = 0;
+        status->classes[pool_class].free_bytes = 0;
+        status->classes[pool_class].largest_free_block = 0;
+        status->classes[pool_class].allocation_failures = cmem_class_allocation_failures[pool_class];
+        status->classes[pool_class].numa_node = NUMA_NO_NODE;
+        status->classes[pool_class].fit_policy = cmem_class_fit_policy (pool_class);
+    }
+    for (pool_index = 0; pool_index < cmem_num_pools; pool_index++)
+    {
+        const cmem_pool_t *const pool = &cmem_pools[pool_index];
+        cmem_status_pool_t *const pool_status = &status->pools[pool_index];
+
+        pool_status->start = pool->start;
+        pool_status->size = (pool->end + 1) - pool->start;
+        pool_status->free_bytes = 0;
+        pool_status->largest_free_block = 0;
+        pool_status->numa_node = pool->numa_node;
+        pool_status->granule_pool = (cmem_granule_pool_mask & (1U << pool_index)) != 0;
+        pool_status->pool_class = pool->pool_class;
+        pool_status->reserved = 0;
+
+        if (pool_status->granule_pool)
+        {
+            /* Granule pools are created in pool order, but a pool smaller than a granule has no granule pool */
+            const cmem_granule_pool_t *const granule_pool = &cmem_granule_pools[granule_pool_index];
+
+            if ((granule_pool_index < cmem_num_granule_pools) &&
+                (granule_pool->start >= pool->start) && (granule_pool->start <= pool->end))
+            {
+                pool_status->free_bytes = (uint64_t) granule_pool->num_free_granules << cmem_granule_shift;
+                pool_status->largest_free_block =
+                        (uint64_t) cmem_granule_largest_free_run (granule_pool) << cmem_granule_shift;
+                granule_pool_index++;
+            }
+        }
+        else
+        {
+            cmem_status_class_t *const class_status = &status->classes[pool->pool_class];
+
+            /* Free regions may span adjacent pools, so only count the part of each free region inside the pool */
+            for (region_index = 0; region_index < cmem_allocation_regions.num_regions; region_index++)
+            {
+                const cmem_allocation_region_t *const region = &cmem_allocation_regions.regions[region_index];
+                const uint64_t overlap_start = max (region->start, pool->start);
+                const uint64_t overlap_end = min (region->end, pool->end);
+
+                if (!region->allocated && (overlap_start <= overlap_end))
+                {
+                    pool_status->free_bytes += (overlap_end + 1) - overlap_start;
+                    pool_status->largest_free_block =
+                            max (pool_status->largest_free_block, (overlap_end + 1) - overlap_start);
+                }
+            }
+
+            /* The class has a NUMA node only when all its pools are on the same node */
+            class_status->numa_node = !class_has_pools[pool->pool_class] ? pool->numa_node :
+                    ((class_status->numa_node == pool->numa_node) ? pool->numa_node : NUMA_NO_NODE);
+            class_has_pools[pool->pool_class] = true;
+            class_status->size += pool_status->size;
+            class_status->free_bytes += pool_status->free_bytes;
+            class_status->largest_free_block = max (class_status->largest_free_block, pool_status->largest_free_block);
+        }
+        status->total_free_bytes += pool_status->free_bytes;
+        status->a32_zone.size += cmem_a32_zone_length (pool->start, pool->end);
+        status->a64_zone.size += pool_status->size - cmem_a32_zone_length (pool->start, pool->end);
+    }
+    cmem_get_zone_free_bytes (&status->a32_zone.free_bytes, &status->a64_zone.free_bytes);
+    status->a32_zone.allocation_failures = cmem_a32_allocation_failures;
+    status->a64_zone.allocation_failures = cmem_a64_allocation_failures;
+    status->a32_reserve = READ_ONCE (cmem_a32_reserve);
+    status->a32_reserve_refusals = cmem_a32_reserve_refusals;
+    status->generation++;
+
+    smp_wmb ();
+    WRITE_ONCE (status->sequence, status->sequence + 1);
+}
+
+
+/**
+ * @brief Free the allocations whose free was deferred since their pages were pinned, once the pins have been released
+ * @details Run from the system workqueue, rescheduling itself while any allocations remain pinned. The frees were
+ *          traced when requested by the owner, so aren't traced again.
+ * @param[in] work Unused
+ */
+static void cmem_reap_pinned_allocations (struct work_struct *const work)
+{
+    uint32_t num_reaped = 0;
+    uint32_t region_index;
+    uint32_t pool_index;
+    unsigned long granule;
+
+    mutex_lock (&cmem_allocation_regions_lock);
+    for (region_index = 0; region_index < cmem_allocation_regions.num_regions; region_index++)
+    {
+        cmem_allocation_region_t *const region = &cmem_allocation_regions.regions[region_index];
+
+        if (region->allocated && (region->allocation_pid == CMEM_PINNED_ALLOCATION_PID) &&
+            !cmem_phys_pinned (region->start, (region->end + 1) - region->start))
+        {
+            region->allocated = false;
+            region->allocation_pid = -1;
+            num_reaped++;
+        }
+    }
+
+    for (pool_index = 0; pool_index < cmem_num_granule_pools; pool_index++)
+    {
+        cmem_granule_pool_t *const pool = &cmem_granule_pools[pool_index];
+
+        for (granule = find_next_bit (pool->first_map, pool->num_granules, 0);
+             granule < pool->num_granules;
+             granule = find_next_bit (pool->first_map, pool->num_granules, granule + 1))
+        {
+            if ((pool->owners[granule] == CMEM_PINNED_ALLOCATION_PID) &&
+                !cmem_phys_pinned (pool->start + ((uint64_t) granule << cmem_granule_shift),
+                        (uint64_t) cmem_granule_allocation_length (pool, granule) << cmem_granule_shift))
+            {
+                cmem_granule_release_allocation (pool, granule);
+                num_reaped++;
+            }
+        }
+    }
+
+    if (num_reaped > 0)
+    {
+        cmem_num_pinned_allocations -= num_reaped;
+        cmem_coalesce_regions (&cmem_allocation_regions);
+        cmem_status_page_stale = true;
+        cmem_update_status_page ();
+    }
+    if (cmem_num_pinned_allocations > 0)
+    {
+        schedule_delayed_work (&cmem_reap_pinned_work, msecs_to_jiffies (CMEM_PINNED_REAP_INTERVAL_MS));
+    }
+    mutex_unlock (&cmem_allocation_regions_lock);
+}
+
+
+/**
+ * @brief Map the read-only status page into a user process
+ * @param[in/out] vma The user mapping, which must be of one page and not writable
+ * @return Zero on success, or a negative errno value on failure
+ */
+static int cmem_mmap_status_page (struct vm_area_struct *const vma)
+{
+    if ((cmem_status_page == NULL) || ((vma->vm_end - vma->vm_start) != PAGE_SIZE))
+    {
+        return -EINVAL;
+    }
+    if (vma->vm_flags & VM_WRITE)
+    {
+        return -EPERM;
+    }
+
+    /* Prevent mprotect() from later making the mapping writable */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6,3,0)
+    vm_flags_clear (vma, VM_MAYWRITE);
+#else
+    vma->vm_flags &= ~VM_MAYWRITE;
+#endif
+
+    return remap_pfn_range (vma, vma->vm_start, virt_to_phys (cmem_status_page) >> PAGE_SHIFT, PAGE_SIZE,
+            vma->vm_page_prot);
+}
+
+
+/**
+ * @brief Free the allocated region which starts at an address
+ * @details Called with cmem_allocation_regions_lock held. As for cmem_mark_region_free() the region isn't coalesced
+ *          with adjacent free regions. If the pages of the region are pinned the region remains allocated with an
+ *          owner of CMEM_PINNED_ALLOCATION_PID, until cmem_reap_pinned_allocations() finds the pins have been released.
+ * @param[in/out] allocator Contains the region to free
+ * @param[in] start The start address of the region
+ */
+static void cmem_free_region_unless_pinned (cmem_allocation_regions_t *const allocator, const uint64_t start)
+{
+    const uint32_t region_index = cmem_find_region_index (allocator, start);
+    cmem_allocation_region_t *region;
+
+    if ((region_index < allocator->num_regions) && (allocator->regions[region_index].start == start))
+    {
+        region = &allocator->regions[region_index];
+        if (cmem_phys_pinned (region->start, (region->end + 1) - region->start))
+        {
+            region->allocation_pid = CMEM_PINNED_ALLOCATION_PID;
+            cmem_defer_pinned_allocation ();
+        }
+        else
+        {
+            region->allocated = false;
+            region->allocation_pid = -1;
+        }
+    }
+}
+
+
+/**
+ * @brief Free a scatter-gather allocation, including all of its chunks
+ * @param[in/out] allocator Contains the cmem regions to free the chunks in
+ * @param[in] sg_allocation The scatter-gather allocation to free, which is removed from cmem_sg_allocations
+ */
+static void cmem_free_sg_allocation (cmem_allocation_regions_t *const allocator, cmem_sg_allocation_t *const sg_allocation)
+{
+    uint32_t chunk_index;
+
+    for (chunk_index = 0; chunk_index < sg_allocation->num_chunks; chunk_index++)
+    {
+        const cmem_host_buf_entry_t *const chunk = &sg_allocation->chunks[chunk_index];
+
+        cmem_free_region_unless_pinned (allocator, chunk->dma_address);
+        cmem_trace_event (CMEM_TRACE_EVENT_FREE, 0, chunk->dma_address, chunk->length, 1,
+                sg_allocation->allocation_pid, 0);
+    }
+    cmem_coalesce_regions (allocator);
+
+    list_del (&sg_allocation->list);
+    kfree (sg_allocation);
+}
+
+
+/**
+ * @brief Find a scatter-gather allocation from the physical address of its first chunk
+ * @param[in] start The physical address of the first chunk
+ * @return The scatter-gather allocation, or NULL if not found
+ */
+static cmem_sg_allocation_t *cmem_find_sg_allocation (const uint64_t start)
+{
+    cmem_sg_allocation_t *sg_allocation;
+
+    list_for_each_entry (sg_allocation, &cmem_sg_allocations, list)
+    {
+        if (sg_allocation->chunks[0].dma_address == start)
+        {
+            return sg_allocation;
+        }
+    }
+
+    return NULL;
+}
+
+
+/**
+ * @brief Determine if a cmem region is a chunk of a scatter-gather allocation of an owner
+ * @param[in] start The start address of the region
+ * @param[in] owner The owner of the region
+ * @return Returns true if the region is a chunk of a scatter-gather allocation
+ */
+static bool cmem_is_sg_chunk (const uint64_t start, const pid_t owner)
+{
+    const cmem_sg_allocation_t *sg_allocation;
+    uint32_t chunk_index;
+
+    list_for_each_entry (sg_allocation, &cmem_sg_allocations, list)
+    {
+        if (sg_allocation->allocation_pid == owner)
+        {
+            for (chunk_index = 0; chunk_index < sg_allocation->num_chunks; chunk_index++)
+            {
+                if (sg_allocation->chunks[chunk_index].dma_address == start)
+                {
+                    return true;
+                }
+            }
+        }
+    }
+
+    return false;
+}
+
+
+/**
+ * @brief Determine if any chunk of a scatter-gather allocation is being accessed by the driver
+ * @details Called with cmem_allocation_regions_lock held
+ * @param[in] sg_allocation The scatter-gather allocation to check
+ * @return Returns true if the allocation mustn't be freed
+ */
+static bool cmem_sg_allocation_busy (const cmem_sg_allocation_t *const sg_allocation)
+{
+    uint32_t chunk_index;
+
+    for (chunk_index = 0; chunk_index < sg_allocation->num_chunks; chunk_index++)
+    {
+        const cmem_host_buf_entry_t *const chunk = &sg_allocation->chunks[chunk_index];
+
+        if (cmem_range_busy (chunk->dma_address, chunk->dma_address + chunk->length - 1))
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+
+/**
+ * @brief Free all allocations of an owner which are entirely inside a physical address range
+ * @details The freed regions are marked as free, but not coalesced, so that many ranges can be freed followed by
+ *          a single call to cmem_coalesce_regions().
+ *          A scatter-gather allocation is freed when its first chunk is inside the range, and the chunks of
+ *          scatter-gather allocations which aren't freed are left allocated.
+ *          Named allocations are never freed, since they have a different owner.
+ *          Allocations from the granule pools are also freed.
+ *          Allocations which the driver is accessing are left allocated, and counted in num_busy.
+ * @param[in/out] allocator Contains the cmem regions to free
+ * @param[in] range_start The start of the physical address range
+ * @param[in] range_end The inclusive end of the physical address range
+ * @param[in] owner The owner of the allocations to free
+ * @param[out] num_busy The number of allocations which weren't freed since the driver is accessing them
+ * @return The number of allocations freed
+ */
+static uint32_t cmem_free_owned_in_range (cmem_allocation_regions_t *const allocator,
+                                          const uint64_t range_start, const uint64_t range_end, const pid_t owner,
+                                          uint32_t *const num_busy)
+{
+    cmem_sg_allocation_t *sg_allocation;
+    cmem_sg_allocation_t *next_sg_allocation;
+    bool owns_sg_allocations = false;
+    uint32_t num_freed = 0;
+    uint32_t chunk_index;
+    uint32_t region_index;
+
+    *num_busy = 0;
+    list_for_each_entry_safe (sg_allocation, next_sg_allocation, &cmem_sg_allocations, list)
+    {
+        if (sg_allocation->allocation_pid == owner)
+        {
+            if ((sg_allocation->chunks[0].dma_address >= range_start) &&
+                (sg_allocation->chunks[0].dma_address <= range_end) && cmem_sg_allocation_busy (sg_allocation))
+            {
+                (*num_busy)++;
+                owns_sg_allocations = true;
+            }
+            else if ((sg_allocation->chunks[0].dma_address >= range_start) &&
+                     (sg_allocation->chunks[0].dma_address <= range_end))
+            {
+                for (chunk_index = 0; chunk_index < sg_allocation->num_chunks; chunk_index++)
+                {
+                    cmem_free_region_unless_pinned (allocator, sg_allocation->chunks[chunk_index].dma_address);
+                    cmem_trace_event (CMEM_TRACE_EVENT_FREE, 0, sg_allocation->chunks[chunk_index].dma_address,
+                            sg_allocation->chunks[chunk_index].length, 1, owner, 0);
+                }
+                list_del (&sg_allocation->list);
+                kfree (sg_allocation);
+                num_freed++;
+            }
+            else
+            {
+                owns_sg_allocations = true;
+            }
+        }
+    }
+
+    num_freed += cmem_granule_free_owned_in_range (range_start, range_end, owner, num_busy);
+
+    for (region_index = cmem_find_region_index (allocator, range_start);
+         (region_index < allocator->num_regions) && (allocator->regions[region_index].end <= range_end);
+         region_index++)
+    {
+        cmem_allocation_region_t *const region = &allocator->regions[region_index];
+
+        if (region->allocated && (region->allocation_pid == owner) &&
+            !(owns_sg_allocations && cmem_is_sg_chunk (region->start, owner)) &&
+            cmem_range_busy (region->start, region->end))
+        {
+            (*num_busy)++;
+        }
+        else if (region->allocated && (region->allocation_pid == owner) &&
+                 !(owns_sg_allocations && cmem_is_sg_chunk (region->start, owner)))
+        {
+            cmem_free_region_unless_pinned (allocator, region->start);
+            cmem_trace_event (CMEM_TRACE_EVENT_FREE, 0, region->start, (region->end + 1) - region->start, 1, owner, 0);
+            num_freed++;
+        }
+    }
+
+    return num_freed;
+}
+
+
+/**
+ * @brief Handle CMEM_IOCTL_FREE_RANGES, freeing all allocations of the caller inside the ranges
+ * @details Called with cmem_allocation_regions_lock held
+ * @param[in] cmem_ioctl_arg The kernel copy of the ranges
+ * @return The number of allocations freed, or a negative errno value on failure. -EBUSY means that the allocations
+ *         which the driver is accessing weren't freed, although the other allocations were freed.
+ */
+static long cmem_free_ranges_ioctl (const cmem_ioctl_t *const cmem_ioctl_arg)
+{
+    uint32_t range_index;
+    uint32_t num_busy;
+    uint32_t total_busy = 0;
+    long num_freed = 0;
+
+    if (cmem_ioctl_arg->host_buf_info.num_buffers > CMEM_MAX_BUF_PER_ALLOC)
+    {
+        return -EINVAL;
+    }
+
+    for (range_index = 0; range_index < cmem_ioctl_arg->host_buf_info.num_buffers; range_index++)
+    {
+        const cmem_host_buf_entry_t *const range = &cmem_ioctl_arg->host_buf_info.buf_info[range_index];
+
+        if ((range->length > 0) && ((range->dma_address + range->length - 1) >= range->dma_address))
+        {
+            num_freed += cmem_free_owned_in_range (&cmem_allocation_regions,
+                    range->dma_address, range->dma_address + range->length - 1, cmem_current_owner (), &num_busy);
+            total_busy += num_busy;
+        }
+    }
+
+    /* Coalesce the free space once for all ranges */
+    cmem_coalesce_regions (&cmem_allocation_regions);
+
+    return (total_busy > 0) ? -EBUSY : num_freed;
+}
+
+
+/**
+ * @brief Count an allocation which failed for lack of free memory, by the addressing capability of the device and by
+ *        the class of pools
+ * @details Failures of the granule pools and of resizes aren't counted against the class.
+ * @param[in] cmd The ioctl which failed, which for CMEM_IOCTL_ALLOC_CLASS_BUFFERS is the equivalent
+ *                CMEM_IOCTL_ALLOC_A32_HOST_BUFFERS or CMEM_IOCTL_ALLOC_A64_HOST_BUFFERS
+ * @param[in] pool_class The CMEM_POOL_CLASS_* of the allocation
+ */
+static void cmem_count_allocation_failure (const unsigned int cmd, const uint32_t pool_class)
+{
+    switch (cmd)
+    {
+    case CMEM_IOCTL_ALLOC_A32_HOST_BUFFERS:
+    case CMEM_IOCTL_ALLOC_A32_SG_BUFFER:
+    case CMEM_IOCTL_ALLOC_A32_NAMED_BUFFER:
+        cmem_a32_allocation_failures++;
+        cmem_class_allocation_failures[pool_class]++;
+        break;
+
+    case CMEM_IOCTL_ALLOC_A32_GRANULE_BUFFERS:
+    case CMEM_IOCTL_RESIZE_A32_BUFFER:
+        cmem_a32_allocation_failures++;
+        break;
+
+    case CMEM_IOCTL_ALLOC_A64_HOST_BUFFERS:
+    case CMEM_IOCTL_ALLOC_A64_SG_BUFFER:
+    case CMEM_IOCTL_ALLOC_A64_NAMED_BUFFER:
+        cmem_a64_allocation_failures++;
+        cmem_class_allocation_failures[pool_class]++;
+        break;
+
+    case CMEM_IOCTL_ALLOC_A64_GRANULE_BUFFERS:
+    case CMEM_IOCTL_RESIZE_A64_BUFFER:
+        cmem_a64_allocation_failures++;
+        break;
+
+    default:
+        break;
+    }
+}
+
+
+/**
+ * @brief Resize an allocated cmem region in place, keeping the same start address
+ * @details Shrinking frees the tail of the region, which is coalesced with any following free region.
+ *          Growing allocates the start of the free region which immediately follows the region.
+ * @param[in/out] allocator Contains the cmem regions
+ * @param[in] a32 When true the region may not grow beyond the first 4 GiB
+ * @param[in] start The start address of the region
+ * @param[in] length The current length of the region
+ * @param[in] new_length The required length of the region
+ * @return Zero on success, -EINVAL if not an allocation of the caller which can be resized, -ENOMEM if there isn't
+ *         enough free space following the region, or -EBUSY if shrinking would free memory which the driver is
+ *         accessing or whose pages are pinned
+ */
+static long cmem_resize_region (cmem_allocation_regions_t *const allocator, const bool a32,
+                                const uint64_t start, const uint64_t length, const uint64_t new_length)
+{
+    const uint64_t max_a32_end = 0xffffffffUL;
+    const uint64_t new_end = start + new_length - 1;
+    const uint32_t region_index = cmem_find_region_index (allocator, start);
+    const cmem_allocation_region_t *region;
+    const cmem_allocation_region_t *next_region;
+
+    if (region_index >= allocator->num_regions)
+    {
+        return -EINVAL;
+    }
+    region = &allocator->regions[region_index];
+    if (!region->allocated || (region->start != start) || (region->end != (start + length - 1)) ||
+        (region->allocation_pid != cmem_current_owner ()) || cmem_is_sg_chunk (start, cmem_current_owner ()))
+    {
+        return -EINVAL;
+    }
+
+    if (new_end < region->end)
+    {
+        const cmem_allocation_region_t tail_region =
+        {
+            .start = new_end + 1,
+            .end = region->end,
+            .allocated = false,
+            .allocation_pid = -1
+        };
+
+        if (cmem_range_busy (tail_region.start, tail_region.end) ||
+            cmem_phys_pinned (tail_region.start, (tail_region.end + 1) - tail_region.start))
+        {
+            cmem_trace_event (CMEM_TRACE_EVENT_RESIZE, (a32 ? CMEM_TRACE_FLAG_A32 : 0) | CMEM_TRACE_FLAG_FAILED,
+                    start, new_length, 1, cmem_current_owner (), 0);
+            return -EBUSY;
+        }
+        if (!cmem_update_regions (allocator, &tail_region))
+        {
+            cmem_trace_event (CMEM_TRACE_EVENT_RESIZE, (a32 ? CMEM_TRACE_FLAG_A32 : 0) | CMEM_TRACE_FLAG_FAILED,
+                    start, new_length, 1, cmem_current_owner (), 0);
+            return -ENOMEM;
+        }
+    }
+    else if (new_end > region->end)
+    {
+        next_region = ((region_index + 1) < allocator->num_regions) ? &allocator->regions[region_index + 1] : NULL;
+        if ((next_region == NULL) || next_region->allocated || (next_region->start != (region->end + 1)) ||
+            (next_region->pool_class != region->pool_class) ||
+            (next_region->end < new_end) || (a32 && (new_end > max_a32_end)) ||
+            (!a32 && cmem_a32_reserve_refuses (cmem_a32_zone_length (region->end + 1, new_end))))
+        {
+            cmem_count_allocation_failure (a32 ? CMEM_IOCTL_RESIZE_A32_BUFFER : CMEM_IOCTL_RESIZE_A64_BUFFER,
+                    region->pool_class);
+            cmem_trace_event (CMEM_TRACE_EVENT_RESIZE, (a32 ? CMEM_TRACE_FLAG_A32 : 0) | CMEM_TRACE_FLAG_FAILED,
+                    start, new_length, 1, cmem_current_owner (), 0);
+            return -ENOMEM;
+        }
+        else
+        {
+            const cmem_allocation_region_t extension_region =
+            {
+                .start = region->end + 1,
+                .end = new_end,
+                .allocated = true,
+                .allocation_pid = cmem_current_owner ()
+            };
+
+            if (!cmem_update_regions (allocator, &extension_region))
+            {
+                /* No space in the regions[] array to split the next free region, which is left unchanged */
+                cmem_trace_event (CMEM_TRACE_EVENT_RESIZE, (a32 ? CMEM_TRACE_FLAG_A32 : 0) | CMEM_TRACE_FLAG_FAILED,
+                        start, new_length, 1, cmem_current_owner (), 0);
+                return -ENOMEM;
+            }
+
+            /* cmem_coalesce_regions() only combines free regions, so merge the extension into the region.
+             * The regions before the extension are unchanged, so the region is still at the same index. */
+            allocator->regions[region_index].end = new_end;
+            cmem_remove_region (allocator, region_index + 1);
+        }
+    }
+    cmem_trace_event (CMEM_TRACE_EVENT_RESIZE, a32 ? CMEM_TRACE_FLAG_A32 : 0, start, new_length, 1,
+            cmem_current_owner (), 0);
+
+    return 0;
+}
+
+
+/**
+ * @brief Handle CMEM_IOCTL_RESIZE_A64_BUFFER and CMEM_IOCTL_RESIZE_A32_BUFFER
+ * @details Called with cmem_allocation_regions_lock held
+ * @param[in] cmd The ioctl, which determines if the buffer may grow beyond the first 4 GiB
+ * @param[in/out] resize_buf The kernel copy of the parameters, with the length updated on success
+ * @return Zero on success, or a negative errno value on failure
+ */
+static long cmem_resize_ioctl (const unsigned int cmd, cmem_ioctl_resize_buf_t *const resize_buf)
+{
+    const bool a32 = cmd == CMEM_IOCTL_RESIZE_A32_BUFFER;
+    unsigned long first_granule;
+    uint64_t resized_length;
+    long ret;
+
+    if ((resize_buf->length == 0) || (resize_buf->new_length == 0) ||
+        ((resize_buf->dma_address + resize_buf->length - 1) < resize_buf->dma_address) ||
+        ((resize_buf->dma_address + resize_buf->new_length - 1) < resize_buf->dma_address))
+    {
+        return -EINVAL;
+    }
+
+    if (cmem_find_granule_pool (resize_buf->dma_address, &first_granule) != NULL)
+    {
+        ret = cmem_granule_resize (a32, resize_buf->dma_address, resize_buf->length, resize_buf->new_length,
+                &resized_length);
+        if (ret == -ENOMEM)
+        {
+            /* The granules following the allocation aren't free */
+            cmem_count_allocation_failure (cmd, CMEM_POOL_CLASS_DRAM);
+        }
+    }
+    else
+    {
+        ret = cmem_resize_region (&cmem_allocation_regions, a32, resize_buf->dma_address, resize_buf->length,
+                resize_buf->new_length);
+        resized_length = resize_buf->new_length;
+    }
+
+    if (ret == 0)
+    {
+        resize_buf->length = resized_length;
+    }
+
+    return ret;
+}
+
+
+/* The tracking structures which an ioctl may need, allocated before cmem_allocation_regions_lock is taken so that
+ * memory is never allocated while the lock is held. An ioctl which keeps one sets the pointer to NULL, and any which
+ * remain are freed once the lock has been released. */
+typedef struct
+{
+    cmem_sg_allocation_t *sg_allocation;
+    cmem_named_allocation_t *named_allocation;
+} cmem_ioctl_prealloc_t;
+
+
+/**
+ * @brief Allocate a scatter-gather buffer.
+ * @details A single physically contiguous chunk is used if possible. Otherwise the largest available chunks are
+ *          allocated in turn, to minimise the number of chunks, until the length has been satisfied.
+ * @param[in] cmd CMEM_IOCTL_ALLOC_A32_SG_BUFFER or CMEM_IOCTL_ALLOC_A64_SG_BUFFER to indicate the type of allocation.
+ * @param[in/out] allocator Contains the cmem regions to allocate from
+ * @param[in/out] sg_buf On input the length and constraints of the buffer, on output the allocated chunks
+ * @param[in/out] prealloc Contains the cmem_sg_allocation_t to record the buffer in, which is taken once the
+ *                         parameters have been validated
+ * @return Zero on success, or a negative errno value on failure
+ */
+static long cmem_allocate_sg (const unsigned int cmd, cmem_allocation_regions_t *const allocator,
+                              cmem_ioctl_sg_buf_t *const sg_buf, cmem_ioctl_prealloc_t *const prealloc)
+{
+    /* The type of allocation for each chunk */
+    const unsigned int chunk_cmd = (cmd == CMEM_IOCTL_ALLOC_A32_SG_BUFFER) ?
+            CMEM_IOCTL_ALLOC_A32_HOST_BUFFERS : CMEM_IOCTL_ALLOC_A64_HOST_BUFFERS;
+    cmem_sg_allocation_t *sg_allocation;
+    cmem_allocation_region_t chunk;
+    uint64_t remaining_length;
+
+    sg_buf->num_chunks = 0;
+    if (!is_power_of_2 (sg_buf->chunk_granularity) || (sg_buf->chunk_granularity < PAGE_SIZE) ||
+        !is_power_of_2 (sg_buf->chunk_alignment) || (sg_buf->chunk_alignment < PAGE_SIZE) ||
+        (sg_buf->length == 0) || !IS_ALIGNED (sg_buf->length, sg_buf->chunk_granularity))
+    {
+        return -EINVAL;
+    }
+
+    sg_allocation = prealloc->sg_allocation;
+    prealloc->sg_allocation = NULL;
+    sg_allocation->allocation_pid = cmem_current_owner ();
+
+    /* First try for a single physically contiguous chunk */
+    cmem_allocate_region (chunk_cmd, allocator, CMEM_POOL_CLASS_DRAM, sg_buf->length, sg_buf->chunk_alignment,
+            cmem_current_owner (), &chunk);
+    if (chunk.allocated)
+    {
+        sg_allocation->chunks[0].dma_address = chunk.start;
+        sg_allocation->chunks[0].length = sg_buf->length;
+        sg_allocation->num_chunks = 1;
+        remaining_length = 0;
+    }
+    else
+    {
+        remaining_length = sg_buf->length;
+    }
+
+    /* Otherwise allocate the largest available chunks in turn, using the same preference as cmem_allocate_region()
+     * for 64-bit capable devices to first use addresses above the first 4 GiB */
+    while ((remaining_length > 0) && (sg_allocation->num_chunks < CMEM_MAX_SG_CHUNKS))
+    {
+        chunk.allocated = false;
+        if (chunk_cmd == CMEM_IOCTL_ALLOC_A64_HOST_BUFFERS)
+        {
+            cmem_find_largest_chunk (chunk_cmd, allocator, CMEM_POOL_CLASS_DRAM, 0x100000000UL, remaining_length,
+                    sg_buf->chunk_granularity, sg_buf->chunk_alignment, cmem_current_owner (), &chunk);
+        }
+        if (!chunk.allocated)
+        {
+            /* Chunks for a 64-bit capable device are limited by a32_reserve, treating them as entirely in the
+             * first 4 GiB */
+            const uint64_t max_length = (chunk_cmd == CMEM_IOCTL_ALLOC_A64_HOST_BUFFERS) ?
+                    min (remaining_length, cmem_a32_zone_allowance ()) : remaining_length;
+
+            cmem_find_largest_chunk (chunk_cmd, allocator, CMEM_POOL_CLASS_DRAM, 0, max_length,
+                    sg_buf->chunk_granularity, sg_buf->chunk_alignment, cmem_current_owner (), &chunk);
+            if (!chunk.allocated && (max_length < remaining_length))
+            {
+                cmem_a32_reserve_refusals++;
+            }
+        }
+        if (!chunk.allocated || !cmem_update_regions (allocator, &chunk))
+        {
+            /* No chunk available, or no space in the regions[] array to record it */
+            break;
+        }
+
+        cmem_trace_event (CMEM_TRACE_EVENT_ALLOC,
+                (chunk_cmd == CMEM_IOCTL_ALLOC_A32_HOST_BUFFERS) ? CMEM_TRACE_FLAG_A32 : 0, chunk.start,
+                (chunk.end + 1) - chunk.start, sg_buf->chunk_alignment, chunk.allocation_pid, CMEM_POOL_CLASS_DRAM);
+        sg_allocation->chunks[sg_allocation->num_chunks].dma_address = chunk.start;
+        sg_allocation->chunks[sg_allocation->num_chunks].length = (chunk.end + 1) - chunk.start;
+        remaining_length -= sg_allocation->chunks[sg_allocation->num_chunks].length;
+        sg_allocation->num_chunks++;
+    }
+
+    list_add_tail (&sg_allocation->list, &cmem_sg_allocations);
+    if (remaining_length > 0)
+    {
+        /* Insufficient free space, or too many chunks required. Release any chunks which were allocated */
+        cmem_count_allocation_failure (cmd, CMEM_POOL_CLASS_DRAM);
+        cmem_free_sg_allocation (allocator, sg_allocation);
+        return -ENOMEM;
+    }
+
+    sg_buf->num_chunks = sg_allocation->num_chunks;
+    memcpy (sg_buf->chunks, sg_allocation->chunks, sizeof (sg_buf->chunks));
+
+    return 0;
+}
+
+
+/**
+ * @brief Handle the ioctls for scatter-gather buffers
+ * @details Called with cmem_allocation_regions_lock held
+ * @param[in] cmd The scatter-gather ioctl
+ * @param[in/out] sg_buf The kernel copy of the parameters, with the chunks updated by an allocation
+ * @param[in/out] prealloc The tracking structures allocated before the lock was taken
+ * @return Zero on success, or a negative errno value on failure
+ */
+static long cmem_sg_ioctl (const unsigned int cmd, cmem_ioctl_sg_buf_t *const sg_buf,
+                           cmem_ioctl_prealloc_t *const prealloc)
+{
+    long ret = 0;
+    cmem_sg_allocation_t *sg_allocation;
+
+    if (cmd == CMEM_IOCTL_FREE_SG_BUFFER)
+    {
+        sg_allocation = cmem_find_sg_allocation (sg_buf->chunks[0].dma_address);
+        if ((sg_allocation == NULL) || (sg_allocation->allocation_pid != cmem_current_owner ()))
+        {
+            ret = -EINVAL;
+        }
+        else if (cmem_sg_allocation_busy (sg_allocation))
+        {
+            ret = -EBUSY;
+        }
+        else
+        {
+            cmem_free_sg_allocation (&cmem_allocation_regions, sg_allocation);
+        }
+    }
+    else
+    {
+        ret = cmem_allocate_sg (cmd, &cmem_allocation_regions, sg_buf, prealloc);
+    }
+
+    return ret;
+}
+
+
+/**
+ * @brief Find a named allocation
+ * @details Called with cmem_allocation_regions_lock held
+ * @param[in] name The name of the allocation, which need not be nul terminated when name_length is shorter
+ * @param[in] name_length The number of characters in name to compare
+ * @return The named allocation, or NULL if not found
+ */
+static cmem_named_allocation_t *cmem_find_named_allocation (const char *const name, const size_t name_length)
+{
+    cmem_named_allocation_t *named_allocation;
+
+    list_for_each_entry (named_allocation, &cmem_named_allocations, list)
+    {
+        if ((strnlen (named_allocation->name, sizeof (named_allocation->name)) == name_length) &&
+            (strncmp (named_allocation->name, name, name_length) == 0))
+        {
+            return named_allocation;
+        }
+    }
+
+    return NULL;
+}
+
+
+/**
+ * @brief Destroy a named allocation, freeing its region
+ * @details Called with cmem_allocation_regions_lock held. Any existing user mappings of the allocation are not
+ *          removed, as for the other types of allocation.
+ * @param[in/out] allocator Contains the cmem regions to free the allocation to
+ * @param[in] named_allocation The named allocation to destroy, which is removed from cmem_named_allocations
+ */
+static void cmem_destroy_named_allocation (cmem_allocation_regions_t *const allocator,
+                                           cmem_named_allocation_t *const named_allocation)
+{
+    dev_info(cmem_dev, "Destroyed named buffer %s of %#llx bytes from address %#llx\n",
+            named_allocation->name, named_allocation->length, named_allocation->start);
+    cmem_free_region_unless_pinned (allocator, named_allocation->start);
+    cmem_coalesce_regions (allocator);
+    cmem_trace_event (CMEM_TRACE_EVENT_FREE, 0, named_allocation->start, named_allocation->length, 1,
+            CMEM_NAMED_ALLOCATION_PID, 0);
+    list_del (&named_allocation->list);
+    kfree (named_allocation);
+}
+
+
+/**
+ * @brief Handle the ioctls for named buffers
+ * @details Called with cmem_allocation_regions_lock held
+ * @param[in] cmd The named buffer ioctl
+ * @param[in/out] named_buf The kernel copy of the parameters, with the allocation filled in on success
+ * @param[in/out] prealloc Contains the cmem_named_allocation_t which is taken when a new allocation is created
+ * @return Zero on success, or a negative errno value on failure
+ */
+static long cmem_named_ioctl (const unsigned int cmd, cmem_ioctl_named_buf_t *const named_buf,
+                              cmem_ioctl_prealloc_t *const prealloc)
+{
+    const uint64_t max_a32_end = 0xffffffffUL;
+    cmem_named_allocation_t *named_allocation;
+    size_t name_length;
+
+    name_length = strnlen (named_buf->name, sizeof (named_buf->name));
+    if ((name_length == 0) || (name_length == sizeof (named_buf->name)))
+    {
+        /* Empty or not nul terminated */
+        return -EINVAL;
+    }
+    named_allocation = cmem_find_named_allocation (named_buf->name, name_length);
+
+    if (cmd == CMEM_IOCTL_DESTROY_NAMED_BUFFER)
+    {
+        if (named_allocation == NULL)
+        {
+            return -ENOENT;
+        }
+        if (cmem_range_busy (named_allocation->start, named_allocation->start + named_allocation->length - 1))
+        {
+            return -EBUSY;
+        }
+        cmem_destroy_named_allocation (&cmem_allocation_regions, named_allocation);
+        return 0;
+    }
+
+    if (named_allocation != NULL)
+    {
+        /* Attach to the existing allocation */
+        if ((named_buf->length > named_allocation->length) ||
+            ((cmd == CMEM_IOCTL_ALLOC_A32_NAMED_BUFFER) &&
+             ((named_allocation->start + named_allocation->length - 1) > max_a32_end)))
+        {
+            return -EINVAL;
+        }
+        named_buf->created = 0;
+    }
+    else if (named_buf->length == 0)
+    {
+        return -ENOENT;
+    }
+    else
+    {
+        /* Create a new allocation, which is page aligned since is always mapped in its entirety */
+        const unsigned int region_cmd = (cmd == CMEM_IOCTL_ALLOC_A32_NAMED_BUFFER) ?
+                CMEM_IOCTL_ALLOC_A32_HOST_BUFFERS : CMEM_IOCTL_ALLOC_A64_HOST_BUFFERS;
+        cmem_allocation_region_t allocated_region;
+
+        /* The region is owned by CMEM_NAMED_ALLOCATION_PID so it isn't freed when the process exits */
+        cmem_allocate_region (region_cmd, &cmem_allocation_regions, CMEM_POOL_CLASS_DRAM,
+                PAGE_ALIGN (named_buf->length), PAGE_SIZE, CMEM_NAMED_ALLOCATION_PID, &allocated_region);
+        if (!allocated_region.allocated)
+        {
+            cmem_count_allocation_failure (cmd, CMEM_POOL_CLASS_DRAM);
+            return -ENOMEM;
+        }
+
+        named_allocation = prealloc->named_allocation;
+        prealloc->named_allocation = NULL;
+        memcpy (named_allocation->name, named_buf->name, name_length + 1);
+        named_allocation->start = allocated_region.start;
+        named_allocation->length = (allocated_region.end + 1) - allocated_region.start;
+        named_allocation->creator_pid = cmem_current_owner ();
+        list_add_tail (&named_allocation->list, &cmem_named_allocations);
+        dev_info(cmem_dev, "Created named buffer %s of %#llx bytes from address %#llx for pid %d\n",
+                named_allocation->name, named_allocation->length, named_allocation->start, named_allocation->creator_pid);
+        named_buf->created = 1;
+    }
+
+    named_buf->length = named_allocation->length;
+    named_buf->dma_address = named_allocation->start;
+
+    return 0;
+}
+
+
+/**
+ * @brief Allocate buffers from one class of pools, for CMEM_IOCTL_ALLOC_CLASS_BUFFERS
+ * @details Called with cmem_allocation_regions_lock held
+ * @param[in/out] class_buf The kernel copy of the parameters, with the allocated buffers filled in
+ * @return Zero on success, or a negative errno value on failure
+ */
+static long cmem_class_ioctl (cmem_ioctl_class_buf_t *const class_buf)
+{
+    cmem_allocation_region_t allocated_region;
+    uint32_t buffer_index;
+    unsigned int cmd;
+    long ret = 0;
+
+    if ((class_buf->pool_class >= CMEM_NUM_POOL_CLASSES) ||
+             (class_buf->host_buf_info.num_buffers > CMEM_MAX_BUF_PER_ALLOC))
+    {
+        ret = -EINVAL;
+    }
+    else
+    {
+        cmd = class_buf->a32 ? CMEM_IOCTL_ALLOC_A32_HOST_BUFFERS : CMEM_IOCTL_ALLOC_A64_HOST_BUFFERS;
+        for (buffer_index = 0; (ret == 0) && (buffer_index < class_buf->host_buf_info.num_buffers); buffer_index++)
+        {
+            cmem_host_buf_entry_t *const buffer = &class_buf->host_buf_info.buf_info[buffer_index];
+
+            cmem_allocate_region (cmd, &cmem_allocation_regions, class_buf->pool_class, buffer->length, 1,
+                    cmem_current_owner (), &allocated_region);
+            if (allocated_region.allocated)
+            {
+                buffer->dma_address = allocated_region.start;
+                buffer->length = (allocated_region.end + 1) - allocated_region.start;
+            }
+            else
+            {
+                /* Indicate the individual allocation failed, and indicate an overall failure */
+                buffer->length = 0;
+                buffer->dma_address = 0;
+                ret = -ENOMEM;
+            }
+        }
+        if (ret == -ENOMEM)
+        {
+            cmem_count_allocation_failure (cmd, class_buf->pool_class);
+        }
+    }
+
+    return ret;
+}
+
+
+/* Kernel copy of the parameters for any of the ioctls which operate on cmem_allocation_regions.
+ * The parameters are copied in before cmem_allocation_regions_lock is taken and copied out after it has been released,
+ * since cmem_mmap() takes cmem_allocation_regions_lock with the mmap_lock held and a page fault during a user copy
+ * takes the mmap_lock. */
+typedef union
+{
+    cmem_ioctl_t host;
+    cmem_ioctl_sg_buf_t sg;
+    cmem_ioctl_named_buf_t named;
+    cmem_ioctl_resize_buf_t resize;
+    cmem_ioctl_class_buf_t class;
+} cmem_ioctl_params_t;
+
+
+/**
+ * @brief Copy the parameters of an ioctl which operates on cmem_allocation_regions from user space
+ * @details Called without cmem_allocation_regions_lock held
+ * @param[in] cmd The ioctl to perform
+ * @param[in] arg The user space pointer to the parameters for the ioctl
+ * @param[out] params The kernel copy of the parameters
+ * @return Zero on success, or a negative errno value on failure
+ */
+static long cmem_ioctl_copy_in (const unsigned int cmd, const unsigned long arg, cmem_ioctl_params_t *const params)
+{
+    size_t params_size;
+
+    switch (cmd)
+    {
+    case CMEM_IOCTL_ALLOC_A64_HOST_BUFFERS:
+    case CMEM_IOCTL_ALLOC_A32_HOST_BUFFERS:
+    case CMEM_IOCTL_ALLOC_A64_GRANULE_BUFFERS:
+    case CMEM_IOCTL_ALLOC_A32_GRANULE_BUFFERS:
+    case CMEM_IOCTL_FREE_HOST_BUFFERS:
+    case CMEM_IOCTL_FREE_RANGES:
+        params_size = sizeof (params->host);
+        break;
+
+    case CMEM_IOCTL_ALLOC_A64_SG_BUFFER:
+    case CMEM_IOCTL_ALLOC_A32_SG_BUFFER:
+    case CMEM_IOCTL_FREE_SG_BUFFER:
+        params_size = sizeof (params->sg);
+        break;
+
+    case CMEM_IOCTL_ALLOC_A64_NAMED_BUFFER:
+    case CMEM_IOCTL_ALLOC_A32_NAMED_BUFFER:
+    case CMEM_IOCTL_DESTROY_NAMED_BUFFER:
+        params_size = sizeof (params->named);
+        break;
+
+    case CMEM_IOCTL_RESIZE_A64_BUFFER:
+    case CMEM_IOCTL_RESIZE_A32_BUFFER:
+        params_size = sizeof (params->resize);
+        break;
+
+    case CMEM_IOCTL_ALLOC_CLASS_BUFFERS:
+        params_size = sizeof (params->class);
+        break;
+
+    case CMEM_IOCTL_FREE_ALL:
+        /* No parameters */
+        return 0;
+
+    default:
+        return -EINVAL;
+    }
+
+    if (copy_from_user (params, (void __user *) arg, params_size))
+    {
+        return -EFAULT;
+    }
+
+    return 0;
+}
+
+
+/**
+ * @brief Allocate the tracking structures which an ioctl may need, before cmem_allocation_regions_lock is taken
+ * @param[in] cmd The ioctl to perform
+ * @param[in] gfp The flags for the allocations, which mustn't block for a non-blocking io_uring command
+ * @param[out] prealloc The tracking structures, which are NULL when not needed by the ioctl
+ * @return Zero on success, or -ENOMEM if an allocation failed in which case nothing remains allocated
+ */
+static long cmem_ioctl_prealloc (const unsigned int cmd, const gfp_t gfp, cmem_ioctl_prealloc_t *const prealloc)
+{
+    prealloc->sg_allocation = NULL;
+    prealloc->named_allocation = NULL;
+    if ((cmd == CMEM_IOCTL_ALLOC_A64_SG_BUFFER) || (cmd == CMEM_IOCTL_ALLOC_A32_SG_BUFFER))
+    {
+        prealloc->sg_allocation = kzalloc (sizeof (*prealloc->sg_allocation), gfp);
+        if (prealloc->sg_allocation == NULL)
+        {
+            return -ENOMEM;
+        }
+    }
+    else if ((cmd == CMEM_IOCTL_ALLOC_A64_NAMED_BUFFER) || (cmd == CMEM_IOCTL_ALLOC_A32_NAMED_BUFFER))
+    {
+        prealloc->named_allocation = kzalloc (sizeof (*prealloc->named_allocation), gfp);
+        if (prealloc->named_allocation == NULL)
+        {
+            return -ENOMEM;
+        }
+    }
+
+    return 0;
+}
+
+
+/**
+ * @brief Free the tracking structures allocated by cmem_ioctl_prealloc() which the ioctl didn't keep
+ * @details Called without cmem_allocation_regions_lock held
+ * @param[in] prealloc The tracking structures
+ */
+static void cmem_ioctl_prealloc_free (const cmem_ioctl_prealloc_t *const prealloc)
+{
+    kfree (prealloc->sg_allocation);
+    kfree (prealloc->named_allocation);
+}
+
+
+/**
+ * @brief Copy the results of an ioctl which operates on cmem_allocation_regions back to user space
+ * @details Called without cmem_allocation_regions_lock held.
+ *          The allocation ioctls copy back on success, and on -ENOMEM so the caller can see which individual
+ *          allocations failed. Other ioctls don't modify the parameters.
+ * @param[in] cmd The ioctl which was performed
+ * @param[in] arg The user space pointer to the parameters for the ioctl
+ * @param[in] params The kernel copy of the parameters, as updated by the ioctl
+ * @param[in] ret The result of the ioctl
+ * @return The result of the ioctl, or -EFAULT if the results couldn't be copied
+ */
+static long cmem_ioctl_copy_out (const unsigned int cmd, const unsigned long arg,
+                                 const cmem_ioctl_params_t *const params, const long ret)
+{
+    size_t params_size;
+
+    if ((ret != 0) && (ret != -ENOMEM))
+    {
+        return ret;
+    }
+
+    switch (cmd)
+    {
+    case CMEM_IOCTL_ALLOC_A64_HOST_BUFFERS:
+    case CMEM_IOCTL_ALLOC_A32_HOST_BUFFERS:
+    case CMEM_IOCTL_ALLOC_A64_GRANULE_BUFFERS:
+    case CMEM_IOCTL_ALLOC_A32_GRANULE_BUFFERS:
+        params_size = sizeof (params->host);
+        break;
+
+    case CMEM_IOCTL_ALLOC_A64_SG_BUFFER:
+    case CMEM_IOCTL_ALLOC_A32_SG_BUFFER:
+        params_size = sizeof (params->sg);
+        break;
+
+    case CMEM_IOCTL_ALLOC_A64_NAMED_BUFFER:
+    case CMEM_IOCTL_ALLOC_A32_NAMED_BUFFER:
+        params_size = sizeof (params->named);
+        break;
+
+    case CMEM_IOCTL_RESIZE_A64_BUFFER:
+    case CMEM_IOCTL_RESIZE_A32_BUFFER:
+        params_size = sizeof (params->resize);
+        break;
+
+    case CMEM_IOCTL_ALLOC_CLASS_BUFFERS:
+        params_size = sizeof (params->class);
+        break;
+
+    default:
+        return ret;
+    }
+
+    if (copy_to_user ((void __user *) arg, params, params_size))
+    {
+        return -EFAULT;
+    }
+
+    return ret;
+}
+
+
+/**
+ * @brief Perform one of the cmem ioctls, which is either called from cmem_ioctl() or cmem_uring_cmd()
+ * @details Called with cmem_allocation_regions_lock held, and only operates on the kernel copy of the parameters
+ *          so doesn't access user space memory or allocate memory.
+ * @param[in] cmd The ioctl to perform
+ * @param[in/out] params The kernel copy of the parameters, as returned by cmem_ioctl_copy_in()
+ * @param[in/out] prealloc The tracking structures allocated by cmem_ioctl_prealloc()
+ * @return Zero or a positive count on success, or a negative errno value on failure
+ */
+static long cmem_ioctl_locked (const unsigned int cmd, cmem_ioctl_params_t *const params,
+                               cmem_ioctl_prealloc_t *const prealloc)
+{
+    cmem_ioctl_t *const cmem_ioctl_arg = &params->host;
+    long ret = 0;
+    uint32_t buffer_index;
+    uint32_t region_index;
+    uint32_t num_busy;
+
+    switch (cmd)
+    {
+    case CMEM_IOCTL_ALLOC_A64_HOST_BUFFERS:
+    case CMEM_IOCTL_ALLOC_A32_HOST_BUFFERS:
+    case CMEM_IOCTL_ALLOC_A64_GRANULE_BUFFERS:
+    case CMEM_IOCTL_ALLOC_A32_GRANULE_BUFFERS:
+        {
+            cmem_allocation_region_t allocated_region;
+
+            /* Allocate the specified buffers */
+            if (cmem_ioctl_arg->host_buf_info.num_buffers > CMEM_MAX_BUF_PER_ALLOC)
+            {
+                ret = -EINVAL;
+            }
+            else
+            {
+                for (buffer_index = 0; (ret == 0) && (buffer_index < cmem_ioctl_arg->host_buf_info.num_buffers); buffer_index++)
+                {
+                    cmem_host_buf_entry_t *const buffer = &cmem_ioctl_arg->host_buf_info.buf_info[buffer_index];
+
+                    if (cmd == CMEM_IOCTL_ALLOC_A64_GRANULE_BUFFERS)
+                    {
+                        cmem_granule_allocate (false, buffer->length, &allocated_region);
+                    }
+                    else if (cmd == CMEM_IOCTL_ALLOC_A32_GRANULE_BUFFERS)
+                    {
+                        cmem_granule_allocate (true, buffer->length, &allocated_region);
+                    }
+                    else
+                    {
+                        cmem_allocate_region (cmd, &cmem_allocation_regions, CMEM_POOL_CLASS_DRAM, buffer->length, 1,
+                                cmem_current_owner (), &allocated_region);
+                    }
+                    if (allocated_region.allocated)
+                    {
+                        buffer->dma_address = allocated_region.start;
+                        buffer->length = (allocated_region.end + 1) - allocated_region.start;
+                    }
+                    else
+                    {
+                        /* Indicate the individual allocation failed, and indicate an overall failure */
+                        buffer->length = 0;
+                        buffer->dma_address = 0;
+                        cmem_count_allocation_failure (cmd, CMEM_POOL_CLASS_DRAM);
+                        ret = -ENOMEM;
+                    }
+                }
+            }
+        }
+        break;
+
+    case CMEM_IOCTL_FREE_HOST_BUFFERS:
+        {
+            /* Free the specified buffers, checking the current process performed the allocations */
+            if (cmem_ioctl_arg->host_buf_info.num_buffers > CMEM_MAX_BUF_PER_ALLOC)
+            {
+                ret = -EINVAL;
+            }
+            else
+            {
+                for (buffer_index = 0; (ret == 0) && (buffer_index < cmem_ioctl_arg->host_buf_info.num_buffers); buffer_index++)
+                {
+                    const cmem_host_buf_entry_t *const buffer = &cmem_ioctl_arg->host_buf_info.buf_info[buffer_index];
+                    const cmem_allocation_region_t region_to_free =
+                    {
+                        .start = buffer->dma_address,
+                        .end = buffer->dma_address + buffer->length - 1,
+                        .allocated = false,
+                        .allocation_pid = -1
+                    };
+                    const long granule_ret = cmem_granule_free_buffer (buffer->dma_address, buffer->length,
+                            cmem_current_owner ());
+                    bool region_found = granule_ret != -EINVAL;
+
+                    if (granule_ret == -EBUSY)
+                    {
+                        ret = -EBUSY;
+                    }
+
+                    for (region_index = 0; !region_found && (region_index < cmem_allocation_regions.num_regions); region_index++)
+                    {
+                        const cmem_allocation_region_t *const existing_region = &cmem_allocation_regions.regions[region_index];
+
+                        /* The chunks of a scatter-gather allocation may only be freed together by
+                         * CMEM_IOCTL_FREE_SG_BUFFER, to avoid leaving a dangling cmem_sg_allocation_t */
+                        if ((region_to_free.start == existing_region->start) && (region_to_free.end == existing_region->end) &&
+                            (cmem_current_owner () == existing_region->allocation_pid) &&
+                            !cmem_is_sg_chunk (existing_region->start, cmem_current_owner ()) &&
+                            cmem_range_busy (existing_region->start, existing_region->end))
+                        {
+                            ret = -EBUSY;
+                            region_found = true;
+                        }
+                        else if ((region_to_free.start == existing_region->start) &&
+                                 (region_to_free.end == existing_region->end) &&
+                                 (cmem_current_owner () == existing_region->allocation_pid) &&
+                                 !cmem_is_sg_chunk (existing_region->start, cmem_current_owner ()))
+                        {
+                            cmem_free_region_unless_pinned (&cmem_allocation_regions, region_to_free.start);
+                            cmem_trace_event (CMEM_TRACE_EVENT_FREE, 0, buffer->dma_address, buffer->length, 1,
+                                    cmem_current_owner (), 0);
+                            region_found = true;
+                        }
+                    }
+
+                    if (!region_found)
+                    {
+                        ret = -EINVAL;
+                    }
+                }
+                cmem_coalesce_regions (&cmem_allocation_regions);
+            }
+        }
+        break;
+
+    case CMEM_IOCTL_ALLOC_A64_SG_BUFFER:
+    case CMEM_IOCTL_ALLOC_A32_SG_BUFFER:
+    case CMEM_IOCTL_FREE_SG_BUFFER:
+        ret = cmem_sg_ioctl (cmd, &params->sg, prealloc);
+        break;
+
+    case CMEM_IOCTL_ALLOC_A64_NAMED_BUFFER:
+    case CMEM_IOCTL_ALLOC_A32_NAMED_BUFFER:
+    case CMEM_IOCTL_DESTROY_NAMED_BUFFER:
+        ret = cmem_named_ioctl (cmd, &params->named, prealloc);
+        break;
+
+    case CMEM_IOCTL_FREE_RANGES:
+        ret = cmem_free_ranges_ioctl (cmem_ioctl_arg);
+        break;
+
+    case CMEM_IOCTL_RESIZE_A64_BUFFER:
+    case CMEM_IOCTL_RESIZE_A32_BUFFER:
+        ret = cmem_resize_ioctl (cmd, &params->resize);
+        break;
+
+    case CMEM_IOCTL_FREE_ALL:
+        ret = cmem_free_owned_in_range (&cmem_allocation_regions, 0, U64_MAX, cmem_current_owner (), &num_busy);
+        cmem_coalesce_regions (&cmem_allocation_regions);
+        if (num_busy > 0)
+        {
+            ret = -EBUSY;
+        }
+        break;
+
+    case CMEM_IOCTL_ALLOC_CLASS_BUFFERS:
+        ret = cmem_class_ioctl (&params->class);
+        break;
+
+    default:
+        ret = -EINVAL;
+        break;
+    }
+
+    cmem_update_status_page ();
+
+    return ret;
+}
+
+
+/**
+ * @brief Find the number of bytes which a process may read or write from a physical address
+ * @details Called with cmem_allocation_regions_lock held
+ * @param[in] phys_addr The physical address at the start of the read or write
+ * @param[in] owner The process performing the read or write, which is the calling process other than for the
+ *                  loopback engine
+ * @return The number of bytes from phys_addr to the end of the allocated region, owned by owner or
+ *         a named allocation, which contains phys_addr. Zero if phys_addr isn't in such a region.
+ */
+static uint64_t cmem_owned_length_locked (const uint64_t phys_addr, const pid_t owner)
+{
+    uint64_t owned_length;
+    uint32_t region_index;
+
+    owned_length = cmem_granule_owned_length (phys_addr, owner);
+    for (region_index = 0; (owned_length == 0) && (region_index < cmem_allocation_regions.num_regions); region_index++)
+    {
+        const cmem_allocation_region_t *const region = &cmem_allocation_regions.regions[region_index];
+
+        if (region->allocated &&
+            ((region->allocation_pid == owner) || (region->allocation_pid == CMEM_NAMED_ALLOCATION_PID)) &&
+            (phys_addr >= region->start) && (phys_addr <= region->end))
+        {
+            owned_length = (region->end + 1) - phys_addr;
+            break;
+        }
+    }
+
+    return owned_length;
+}
+
+
+/**
+ * @brief Find the number of bytes which a process may read or write from a physical address
+ * @details The allocation may be freed once this returns, so the result is only advisory unless the caller has
+ *          another way of preventing the free.
+ * @param[in] phys_addr The physical address at the start of the read or write
+ * @param[in] owner The process performing the read or write
+ * @return As cmem_owned_length_locked()
+ */
+static uint64_t cmem_owned_length (const uint64_t phys_addr, const pid_t owner)
+{
+    uint64_t owned_length;
+
+    mutex_lock (&cmem_allocation_regions_lock);
+    owned_length = cmem_owned_length_locked (phys_addr, owner);
+    mutex_unlock (&cmem_allocation_regions_lock);
+
+    return owned_length;
+}
+
+
+/**
+ * @brief Check that a physical address range may be accessed by a process, and prevent it from being freed
+ * @details The check and adding the busy range are performed under cmem_allocation_regions_lock, so that the range
+ *          can't be freed between them. The operations which free or shrink allocations fail with -EBUSY until
+ *          cmem_release_busy_range() is called.
+ * @param[in] start The physical address of the start of the range
+ * @param[in] length The length of the range
+ * @param[in] owner The process which will access the range
+ * @param[out] busy_range Added to cmem_busy_ranges on success
+ * @return Returns true if the range was claimed, or false if it isn't owned by owner or a named allocation
+ */
+static bool cmem_claim_owned_range (const uint64_t start, const uint64_t length, const pid_t owner,
+                                    cmem_busy_range_t *const busy_range)
+{
+    bool claimed;
+
+    mutex_lock (&cmem_allocation_regions_lock);
+    claimed = cmem_owned_length_locked (start, owner) >= length;
+    if (claimed)
+    {
+        busy_range->start = start;
+        busy_range->end = start + length - 1;
+        list_add (&busy_range->list, &cmem_busy_ranges);
+    }
+    mutex_unlock (&cmem_allocation_regions_lock);
+
+    return claimed;
+}
+
+
+/**
+ * @brief Allow a range claimed by cmem_claim_owned_range() to be freed
+ * @param[in/out] busy_range The range to release, which is ignored if not claimed
+ */
+static void cmem_release_busy_range (cmem_busy_range_t *const busy_range)
+{
+    mutex_lock (&cmem_allocation_regions_lock);
+    if (!list_empty (&busy_range->list))
+    {
+        list_del_init (&busy_range->list);
+    }
+    mutex_unlock (&cmem_allocation_regions_lock);
+}
+
+
+#ifdef CONFIG_X86
+/**
+ * @brief Write back the CPU cache lines of a kernel mapping, leaving the lines valid in the cache
+ * @param[in] kernel_addr The start of the kernel mapping
+ * @param[in] length The length of the kernel mapping
+ */
+static void cmem_clean_cache_range (void *const kernel_addr, const size_t length)
+{
+#ifdef CONFIG_ARCH_HAS_PMEM_API
+    /* Uses clwb when the CPU supports it, otherwise clflushopt or clflush. Doesn't fence the write backs. */
+    arch_wb_cache_pmem (kernel_addr, length);
+    wmb ();
+#else
+    clflush_cache_range (kernel_addr, length);
+#endif
+}
+
+
+/**
+ * @brief Perform cache maintenance on a range of physical memory
+ * @details The CPU caches are physically tagged, so the maintenance can be performed through a temporary kernel
+ *          mapping created by memremap(), with the same write-back cache type as the user mappings.
+ * @param[in] flush true to write back and invalidate the cache lines, false to only write back the cache lines
+ * @param[in] start The physical address of the start of the range
+ * @param[in] length The length of the range
+ * @return Zero on success, or a negative errno value on failure
+ */
+static long cmem_cache_maintain_range (const bool flush, const uint64_t start, const uint64_t length)
+{
+    uint64_t offset = 0;
+
+    while (offset < length)
+    {
+        /* Each kernel mapping after the first starts on a multiple of the maximum length */
+        const uint64_t map_start = start + offset;
+        const size_t map_length = min_t (uint64_t, length - offset,
+                CMEM_RW_MAX_MAP_LENGTH - (map_start & (CMEM_RW_MAX_MAP_LENGTH - 1)));
+        void *const kernel_addr = memremap (map_start, map_length, MEMREMAP_WB);
+
+        if (kernel_addr == NULL)
+        {
+            return -ENOMEM;
+        }
+        if (flush)
+        {
+            /* Uses clflushopt when the CPU supports it, otherwise clflush */
+            clflush_cache_range (kernel_addr, map_length);
+        }
+        else
+        {
+            cmem_clean_cache_range (kernel_addr, map_length);
+        }
+        memunmap (kernel_addr);
+
+        offset += map_length;
+        cond_resched ();
+    }
+
+    return 0;
+}
+#endif
+
+
+/**
+ * @brief Handle CMEM_IOCTL_CLEAN_CACHE_RANGES and CMEM_IOCTL_FLUSH_CACHE_RANGES
+ * @details Cache maintenance doesn't change the allocations, so cmem_allocation_regions_lock is only held while checking
+ *          the ranges are owned and not during the maintenance. A process which frees a buffer during cache
+ *          maintenance of the buffer has the same undefined result as freeing a buffer which a device is accessing.
+ * @param[in] cmd The ioctl, which determines if the cache lines are invalidated
+ * @param[in] arg The user space pointer to the cmem_ioctl_cache_ranges_t
+ * @return Zero on success, or a negative errno value on failure
+ */
+static long cmem_cache_ioctl (const unsigned int cmd, const unsigned long arg)
+{
+#ifdef CONFIG_X86
+    cmem_ioctl_cache_ranges_t *cache_ranges;
+    uint32_t range_index;
+    long ret = 0;
+
+    /* cmem_ioctl_cache_ranges_t is more than 1K in size, so allocate on the heap */
+    cache_ranges = kmalloc (sizeof (*cache_ranges), GFP_KERNEL);
+    if (cache_ranges == NULL)
+    {
+        return -ENOMEM;
+    }
+
+    if (copy_from_user (cache_ranges, (cmem_ioctl_cache_ranges_t *) arg, sizeof (*cache_ranges)))
+    {
+        ret = -EFAULT;
+    }
+    else if (cache_ranges->num_ranges > CMEM_MAX_CACHE_RANGES)
+    {
+        ret = -EINVAL;
+    }
+
+    /* Check all ranges first, so that an invalid range doesn't leave the maintenance partially performed */
+    for (range_index = 0; (ret == 0) && (range_index < cache_ranges->num_ranges); range_index++)
+    {
+        const cmem_cache_range_t *const range = &cache_ranges->ranges[range_index];
+
+        if ((range->length == 0) || ((range->dma_address + range->length - 1) < range->dma_address) ||
+            (cmem_owned_length (range->dma_address, cmem_current_owner ()) < range->length))
+        {
+            ret = -EINVAL;
+        }
+    }
+
+    for (range_index = 0; (ret == 0) && (range_index < cache_ranges->num_ranges); range_index++)
+    {
+        ret = cmem_cache_maintain_range (cmd == CMEM_IOCTL_FLUSH_CACHE_RANGES,
+                cache_ranges->ranges[range_index].dma_address, cache_ranges->ranges[range_index].length);
+    }
+
+    kfree (cache_ranges);
+
+    return ret;
+#else
+    return -EOPNOTSUPP;
+#endif
+}
+
+
+/* The remaining delay below which the loopback engine spins rather than sleeps, since sleeps overshoot */
+#define CMEM_LOOPBACK_SPIN_NS (20 * NSEC_PER_USEC)
+
+
+/**
+ * @brief Get one of the uint32_t indices in the control block of a ring mapped by the loopback engine
+ * @param[in] ring The kernel mapping of the ring
+ * @param[in] offset The CMEM_RING_*_OFFSET of the index
+ * @return Pointer to the index
+ */
+static inline uint32_t *cmem_loopback_ring_index (void *const ring, const size_t offset)
+{
+    return (uint32_t *) ((uint8_t *) ring + offset);
+}
+
+
+/**
+ * @brief Map a ring for the loopback engine, after checking that it is in a buffer owned by the process starting
+ *        the engine
+ * @param[in] dma_address The physical address of the control block of the ring
+ * @param[in] num_slots The number of slots in the ring, which must be a power of two
+ * @param[in] slot_size The size of each slot in bytes
+ * @param[in] owner The process starting the engine
+ * @param[out] ring_length The length of the mapping
+ * @param[out] ring_busy Claimed for the ring on success, so the buffer containing the ring can't be freed while mapped
+ * @return The kernel mapping of the ring, or NULL if the ring is invalid or couldn't be mapped
+ */
+static void *cmem_loopback_map_ring (const uint64_t dma_address, const uint32_t num_slots, const size_t slot_size,
+                                     const pid_t owner, size_t *const ring_length, cmem_busy_range_t *const ring_busy)
+{
+    void *ring;
+
+    if ((num_slots == 0) || !is_power_of_2 (num_slots) ||
+        (num_slots > ((CMEM_RW_MAX_MAP_LENGTH - CMEM_RING_CONTROL_LENGTH) / slot_size)))
+    {
+        return NULL;
+    }
+
+    *ring_length = CMEM_RING_CONTROL_LENGTH + (num_slots * slot_size);
+    if (!cmem_claim_owned_range (dma_address, *ring_length, owner, ring_busy))
+    {
+        return NULL;
+    }
+
+    ring = memremap (dma_address, *ring_length, MEMREMAP_WB);
+    if (ring == NULL)
+    {
+        cmem_release_busy_range (ring_busy);
+    }
+
+    return ring;
+}
+
+
+/**
+ * @brief Remove the kernel mapping kept by a loopback engine for a buffer, if it hasn't already been removed
+ * @details Only called by the engine when the window isn't being accessed
+ * @param[in/out] window The window to unmap
+ */
+static void cmem_loopback_unmap_window (cmem_loopback_window_t *const window)
+{
+    void *kernel_addr;
+
+    mutex_lock (&cmem_allocation_regions_lock);
+    kernel_addr = window->kernel_addr;
+    window->kernel_addr = NULL;
+    if (!list_empty (&window->list))
+    {
+        list_del_init (&window->list);
+    }
+    mutex_unlock (&cmem_allocation_regions_lock);
+
+    if (kernel_addr != NULL)
+    {
+        memunmap (kernel_addr);
+    }
+}
+
+
+/**
+ * @brief Get a kernel mapping of part of a buffer for a loopback engine, and prevent it from being unmapped
+ * @details Reuses the mapping of the window if it contains the range. Otherwise replaces it with a mapping from the
+ *          start of the range up to the next multiple of CMEM_RW_MAX_MAP_LENGTH or the end of the allocation, so that
+ *          subsequent descriptors which access the rest of that part of the buffer can reuse it.
+ *          The window is claimed until cmem_release_busy_range() is called for window->busy, so the allocation can't be
+ *          freed or shrunk while accessed. The caller has already claimed the range, which must be owned by owner.
+ * @param[in/out] window The window of the engine for the buffer
+ * @param[in] start The physical address of the start of the range
+ * @param[in] length The length of the range, which doesn't cross a multiple of CMEM_RW_MAX_MAP_LENGTH
+ * @param[in] owner The process which started the engine
+ * @return The kernel mapping of start, or NULL if the range couldn't be mapped
+ */
+static void *cmem_loopback_map_window (cmem_loopback_window_t *const window, const uint64_t start,
+                                       const uint64_t length, const pid_t owner)
+{
+    void *old_kernel_addr = NULL;
+    void *kernel_addr;
+    uint64_t window_length;
+
+    mutex_lock (&cmem_allocation_regions_lock);
+    if ((window->kernel_addr != NULL) && (start >= window->busy.start) && ((start + length - 1) <= window->busy.end))
+    {
+        list_add (&window->busy.list, &cmem_busy_ranges);
+        mutex_unlock (&cmem_allocation_regions_lock);
+        return (uint8_t *) window->kernel_addr + (start - window->busy.start);
+    }
+
+    /* Claim the new range before mapping it, and remove the previous mapping once the lock is released */
+    if (window->kernel_addr != NULL)
+    {
+        old_kernel_addr = window->kernel_addr;
+        window->kernel_addr = NULL;
+        list_del_init (&window->list);
+    }
+    window_length = min_t (uint64_t, cmem_owned_length_locked (start, owner),
+            CMEM_RW_MAX_MAP_LENGTH - (start & (CMEM_RW_MAX_MAP_LENGTH - 1)));
+    window->busy.start = start;
+    window->busy.end = start + window_length - 1;
+    list_add (&window->busy.list, &cmem_busy_ranges);
+    mutex_unlock (&cmem_allocation_regions_lock);
+
+    if (old_kernel_addr != NULL)
+    {
+        memunmap (old_kernel_addr);
+    }
+    kernel_addr = memremap (window->busy.start, (window->busy.end + 1) - window->busy.start, MEMREMAP_WB);
+    if (kernel_addr == NULL)
+    {
+        cmem_release_busy_range (&window->busy);
+        return NULL;
+    }
+
+    mutex_lock (&cmem_allocation_regions_lock);
+    window->kernel_addr = kernel_addr;
+    list_add (&window->list, &cmem_loopback_windows);
+    mutex_unlock (&cmem_allocation_regions_lock);
+
+    return kernel_addr;
+}
+
+
+/**
+ * @brief Free the state of a loopback engine, once its thread has stopped or was never started
+ * @param[in] loopback The engine to free
+ */
+static void cmem_loopback_free (cmem_loopback_t *const loopback)
+{
+    if (loopback->descriptor_ring != NULL)
+    {
+        memunmap (loopback->descriptor_ring);
+    }
+    if (loopback->completion_ring != NULL)
+    {
+        memunmap (loopback->completion_ring);
+    }
+    cmem_release_busy_range (&loopback->descriptor_ring_busy);
+    cmem_release_busy_range (&loopback->completion_ring_busy);
+    cmem_loopback_unmap_window (&loopback->dest_window);
+    cmem_loopback_unmap_window (&loopback->src_window);
+    kfree (loopback);
+}
+
+
+/**
+ * @brief Consume the next descriptor from the descriptor ring of a loopback engine
+ * @details The engine is the only consumer of the ring, so can read head without synchronisation.
+ * @param[in/out] loopback The engine
+ * @param[out] descriptor The descriptor consumed
+ * @return Returns true if a descriptor was consumed, or false if the ring is empty
+ */
+static bool cmem_loopback_consume (cmem_loopback_t *const loopback, cmem_loopback_descriptor_t *const descriptor)
+{
+    uint32_t *const tail = cmem_loopback_ring_index (loopback->descriptor_ring, CMEM_RING_TAIL_OFFSET);
+    uint32_t *const head = cmem_loopback_ring_index (loopback->descriptor_ring, CMEM_RING_HEAD_OFFSET);
+    const cmem_loopback_descriptor_t *const slots =
+            (const cmem_loopback_descriptor_t *) ((uint8_t *) loopback->descriptor_ring + CMEM_RING_CONTROL_LENGTH);
+    const uint32_t head_value = READ_ONCE (*head);
+
+    /* Acquire tail before reading the slot, pairing with the release of tail by the producer in cmem_ring_publish() */
+    if (smp_load_acquire (tail) == head_value)
+    {
+        return false;
+    }
+    memcpy (descriptor, &slots[head_value & (loopback->params.num_descriptor_slots - 1)], sizeof (*descriptor));
+
+    /* Release head after reading the slot, so the producer can't overwrite the slot while it is being read */
+    smp_store_release (head, head_value + 1);
+
+    return true;
+}
+
+
+/**
+ * @brief Write a completion to the completion ring of a loopback engine, waiting for the consumer if the ring is full
+ * @details The engine is the only producer of the ring. tail_reserve is advanced along with tail, so the ring remains
+ *          consistent if it was created for multiple producers.
+ * @param[in/out] loopback The engine
+ * @param[in] completion The completion to write
+ * @return Returns true if the completion was written, or false if the engine was stopped while the ring was full
+ */
+static bool cmem_loopback_complete (cmem_loopback_t *const loopback, const cmem_loopback_completion_t *const completion)
+{
+    uint32_t *const tail_reserve = cmem_loopback_ring_index (loopback->completion_ring, CMEM_RING_TAIL_RESERVE_OFFSET);
+    uint32_t *const tail = cmem_loopback_ring_index (loopback->completion_ring, CMEM_RING_TAIL_OFFSET);
+    uint32_t *const head = cmem_loopback_ring_index (loopback->completion_ring, CMEM_RING_HEAD_OFFSET);
+    cmem_loopback_completion_t *const slots =
+            (cmem_loopback_completion_t *) ((uint8_t *) loopback->completion_ring + CMEM_RING_CONTROL_LENGTH);
+    const uint32_t tail_value = READ_ONCE (*tail);
+
+    /* Acquire head before overwriting a slot, pairing with the release of head by the consumer in cmem_ring_release() */
+    while ((tail_value - smp_load_acquire (head)) >= loopback->params.num_completion_slots)
+    {
+        if (kthread_should_stop ())
+        {
+            return false;
+        }
+        usleep_range (10, 100);
+    }
+    memcpy (&slots[tail_value & (loopback->params.num_completion_slots - 1)], completion, sizeof (*completion));
+    WRITE_ONCE (*tail_reserve, tail_value + 1);
+    smp_store_release (tail, tail_value + 1);
+    wake_up_interruptible (loopback->completion_wait);
+
+    return true;
+}
+
+
+/**
+ * @brief Determine if the completion ring of a loopback engine contains completions not yet consumed
+ */
+static bool cmem_loopback_completions_pending (cmem_loopback_t *const loopback)
+{
+    return READ_ONCE (*cmem_loopback_ring_index (loopback->completion_ring, CMEM_RING_TAIL_OFFSET)) !=
+            READ_ONCE (*cmem_loopback_ring_index (loopback->completion_ring, CMEM_RING_HEAD_OFFSET));
+}
+
+
+/**
+ * @brief Perform the copy or fill of one descriptor for a loopback engine
+ * @details The buffers are accessed through kernel mappings of at most CMEM_RW_MAX_MAP_LENGTH, in the same way as
+ *          cmem_rw_iter(), which are kept by the engine so that subsequent descriptors for the same part of the buffers
+ *          don't have to map them again. memmove() is used since the source and destination may overlap within one
+ *          buffer.
+ *          The buffers are claimed for the duration of the copy or fill, so they can't be freed while accessed.
+ * @param[in/out] loopback The engine
+ * @param[in] descriptor The descriptor to perform
+ * @return Zero on success, or a negative errno value if the descriptor is invalid or a mapping failed
+ */
+static int32_t cmem_loopback_perform (cmem_loopback_t *const loopback,
+                                      const cmem_loopback_descriptor_t *const descriptor)
+{
+    const bool copy = descriptor->opcode == CMEM_LOOPBACK_OP_COPY;
+    int32_t ret = 0;
+    uint64_t offset = 0;
+
+    if (((descriptor->opcode != CMEM_LOOPBACK_OP_COPY) && (descriptor->opcode != CMEM_LOOPBACK_OP_FILL)) ||
+        (descriptor->length == 0) || (descriptor->length > CMEM_LOOPBACK_MAX_LENGTH))
+    {
+        return -EINVAL;
+    }
+    if (!cmem_claim_owned_range (descriptor->dest_dma_address, descriptor->length, loopback->owner,
+            &loopback->dest_busy))
+    {
+        return -EINVAL;
+    }
+    if (copy && !cmem_claim_owned_range (descriptor->src_dma_address, descriptor->length, loopback->owner,
+            &loopback->src_busy))
+    {
+        cmem_release_busy_range (&loopback->dest_busy);
+        return -EINVAL;
+    }
+
+    while ((ret == 0) && (offset < descriptor->length))
+    {
+        /* Each kernel mapping after the first starts on a multiple of the maximum length */
+        const uint64_t dest_start = descriptor->dest_dma_address + offset;
+        const uint64_t src_start = descriptor->src_dma_address + offset;
+        size_t map_length = min_t (uint64_t, descriptor->length - offset,
+                CMEM_RW_MAX_MAP_LENGTH - (dest_start & (CMEM_RW_MAX_MAP_LENGTH - 1)));
+        void *src_addr = NULL;
+        void *dest_addr;
+
+        if (copy)
+        {
+            map_length = min_t (uint64_t, map_length, CMEM_RW_MAX_MAP_LENGTH - (src_start & (CMEM_RW_MAX_MAP_LENGTH - 1)));
+            src_addr = cmem_loopback_map_window (&loopback->src_window, src_start, map_length, loopback->owner);
+            if (src_addr == NULL)
+            {
+                ret = -ENOMEM;
+                break;
             }
-            else
+        }
+        dest_addr = cmem_loopback_map_window (&loopback->dest_window, dest_start, map_length, loopback->owner);
+        if (dest_addr == NULL)
+        {
+            cmem_release_busy_range (&loopback->src_window.busy);
+            ret = -ENOMEM;
+            break;
+        }
+
+        if (copy)
+        {
+            memmove (dest_addr, src_addr, map_length);
+        }
+        else
+        {
+            memset (dest_addr, (int) (descriptor->fill_value & 0xff), map_length);
+        }
+        cmem_release_busy_range (&loopback->dest_window.busy);
+        cmem_release_busy_range (&loopback->src_window.busy);
+
+        offset += map_length;
+        cond_resched ();
+    }
+
+    cmem_release_busy_range (&loopback->dest_busy);
+    cmem_release_busy_range (&loopback->src_busy);
+
+    return ret;
+}
+
+
+/**
+ * @brief Delay a loopback engine until the time at which a descriptor completes, to model the rate and latency of
+ *        a device
+ * @details Sleeps for most of a long delay and spins for the remainder, so short delays are accurate.
+ * @param[in] target_ns The monotonic time at which the descriptor completes
+ */
+static void cmem_loopback_throttle (const uint64_t target_ns)
+{
+    uint64_t now_ns;
+
+    while (((now_ns = ktime_get_ns ()) < target_ns) && !kthread_should_stop ())
+    {
+        const uint64_t remaining_ns = target_ns - now_ns;
+
+        if (remaining_ns > CMEM_LOOPBACK_SPIN_NS)
+        {
+            const unsigned long sleep_us = (unsigned long) div_u64 (remaining_ns - CMEM_LOOPBACK_SPIN_NS, NSEC_PER_USEC);
+
+            usleep_range (sleep_us, sleep_us + 10);
+        }
+        else
+        {
+            cpu_relax ();
+        }
+    }
+}
+
+
+/**
+ * @brief The kernel thread of a loopback engine, which performs descriptors until stopped
+ * @details When the descriptor ring is empty sleeps until woken by the doorbell, or for one millisecond in case
+ *          the producer didn't ring the doorbell.
+ *          Only returns once kthread_stop() has been called, so the task remains valid for kthread_stop().
+ * @param[in/out] data The cmem_loopback_t of the engine
+ * @return Always zero
+ */
+static int cmem_loopback_thread (void *const data)
+{
+    cmem_loopback_t *const loopback = data;
+    cmem_loopback_descriptor_t descriptor;
+    cmem_loopback_completion_t completion;
+    uint64_t start_ns;
+    uint64_t target_ns;
+
+    memset (&completion, 0, sizeof (completion));
+    while (!kthread_should_stop ())
+    {
+        /* Set the state before checking the ring, so that a doorbell between the check and the sleep isn't lost */
+        set_current_state (TASK_INTERRUPTIBLE);
+        if (!cmem_loopback_consume (loopback, &descriptor))
+        {
+            if (!kthread_should_stop ())
+            {
+                schedule_timeout (msecs_to_jiffies (1));
+            }
+            __set_current_state (TASK_RUNNING);
+            continue;
+        }
+        __set_current_state (TASK_RUNNING);
+
+        start_ns = ktime_get_ns ();
+        completion.user_data = descriptor.user_data;
+        completion.status = cmem_loopback_perform (loopback, &descriptor);
+        target_ns = start_ns + loopback->params.descriptor_latency_ns;
+        if (completion.status == 0)
+        {
+            loopback->stats.num_bytes += descriptor.length;
+            if (loopback->params.bytes_per_second > 0)
+            {
+                /* Can't overflow since the length is limited to CMEM_LOOPBACK_MAX_LENGTH */
+                target_ns += div64_u64 (descriptor.length * NSEC_PER_SEC, loopback->params.bytes_per_second);
+            }
+        }
+        else
+        {
+            loopback->stats.num_errors++;
+        }
+        cmem_loopback_throttle (target_ns);
+
+        if (cmem_loopback_complete (loopback, &completion))
+        {
+            loopback->stats.num_descriptors++;
+        }
+
+        /* A full descriptor ring of unthrottled small descriptors never sleeps, so yield between descriptors */
+        cond_resched ();
+    }
+
+    return 0;
+}
+
+
+/**
+ * @brief Start the loopback engine of a file
+ * @details Called with cmem_loopback_lock held
+ * @param[in/out] file The file to start the engine for, which doesn't have a started engine
+ * @param[in] arg The user space pointer to the cmem_ioctl_loopback_t
+ * @return Zero on success, or a negative errno value on failure
+ */
+static long cmem_loopback_start (cmem_file_t *const file, const unsigned long arg)
+{
+    cmem_loopback_t *loopback;
+    long ret = 0;
+
+    loopback = kzalloc (sizeof (*loopback), GFP_KERNEL);
+    if (loopback == NULL)
+    {
+        return -ENOMEM;
+    }
+    /* Initialised as not claimed, so cmem_loopback_free() can release them all */
+    INIT_LIST_HEAD (&loopback->descriptor_ring_busy.list);
+    INIT_LIST_HEAD (&loopback->completion_ring_busy.list);
+    INIT_LIST_HEAD (&loopback->dest_busy.list);
+    INIT_LIST_HEAD (&loopback->src_busy.list);
+    INIT_LIST_HEAD (&loopback->dest_window.busy.list);
+    INIT_LIST_HEAD (&loopback->dest_window.list);
+    INIT_LIST_HEAD (&loopback->src_window.busy.list);
+    INIT_LIST_HEAD (&loopback->src_window.list);
+
+    if (copy_from_user (&loopback->params, (cmem_ioctl_loopback_t *) arg, sizeof (loopback->params)))
+    {
+        ret = -EFAULT;
+    }
+    else
+    {
+        loopback->owner = cmem_current_owner ();
+        loopback->completion_wait = &file->completion_wait;
+        loopback->descriptor_ring = cmem_loopback_map_ring (loopback->params.descriptor_ring_dma_address,
+                loopback->params.num_descriptor_slots, sizeof (cmem_loopback_descriptor_t), loopback->owner,
+                &loopback->descriptor_ring_length, &loopback->descriptor_ring_busy);
+        loopback->completion_ring = cmem_loopback_map_ring (loopback->params.completion_ring_dma_address,
+                loopback->params.num_completion_slots, sizeof (cmem_loopback_completion_t), loopback->owner,
+                &loopback->completion_ring_length, &loopback->completion_ring_busy);
+        if ((loopback->descriptor_ring == NULL) || (loopback->completion_ring == NULL))
+        {
+            ret = -EINVAL;
+        }
+    }
+
+    if (ret == 0)
+    {
+        loopback->thread = kthread_create (cmem_loopback_thread, loopback, "cmem_loopback/%d", loopback->owner);
+        if (IS_ERR (loopback->thread))
+        {
+            ret = PTR_ERR (loopback->thread);
+        }
+    }
+
+    if (ret == 0)
+    {
+        file->loopback = loopback;
+        wake_up_process (loopback->thread);
+        dev_info(cmem_dev, "Started loopback engine for pid %d\n", loopback->owner);
+    }
+    else
+    {
+        cmem_loopback_free (loopback);
+    }
+
+    return ret;
+}
+
+
+/**
+ * @brief Stop the loopback engine of a file, waiting for its thread to exit
+ * @details Called with cmem_loopback_lock held
+ * @param[in/out] file The file with a started engine
+ * @param[out] stats The statistics of the engine
+ */
+static void cmem_loopback_stop (cmem_file_t *const file, cmem_ioctl_loopback_stats_t *const stats)
+{
+    cmem_loopback_t *const loopback = file->loopback;
+
+    kthread_stop (loopback->thread);
+    *stats = loopback->stats;
+    file->loopback = NULL;
+    cmem_loopback_free (loopback);
+}
+
+
+/**
+ * @brief Perform one of the ioctls which control the loopback engine of a file
+ * @param[in] filp The file whose engine is controlled
+ * @param[in] cmd The CMEM_IOCTL_LOOPBACK_* ioctl
+ * @param[in] arg The user space pointer to the parameters of the ioctl
+ * @return Zero on success, or a negative errno value on failure
+ */
+static long cmem_loopback_ioctl (struct file *const filp, const unsigned int cmd, const unsigned long arg)
+{
+    cmem_file_t *const file = filp->private_data;
+    cmem_ioctl_loopback_stats_t stats;
+    long ret = 0;
+
+    mutex_lock (&cmem_loopback_lock);
+    switch (cmd)
+    {
+    case CMEM_IOCTL_LOOPBACK_START:
+        ret = (file->loopback != NULL) ? -EBUSY : cmem_loopback_start (file, arg);
+        break;
+
+    case CMEM_IOCTL_LOOPBACK_DOORBELL:
+        if (file->loopback == NULL)
+        {
+            ret = -EINVAL;
+        }
+        else
+        {
+            wake_up_process (file->loopback->thread);
+        }
+        break;
+
+    case CMEM_IOCTL_LOOPBACK_STOP:
+        if (file->loopback == NULL)
+        {
+            ret = -EINVAL;
+        }
+        else
+        {
+            cmem_loopback_stop (file, &stats);
+            if (copy_to_user ((cmem_ioctl_loopback_stats_t *) arg, &stats, sizeof (stats)))
+            {
+                ret = -EFAULT;
+            }
+        }
+        break;
+    }
+    mutex_unlock (&cmem_loopback_lock);
+
+    return ret;
+}
+
+
+/**
+* cmem_ioctl() - Application interface for cmem module to allocate or free contiguous memory regions
+*/
+static long cmem_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
+{
+    long ret;
+    cmem_ioctl_params_t *params;
+    cmem_ioctl_prealloc_t prealloc;
+
+    if ((cmd == CMEM_IOCTL_CLEAN_CACHE_RANGES) || (cmd == CMEM_IOCTL_FLUSH_CACHE_RANGES))
+    {
+        return cmem_cache_ioctl (cmd, arg);
+    }
+    if ((cmd == CMEM_IOCTL_LOOPBACK_START) || (cmd == CMEM_IOCTL_LOOPBACK_DOORBELL) || (cmd == CMEM_IOCTL_LOOPBACK_STOP))
+    {
+        return cmem_loopback_ioctl (filp, cmd, arg);
+    }
+
+    /* The parameters are more than 1K in size, so allocate a local copy on the heap to avoid -Wframe-larger-than=
+     * warnings on some Kernels. */
+    params = kmalloc (sizeof (*params), GFP_KERNEL);
+    if (params == NULL)
+    {
+        return -ENOMEM;
+    }
+
+    ret = cmem_ioctl_copy_in (cmd, arg, params);
+    if (ret == 0)
+    {
+        ret = cmem_ioctl_prealloc (cmd, GFP_KERNEL, &prealloc);
+    }
+    if (ret == 0)
+    {
+        if (cmem_lock_regions () != 0)
+        {
+            cmem_ioctl_prealloc_free (&prealloc);
+            kfree (params);
+            return -ENOMEM;
+        }
+        ret = cmem_ioctl_locked (cmd, params, &prealloc);
+        mutex_unlock (&cmem_allocation_regions_lock);
+        cmem_ioctl_prealloc_free (&prealloc);
+        ret = cmem_ioctl_copy_out (cmd, arg, params, ret);
+    }
+    kfree (params);
+
+    return ret;
+}
+
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5,19,0)
+/**
+ * @brief Perform a cmem ioctl submitted as an io_uring IORING_OP_URING_CMD, so that an event loop can submit batches
+ *        of allocations and frees without blocking.
+ * @details The cmd_op of the SQE is one of the CMEM_IOCTL_* values, and the command area of the SQE contains a
+ *          cmem_uring_cmd_t with the user space pointer to the parameters, which are updated with the results
+ *          in the same way as the ioctl. The CQE result is zero on success, or a negative errno value.
+ *
+ *          When issued non-blocking and cmem_allocation_regions_lock is contended returns -EAGAIN, which causes
+ *          io_uring to re-issue the command from an io-wq worker thread which is allowed to block.
+ *          The command is otherwise completed inline, since once the lock is held the operations don't sleep
+ *          for long. The parameters are copied in before the lock is taken, and copied out after it is released.
+ *          When issued non-blocking the memory for the parameters and tracking structures is allocated with
+ *          GFP_NOWAIT, returning -EAGAIN if it isn't immediately available.
+ * @param[in] ioucmd The io_uring command
+ * @param[in] issue_flags IO_URING_F_* flags for how the command is being issued
+ * @return Zero on success, or a negative errno value on failure
+ */
+static int cmem_uring_cmd (struct io_uring_cmd *const ioucmd, const unsigned int issue_flags)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6,6,0)
+    const cmem_uring_cmd_t *const uring_cmd = io_uring_sqe_cmd (ioucmd->sqe);
+#else
+    const cmem_uring_cmd_t *const uring_cmd = ioucmd->cmd;
+#endif
+    const unsigned long arg = (unsigned long) READ_ONCE (uring_cmd->arg);
+    const bool nonblock = (issue_flags & IO_URING_F_NONBLOCK) != 0;
+    const gfp_t gfp = nonblock ? GFP_NOWAIT : GFP_KERNEL;
+    cmem_ioctl_params_t *params;
+    cmem_ioctl_prealloc_t prealloc;
+    long ret;
+
+    if ((ioucmd->cmd_op == CMEM_IOCTL_CLEAN_CACHE_RANGES) || (ioucmd->cmd_op == CMEM_IOCTL_FLUSH_CACHE_RANGES))
+    {
+        /* Cache maintenance of large ranges takes a significant time, so is performed from an io-wq worker thread */
+        return (issue_flags & IO_URING_F_NONBLOCK) ? -EAGAIN : cmem_cache_ioctl (ioucmd->cmd_op, arg);
+    }
+    if ((ioucmd->cmd_op == CMEM_IOCTL_LOOPBACK_START) || (ioucmd->cmd_op == CMEM_IOCTL_LOOPBACK_DOORBELL) ||
+        (ioucmd->cmd_op == CMEM_IOCTL_LOOPBACK_STOP))
+    {
+        /* The loopback engine is controlled through ioctls on the file */
+        return -EOPNOTSUPP;
+    }
+
+    params = kmalloc (sizeof (*params), gfp);
+    if (params == NULL)
+    {
+        return nonblock ? -EAGAIN : -ENOMEM;
+    }
+
+    /* As for cmem_ioctl() the user copies are performed without cmem_allocation_regions_lock held */
+    ret = cmem_ioctl_copy_in (ioucmd->cmd_op, arg, params);
+    if (ret != 0)
+    {
+        kfree (params);
+        return ret;
+    }
+    if (cmem_ioctl_prealloc (ioucmd->cmd_op, gfp, &prealloc) != 0)
+    {
+        kfree (params);
+        return nonblock ? -EAGAIN : -ENOMEM;
+    }
+
+    if (nonblock)
+    {
+        if (!mutex_trylock (&cmem_allocation_regions_lock))
+        {
+            ret = -EAGAIN;
+        }
+        else if (cmem_regions_headroom (&cmem_allocation_regions) < CMEM_REGIONS_LOCKED_HEADROOM)
+        {
+            /* Growing the regions[] array may block, so is left to the io-wq worker thread */
+            mutex_unlock (&cmem_allocation_regions_lock);
+            ret = -EAGAIN;
+        }
+    }
+    else if (cmem_lock_regions () != 0)
+    {
+        ret = -ENOMEM;
+    }
+    if (ret != 0)
+    {
+        cmem_ioctl_prealloc_free (&prealloc);
+        kfree (params);
+        return ret;
+    }
+
+    ret = cmem_ioctl_locked (ioucmd->cmd_op, params, &prealloc);
+    mutex_unlock (&cmem_allocation_regions_lock);
+    cmem_ioctl_prealloc_free (&prealloc);
+    ret = cmem_ioctl_copy_out (ioucmd->cmd_op, arg, params, ret);
+    kfree (params);
+
+    return ret;
+}
+#endif
+
+
+/**
+ * @brief When a process opens the cmem driver, count the open file against the process
+ * @details The count is referenced from the private data of the file, so that cmem_release() decrements the count
+ *          of the process which opened the file.
+ */
+static int cmem_open (struct inode *const inodep, struct file *const filp)
+{
+    const pid_t owner = cmem_current_owner ();
+    cmem_open_process_t *open_process;
+    cmem_open_process_t *new_open_process;
+    cmem_file_t *file;
+
+    /* Allocate before taking the lock, in case the process doesn't have a count yet */
+    file = kzalloc (sizeof (*file), GFP_KERNEL);
+    new_open_process = kzalloc (sizeof (*new_open_process), GFP_KERNEL);
+    if ((file == NULL) || (new_open_process == NULL))
+    {
+        kfree (file);
+        kfree (new_open_process);
+        return -ENOMEM;
+    }
+    init_waitqueue_head (&file->completion_wait);
+
+    mutex_lock (&cmem_allocation_regions_lock);
+    list_for_each_entry (open_process, &cmem_open_processes, list)
+    {
+        if (open_process->owner == owner)
+        {
+            open_process->num_open_files++;
+            file->open_process = open_process;
+            break;
+        }
+    }
+    if (file->open_process == NULL)
+    {
+        new_open_process->owner = owner;
+        new_open_process->num_open_files = 1;
+        list_add (&new_open_process->list, &cmem_open_processes);
+        file->open_process = new_open_process;
+        new_open_process = NULL;
+    }
+    mutex_unlock (&cmem_allocation_regions_lock);
+    kfree (new_open_process);
+    filp->private_data = file;
+
+    return 0;
+}
+
+
+/**
+ * @brief When a process closes the cmem driver, free any outstanding allocations for the process once all files
+ *        opened by the process have been released
+ * @details A file is only released once it has been closed and all mappings made through it removed.
+ *          The loopback engine of the file is stopped first, since it may be accessing the allocations.
+ */
+int cmem_release (struct inode *const inodep, struct file *const filp)
+{
+    cmem_file_t *const file = filp->private_data;
+    cmem_open_process_t *const open_process = file->open_process;
+    const pid_t owner = open_process->owner;
+    cmem_ioctl_loopback_stats_t stats;
+    uint32_t num_freed = 0;
+    uint32_t num_busy;
+
+    mutex_lock (&cmem_loopback_lock);
+    if (file->loopback != NULL)
+    {
+        cmem_loopback_stop (file, &stats);
+    }
+    mutex_unlock (&cmem_loopback_lock);
+    kfree (file);
+
+    mutex_lock (&cmem_allocation_regions_lock);
+    open_process->num_open_files--;
+    if (open_process->num_open_files == 0)
+    {
+        list_del (&open_process->list);
+        kfree (open_process);
+        /* The loopback engines of the process have been stopped, so num_busy is zero */
+        num_freed = cmem_free_owned_in_range (&cmem_allocation_regions, 0, U64_MAX, owner, &num_busy);
+        cmem_coalesce_regions (&cmem_allocation_regions);
+        cmem_trace_event (CMEM_TRACE_EVENT_RELEASE, 0, 0, 0, 1, owner, 0);
+        cmem_update_status_page ();
+    }
+    mutex_unlock (&cmem_allocation_regions_lock);
+
+    if (num_freed > 0)
+    {
+        dev_info(cmem_dev, "Freed %u allocations for pid %d\n", num_freed, owner);
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Determine if all of the memory of a user mapping is in page backed pools
+ * @param[in] sg_allocation When non-NULL the scatter-gather allocation whose chunks are mapped
+ * @param[in] addr The physical address of the mapping when sg_allocation is NULL
+ * @param[in] sz The length of the mapping
+ * @return Returns true if the pages of the mapping can be inserted by cmem_insert_pages()
+ */
+static bool cmem_mapping_page_backed (const cmem_sg_allocation_t *const sg_allocation, const uint64_t addr,
+                                      const unsigned long sz)
+{
+    unsigned long checked_length = 0;
+    uint32_t chunk_index;
+
+    if (sg_allocation == NULL)
+    {
+        return cmem_phys_page_backed (addr, sz);
+    }
+
+    for (chunk_index = 0; (checked_length < sz) && (chunk_index < sg_allocation->num_chunks); chunk_index++)
+    {
+        const cmem_host_buf_entry_t *const chunk = &sg_allocation->chunks[chunk_index];
+        const unsigned long chunk_map_length = min_t (unsigned long, sz - checked_length, chunk->length);
+
+        if (!cmem_phys_page_backed (chunk->dma_address, chunk_map_length))
+        {
+            return false;
+        }
+        checked_length += chunk_map_length;
+    }
+
+    return true;
+}
+
+
+/**
+ * @brief Map a physical address range into a user mapping
+ * @details For a page backed pool the pages are inserted with vm_insert_pages(), which takes a reference on each page
+ *          and leaves the mapping pinnable by get_user_pages(). The pages are inserted in batches of the number of
+ *          page pointers which fit in one page. Otherwise remap_pfn_range() is used, which makes the mapping
+ *          VM_PFNMAP. One mapping can't mix the two, since vm_insert_pages() can't be used on a VM_PFNMAP mapping.
+ * @param[in/out] vma The user mapping
+ * @param[in] offset The offset into the user mapping to map the range at
+ * @param[in] phys_addr The physical address of the range, which is page aligned
+ * @param[in] length The length of the range
+ * @param[in] page_backed When true inserts the pages of a page backed pool, otherwise uses remap_pfn_range()
+ * @return Zero on success, or a negative errno value on failure
+ */
+static int cmem_map_range (struct vm_area_struct *const vma, const unsigned long offset,
+                           const uint64_t phys_addr, const unsigned long length, const bool page_backed)
+{
+#ifdef CMEM_PAGE_BACKED_SUPPORTED
+    const unsigned long batch_size = PAGE_SIZE / sizeof (struct page *);
+    const unsigned long num_pages = PAGE_ALIGN (length) >> PAGE_SHIFT;
+    unsigned long page_index = 0;
+    unsigned long batch_pages;
+    unsigned long batch_index;
+    struct page **pages;
+    int ret = 0;
+
+    if (page_backed)
+    {
+        pages = kmalloc (PAGE_SIZE, GFP_KERNEL);
+        if (pages == NULL)
+        {
+            return -ENOMEM;
+        }
+
+        while ((ret == 0) && (page_index < num_pages))
+        {
+            batch_pages = min (num_pages - page_index, batch_size);
+            for (batch_index = 0; batch_index < batch_pages; batch_index++)
             {
-                for (buffer_index = 0; (ret == 0) && (buffer_index < cmem_ioctl_arg->host_buf_info.num_buffers); buffer_index++)
-                {
-                    const cmem_host_buf_entry_t *const buffer = &cmem_ioctl_arg->host_buf_info.buf_info[buffer_index];
-                    const cmem_allocation_region_t region_to_free =
-                    {
-                        .start = buffer->dma_address,
-                        .end = buffer->dma_address + buffer->length - 1,
-                        .allocated = false,
-                        .allocation_pid = -1
-                    };
-                    bool region_found = false;
+                pages[batch_index] = pfn_to_page (PHYS_PFN (phys_addr) + page_index + batch_index);
+            }
+            ret = vm_insert_pages (vma, vma->vm_start + offset + (page_index << PAGE_SHIFT), pages, &batch_pages);
+            page_index += batch_size;
+        }
+        kfree (pages);
 
-                    for (region_index = 0; !region_found && (region_index < cmem_allocation_regions.num_regions); region_index++)
-                    {
-                        const cmem_allocation_region_t *const existing_region = &cmem_allocation_regions.regions[region_index];
+        return ret;
+    }
+#endif
 
-                        if ((region_to_free.start == existing_region->start) && (region_to_free.end == existing_region->end) &&
-                            (task_pid_nr (current) == existing_region->allocation_pid))
-                        {
-                            cmem_update_regions (&cmem_allocation_regions, &region_to_free);
-                            region_found = true;
-                        }
-                    }
+    return remap_pfn_range (vma, vma->vm_start + offset, phys_addr >> PAGE_SHIFT, length, vma->vm_page_prot);
+}
 
-                    if (!region_found)
-                    {
-                        ret = -EINVAL;
-                    }
-                }
+
+/**
+ * cmem_mmap() - Provide userspace mapping for specified kernel memory
+ *
+ * As of Kernel 4.18.0 the remap_pfn_range() function is documented with:
+ *    "Note: this is only safe if the mm semaphore is held when called."
+ *
+ * Attempted to add calls to take the mm semaphore with:
+ *     down_write(&vma->vm_mm->mmap_sem);
+ *     ret = remap_pfn_range(vma, vma->vm_start,
+ *             vma->vm_pgoff,
+ *             sz, vma->vm_page_prot);
+ *     up_write(&vma->vm_mm->mmap_sem);
+ *
+ * However, when a user space process attempted to call memmep() hung with the the following backtrace:
+ *   [<0>] rwsem_down_write_slowpath
+ *   [<0>] cmem_mmap [cmem_dev]
+ *   [<0>] mmap_region
+ *   [<0>] do_mmap
+ *   [<0>] vm_mmap_pgoff
+ *   [<0>] ksys_mmap_pgoff
+ *   [<0>] do_syscall_64
+ *   [<0>] entry_SYSCALL_64_after_hwframe
+ *
+ * On investigation in https://stackoverflow.com/a/78285167/4207678, vm_mmap_pgoff() is taking the mm semaphore
+ * around the call to do_mmap() and therefore the mm semaphore is already held when this function is called.
+ *
+ * When the offset is the first chunk of a scatter-gather allocation, the chunks are mapped back-to-back into the
+ * virtual address range.
+ *
+ * When the device was opened with O_SYNC the mapping is uncached, in the same way as /dev/mem, for comparison with
+ * write-back mappings using the cache maintenance ioctls. The idle kernel mappings of the range kept by loopback
+ * engines are removed first, since their memory type would conflict.
+ *
+ * When all of the mapping is in page backed pools the pages are inserted rather than remapped, so the mapping can be
+ * pinned by get_user_pages(). Page backed pools can't be mapped uncached, since memremap_pages() reserves the
+ * write-back memory type for them.
+ * @filp: File private data - the O_SYNC flag selects an uncached mapping
+ * @vma: User virtual memory area to map to
+ */
+static int cmem_mmap(struct file *const filp, struct vm_area_struct *const vma)
+{
+    int ret = -EINVAL;
+    unsigned long sz = vma->vm_end - vma->vm_start;
+    unsigned long long addr = (unsigned long long)vma->vm_pgoff << PAGE_SHIFT;
+    const cmem_sg_allocation_t *sg_allocation;
+    cmem_mapping_t *mapping;
+    bool mapping_in_pools = true;
+    bool page_backed;
+    uint32_t chunk_index;
+
+    if (addr == CMEM_STATUS_PAGE_OFFSET)
+    {
+        return cmem_mmap_status_page (vma);
+    }
+
+    dev_info(cmem_dev, "Mapping %#lx bytes from address %#llx for pid %d\n",
+            sz, addr, cmem_current_owner ());
+
+    vma->vm_ops = &custom_vm_ops;
+    if (filp->f_flags & O_SYNC)
+    {
+        vma->vm_page_prot = pgprot_noncached (vma->vm_page_prot);
+    }
+
+    mutex_lock (&cmem_allocation_regions_lock);
+    sg_allocation = cmem_find_sg_allocation (addr);
+    page_backed = cmem_mapping_page_backed (sg_allocation, addr, sz);
+    if (page_backed && (filp->f_flags & O_SYNC))
+    {
+        mutex_unlock (&cmem_allocation_regions_lock);
+        dev_err(cmem_dev, "Page backed pools can't be mapped uncached\n");
+        return -EINVAL;
+    }
+
+    /* Record the chunks which are mapped, for use by cmem_vma_access() */
+    mapping = kzalloc (struct_size (mapping, chunks, (sg_allocation != NULL) ? sg_allocation->num_chunks : 1), GFP_KERNEL);
+    if (mapping == NULL)
+    {
+        mutex_unlock (&cmem_allocation_regions_lock);
+        return -ENOMEM;
+    }
+    kref_init (&mapping->refcount);
+    mapping->base_pgoff = vma->vm_pgoff;
+
+    if (sg_allocation != NULL)
+    {
+        unsigned long mapped_length = 0;
+
+        ret = 0;
+        chunk_index = 0;
+        while ((ret == 0) && (mapped_length < sz) && (chunk_index < sg_allocation->num_chunks))
+        {
+            const cmem_host_buf_entry_t *const chunk = &sg_allocation->chunks[chunk_index];
+            const unsigned long chunk_map_length = min_t (unsigned long, sz - mapped_length, chunk->length);
+
+            if (filp->f_flags & O_SYNC)
+            {
+                cmem_unmap_loopback_windows (chunk->dma_address, chunk->dma_address + chunk_map_length - 1);
             }
+            ret = cmem_map_range (vma, mapped_length, chunk->dma_address, chunk_map_length, page_backed);
+            mapping->chunks[chunk_index].phys_addr = chunk->dma_address;
+            mapping->chunks[chunk_index].length = chunk_map_length;
+            mapping->num_chunks++;
+            mapped_length += chunk_map_length;
+            chunk_index++;
+        }
+
+        if ((ret == 0) && (mapped_length < sz))
+        {
+            /* Attempted to map beyond the end of the scatter-gather allocation */
+            ret = -EINVAL;
+        }
+    }
+    else
+    {
+        if (filp->f_flags & O_SYNC)
+        {
+            cmem_unmap_loopback_windows (addr, addr + sz - 1);
+        }
+        ret = cmem_map_range (vma, 0, addr, sz, page_backed);
+        mapping->chunks[0].phys_addr = addr;
+        mapping->chunks[0].length = sz;
+        mapping->num_chunks = 1;
+    }
+    mutex_unlock (&cmem_allocation_regions_lock);
+
+    /* Only attach the mapping state when all of the mapping is pool memory, so that cmem_vma_access() only creates
+     * kernel mappings of the reserved memory. Otherwise cmem_vma_access() uses generic_access_phys(). */
+    for (chunk_index = 0; chunk_index < mapping->num_chunks; chunk_index++)
+    {
+        if (!cmem_phys_in_pool (mapping->chunks[chunk_index].phys_addr, mapping->chunks[chunk_index].length))
+        {
+            mapping_in_pools = false;
+        }
+    }
+    if ((ret == 0) && mapping_in_pools)
+    {
+        vma->vm_private_data = mapping;
+    }
+    else
+    {
+        kfree (mapping);
+    }
+
+    return ret;
+}
+
+
+/**
+ * @brief Transfer data between a user I/O vector and the physical memory of an allocation, for read or write
+ * @details The file position is the physical address. A transfer stops at the end of the allocated region containing
+ *          the file position, and so may return less than requested. Only regions allocated by the calling process
+ *          or named allocations may be accessed.
+ *
+ *          The memory is accessed using temporary kernel mappings created by memremap(), rather than assuming the
+ *          reserved memory is in the Kernel direct mapping. cmem_allocation_regions_lock isn't held during the copy,
+ *          since copying to or from user memory may fault and cmem_mmap() is called with the mm semaphore held.
+ *          Instead the range is claimed for the duration of the transfer, so that freeing or shrinking the allocation
+ *          fails with -EBUSY rather than the memory being reallocated while it is accessed.
+ * @param[in/out] iocb Contains the file position, which is advanced by the number of bytes transferred
+ * @param[in/out] iter The user I/O vector
+ * @param[in] write true to write to the allocation, false to read from the allocation
+ * @return The number of bytes transferred, or a negative errno value
+ */
+static ssize_t cmem_rw_iter (struct kiocb *const iocb, struct iov_iter *const iter, const bool write)
+{
+    const uint64_t phys_addr = iocb->ki_pos;
+    const uint64_t owned_length = cmem_owned_length (phys_addr, cmem_current_owner ());
+    size_t remaining = min_t (uint64_t, iov_iter_count (iter), owned_length);
+    cmem_busy_range_t busy_range;
+    ssize_t transferred = 0;
+    ssize_t error = -EFAULT;
+
+    if (iov_iter_count (iter) == 0)
+    {
+        return 0;
+    }
+    /* Fails if the allocation has been freed since its length was found */
+    if ((owned_length == 0) || !cmem_claim_owned_range (phys_addr, remaining, cmem_current_owner (), &busy_range))
+    {
+        return -EFAULT;
+    }
+
+    while (remaining > 0)
+    {
+        /* Each kernel mapping after the first starts on a multiple of the maximum length */
+        const uint64_t map_start = phys_addr + transferred;
+        const size_t map_length = min_t (uint64_t, remaining,
+                CMEM_RW_MAX_MAP_LENGTH - (map_start & (CMEM_RW_MAX_MAP_LENGTH - 1)));
+        void *const kernel_addr = memremap (map_start, map_length, MEMREMAP_WB);
+        size_t copied;
+
+        if (kernel_addr == NULL)
+        {
+            error = -ENOMEM;
+            break;
         }
-        break;
+        copied = write ? copy_from_iter (kernel_addr, map_length, iter) : copy_to_iter (kernel_addr, map_length, iter);
+        memunmap (kernel_addr);
 
-    default:
-        ret = -EINVAL;
-        break;
+        transferred += copied;
+        remaining -= copied;
+        if (copied < map_length)
+        {
+            /* Fault on the user memory */
+            break;
+        }
+        if (fatal_signal_pending (current))
+        {
+            break;
+        }
+        cond_resched ();
     }
+    cmem_release_busy_range (&busy_range);
 
-    mutex_unlock (&cmem_allocation_regions_lock);
-    kfree (cmem_ioctl_arg);
+    if (transferred == 0)
+    {
+        return error;
+    }
+    iocb->ki_pos += transferred;
 
-    return ret;
+    return transferred;
 }
 
 
 /**
- * @brief When a process closes the cmem driver, free any outstanding allocations for the process
+ * @brief Read from an allocation, with the file position being the physical address.
+ * @details Also used to splice from the device, which allows a buffer to be streamed to a file or pipe with
+ *          sendfile() or splice() without passing through user space.
  */
-int cmem_release (struct inode *const inodep, struct file *const filp)
+static ssize_t cmem_read_iter (struct kiocb *const iocb, struct iov_iter *const to)
 {
-    uint32_t region_index;
-    bool region_removed;
-
-    mutex_lock (&cmem_allocation_regions_lock);
-    do
-    {
-        region_removed = false;
-        for (region_index = 0; !region_removed && (region_index < cmem_allocation_regions.num_regions); region_index++)
-        {
-            const cmem_allocation_region_t *const existing_region = &cmem_allocation_regions.regions[region_index];
-
-            if (existing_region->allocated && (existing_region->allocation_pid == task_pid_nr (current)))
-            {
-                const cmem_allocation_region_t region_to_free =
-                {
-                    .start = existing_region->start,
-                    .end = existing_region->end,
-                    .allocated = false,
-                    .allocation_pid = -1
-                };
-
-                dev_info(cmem_dev, "Freed %#llx bytes from address %#llx for pid %d\n",
-                        (existing_region->end + 1) - existing_region->start, existing_region->start, task_pid_nr (current));
-                cmem_update_regions (&cmem_allocation_regions, &region_to_free);
-                region_removed = true;
-            }
-        }
-    } while (region_removed);
-    mutex_unlock (&cmem_allocation_regions_lock);
-
-    return 0;
+    return cmem_rw_iter (iocb, to, false);
 }
 
+
 /**
- * cmem_mmap() - Provide userspace mapping for specified kernel memory
- *
- * As of Kernel 4.18.0 the remap_pfn_range() function is documented with:
- *    "Note: this is only safe if the mm semaphore is held when called."
- *
- * Attempted to add calls to take the mm semaphore with:
- *     down_write(&vma->vm_mm->mmap_sem);
- *     ret = remap_pfn_range(vma, vma->vm_start,
- *             vma->vm_pgoff,
- *             sz, vma->vm_page_prot);
- *     up_write(&vma->vm_mm->mmap_sem);
- *
- * However, when a user space process attempted to call memmep() hung with the the following backtrace:
- *   [<0>] rwsem_down_write_slowpath
- *   [<0>] cmem_mmap [cmem_dev]
- *   [<0>] mmap_region
- *   [<0>] do_mmap
- *   [<0>] vm_mmap_pgoff
- *   [<0>] ksys_mmap_pgoff
- *   [<0>] do_syscall_64
- *   [<0>] entry_SYSCALL_64_after_hwframe
- *
- * On investigation in https://stackoverflow.com/a/78285167/4207678, vm_mmap_pgoff() is taking the mm semaphore
- * around the call to do_mmap() and therefore the mm semaphore is already held when this function is called.
- * @filp: File private data - ignored
- * @vma: User virtual memory area to map to
+ * @brief Write to an allocation, with the file position being the physical address.
  */
-static int cmem_mmap(struct file *const filp, struct vm_area_struct *const vma)
+static ssize_t cmem_write_iter (struct kiocb *const iocb, struct iov_iter *const from)
 {
-    int ret = -EINVAL;
-    unsigned long sz = vma->vm_end - vma->vm_start;
-    unsigned long long addr = (unsigned long long)vma->vm_pgoff << PAGE_SHIFT;
-
-    dev_info(cmem_dev, "Mapping %#lx bytes from address %#llx for pid %d\n",
-            sz, addr, task_pid_nr (current));
+    return cmem_rw_iter (iocb, from, true);
+}
 
-    vma->vm_ops = &custom_vm_ops;
-    ret = remap_pfn_range(vma, vma->vm_start,
-            vma->vm_pgoff,
-            sz, vma->vm_page_prot);
 
-    return ret;
+/**
+ * @brief Seek to a physical address for a subsequent read or write.
+ * @details SEEK_END isn't supported, since the device has no size.
+ */
+static loff_t cmem_llseek (struct file *const filp, const loff_t offset, const int whence)
+{
+    return no_seek_end_llseek (filp, offset, whence);
 }
 
 
+/**
+ * @brief Poll for completions written by the loopback engine of the file
+ * @return POLLIN when the completion ring of a started engine isn't empty, otherwise zero
+ */
 static unsigned int cmem_poll(struct file *const filp, poll_table *const wait)
 {
-    return(0);
+    cmem_file_t *const file = filp->private_data;
+    unsigned int mask = 0;
+
+    poll_wait (filp, &file->completion_wait, wait);
+    mutex_lock (&cmem_loopback_lock);
+    if ((file->loopback != NULL) && cmem_loopback_completions_pending (file->loopback))
+    {
+        mask = POLLIN | POLLRDNORM;
+    }
+    mutex_unlock (&cmem_loopback_lock);
+
+    return mask;
 }
 
 /**
@@ -598,8 +4445,21 @@ static unsigned int cmem_poll(struct file *const filp, poll_table *const wait)
 static const struct file_operations cmem_fops = {
     .owner          = THIS_MODULE,
     .mmap           = cmem_mmap,
+    .llseek         = cmem_llseek,
+    .read_iter      = cmem_read_iter,
+    .write_iter     = cmem_write_iter,
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6,5,0)
+    .splice_read    = copy_splice_read,
+#else
+    .splice_read    = generic_file_splice_read,
+#endif
+    .splice_write   = iter_file_splice_write,
     .unlocked_ioctl = cmem_ioctl,
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5,19,0)
+    .uring_cmd      = cmem_uring_cmd,
+#endif
     .poll           = cmem_poll,
+    .open           = cmem_open,
     .release        = cmem_release
 };
 
@@ -607,6 +4467,8 @@ static const struct file_operations cmem_fops = {
 /**
  * @details Callback for parse_args() which extracts the value of reserved memory regions from memmap arguments.
  *          The reserved memory regions are validated, and if valid used to update the reserved memory areas.
+ *          memmap=nn$ss regions are CMEM_POOL_CLASS_DRAM or CMEM_POOL_CLASS_BULK pools according to the bulk_pools
+ *          module parameter, and memmap=nn!ss persistent memory regions are CMEM_POOL_CLASS_PMEM pools.
  * @param[in] param The name of the parameter
  * @param[in] val The value of the parameter
  * @param[in] unused Not used
@@ -617,6 +4479,7 @@ static int cmem_boot_param_cb (char *const param, char *val, const char *const u
 {
     unsigned long long region_size, region_start;
     cmem_allocation_region_t new_region;
+    bool persistent;
 
     if (strcmp (param, "memmap") == 0)
     {
@@ -629,12 +4492,14 @@ static int cmem_boot_param_cb (char *const param, char *val, const char *const u
             }
 
             region_size = memparse (val, &val);
-            if (*val == '$')
+            if ((*val == '$') || (*val == '!'))
             {
+                persistent = *val == '!';
                 region_start = memparse (val + 1, &val);
 
                 /* Sanity check that the memmap region extracted from the Kernel parameters is marked as RAM
-                 * by the firmware and reserved by Linux. I.e. to only use real RAM not in use by Linux.
+                 * by the firmware and reserved, or for memmap=nn!ss as persistent memory, by Linux.
+                 * I.e. to only use real RAM not in use by Linux.
                  * @todo Uses the mapped <any> functions which are exported, but for a robust check should
                  *       check the entire region is of the specified type. */
                 if (!e820__mapped_raw_any (region_start, region_start + region_size, E820_TYPE_RAM))
@@ -642,18 +4507,48 @@ static int cmem_boot_param_cb (char *const param, char *val, const char *const u
                     pr_info(CMEM_DRVNAME " Ignored memmap start 0x%llx size 0x%llx not marked as RAM by firmware\n",
                             region_start, region_size);
                 }
-                else if (!e820__mapped_any (region_start, region_start + region_size, E820_TYPE_RESERVED))
+                else if (!e820__mapped_any (region_start, region_start + region_size,
+                        persistent ? E820_TYPE_PRAM : E820_TYPE_RESERVED))
                 {
-                    pr_info(CMEM_DRVNAME " Ignored memmap start 0x%llx size 0x%llx not marked as reserved by Linux\n",
-                            region_start, region_size);
+                    pr_info(CMEM_DRVNAME " Ignored memmap start 0x%llx size 0x%llx not marked as %s by Linux\n",
+                            region_start, region_size, persistent ? "persistent memory" : "reserved");
+                }
+                else if (cmem_num_pools == CMEM_MAX_POOLS)
+                {
+                    pr_info(CMEM_DRVNAME " Ignored memmap start 0x%llx size 0x%llx as maximum of %u pools already in use\n",
+                            region_start, region_size, CMEM_MAX_POOLS);
                 }
                 else
                 {
-                    new_region.start = region_start;
-                    new_region.end = region_start + region_size;
-                    new_region.allocated = false;
-                    new_region.allocation_pid = -1;
-                    cmem_update_regions (&cmem_allocation_regions, &new_region);
+                    cmem_pools[cmem_num_pools].start = region_start;
+                    cmem_pools[cmem_num_pools].end = region_start + region_size - 1;
+                    cmem_pools[cmem_num_pools].numa_node = pfn_valid (PHYS_PFN (region_start)) ?
+                            page_to_nid (pfn_to_page (PHYS_PFN (region_start))) : NUMA_NO_NODE;
+                    if (persistent)
+                    {
+                        cmem_pools[cmem_num_pools].pool_class = CMEM_POOL_CLASS_PMEM;
+                    }
+                    else if (cmem_bulk_pool_mask & (1U << cmem_num_pools))
+                    {
+                        cmem_pools[cmem_num_pools].pool_class = CMEM_POOL_CLASS_BULK;
+                    }
+                    else
+                    {
+                        cmem_pools[cmem_num_pools].pool_class = CMEM_POOL_CLASS_DRAM;
+                    }
+
+                    /* Pools selected by the granule_pools module parameter are managed by the granule bitmap
+                     * allocator once all pools have been found */
+                    if ((cmem_granule_pool_mask & (1U << cmem_num_pools)) == 0)
+                    {
+                        new_region.start = cmem_pools[cmem_num_pools].start;
+                        new_region.end = cmem_pools[cmem_num_pools].end;
+                        new_region.allocated = false;
+                        new_region.pool_class = cmem_pools[cmem_num_pools].pool_class;
+                        new_region.allocation_pid = -1;
+                        cmem_update_regions (&cmem_allocation_regions, &new_region);
+                    }
+                    cmem_num_pools++;
                 }
             }
             val = seperator;
@@ -673,6 +4568,8 @@ static int get_mem_areas_from_memmap_params (void)
 {
     const char **lookup_saved_command_line;
     char *cmdline;
+    uint32_t pool_index;
+    int ret;
 
     char *(*parse_args_lookup)(const char *doing,
             char *args,
@@ -700,19 +4597,337 @@ static int get_mem_areas_from_memmap_params (void)
         return -EINVAL;
     }
 
+    if ((cmem_granule_size < PAGE_SIZE) || !is_power_of_2 (cmem_granule_size))
+    {
+        pr_info(CMEM_DRVNAME " Invalid granule_size %u\n", cmem_granule_size);
+        return -EINVAL;
+    }
+    cmem_granule_shift = ilog2 (cmem_granule_size);
+
+    /* The pools are added as regions while parsing the command line */
+    ret = cmem_grow_regions (CMEM_MAX_POOLS + CMEM_REGIONS_UPDATE_HEADROOM);
+    if (ret)
+    {
+        return ret;
+    }
+
     cmdline = kstrdup (*lookup_saved_command_line, GFP_KERNEL);
     parse_args_lookup("cmem params", cmdline, NULL, 0, 0, 0, NULL, &cmem_boot_param_cb);
     kfree (cmdline);
 
-    if (cmem_allocation_regions.num_regions == 0)
+    for (pool_index = 0; pool_index < cmem_num_pools; pool_index++)
+    {
+        if (cmem_granule_pool_mask & (1U << pool_index))
+        {
+            ret = cmem_create_granule_pool (&cmem_pools[pool_index]);
+            if (ret)
+            {
+                cmem_free_granule_pools ();
+                return ret;
+            }
+        }
+    }
+
+    if ((cmem_allocation_regions.num_regions == 0) && (cmem_num_granule_pools == 0))
     {
         pr_info(CMEM_DRVNAME " No reserved memory regions found\n");
         return -EINVAL;
     }
 
+    /* Preallocate the region entries for the pools */
+    ret = cmem_grow_regions ((cmem_allocation_regions.num_regions * cmem_region_reserve) + CMEM_REGIONS_LOCKED_HEADROOM);
+    if (ret)
+    {
+        cmem_free_granule_pools ();
+        return ret;
+    }
+
     return 0;
 }
 
+/**
+ * @brief Show the named_buffers device attribute, which lists one named buffer per line as:
+ *        <name> <physical address> <length> <creator pid>
+ */
+static ssize_t named_buffers_show (struct device *const dev, struct device_attribute *const attr, char *const buf)
+{
+    const cmem_named_allocation_t *named_allocation;
+    ssize_t len = 0;
+
+    mutex_lock (&cmem_allocation_regions_lock);
+    list_for_each_entry (named_allocation, &cmem_named_allocations, list)
+    {
+        len += scnprintf (&buf[len], PAGE_SIZE - len, "%s 0x%llx 0x%llx %d\n",
+                named_allocation->name, named_allocation->start, named_allocation->length, named_allocation->creator_pid);
+    }
+    mutex_unlock (&cmem_allocation_regions_lock);
+
+    return len;
+}
+static DEVICE_ATTR_RO (named_buffers);
+
+
+/**
+ * @brief Store to the destroy_named_buffer device attribute, which destroys the named buffer written.
+ * @details Allows an administrator to reclaim a named buffer for which the owning service no longer exists.
+ */
+static ssize_t destroy_named_buffer_store (struct device *const dev, struct device_attribute *const attr,
+                                           const char *const buf, const size_t count)
+{
+    cmem_named_allocation_t *named_allocation;
+    const size_t name_length = ((count > 0) && (buf[count - 1] == '\n')) ? (count - 1) : count;
+    ssize_t ret = count;
+
+    mutex_lock (&cmem_allocation_regions_lock);
+    named_allocation = cmem_find_named_allocation (buf, name_length);
+    if (named_allocation == NULL)
+    {
+        ret = -ENOENT;
+    }
+    else if (cmem_range_busy (named_allocation->start, named_allocation->start + named_allocation->length - 1))
+    {
+        ret = -EBUSY;
+    }
+    else
+    {
+        cmem_destroy_named_allocation (&cmem_allocation_regions, named_allocation);
+        cmem_update_status_page ();
+    }
+    mutex_unlock (&cmem_allocation_regions_lock);
+
+    return ret;
+}
+static DEVICE_ATTR_WO (destroy_named_buffer);
+
+
+/**
+ * @brief Register a Kernel module as an owner of allocations from the pools
+ * @param[in] name Identifies the module in the kernel_owners device attribute, truncated if too long
+ * @return The owner to pass to the other cmem_kernel_* functions, or an ERR_PTR() on failure
+ */
+cmem_kernel_owner_t *cmem_kernel_register (const char *const name)
+{
+    cmem_kernel_owner_t *const owner = kzalloc (sizeof (*owner), GFP_KERNEL);
+
+    if (owner == NULL)
+    {
+        return ERR_PTR (-ENOMEM);
+    }
+
+    strscpy (owner->name, name, sizeof (owner->name));
+    mutex_lock (&cmem_allocation_regions_lock);
+    owner->owner = cmem_next_kernel_owner_pid--;
+    list_add_tail (&owner->list, &cmem_kernel_owners);
+    mutex_unlock (&cmem_allocation_regions_lock);
+    dev_info(cmem_dev, "Registered Kernel owner %s as %d\n", owner->name, owner->owner);
+
+    return owner;
+}
+EXPORT_SYMBOL_GPL (cmem_kernel_register);
+
+
+/**
+ * @brief Unregister a Kernel module, freeing any of its allocations which remain
+ * @details The module must have stopped any DMA to its allocations, and removed any mappings of them.
+ * @param[in] owner The owner returned by cmem_kernel_register(), which is freed
+ */
+void cmem_kernel_unregister (cmem_kernel_owner_t *const owner)
+{
+    uint32_t num_freed;
+    uint32_t num_busy;
+
+    mutex_lock (&cmem_allocation_regions_lock);
+    list_del (&owner->list);
+    /* Loopback engines only access allocations of their process, so num_busy is zero for a Kernel owner */
+    num_freed = cmem_free_owned_in_range (&cmem_allocation_regions, 0, U64_MAX, owner->owner, &num_busy);
+    cmem_coalesce_regions (&cmem_allocation_regions);
+    cmem_trace_event (CMEM_TRACE_EVENT_RELEASE, 0, 0, 0, 1, owner->owner, 0);
+    cmem_update_status_page ();
+    mutex_unlock (&cmem_allocation_regions_lock);
+
+    dev_info(cmem_dev, "Unregistered Kernel owner %s, freeing %u allocations\n", owner->name, num_freed);
+    kfree (owner);
+}
+EXPORT_SYMBOL_GPL (cmem_kernel_unregister);
+
+
+/**
+ * @brief Allocate a physically contiguous buffer for a Kernel module
+ * @details Uses cmem_allocate_region(), so has the same A32/A64 semantics as CMEM_IOCTL_ALLOC_A32_HOST_BUFFERS and
+ *          CMEM_IOCTL_ALLOC_A64_HOST_BUFFERS. Failures for lack of free memory are counted in the status page.
+ * @param[in/out] owner The owner the allocation is accounted to
+ * @param[in] a32 When true the buffer is for a device which is only 32-bit capable, so must be in the first 4 GiB
+ * @param[in] length The length of the buffer in bytes
+ * @param[in] alignment The required alignment of the start of the buffer, which must be a power of two
+ * @param[out] dma_address When successful the physical address of the buffer
+ * @return Zero on success, -EINVAL if the arguments are invalid, or -ENOMEM if there isn't enough free memory
+ */
+int cmem_kernel_alloc (cmem_kernel_owner_t *const owner, const bool a32, const size_t length, const uint64_t alignment,
+                       uint64_t *const dma_address)
+{
+    const unsigned int cmd = a32 ? CMEM_IOCTL_ALLOC_A32_HOST_BUFFERS : CMEM_IOCTL_ALLOC_A64_HOST_BUFFERS;
+    cmem_allocation_region_t allocated_region;
+    int ret = 0;
+
+    if ((length == 0) || !is_power_of_2 (alignment))
+    {
+        return -EINVAL;
+    }
+
+    if (cmem_lock_regions () != 0)
+    {
+        return -ENOMEM;
+    }
+    cmem_allocate_region (cmd, &cmem_allocation_regions, CMEM_POOL_CLASS_DRAM, length, alignment, owner->owner,
+            &allocated_region);
+    if (allocated_region.allocated)
+    {
+        *dma_address = allocated_region.start;
+        owner->num_allocations++;
+        owner->allocated_bytes += length;
+    }
+    else
+    {
+        cmem_count_allocation_failure (cmd, CMEM_POOL_CLASS_DRAM);
+        owner->allocation_failures++;
+        ret = -ENOMEM;
+    }
+    cmem_update_status_page ();
+    mutex_unlock (&cmem_allocation_regions_lock);
+
+    return ret;
+}
+EXPORT_SYMBOL_GPL (cmem_kernel_alloc);
+
+
+/**
+ * @brief Free a buffer allocated by cmem_kernel_alloc()
+ * @details If the pages of the buffer are pinned, e.g. through a user mapping of a page backed pool, the memory
+ *          remains allocated until the pins are released, although it is no longer accounted to the owner.
+ * @param[in/out] owner The owner which allocated the buffer
+ * @param[in] dma_address The physical address of the buffer
+ * @param[in] length The length of the buffer
+ * @return Zero on success, or -EINVAL if not a buffer allocated by the owner
+ */
+int cmem_kernel_free (cmem_kernel_owner_t *const owner, const uint64_t dma_address, const size_t length)
+{
+    uint32_t region_index;
+    int ret = -EINVAL;
+
+    mutex_lock (&cmem_allocation_regions_lock);
+    region_index = cmem_find_region_index (&cmem_allocation_regions, dma_address);
+    if ((region_index < cmem_allocation_regions.num_regions) &&
+        cmem_allocation_regions.regions[region_index].allocated &&
+        (cmem_allocation_regions.regions[region_index].allocation_pid == owner->owner) &&
+        (cmem_allocation_regions.regions[region_index].start == dma_address) &&
+        (cmem_allocation_regions.regions[region_index].end == (dma_address + length - 1)))
+    {
+        cmem_free_region_unless_pinned (&cmem_allocation_regions, dma_address);
+        cmem_coalesce_regions (&cmem_allocation_regions);
+        cmem_trace_event (CMEM_TRACE_EVENT_FREE, 0, dma_address, length, 1, owner->owner, 0);
+        owner->num_allocations--;
+        owner->allocated_bytes -= length;
+        cmem_update_status_page ();
+        ret = 0;
+    }
+    mutex_unlock (&cmem_allocation_regions_lock);
+
+    return ret;
+}
+EXPORT_SYMBOL_GPL (cmem_kernel_free);
+
+
+/**
+ * @brief Find the allocation which contains a physical address
+ * @details Allows a Kernel module to validate a physical address passed to it, e.g. from a user space process which
+ *          allocated the buffer through /dev/cmem. Allocations from the granule pools aren't found.
+ *          The allocation may be freed by its owner once this function returns.
+ * @param[in] phys_addr The physical address to look up
+ * @param[out] buffer When successful the allocation which contains the address
+ * @return Zero on success, or -ENOENT if the address isn't in an allocation
+ */
+int cmem_kernel_lookup (const uint64_t phys_addr, cmem_kernel_buffer_t *const buffer)
+{
+    uint32_t region_index;
+    int ret = -ENOENT;
+
+    mutex_lock (&cmem_allocation_regions_lock);
+    region_index = cmem_find_region_index (&cmem_allocation_regions, phys_addr + 1);
+    if (region_index > 0)
+    {
+        const cmem_allocation_region_t *const region = &cmem_allocation_regions.regions[region_index - 1];
+
+        if (region->allocated && (phys_addr >= region->start) && (phys_addr <= region->end))
+        {
+            buffer->dma_address = region->start;
+            buffer->length = (region->end + 1) - region->start;
+            buffer->owner = region->allocation_pid;
+            ret = 0;
+        }
+    }
+    mutex_unlock (&cmem_allocation_regions_lock);
+
+    return ret;
+}
+EXPORT_SYMBOL_GPL (cmem_kernel_lookup);
+
+
+/**
+ * @brief Create a write-back Kernel mapping of part of an allocation
+ * @details The caller must ensure the allocation isn't freed while mapped.
+ * @param[in] dma_address The physical address of the start of the mapping
+ * @param[in] length The length of the mapping, which must be inside one allocation
+ * @return The Kernel virtual address of the mapping, or NULL on failure
+ */
+void *cmem_kernel_map (const uint64_t dma_address, const size_t length)
+{
+    cmem_kernel_buffer_t buffer;
+
+    if ((length == 0) || (cmem_kernel_lookup (dma_address, &buffer) != 0) ||
+        ((dma_address + length) > (buffer.dma_address + buffer.length)))
+    {
+        return NULL;
+    }
+
+    return memremap (dma_address, length, MEMREMAP_WB);
+}
+EXPORT_SYMBOL_GPL (cmem_kernel_map);
+
+
+/**
+ * @brief Remove a Kernel mapping created by cmem_kernel_map()
+ * @param[in] kernel_addr The Kernel virtual address returned by cmem_kernel_map()
+ */
+void cmem_kernel_unmap (void *const kernel_addr)
+{
+    memunmap (kernel_addr);
+}
+EXPORT_SYMBOL_GPL (cmem_kernel_unmap);
+
+
+/**
+ * @brief Show the kernel_owners device attribute, which lists one Kernel module registered to use the API in
+ *        cmem_kernel.h per line as:
+ *        <name> <owner> <allocations> <allocated bytes> <allocation failures>
+ */
+static ssize_t kernel_owners_show (struct device *const dev, struct device_attribute *const attr, char *const buf)
+{
+    const cmem_kernel_owner_t *owner;
+    ssize_t len = 0;
+
+    mutex_lock (&cmem_allocation_regions_lock);
+    list_for_each_entry (owner, &cmem_kernel_owners, list)
+    {
+        len += scnprintf (&buf[len], PAGE_SIZE - len, "%s %d %u 0x%llx %llu\n",
+                owner->name, owner->owner, owner->num_allocations, owner->allocated_bytes, owner->allocation_failures);
+    }
+    mutex_unlock (&cmem_allocation_regions_lock);
+
+    return len;
+}
+static DEVICE_ATTR_RO (kernel_owners);
+
+
 /**
 * cmem_init() - Initialize DMA Buffers device
 *
@@ -729,12 +4944,29 @@ static int __init cmem_init(void)
     ret = get_mem_areas_from_memmap_params ();
     if (ret)
     {
+        kvfree (cmem_allocation_regions.regions);
         return ret;
     }
+    cmem_trace_create ();
+    if (cmem_page_backed)
+    {
+        cmem_create_page_backing ();
+    }
+
+    /* Failure to allocate the status page isn't fatal, and causes mmap() of the status page to fail */
+    BUILD_BUG_ON (sizeof (cmem_status_page_t) > PAGE_SIZE);
+    cmem_status_page = (cmem_status_page_t *) get_zeroed_page (GFP_KERNEL);
+    cmem_update_status_page ();
 
     ret = alloc_chrdev_region(&cmem_dev_id, 0, 1, CMEM_DRVNAME);
     if (ret) {
         pr_err(CMEM_DRVNAME ": could not allocate the character driver");
+        cmem_free_granule_pools ();
+        free_page ((unsigned long) cmem_status_page);
+        debugfs_remove_recursive (cmem_debugfs_dir);
+        vfree (cmem_trace_records);
+        cmem_free_page_backing ();
+        kvfree (cmem_allocation_regions.regions);
         return -1;
     }
 
@@ -770,6 +5002,14 @@ static int __init cmem_init(void)
 
     dev_info(cmem_dev, "Added device to the sys file system\n");
 
+    /* Failure to create the attributes for administration of named buffers and Kernel owners isn't fatal */
+    if (device_create_file (cmem_dev, &dev_attr_named_buffers) ||
+        device_create_file (cmem_dev, &dev_attr_destroy_named_buffer) ||
+        device_create_file (cmem_dev, &dev_attr_kernel_owners))
+    {
+        dev_warn(cmem_dev, "Failed to create device attributes\n");
+    }
+
     for (region_index = 0; region_index < cmem_allocation_regions.num_regions; region_index++)
     {
         const cmem_allocation_region_t *const region = &cmem_allocation_regions.regions[region_index];
@@ -787,6 +5027,12 @@ static int __init cmem_init(void)
     class_destroy(cmem_class);
     err_class_create:
     unregister_chrdev_region(cmem_dev_id, 1);
+    cmem_free_granule_pools ();
+    free_page ((unsigned long) cmem_status_page);
+    debugfs_remove_recursive (cmem_debugfs_dir);
+    vfree (cmem_trace_records);
+    cmem_free_page_backing ();
+    kvfree (cmem_allocation_regions.regions);
 
     return(-1);
 }
@@ -797,11 +5043,38 @@ module_init(cmem_init);
 */
 static void __exit cmem_cleanup(void)
 {
-    /* Free memory reserved */
-    if (cmem_allocation_regions.regions != NULL)
+    cmem_named_allocation_t *named_allocation;
+    cmem_named_allocation_t *next_named_allocation;
+    cmem_kernel_owner_t *kernel_owner;
+    cmem_kernel_owner_t *next_kernel_owner;
+
+    cancel_delayed_work_sync (&cmem_reap_pinned_work);
+
+    /* Named buffers don't persist across the module being unloaded */
+    list_for_each_entry_safe (named_allocation, next_named_allocation, &cmem_named_allocations, list)
+    {
+        list_del (&named_allocation->list);
+        kfree (named_allocation);
+    }
+
+    /* The module can't be unloaded while Kernel modules which use its exported symbols are loaded, so any owners
+     * which remain were left registered by modules which have already been unloaded */
+    list_for_each_entry_safe (kernel_owner, next_kernel_owner, &cmem_kernel_owners, list)
     {
-        kfree (cmem_allocation_regions.regions);
+        list_del (&kernel_owner->list);
+        kfree (kernel_owner);
     }
+
+    /* Free memory reserved */
+    kvfree (cmem_allocation_regions.regions);
+    cmem_free_granule_pools ();
+    free_page ((unsigned long) cmem_status_page);
+    debugfs_remove_recursive (cmem_debugfs_dir);
+    vfree (cmem_trace_records);
+    cmem_free_page_backing ();
+    device_remove_file (cmem_dev, &dev_attr_kernel_owners);
+    device_remove_file (cmem_dev, &dev_attr_destroy_named_buffer);
+    device_remove_file (cmem_dev, &dev_attr_named_buffers);
     device_destroy(cmem_class, MKDEV(cmem_major,0));
 
     class_destroy(cmem_class);
@@ -76,9 +76,388 @@ typedef struct
 /* IOCTLs defined for the application as well as driver.
  * CMEM_IOCTL_ALLOC_A64_HOST_BUFFERS allocates buffers for DMA which supports 64-bit addressing.
  * CMEM_IOCTL_ALLOC_A32_HOST_BUFFERS allocates buffers for DMA which only supports 32-bit addressing, and therefore
- * only performs allocation for the first 4 GiB of memory. */
+ * only performs allocation for the first 4 GiB of memory.
+ * CMEM_IOCTL_FREE_HOST_BUFFERS fails with EINVAL for a chunk of a scatter-gather buffer, which may only be freed
+ * in its entirety by CMEM_IOCTL_FREE_SG_BUFFER. */
 #define CMEM_IOCTL_ALLOC_A64_HOST_BUFFERS  _IOWR('P', 1, cmem_ioctl_t)
 #define CMEM_IOCTL_ALLOC_A32_HOST_BUFFERS  _IOWR('P', 2, cmem_ioctl_t)
 #define CMEM_IOCTL_FREE_HOST_BUFFERS       _IOWR('P', 3, cmem_ioctl_t)
 
+/* Maximum number of physically contiguous chunks in one scatter-gather buffer */
+#define CMEM_MAX_SG_CHUNKS 64
+
+/* Parameters for a scatter-gather buffer, which is made up of physically discontiguous chunks which
+ * are mapped back-to-back into one contiguous virtual address range. */
+typedef struct
+{
+    /* The total length of the buffer, which must be a multiple of chunk_granularity */
+    uint64_t length;
+    /* The length of each chunk is a multiple of this, which must be a power of two and at least the page size */
+    uint64_t chunk_granularity;
+    /* The physical start address of each chunk is aligned to this, which must be a power of two and at least the page size */
+    uint64_t chunk_alignment;
+    /* The number of chunks in the chunks[] array */
+    uint32_t num_chunks;
+    /* The chunks, in the order they are mapped into the virtual address range */
+    cmem_host_buf_entry_t chunks[CMEM_MAX_SG_CHUNKS];
+} cmem_ioctl_sg_buf_t;
+
+/* CMEM_IOCTL_ALLOC_A64_SG_BUFFER and CMEM_IOCTL_ALLOC_A32_SG_BUFFER allocate a scatter-gather buffer, which is physically
+ * contiguous if a large enough free region is available, otherwise is allocated as multiple chunks.
+ * The buffer is mapped by calling mmap() with an offset of the physical address of the first chunk.
+ * CMEM_IOCTL_FREE_SG_BUFFER frees a scatter-gather buffer, which is identified by the physical address of the first chunk. */
+#define CMEM_IOCTL_ALLOC_A64_SG_BUFFER     _IOWR('P', 4, cmem_ioctl_sg_buf_t)
+#define CMEM_IOCTL_ALLOC_A32_SG_BUFFER     _IOWR('P', 5, cmem_ioctl_sg_buf_t)
+#define CMEM_IOCTL_FREE_SG_BUFFER          _IOWR('P', 6, cmem_ioctl_sg_buf_t)
+
+/* Maximum length of the name of a named buffer, including the terminating nul */
+#define CMEM_MAX_NAME_LENGTH 64
+
+/* Parameters for a named buffer, which persists when the allocating process exits until explicitly destroyed */
+typedef struct
+{
+    /* The nul terminated name which identifies the buffer */
+    char name[CMEM_MAX_NAME_LENGTH];
+    /* On input the length to allocate if the buffer doesn't exist, where zero only attaches to an existing buffer.
+     * On output the length of the buffer. */
+    uint64_t length;
+    /* On output the physical address of the buffer */
+    uint64_t dma_address;
+    /* On output non-zero if the buffer was created, or zero if attached to an existing buffer */
+    uint32_t created;
+} cmem_ioctl_named_buf_t;
+
+/* CMEM_IOCTL_ALLOC_A64_NAMED_BUFFER and CMEM_IOCTL_ALLOC_A32_NAMED_BUFFER attach to the named buffer if it exists,
+ * or otherwise allocate it. Attaching fails if the existing buffer is shorter than the requested length,
+ * or for CMEM_IOCTL_ALLOC_A32_NAMED_BUFFER is not in the first 4 GiB.
+ * The buffer is mapped by calling mmap() with an offset of the physical address, and the contents are retained
+ * when all processes have unmapped the buffer.
+ * CMEM_IOCTL_DESTROY_NAMED_BUFFER frees the named buffer, which may be done by any process. */
+#define CMEM_IOCTL_ALLOC_A64_NAMED_BUFFER  _IOWR('P', 7, cmem_ioctl_named_buf_t)
+#define CMEM_IOCTL_ALLOC_A32_NAMED_BUFFER  _IOWR('P', 8, cmem_ioctl_named_buf_t)
+#define CMEM_IOCTL_DESTROY_NAMED_BUFFER    _IOWR('P', 9, cmem_ioctl_named_buf_t)
+
+/* CMEM_IOCTL_FREE_RANGES frees every allocation of the calling process which is entirely inside one of the physical
+ * address ranges given by the dma_address and length of each buf_info[] entry. A scatter-gather buffer is freed when
+ * its first chunk is inside a range. CMEM_IOCTL_FREE_ALL frees all allocations of the calling process, other than
+ * named buffers. Both coalesce the free space once after freeing all the allocations, and return the number of
+ * allocations freed. */
+#define CMEM_IOCTL_FREE_RANGES             _IOWR('P', 10, cmem_ioctl_t)
+#define CMEM_IOCTL_FREE_ALL                _IO('P', 11)
+
+/* CMEM_IOCTL_ALLOC_A64_GRANULE_BUFFERS and CMEM_IOCTL_ALLOC_A32_GRANULE_BUFFERS allocate buffers in the same way as
+ * CMEM_IOCTL_ALLOC_A64_HOST_BUFFERS and CMEM_IOCTL_ALLOC_A32_HOST_BUFFERS, but from the pools managed by the granule
+ * bitmap allocator which are selected by the granule_pools module parameter. The length of each buffer is rounded up
+ * to a multiple of the granule_size module parameter, and the rounded length is returned. The buffers are freed in the
+ * same way as other buffers. */
+#define CMEM_IOCTL_ALLOC_A64_GRANULE_BUFFERS _IOWR('P', 12, cmem_ioctl_t)
+#define CMEM_IOCTL_ALLOC_A32_GRANULE_BUFFERS _IOWR('P', 13, cmem_ioctl_t)
+
+/* Parameters to resize a buffer in place, keeping the same physical address */
+typedef struct
+{
+    /* The physical address of the buffer */
+    uint64_t dma_address;
+    /* On input the current length of the buffer. On output the length after the resize. */
+    uint64_t length;
+    /* The required length of the buffer, which must be non-zero */
+    uint64_t new_length;
+} cmem_ioctl_resize_buf_t;
+
+/* CMEM_IOCTL_RESIZE_A64_BUFFER and CMEM_IOCTL_RESIZE_A32_BUFFER resize a buffer allocated by the calling process,
+ * without moving the contents. Shrinking returns the tail of the buffer to the pool, after which the caller must
+ * unmap the tail, so that a failed shrink leaves the buffer mapped. Shrinking fails with EBUSY if the pages of the
+ * tail are still pinned, in a page backed pool. Growing extends the buffer into the free space which immediately
+ * follows it, and fails with ENOMEM if there isn't enough free space, or for CMEM_IOCTL_RESIZE_A32_BUFFER if the
+ * buffer would extend beyond the first 4 GiB. Scatter-gather and named buffers can't be resized. */
+#define CMEM_IOCTL_RESIZE_A64_BUFFER       _IOWR('P', 14, cmem_ioctl_resize_buf_t)
+#define CMEM_IOCTL_RESIZE_A32_BUFFER       _IOWR('P', 15, cmem_ioctl_resize_buf_t)
+
+/* The maximum number of ranges in one cache maintenance ioctl */
+#define CMEM_MAX_CACHE_RANGES 64
+
+/* One range of a buffer for cache maintenance */
+typedef struct
+{
+    /* The physical address of the start of the range */
+    uint64_t dma_address;
+    /* The length of the range in bytes */
+    uint64_t length;
+} cmem_cache_range_t;
+
+/* Parameters for a batch of cache maintenance ranges */
+typedef struct
+{
+    /* The number of valid entries in the ranges[] array */
+    uint32_t num_ranges;
+    cmem_cache_range_t ranges[CMEM_MAX_CACHE_RANGES];
+} cmem_ioctl_cache_ranges_t;
+
+/* CMEM_IOCTL_CLEAN_CACHE_RANGES writes back dirty CPU cache lines in each range, leaving the lines valid in the cache,
+ * before a device which doesn't snoop the CPU caches reads the ranges. CMEM_IOCTL_FLUSH_CACHE_RANGES writes back and
+ * invalidates the CPU cache lines in each range, after such a device has written the ranges and before the CPU reads
+ * them. Each range must be inside one buffer allocated by the calling process, or a named buffer. All ranges are
+ * checked before any maintenance is performed. Only supported on x86, otherwise fails with EOPNOTSUPP. */
+#define CMEM_IOCTL_CLEAN_CACHE_RANGES      _IOWR('P', 16, cmem_ioctl_cache_ranges_t)
+#define CMEM_IOCTL_FLUSH_CACHE_RANGES      _IOWR('P', 17, cmem_ioctl_cache_ranges_t)
+
+/* The layout of the control block of a ring created by cmem_ring_create() in the user space library, which the loopback
+ * engine uses to access the rings by physical address. Each index is a uint32_t on its own cache line, and the slots
+ * start immediately after the control block. */
+#define CMEM_RING_TAIL_RESERVE_OFFSET 0
+#define CMEM_RING_TAIL_OFFSET         64
+#define CMEM_RING_HEAD_OFFSET         128
+#define CMEM_RING_CONTROL_LENGTH      192
+
+/* The operations which the loopback engine performs on a descriptor */
+#define CMEM_LOOPBACK_OP_COPY 0 /* Copy length bytes from src_dma_address to dest_dma_address */
+#define CMEM_LOOPBACK_OP_FILL 1 /* Fill length bytes at dest_dma_address with the fill_value byte */
+
+/* The maximum length of one descriptor */
+#define CMEM_LOOPBACK_MAX_LENGTH (1ULL << 30)
+
+/* A descriptor submitted to the loopback engine, which is one slot of the descriptor ring */
+typedef struct
+{
+    /* The physical address of the source of a copy, unused for a fill */
+    uint64_t src_dma_address;
+    /* The physical address of the destination */
+    uint64_t dest_dma_address;
+    /* The number of bytes to copy or fill */
+    uint64_t length;
+    /* Opaque value returned in the completion */
+    uint64_t user_data;
+    /* One of the CMEM_LOOPBACK_OP_* values */
+    uint32_t opcode;
+    /* The byte value written by CMEM_LOOPBACK_OP_FILL, in the least significant 8 bits */
+    uint32_t fill_value;
+} cmem_loopback_descriptor_t;
+
+/* A completion written by the loopback engine, which is one slot of the completion ring */
+typedef struct
+{
+    /* The user_data from the descriptor */
+    uint64_t user_data;
+    /* Zero on success, or a negative errno value if the descriptor was invalid and wasn't performed */
+    int32_t status;
+    uint32_t reserved;
+} cmem_loopback_completion_t;
+
+/* Parameters to start the loopback engine. Each ring is a cmem_ring in a buffer allocated by the calling process, with
+ * the ring slot size being the size of the descriptor or completion. */
+typedef struct
+{
+    /* The physical address of the control block of the descriptor ring, which the engine consumes */
+    uint64_t descriptor_ring_dma_address;
+    /* The physical address of the control block of the completion ring, which the engine produces */
+    uint64_t completion_ring_dma_address;
+    /* The number of slots in each ring, which must be a power of two */
+    uint32_t num_descriptor_slots;
+    uint32_t num_completion_slots;
+    /* Throttles the engine to this transfer rate, or zero for no limit */
+    uint64_t bytes_per_second;
+    /* The minimum time taken by each descriptor, to model the fixed latency of a device */
+    uint32_t descriptor_latency_ns;
+    uint32_t reserved;
+} cmem_ioctl_loopback_t;
+
+/* The statistics of the loopback engine, returned when stopped */
+typedef struct
+{
+    /* The number of descriptors completed, including those with an error status */
+    uint64_t num_descriptors;
+    /* The number of bytes copied or filled */
+    uint64_t num_bytes;
+    /* The number of descriptors completed with an error status */
+    uint64_t num_errors;
+} cmem_ioctl_loopback_stats_t;
+
+/* The loopback engine is a kernel thread which stands in for a DMA engine, so that the path of allocating buffers,
+ * passing their physical addresses to a device through a ring and consuming the results can be measured without
+ * hardware. There is one engine per open file.
+ *
+ * CMEM_IOCTL_LOOPBACK_START starts the engine. Fails with EBUSY if the engine of the file is already started, or
+ *   EINVAL if a ring isn't in a buffer owned by the calling process.
+ * CMEM_IOCTL_LOOPBACK_DOORBELL wakes the engine after descriptors have been published. The engine also polls the
+ *   descriptor ring every millisecond when idle.
+ * CMEM_IOCTL_LOOPBACK_STOP stops the engine, returning its statistics. Descriptors not yet consumed are left in the
+ *   descriptor ring.
+ *
+ * The engine only accesses buffers owned by the process which started it, or named buffers, which are checked as each
+ * descriptor is consumed. While the engine is started the buffers containing the rings can't be freed or shrunk, and
+ * while a descriptor is being performed neither can its buffers: the free, resize and destroy ioctls fail with EBUSY.
+ * CMEM_IOCTL_FREE_RANGES and CMEM_IOCTL_FREE_ALL still free the other allocations before failing with EBUSY.
+ * The engine accesses the buffers through write-back mappings, so the buffers mustn't be mapped by a file opened with
+ * O_SYNC.
+ *
+ * poll() on the file reports POLLIN when the completion ring isn't empty. */
+#define CMEM_IOCTL_LOOPBACK_START          _IOW('P', 18, cmem_ioctl_loopback_t)
+#define CMEM_IOCTL_LOOPBACK_DOORBELL       _IO('P', 19)
+#define CMEM_IOCTL_LOOPBACK_STOP           _IOR('P', 20, cmem_ioctl_loopback_stats_t)
+
+/* The classes of memmap pools. Each class has its own capacity, fit policy and NUMA node, and an allocation is made
+ * from the pools of one class:
+ * - CMEM_POOL_CLASS_DRAM are memmap=nn$ss pools, used by all allocations other than CMEM_IOCTL_ALLOC_CLASS_BUFFERS.
+ * - CMEM_POOL_CLASS_BULK are memmap=nn$ss pools selected by the bulk_pools module parameter, e.g. on a remote NUMA
+ *   node, for large buffers which are accessed infrequently.
+ * - CMEM_POOL_CLASS_PMEM are memmap=nn!ss persistent memory pools. */
+#define CMEM_POOL_CLASS_DRAM  0
+#define CMEM_POOL_CLASS_BULK  1
+#define CMEM_POOL_CLASS_PMEM  2
+#define CMEM_NUM_POOL_CLASSES 3
+
+/* Parameters to allocate buffers from one class of pools */
+typedef struct
+{
+    /* The CMEM_POOL_CLASS_* to allocate from */
+    uint32_t pool_class;
+    /* Non-zero when the buffers are for a device which is only 32-bit capable, so must be in the first 4 GiB */
+    uint32_t a32;
+    cmem_ioctl_host_buf_info_t host_buf_info;
+} cmem_ioctl_class_buf_t;
+
+/* CMEM_IOCTL_ALLOC_CLASS_BUFFERS allocates buffers in the same way as CMEM_IOCTL_ALLOC_A64_HOST_BUFFERS or
+ * CMEM_IOCTL_ALLOC_A32_HOST_BUFFERS, but from the pools of one class, and fails with EINVAL for an unknown class.
+ * The buffers are freed in the same way as other buffers. */
+#define CMEM_IOCTL_ALLOC_CLASS_BUFFERS     _IOWR('P', 21, cmem_ioctl_class_buf_t)
+
+/* The maximum number of memmap pools reported in the status page */
+#define CMEM_STATUS_MAX_POOLS 16
+
+/* The capacity of one memmap pool in the status page */
+typedef struct
+{
+    /* The physical address of the start of the pool */
+    uint64_t start;
+    /* The size of the pool in bytes */
+    uint64_t size;
+    /* The number of free bytes in the pool */
+    uint64_t free_bytes;
+    /* The size of the largest physically contiguous free block in the pool, which is the largest buffer which can
+     * be allocated from the pool. For a granule pool is a multiple of the granule size. */
+    uint64_t largest_free_block;
+    /* The NUMA node of the memory in the pool, or -1 if not known */
+    int32_t numa_node;
+    /* Non-zero if the pool is managed by the granule bitmap allocator */
+    uint32_t granule_pool;
+    /* The CMEM_POOL_CLASS_* of the pool */
+    uint32_t pool_class;
+    uint32_t reserved;
+} cmem_status_pool_t;
+
+/* The capacity of one class of pools in the status page, excluding pools managed by the granule bitmap allocator */
+typedef struct
+{
+    /* The size of the pools in the class */
+    uint64_t size;
+    /* The number of free bytes in the class */
+    uint64_t free_bytes;
+    /* The size of the largest physically contiguous free block in the class */
+    uint64_t largest_free_block;
+    /* The number of allocations from the class which failed for lack of free memory */
+    uint64_t allocation_failures;
+    /* The NUMA node of the pools in the class, or -1 if not known or the pools are on different nodes */
+    int32_t numa_node;
+    /* The cmem_fit_policy_t used for allocations from the class: 0 best, 1 first or 2 worst fit */
+    uint32_t fit_policy;
+} cmem_status_class_t;
+
+/* The capacity of a zone of physical addresses in the status page */
+typedef struct
+{
+    /* The size of the pools in the zone */
+    uint64_t size;
+    /* The number of free bytes in the zone */
+    uint64_t free_bytes;
+    /* The number of allocations which failed for lack of free memory, for devices which use the zone */
+    uint64_t allocation_failures;
+} cmem_status_zone_t;
+
+/* The contents of the read-only status page, which is mapped by calling mmap() on the cmem device with an offset of
+ * CMEM_STATUS_PAGE_OFFSET and a length of one page. Allows the capacity of the pools to be sampled without system calls.
+ *
+ * The page is updated under a sequence count. The sequence is odd while an update is in progress, so a reader must
+ * wait for an even sequence, copy the contents, and then retry if the sequence has changed. */
+typedef struct
+{
+    /* The sequence count for consistent reads */
+    uint32_t sequence;
+    /* The number of valid entries in the pools[] array */
+    uint32_t num_pools;
+    /* Incremented each time the allocations change */
+    uint64_t generation;
+    /* The total number of free bytes in all pools */
+    uint64_t total_free_bytes;
+    cmem_status_pool_t pools[CMEM_STATUS_MAX_POOLS];
+    /* The first 4 GiB, with the allocation failures of devices which are only 32-bit capable */
+    cmem_status_zone_t a32_zone;
+    /* Above the first 4 GiB, with the allocation failures of 64-bit capable devices */
+    cmem_status_zone_t a64_zone;
+    /* The a32_reserve module parameter, which is the number of bytes of free memory in the first 4 GiB which
+     * allocations for 64-bit capable devices may not use */
+    uint64_t a32_reserve;
+    /* The number of times an allocation for a 64-bit capable device was refused free memory in the first 4 GiB
+     * by a32_reserve */
+    uint64_t a32_reserve_refusals;
+    /* Indexed by CMEM_POOL_CLASS_* */
+    cmem_status_class_t classes[CMEM_NUM_POOL_CLASSES];
+} cmem_status_page_t;
+
+/* The mmap() offset which maps the status page, which is above any physical address */
+#define CMEM_STATUS_PAGE_OFFSET (1ULL << 60)
+
+/* The command area of an io_uring IORING_OP_URING_CMD SQE submitted to the cmem device.
+ * The cmd_op of the SQE is one of the CMEM_IOCTL_* values, and arg is the user space pointer to the parameters for the
+ * ioctl, which must remain valid until the completion. Fits in the command area of a standard 64 byte SQE. */
+typedef struct
+{
+    uint64_t arg;
+} cmem_uring_cmd_t;
+
+/* The events recorded in the allocation trace */
+#define CMEM_TRACE_EVENT_POOL    0 /* A free region of the memmap pools when the module was loaded */
+#define CMEM_TRACE_EVENT_ALLOC   1 /* An allocation of a region, or an attempt if CMEM_TRACE_FLAG_FAILED is set */
+#define CMEM_TRACE_EVENT_FREE    2 /* A region was freed */
+#define CMEM_TRACE_EVENT_RESIZE  3 /* A region was resized to length, or an attempt if CMEM_TRACE_FLAG_FAILED is set */
+#define CMEM_TRACE_EVENT_RELEASE 4 /* The owner closed its last file, after its remaining regions were freed */
+#define CMEM_TRACE_EVENT_LOST    5 /* Records were lost since the trace was full, the number of which is in length */
+
+/* The flags of a trace record */
+#define CMEM_TRACE_FLAG_A32     0x01 /* The allocation was for a device which is only 32-bit capable */
+#define CMEM_TRACE_FLAG_FAILED  0x02 /* The allocation or resize failed */
+#define CMEM_TRACE_FLAG_GRANULE 0x04 /* The buffer is from the granule pools, rather than the regions of the pools */
+
+/* One record of the allocation trace */
+typedef struct
+{
+    /* The CLOCK_MONOTONIC time of the event */
+    uint64_t timestamp_ns;
+    /* The physical address of the region, zero for a failed allocation */
+    uint64_t address;
+    /* The length of the region in bytes, which for an allocation is the requested length */
+    uint64_t length;
+    /* The process which owns the region when positive. Otherwise -1 for a free region, -2 for a named buffer which
+     * persists until destroyed, -3 for a freed buffer whose pages were still pinned and which is freed once they are
+     * released, or -4 and below for a buffer owned by a Kernel module */
+    int32_t owner;
+    /* One of the CMEM_TRACE_EVENT_* values */
+    uint8_t event;
+    /* CMEM_TRACE_FLAG_* values */
+    uint8_t flags;
+    /* log2 of the required alignment of an allocation */
+    uint8_t alignment_shift;
+    /* The CMEM_POOL_CLASS_* of a CMEM_TRACE_EVENT_POOL region or the pools a CMEM_TRACE_EVENT_ALLOC was made from,
+     * otherwise zero */
+    uint8_t pool_class;
+} cmem_trace_record_t;
+
+/* When the trace_records module parameter is non-zero the module records the allocations and frees of regions in a
+ * trace of that many records, which is read as a stream of cmem_trace_record_t from the file trace in the cmem
+ * directory of debugfs. Reading consumes the records, and returns zero bytes when the trace is empty.
+ * Allocations, frees and resizes of buffers from the granule pools are recorded with CMEM_TRACE_FLAG_GRANULE set,
+ * and the granule pools aren't recorded as CMEM_TRACE_EVENT_POOL regions.
+ *
+ * The trace can be replayed through the region engine in user space by the replay benchmark, to compare allocation
+ * policies and pool sizes against a real workload. */
+
 #endif
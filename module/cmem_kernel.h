@@ -0,0 +1,48 @@
+/*
+ * cmem_kernel.h
+ *
+ *  Created on: 18 Oct 2026
+ *      Author: Mr_Halfword
+ *
+ * The API exported by the cmem module to other Kernel modules, which allows them to allocate physically contiguous
+ * buffers from the same pools as user space processes, without a round trip through /dev/cmem.
+ *
+ * A module registers as an owner, to which its allocations are accounted, and which frees any remaining allocations
+ * when unregistered. Allocations have the same A32/A64 semantics as the CMEM_IOCTL_ALLOC_A32_HOST_BUFFERS and
+ * CMEM_IOCTL_ALLOC_A64_HOST_BUFFERS ioctls, including the a32_reserve and fit_policy module parameters, and are made from the
+ * pools in the DRAM class.
+ *
+ * All of the functions may sleep, so can't be called from atomic context.
+ *
+ * A module using the API is built with KBUILD_EXTRA_SYMBOLS set to the Module.symvers of the cmem module.
+ */
+
+#ifndef CMEM_KERNEL_H_
+#define CMEM_KERNEL_H_
+
+#include <linux/types.h>
+
+typedef struct cmem_kernel_owner_s cmem_kernel_owner_t;
+
+/* An allocation found by cmem_kernel_lookup() */
+typedef struct
+{
+    /* The physical address of the start of the allocation */
+    uint64_t dma_address;
+    /* The length of the allocation in bytes */
+    uint64_t length;
+    /* The owner of the allocation: the process id for an allocation by a user space process, -2 for a named buffer,
+     * or a value below -2 for an allocation by a Kernel module */
+    pid_t owner;
+} cmem_kernel_buffer_t;
+
+cmem_kernel_owner_t *cmem_kernel_register (const char *const name);
+void cmem_kernel_unregister (cmem_kernel_owner_t *const owner);
+int cmem_kernel_alloc (cmem_kernel_owner_t *const owner, const bool a32, const size_t length, const uint64_t alignment,
+                       uint64_t *const dma_address);
+int cmem_kernel_free (cmem_kernel_owner_t *const owner, const uint64_t dma_address, const size_t length);
+int cmem_kernel_lookup (const uint64_t phys_addr, cmem_kernel_buffer_t *const buffer);
+void *cmem_kernel_map (const uint64_t dma_address, const size_t length);
+void cmem_kernel_unmap (void *const kernel_addr);
+
+#endif /* CMEM_KERNEL_H_ */
@@ -0,0 +1,523 @@
+/*
+ * cmem_regions.c
+ *
+ *  Created on: 18 Oct 2026
+ *      Author: Mr_Halfword
+ *
+ * The region engine, which allocates physically contiguous address regions from the free space in the memmap pools.
+ *
+ * Built both into the Kernel module and into user space, where cmem_benchmarks replays allocation traces captured from
+ * the driver through the same engine. The engine has no locking or global state; the caller provides both.
+ */
+
+#ifdef __KERNEL__
+#include <linux/kernel.h>
+#include <linux/types.h>
+#include <linux/string.h>
+#include <linux/sort.h>
+#else
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <linux/ioctl.h>
+
+/* The Kernel functions used by the region engine, implemented with the C library */
+#define sort(base, num, size, compare, swap) qsort ((base), (num), (size), (compare))
+#define ALIGN(value, alignment) (((value) + ((alignment) - 1)) & ~((uint64_t) (alignment) - 1))
+#define ALIGN_DOWN(value, alignment) ((value) & ~((uint64_t) (alignment) - 1))
+#define min(a, b) (((a) < (b)) ? (a) : (b))
+#define max(a, b) (((a) > (b)) ? (a) : (b))
+#define pr_err(...) fprintf (stderr, __VA_ARGS__)
+#endif
+
+#include "cmem.h"
+#include "cmem_regions.h"
+
+
+/**
+ * @brief sort comparison function for cmem regions, which compares the start values
+ */
+static int cmem_region_compare (const void *const compare_a, const void *const compare_b)
+{
+    const cmem_allocation_region_t *const region_a = compare_a;
+    const cmem_allocation_region_t *const region_b = compare_b;
+
+    if (region_a->start < region_b->start)
+    {
+        return -1;
+    }
+    else if (region_a->start == region_b->start)
+    {
+        return 0;
+    }
+    else
+    {
+        return 1;
+    }
+}
+
+
+/**
+ * @brief Get the number of unused entries in the regions[] array
+ * @param[in] allocator Contains the cmem regions
+ * @return The number of regions which can be appended before the array has to be replaced by a larger one
+ */
+uint32_t cmem_regions_headroom (const cmem_allocation_regions_t *const allocator)
+{
+    return allocator->regions_allocated_length - allocator->num_regions;
+}
+
+
+/**
+ * @brief Move the cmem regions into a larger array
+ * @details The region engine never allocates memory, so that the caller can allocate the array without holding the
+ *          lock which protects the regions.
+ * @param[in/out] allocator Contains the cmem regions to move
+ * @param[in] new_regions The array allocated by the caller, which must be longer than the current array
+ * @param[in] new_length The number of entries in new_regions[]
+ * @return The previous array, which the caller is to free. NULL if no array had been set.
+ */
+cmem_allocation_region_t *cmem_replace_regions (cmem_allocation_regions_t *const allocator,
+                                                cmem_allocation_region_t *const new_regions, const uint32_t new_length)
+{
+    cmem_allocation_region_t *const old_regions = allocator->regions;
+
+    if (allocator->num_regions > 0)
+    {
+        memcpy (new_regions, old_regions, allocator->num_regions * sizeof (allocator->regions[0]));
+    }
+    allocator->regions = new_regions;
+    allocator->regions_allocated_length = new_length;
+
+    return old_regions;
+}
+
+
+/**
+ * @brief Append a new cmem region to the end of array.
+ * @details This is a helper function which can leave the regions[] un-sorted.
+ *          The caller must have checked the array has an unused entry.
+ * @param[in/out] allocator Contains the cmem regions to modify
+ * @param[in] new_region The new cmem region to append
+ */
+void cmem_append_region (cmem_allocation_regions_t *const allocator, const cmem_allocation_region_t *const new_region)
+{
+    /* Append the new region to the end of the array. May not be address order, is sorted later */
+    allocator->regions[allocator->num_regions] = *new_region;
+    allocator->num_regions++;
+}
+
+
+/**
+ * @brief Remove one cmem region, shuffling down the following entries in the array
+ * @param[in/out] allocator Contains the cmem regions to modify
+ * @param[in] region_index Identifies which region to remove
+ */
+void cmem_remove_region (cmem_allocation_regions_t *const allocator, const uint32_t region_index)
+{
+    const uint32_t num_regions_to_shuffle = allocator->num_regions - region_index - 1;
+
+    memmove (&allocator->regions[region_index], &allocator->regions[region_index + 1],
+            sizeof (allocator->regions[region_index]) * num_regions_to_shuffle);
+    allocator->num_regions--;
+}
+
+
+/**
+ * @brief Combine adjacent cmem regions which are free.
+ * @details Adjacent cmem regions which are allocated need to be kept as separate regions to support freeing them
+ *          automatically when the allocating process exits.
+ *          Performed as a single pass which compacts the regions[] array, so that any number of regions freed
+ *          at once are coalesced in time proportional to the number of regions.
+ * @param[in/out] allocator Contains the cmem regions to coalesce, which must be sorted in ascending start order
+ */
+void cmem_coalesce_regions (cmem_allocation_regions_t *const allocator)
+{
+    uint32_t read_index;
+    uint32_t write_index = 0;
+
+    for (read_index = 0; read_index < allocator->num_regions; read_index++)
+    {
+        const cmem_allocation_region_t *const next_region = &allocator->regions[read_index];
+        cmem_allocation_region_t *const this_region = (write_index > 0) ? &allocator->regions[write_index - 1] : NULL;
+
+        if ((this_region != NULL) &&
+            ((this_region->end + 1) == next_region->start) && !this_region->allocated && !next_region->allocated &&
+            (this_region->pool_class == next_region->pool_class))
+        {
+            this_region->end = next_region->end;
+        }
+        else
+        {
+            if ((this_region != NULL) && (this_region->end >= next_region->start))
+            {
+                /* Bug if the adjacent IOVA regions are overlapping */
+                pr_err (CMEM_DRVNAME ": Adjacent iova_regions overlap\n");
+            }
+            if (write_index != read_index)
+            {
+                allocator->regions[write_index] = *next_region;
+            }
+            write_index++;
+        }
+    }
+    allocator->num_regions = write_index;
+}
+
+
+/**
+ * @brief Update the array of cmem regions with a new region.
+ * @brief The new region can either:
+ *        a. Add a free region at initialisation.
+ *        b. Mark a region as allocated. This may split an existing free region.
+ *        c. Free a previously allocated region. This may combine adjacent free regions.
+ *        In cases b. and c. the new region takes the pool_class of the existing region it is within.
+ * @param[in/out] allocator Contains the cmem regions to update
+ * @param[in] new_region Defines the new region
+ * @return Returns true if the regions were updated, or false if the regions[] array has fewer than
+ *         CMEM_REGIONS_UPDATE_HEADROOM unused entries, in which case the regions are unchanged
+ */
+bool cmem_update_regions (cmem_allocation_regions_t *const allocator, const cmem_allocation_region_t *const new_region)
+{
+    bool new_region_processed = false;
+    uint32_t region_index;
+
+    if (cmem_regions_headroom (allocator) < CMEM_REGIONS_UPDATE_HEADROOM)
+    {
+        pr_err (CMEM_DRVNAME ": No unused entries to update region start 0x%llx\n", (unsigned long long) new_region->start);
+        return false;
+    }
+
+    /* Search for which existing region the region overlaps */
+    for (region_index = 0; !new_region_processed && (region_index < allocator->num_regions); region_index++)
+    {
+        /* Take a copy of the existing region, since cmem_remove_region() shuffles the array */
+        const cmem_allocation_region_t existing_region = allocator->regions[region_index];
+
+        if ((new_region->start >= existing_region.start) && (new_region->end <= existing_region.end))
+        {
+            /* Remove the existing region */
+            cmem_remove_region (allocator, region_index);
+
+            /* If the new region doesn't start at the beginning of the existing region, then append a region
+             * with the same allocated state as the existing region to fill up to the start of the new region */
+            if (new_region->start > existing_region.start)
+            {
+                const cmem_allocation_region_t before_region =
+                {
+                    .start = existing_region.start,
+                    .end = new_region->start - 1,
+                    .allocated = existing_region.allocated,
+                    .pool_class = existing_region.pool_class,
+                    .allocation_pid = existing_region.allocated ? existing_region.allocation_pid : -1
+                };
+
+                cmem_append_region (allocator, &before_region);
+            }
+
+            /* Append the new region, in the class of the existing region */
+            cmem_append_region (allocator, new_region);
+            allocator->regions[allocator->num_regions - 1].pool_class = existing_region.pool_class;
+
+            /* If the new region ends before that of the existing region, then append a region with the same
+             * allocated state as the existing region to fill up to the end of the existing region */
+            if (new_region->end < existing_region.end)
+            {
+                const cmem_allocation_region_t after_region =
+                {
+                    .start = new_region->end + 1,
+                    .end = existing_region.end,
+                    .allocated = existing_region.allocated,
+                    .pool_class = existing_region.pool_class,
+                    .allocation_pid = existing_region.allocated ? existing_region.allocation_pid : -1
+                };
+
+                cmem_append_region (allocator, &after_region);
+            }
+
+            new_region_processed = true;
+        }
+    }
+
+    if (!new_region_processed)
+    {
+        /* The new region doesn't overlap an existing region. Must be inserting free regions at initialisation */
+        cmem_append_region (allocator, new_region);
+    }
+
+    /* Sort the cmem regions into ascending start order */
+    sort (allocator->regions, allocator->num_regions, sizeof (allocator->regions[0]), cmem_region_compare, NULL);
+
+    cmem_coalesce_regions (allocator);
+
+    return true;
+}
+
+
+/**
+ * @brief Get the free space in a cmem region which can be used for an allocation
+ * @param[in] cmd CMEM_IOCTL_ALLOC_A32_HOST_BUFFERS or CMEM_IOCTL_ALLOC_A64_HOST_BUFFERS to indicate the type of allocation.
+ * @param[in] existing_region The cmem region to check
+ * @param[in] pool_class The CMEM_POOL_CLASS_* the allocation is made from
+ * @param[in] min_start Minimum start IOVA to use for the allocation.
+ * @param[in] alignment The required alignment of the start of the allocation, which must be a power of two.
+ * @param[out] usable_region_start When the returned size is non-zero, the aligned start of the usable space
+ * @return The size of the usable space, or zero if no space in the region can be used
+ */
+static uint64_t cmem_region_usable_space (const unsigned int cmd, const cmem_allocation_region_t *const existing_region,
+                                          const uint32_t pool_class, const uint64_t min_start, const uint64_t alignment,
+                                          uint64_t *const usable_region_start)
+{
+    const uint64_t max_a32_end = 0xffffffffUL;
+    uint64_t usable_region_size = 0;
+
+    if (existing_region->allocated)
+    {
+        /* Skip this region, as not free */
+    }
+    else if (existing_region->pool_class != pool_class)
+    {
+        /* Skip this region, as in a different class of pool */
+    }
+    else if (existing_region->end < min_start)
+    {
+        /* Skip this region, as all of it is below the minimum start */
+    }
+    else if ((cmd == CMEM_IOCTL_ALLOC_A32_HOST_BUFFERS) && (existing_region->start > max_a32_end))
+    {
+        /* Skip this region, as all of it is above what can be addressed the device which is only 32-bit capable */
+    }
+    else
+    {
+        /* When the device is only 32-bit address capable limit the end to the first 4 GiB */
+        const uint64_t usable_region_end =
+                ((cmd == CMEM_IOCTL_ALLOC_A32_HOST_BUFFERS) && (max_a32_end < existing_region->end)) ?
+                        max_a32_end : existing_region->end;
+
+        /* Limit the usable start for the region to the minimum, and then apply the alignment */
+        *usable_region_start = ALIGN ((existing_region->start >= min_start) ? existing_region->start : min_start, alignment);
+
+        if (*usable_region_start <= usable_region_end)
+        {
+            usable_region_size = (usable_region_end + 1) - *usable_region_start;
+        }
+    }
+
+    return usable_region_size;
+}
+
+
+/**
+ * @brief Move the start of the usable space in a free region to stagger its cache colour from the previous allocation
+ * @details The start is rounded up to a colour boundary, and then moved up by one more colour if needed so that the
+ *          number of colours between the start of the previous coloured allocation and this start is odd. A run of
+ *          allocations of the same length then has a constant odd colour stride, which with a power of two number of
+ *          colours visits every colour before repeating one. At most two colours of space are left unused.
+ * @param[in] allocator Contains the start of the previous coloured allocation
+ * @param[in] usable_region_start The aligned start of the usable space in a free region
+ * @param[in] colour_step The size of the colour stride, which is a multiple of the alignment of the allocation
+ * @return The coloured start
+ */
+static uint64_t cmem_coloured_start (const cmem_allocation_regions_t *const allocator,
+                                     const uint64_t usable_region_start, const uint64_t colour_step)
+{
+    const uint64_t coloured_start = ALIGN (usable_region_start, colour_step);
+    const uint64_t colour_distance = (coloured_start / colour_step) - (allocator->previous_coloured_start / colour_step);
+
+    return ((colour_distance & 1) == 0) ? (coloured_start + colour_step) : coloured_start;
+}
+
+
+/**
+ * @brief Search the free cmem regions for space for an allocation
+ * @param[in] cmd CMEM_IOCTL_ALLOC_A32_HOST_BUFFERS or CMEM_IOCTL_ALLOC_A64_HOST_BUFFERS to indicate the type of allocation.
+ * @param[in] allocator Contains the cmem regions to allocate from
+ * @param[in] pool_class The CMEM_POOL_CLASS_* to allocate from
+ * @param[in] min_start Minimum start IOVA to use for the allocation.
+ * @param[in] length The length of the allocation required
+ * @param[in] alignment The required alignment of the start of the allocation, which must be a power of two.
+ * @param[in] colour_step When non-zero the start is staggered by cmem_coloured_start()
+ * @param[in] policy Selects which free region is used when more than one has space for the allocation
+ * @param[in] owner The owner recorded for the allocated region
+ * @param[out] region The allocated region. Success is indicated when allocated is true, which must be false on entry
+ */
+static void cmem_search_free_regions (const unsigned int cmd,
+                                      const cmem_allocation_regions_t *const allocator, const uint32_t pool_class,
+                                      const uint64_t min_start, const size_t length, const uint64_t alignment,
+                                      const uint64_t colour_step, const cmem_fit_policy_t policy, const pid_t owner,
+                                      cmem_allocation_region_t *const region)
+{
+    uint32_t region_index;
+    uint64_t chosen_unused_space;
+
+    /* Search the existing free regions in which the aligned size will fit, choosing one according to the policy:
+     * - Best fit chooses the smallest, to try and reduce running out of IOVA addresses due to fragmentation.
+     * - First fit chooses the lowest address, stopping the search at the first region which fits.
+     * - Worst fit chooses the largest, so the space left over is more likely to be usable. */
+    chosen_unused_space = 0;
+    for (region_index = 0;
+         (region_index < allocator->num_regions) && !((policy == CMEM_FIT_FIRST) && region->allocated);
+         region_index++)
+    {
+        uint64_t usable_region_start;
+        uint64_t usable_region_size = cmem_region_usable_space (cmd, &allocator->regions[region_index],
+                pool_class, min_start, alignment, &usable_region_start);
+
+        if ((usable_region_size > 0) && (colour_step > 0))
+        {
+            const uint64_t coloured_start = cmem_coloured_start (allocator, usable_region_start, colour_step);
+
+            usable_region_size = ((coloured_start - usable_region_start) < usable_region_size) ?
+                    (usable_region_size - (coloured_start - usable_region_start)) : 0;
+            usable_region_start = coloured_start;
+        }
+
+        if ((usable_region_size > 0) && (usable_region_size >= length))
+        {
+            const uint64_t region_unused_space = usable_region_size - length;
+
+            if (!region->allocated ||
+                ((policy == CMEM_FIT_WORST) ? (region_unused_space > chosen_unused_space) :
+                                              (region_unused_space < chosen_unused_space)))
+            {
+                region->start = usable_region_start;
+                region->end = region->start + (length - 1);
+                region->allocated = true;
+                region->pool_class = pool_class;
+                region->allocation_pid = owner;
+                chosen_unused_space = region_unused_space;
+            }
+        }
+    }
+}
+
+
+/**
+ * @brief Attempt to perform an cmem allocation, by searching the free cmem regions
+ * @details When the allocator has cache colouring enabled, and the alignment is less than the size of one way of the
+ *          cache, the allocation is first attempted with a start staggered by cmem_coloured_start(). If there is
+ *          no free space for the staggered start the allocation is attempted without colouring.
+ * @param[in] cmd CMEM_IOCTL_ALLOC_A32_HOST_BUFFERS or CMEM_IOCTL_ALLOC_A64_HOST_BUFFERS to indicate the type of allocation.
+ * @param[in/out] allocator Contains the cmem regions to allocate from
+ * @param[in] pool_class The CMEM_POOL_CLASS_* to allocate from
+ * @param[in] min_start Minimum start IOVA to use for the allocation.
+ *                      May be non-zero to cause a 64-bit DMA capable device to initially avoid the
+ *                      first 4 GiB of address space.
+ * @param[in] length The length of the allocation required
+ * @param[in] alignment The required alignment of the start of the allocation, which must be a power of two.
+ * @param[in] policy Selects which free region is used when more than one has space for the allocation
+ * @param[in] owner The owner recorded for the allocated region
+ * @param[out] region The allocated region. Success is indicated when allocated is true, which must be false on entry
+ */
+void cmem_attempt_allocation (const unsigned int cmd,
+                              cmem_allocation_regions_t *const allocator, const uint32_t pool_class,
+                              const uint64_t min_start, const size_t length, const uint64_t alignment,
+                              const cmem_fit_policy_t policy, const pid_t owner,
+                              cmem_allocation_region_t *const region)
+{
+    const uint64_t colour_step = max (alignment, allocator->colour_size);
+    const bool colouring = (allocator->num_colours > 1) && (allocator->colour_size > 0) &&
+            ((colour_step / allocator->colour_size) < allocator->num_colours);
+
+    if (colouring)
+    {
+        cmem_search_free_regions (cmd, allocator, pool_class, min_start, length, alignment, colour_step, policy, owner,
+                region);
+    }
+    if (!region->allocated)
+    {
+        cmem_search_free_regions (cmd, allocator, pool_class, min_start, length, alignment, 0, policy, owner, region);
+    }
+    if (colouring && region->allocated)
+    {
+        allocator->previous_coloured_start = region->start;
+    }
+}
+
+
+/**
+ * @brief Find the largest chunk which can be allocated from the free cmem regions, for a scatter-gather allocation
+ * @param[in] cmd CMEM_IOCTL_ALLOC_A32_HOST_BUFFERS or CMEM_IOCTL_ALLOC_A64_HOST_BUFFERS to indicate the type of allocation.
+ * @param[in] allocator Contains the cmem regions to allocate from
+ * @param[in] pool_class The CMEM_POOL_CLASS_* to allocate from
+ * @param[in] min_start Minimum start IOVA to use for the chunk.
+ * @param[in] max_length The maximum length of the chunk
+ * @param[in] granularity The length of the chunk must be a multiple of this power of two
+ * @param[in] alignment The required alignment of the start of the chunk, which must be a power of two.
+ * @param[in] owner The owner recorded for the chunk
+ * @param[out] chunk The chunk to allocate. Success is indicated when allocated is true
+ */
+void cmem_find_largest_chunk (const unsigned int cmd,
+                              const cmem_allocation_regions_t *const allocator, const uint32_t pool_class,
+                              const uint64_t min_start, const uint64_t max_length,
+                              const uint64_t granularity, const uint64_t alignment, const pid_t owner,
+                              cmem_allocation_region_t *const chunk)
+{
+    uint32_t region_index;
+    uint64_t largest_length = 0;
+
+    for (region_index = 0; region_index < allocator->num_regions; region_index++)
+    {
+        uint64_t usable_region_start;
+        const uint64_t usable_region_size = cmem_region_usable_space (cmd, &allocator->regions[region_index],
+                pool_class, min_start, alignment, &usable_region_start);
+        const uint64_t chunk_length = min (ALIGN_DOWN (usable_region_size, granularity), max_length);
+
+        if (chunk_length > largest_length)
+        {
+            chunk->start = usable_region_start;
+            chunk->end = usable_region_start + (chunk_length - 1);
+            chunk->allocated = true;
+            chunk->pool_class = pool_class;
+            chunk->allocation_pid = owner;
+            largest_length = chunk_length;
+        }
+    }
+}
+
+
+/**
+ * @brief Find the cmem region which starts at or after an address, using a binary search
+ * @param[in] allocator Contains the cmem regions to search, which are sorted in ascending start order
+ * @param[in] start The address to search for
+ * @return The index of the first region with a start at or after the address, or num_regions if none
+ */
+uint32_t cmem_find_region_index (const cmem_allocation_regions_t *const allocator, const uint64_t start)
+{
+    uint32_t low = 0;
+    uint32_t high = allocator->num_regions;
+
+    while (low < high)
+    {
+        const uint32_t mid = low + ((high - low) / 2);
+
+        if (allocator->regions[mid].start < start)
+        {
+            low = mid + 1;
+        }
+        else
+        {
+            high = mid;
+        }
+    }
+
+    return low;
+}
+
+
+/**
+ * @brief Mark the allocated cmem region which starts at an address as free, without coalescing the free regions
+ * @param[in/out] allocator Contains the cmem regions
+ * @param[in] start The start address of the region
+ */
+void cmem_mark_region_free (cmem_allocation_regions_t *const allocator, const uint64_t start)
+{
+    const uint32_t region_index = cmem_find_region_index (allocator, start);
+
+    if ((region_index < allocator->num_regions) && (allocator->regions[region_index].start == start))
+    {
+        allocator->regions[region_index].allocated = false;
+        allocator->regions[region_index].allocation_pid = -1;
+    }
+}
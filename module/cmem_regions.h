@@ -0,0 +1,102 @@
+/*
+ * cmem_regions.h
+ *
+ *  Created on: 18 Oct 2026
+ *      Author: Mr_Halfword
+ *
+ * The region engine, which is shared between the Kernel module and user space tools.
+ */
+
+#ifndef CMEM_REGIONS_H_
+#define CMEM_REGIONS_H_
+
+#ifdef __KERNEL__
+#include <linux/types.h>
+#else
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+#endif
+
+/* Defines one physically contiguous address region allocated by the module */
+typedef struct
+{
+    /* The start address of the region */
+    uint64_t start;
+    /* The inclusive end address of the region */
+    uint64_t end;
+    /* Defines if the region is in-use:
+     * - false means free for allocation
+     * - true means has been allocated */
+    bool allocated;
+    /* The CMEM_POOL_CLASS_* of the pool which contains the region. Regions of different classes are never
+     * combined, and an allocation keeps the class of the free region it was made from. */
+    uint8_t pool_class;
+    /* When allocate is true which process performed the allocation.
+     * Used to automatically free the allocation if the process terminates. */
+    pid_t allocation_pid;
+} cmem_allocation_region_t;
+
+
+/* Used to perform allocations of physically contiguous address regions to user processes.
+ * No specific alignment for allocations is performed by this module. */
+typedef struct
+{
+    /* Array of regions, allocated by the caller and replaced with cmem_replace_regions() when more entries are needed.
+     *
+     * Initialised to free regions.
+     * Updated as regions are allocated and freed. */
+    cmem_allocation_region_t *regions;
+    /* The current number of valid entries in the regions[] array */
+    uint32_t num_regions;
+    /* The current allocated length of the regions[] array */
+    uint32_t regions_allocated_length;
+    /* When num_colours is greater than one cmem_attempt_allocation() staggers the start of each allocation across the
+     * colours of the last level cache, each of colour_size bytes, so the starts of equally sized buffers allocated
+     * back-to-back don't all map to the same cache sets. num_colours is the size of one way of the cache in colours,
+     * which should be a power of two. */
+    uint32_t num_colours;
+    uint64_t colour_size;
+    /* The start of the previous allocation made with colouring enabled */
+    uint64_t previous_coloured_start;
+} cmem_allocation_regions_t;
+
+/* The number of unused entries in the regions[] array needed by cmem_update_regions(), which may split one region
+ * into three */
+#define CMEM_REGIONS_UPDATE_HEADROOM 2
+
+/* Selects which free region an allocation is placed in, when more than one has space for it */
+typedef enum
+{
+    /* The smallest free region, leaving the larger free regions for larger allocations */
+    CMEM_FIT_BEST,
+    /* The free region with the lowest address, which is the quickest to find */
+    CMEM_FIT_FIRST,
+    /* The largest free region, so the space left over is more likely to be large enough for later allocations */
+    CMEM_FIT_WORST,
+
+    CMEM_FIT_NUM_POLICIES
+} cmem_fit_policy_t;
+
+uint32_t cmem_regions_headroom (const cmem_allocation_regions_t *const allocator);
+cmem_allocation_region_t *cmem_replace_regions (cmem_allocation_regions_t *const allocator,
+                                                cmem_allocation_region_t *const new_regions, const uint32_t new_length);
+void cmem_append_region (cmem_allocation_regions_t *const allocator, const cmem_allocation_region_t *const new_region);
+void cmem_remove_region (cmem_allocation_regions_t *const allocator, const uint32_t region_index);
+void cmem_coalesce_regions (cmem_allocation_regions_t *const allocator);
+bool cmem_update_regions (cmem_allocation_regions_t *const allocator, const cmem_allocation_region_t *const new_region);
+void cmem_attempt_allocation (const unsigned int cmd,
+                              cmem_allocation_regions_t *const allocator, const uint32_t pool_class,
+                              const uint64_t min_start, const size_t length, const uint64_t alignment,
+                              const cmem_fit_policy_t policy, const pid_t owner,
+                              cmem_allocation_region_t *const region);
+void cmem_find_largest_chunk (const unsigned int cmd,
+                              const cmem_allocation_regions_t *const allocator, const uint32_t pool_class,
+                              const uint64_t min_start, const uint64_t max_length,
+                              const uint64_t granularity, const uint64_t alignment, const pid_t owner,
+                              cmem_allocation_region_t *const chunk);
+uint32_t cmem_find_region_index (const cmem_allocation_regions_t *const allocator, const uint64_t start);
+void cmem_mark_region_free (cmem_allocation_regions_t *const allocator, const uint64_t start);
+
+#endif /* CMEM_REGIONS_H_ */